@@ -189,12 +189,38 @@ class MainMenuActivity : AppCompatActivity() {
         val videoQuality = sharedPref.getString("video_quality", "1080p")
         val framerate = sharedPref.getString("framerate", "60")
         val bitrate = sharedPref.getString("bitrate", "10")
+        val framePacing = sharedPref.getString("frame_pacing", "latest")
+        val decodePath = sharedPref.getString("decode_path", "gl")
+        val fecPercentage = sharedPref.getString("fec_percentage", "0")
+        val sessionResume = sharedPref.getString("session_resume", "true")
+        val jitterPreset = sharedPref.getString("jitter_preset", "balanced")
+        val jitterFloorMs = sharedPref.getString("jitter_floor_ms", "0")
+        val jitterCeilingMs = sharedPref.getString("jitter_ceiling_ms", "0")
+        val presentMode = sharedPref.getString("present_mode", "swapchain")
+        val tenBit = sharedPref.getString("ten_bit", "false")
+        val upscaling = sharedPref.getString("upscaling", "off")
+        val displayCount = sharedPref.getString("display_count", "1")
+        val transport = sharedPref.getString("transport", "rtp")
+        val stunServer = sharedPref.getString("stun_server", "")
 
         val intent = Intent(this@MainMenuActivity, StreamingActivity::class.java)
         intent.putExtra("host_ip", hostIp)
         intent.putExtra("video_quality", videoQuality)
         intent.putExtra("framerate", framerate)
         intent.putExtra("bitrate", bitrate)
+        intent.putExtra("frame_pacing", framePacing)
+        intent.putExtra("decode_path", decodePath)
+        intent.putExtra("fec_percentage", fecPercentage)
+        intent.putExtra("session_resume", sessionResume)
+        intent.putExtra("jitter_preset", jitterPreset)
+        intent.putExtra("jitter_floor_ms", jitterFloorMs)
+        intent.putExtra("jitter_ceiling_ms", jitterCeilingMs)
+        intent.putExtra("present_mode", presentMode)
+        intent.putExtra("ten_bit", tenBit)
+        intent.putExtra("upscaling", upscaling)
+        intent.putExtra("display_count", displayCount)
+        intent.putExtra("transport", transport)
+        intent.putExtra("stun_server", stunServer)
 
         Log.i(
             "RStreamClient",
@@ -209,12 +235,38 @@ class MainMenuActivity : AppCompatActivity() {
         val videoQuality = sharedPref.getString("video_quality", "1080p")
         val framerate = sharedPref.getString("framerate", "60")
         val bitrate = sharedPref.getString("bitrate", "10")
+        val framePacing = sharedPref.getString("frame_pacing", "latest")
+        val decodePath = sharedPref.getString("decode_path", "gl")
+        val fecPercentage = sharedPref.getString("fec_percentage", "0")
+        val sessionResume = sharedPref.getString("session_resume", "true")
+        val jitterPreset = sharedPref.getString("jitter_preset", "balanced")
+        val jitterFloorMs = sharedPref.getString("jitter_floor_ms", "0")
+        val jitterCeilingMs = sharedPref.getString("jitter_ceiling_ms", "0")
+        val presentMode = sharedPref.getString("present_mode", "swapchain")
+        val tenBit = sharedPref.getString("ten_bit", "false")
+        val upscaling = sharedPref.getString("upscaling", "off")
+        val displayCount = sharedPref.getString("display_count", "1")
+        val transport = sharedPref.getString("transport", "rtp")
+        val stunServer = sharedPref.getString("stun_server", "")
 
         val intent = Intent(this@MainMenuActivity, StreamingActivity::class.java)
         intent.putExtra("host_ip", host.ipAddress)
         intent.putExtra("video_quality", videoQuality)
         intent.putExtra("framerate", framerate)
         intent.putExtra("bitrate", bitrate)
+        intent.putExtra("frame_pacing", framePacing)
+        intent.putExtra("decode_path", decodePath)
+        intent.putExtra("fec_percentage", fecPercentage)
+        intent.putExtra("session_resume", sessionResume)
+        intent.putExtra("jitter_preset", jitterPreset)
+        intent.putExtra("jitter_floor_ms", jitterFloorMs)
+        intent.putExtra("jitter_ceiling_ms", jitterCeilingMs)
+        intent.putExtra("present_mode", presentMode)
+        intent.putExtra("ten_bit", tenBit)
+        intent.putExtra("upscaling", upscaling)
+        intent.putExtra("display_count", displayCount)
+        intent.putExtra("transport", transport)
+        intent.putExtra("stun_server", stunServer)
         intent.putExtra("pin", pin)
 
         Log.i(
@@ -3,43 +3,69 @@
 #include <EGL/egl.h>
 #include <android_native_app_glue.h>
 
+#include <cstring>
 #include <stdexcept>
 
+#include <dlfcn.h>
+
 #include "stream/render/gl_error.h"
 #include "stream/sample.h"
 
 #define MAX_CONFIGS 1024
 
-EglData::EglData(ANativeWindow *window) {
-    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+// From EGL_KHR_mutable_render_buffer and EGL_ANDROID_front_buffer_auto_refresh, older NDK headers lack them.
+#ifndef EGL_MUTABLE_RENDER_BUFFER_BIT_KHR
+    #define EGL_MUTABLE_RENDER_BUFFER_BIT_KHR 0x1000
+#endif
+#ifndef EGL_FRONT_BUFFER_AUTO_REFRESH_ANDROID
+    #define EGL_FRONT_BUFFER_AUTO_REFRESH_ANDROID 0x314C
+#endif
 
-    if (display == EGL_NO_DISPLAY) {
-        ALOGE("Failed to get EGL display");
-        return;
-    }
+/// The compositor runs at least this fast where the panel can, see setFrameRate.
+#define MIN_PANEL_REFRESH_RATE 120
 
-    bool success = eglInitialize(display, NULL, NULL);
+// ANativeWindow_setFrameRate is API 30, the change strategy API 31. We run on older devices too.
+typedef int32_t (*set_frame_rate_func)(ANativeWindow *window, float frame_rate, int8_t compatibility);
+typedef int32_t (*set_frame_rate_with_strategy_func)(ANativeWindow *window,
+                                                   float frame_rate,
+                                                   int8_t compatibility,
+                                                   int8_t change_strategy);
+// ANATIVEWINDOW_FRAME_RATE_COMPATIBILITY_FIXED_SOURCE and ANATIVEWINDOW_CHANGE_FRAME_RATE_ALWAYS
+#define FRAME_RATE_COMPATIBILITY_FIXED_SOURCE 1
+#define CHANGE_FRAME_RATE_ALWAYS 1
 
-    if (!success) {
-        ALOGE("Failed to initialize EGL");
-        return;
+static bool hasExtension(EGLDisplay display, const char *name) {
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (extensions == nullptr) {
+        return false;
     }
+    const size_t length = strlen(name);
+    for (const char *found = strstr(extensions, name); found != nullptr; found = strstr(found + length, name)) {
+        if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    EGLConfig configs[MAX_CONFIGS];
+/// eglChooseConfig sorts deeper configs first, so look for the exact channel sizes ourselves.
+static bool chooseConfig(EGLDisplay display, bool ten_bit, bool mutable_render_buffer, EGLConfig *out_config) {
+    const EGLint color_size = ten_bit ? 10 : 8;
+    const EGLint alpha_size = ten_bit ? 2 : 8;
 
-    // RGBA8, multisample not required, ES3, and window
+    // Multisample not required, ES3, and window
     const EGLint attributes[] = {
             EGL_RED_SIZE,
-            8,
+            color_size,
 
             EGL_GREEN_SIZE,
-            8,
+            color_size,
 
             EGL_BLUE_SIZE,
-            8,
+            color_size,
 
             EGL_ALPHA_SIZE,
-            8,
+            alpha_size,
 
             EGL_SAMPLES,
             1,
@@ -48,24 +74,124 @@ EglData::EglData(ANativeWindow *window) {
             EGL_OPENGL_ES3_BIT,
 
             EGL_SURFACE_TYPE,
-            EGL_WINDOW_BIT,
+            EGL_WINDOW_BIT | (mutable_render_buffer ? EGL_MUTABLE_RENDER_BUFFER_BIT_KHR : 0),
 
             EGL_NONE,
     };
 
+    EGLConfig configs[MAX_CONFIGS];
     EGLint num_configs = 0;
-    CHK_EGL(eglChooseConfig(display, attributes, configs, MAX_CONFIGS, &num_configs));
+    if (!eglChooseConfig(display, attributes, configs, MAX_CONFIGS, &num_configs)) {
+        return false;
+    }
 
-    if (num_configs == 0) {
-        ALOGE("Failed to find suitable EGL config");
-        throw std::runtime_error("Failed to find suitable EGL config");
+    for (EGLint i = 0; i < num_configs; i++) {
+        EGLint red = 0;
+        EGLint alpha = 0;
+        eglGetConfigAttrib(display, configs[i], EGL_RED_SIZE, &red);
+        eglGetConfigAttrib(display, configs[i], EGL_ALPHA_SIZE, &alpha);
+        if (red == color_size && alpha == alpha_size) {
+            ALOGI("Got %d egl configs, taking the first %d bit one.", num_configs, color_size);
+            *out_config = configs[i];
+            return true;
+        }
     }
-    ALOGI("Got %d egl configs, just taking the first one.", num_configs);
+    return false;
+}
 
-    config = configs[0];
+/// Ask for a multiple of the stream frame rate, so the compositor doesn't add a 60 Hz frame of latency on faster
+/// panels. Where the panel can't go that high, the system picks the closest rate that keeps the frames evenly paced.
+static void setFrameRate(ANativeWindow *window, int32_t frame_rate) {
+    if (frame_rate <= 0) {
+        return;
+    }
+    static void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (lib == nullptr) {
+        return;
+    }
 
-    EGLint format;
-    eglGetConfigAttrib(display, config, EGL_NATIVE_VISUAL_ID, &format);
+    float rate = (float)frame_rate;
+    while (rate < MIN_PANEL_REFRESH_RATE) {
+        rate += (float)frame_rate;
+    }
+
+    auto with_strategy =
+        (set_frame_rate_with_strategy_func)dlsym(lib, "ANativeWindow_setFrameRateWithChangeStrategy");
+    auto plain = (set_frame_rate_func)dlsym(lib, "ANativeWindow_setFrameRate");
+
+    int32_t result;
+    if (with_strategy != nullptr) {
+        // A mode switch blanks the screen once at the start of the stream, which beats a frame of latency throughout.
+        result = with_strategy(window, rate, FRAME_RATE_COMPATIBILITY_FIXED_SOURCE, CHANGE_FRAME_RATE_ALWAYS);
+    } else if (plain != nullptr) {
+        result = plain(window, rate, FRAME_RATE_COMPATIBILITY_FIXED_SOURCE);
+    } else {
+        ALOGI("EGL: No frame rate API, keeping the panel refresh rate");
+        return;
+    }
+    if (result != 0) {
+        ALOGW("EGL: Setting frame rate %.0f failed: %d", rate, result);
+    } else {
+        ALOGI("EGL: Asked for %.0f Hz for a %d fps stream", rate, frame_rate);
+    }
+}
+
+bool EglData::supportsTenBit() {
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    // Refcounted, the EglData created afterwards initializes it again anyway.
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        return false;
+    }
+    EGLConfig config;
+    return chooseConfig(display, true, false, &config);
+}
+
+EglData::EglData(ANativeWindow *window, const EglSurfaceOptions &options) : options(options) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if (display == EGL_NO_DISPLAY) {
+        ALOGE("Failed to get EGL display");
+        return;
+    }
+
+    bool success = eglInitialize(display, NULL, NULL);
+
+    if (!success) {
+        ALOGE("Failed to initialize EGL");
+        return;
+    }
+
+    // Single buffering needs a config whose render buffer can be switched after creating the surface.
+    bool front = options.front_buffer && hasExtension(display, "EGL_KHR_mutable_render_buffer") &&
+                 hasExtension(display, "EGL_ANDROID_front_buffer_auto_refresh");
+    if (options.front_buffer && !front) {
+        ALOGW("EGL: No front buffer rendering on this device");
+    }
+
+    // Drop the optional features one by one until a config fits.
+    const bool attempts[][2] = {
+        {options.ten_bit, front},
+        {false, front},
+        {options.ten_bit, false},
+        {false, false},
+    };
+    bool found = false;
+    for (const auto &attempt : attempts) {
+        if (chooseConfig(display, attempt[0], attempt[1], &config)) {
+            ten_bit = attempt[0];
+            front_buffer = attempt[1];
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        ALOGE("Failed to find suitable EGL config");
+        throw std::runtime_error("Failed to find suitable EGL config");
+    }
+    if (options.ten_bit && !ten_bit) {
+        ALOGW("EGL: No 10 bit config, presenting in 8 bit");
+    }
 
     EGLint contextAttributes[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
     CHK_EGL(context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes));
@@ -77,17 +203,49 @@ EglData::EglData(ANativeWindow *window) {
     CHECK_EGL_ERROR();
     ALOGI("EGL: Created context");
 
+    try {
+        createSurface(window);
+    } catch (...) {
+        eglDestroyContext(display, context);
+        throw;
+    }
+}
+
+void EglData::createSurface(ANativeWindow *window) {
+    EGLint format;
+    eglGetConfigAttrib(display, config, EGL_NATIVE_VISUAL_ID, &format);
+
     ANativeWindow_setBuffersGeometry(window, 0, 0, format);
     surface = eglCreateWindowSurface(display, config, window, NULL);
 
     if (surface == EGL_NO_SURFACE) {
         ALOGE("Failed to create EGL surface");
-        eglDestroyContext(display, context);
         throw std::runtime_error("Failed to create EGL surface");
     }
 
     CHECK_EGL_ERROR();
-    ALOGI("EGL: Created surface");
+    ALOGI("EGL: Created %s bit surface", ten_bit ? "10" : "8");
+
+    setFrameRate(window, options.frame_rate);
+
+    if (front_buffer) {
+        // Takes effect with the next eglSwapBuffers, after that the swap is merely a flush.
+        if (eglSurfaceAttrib(display, surface, EGL_RENDER_BUFFER, EGL_SINGLE_BUFFER) &&
+            eglSurfaceAttrib(display, surface, EGL_FRONT_BUFFER_AUTO_REFRESH_ANDROID, EGL_TRUE)) {
+            ALOGI("EGL: Rendering to the front buffer");
+        } else {
+            ALOGW("EGL: Front buffer rendering refused, staying double buffered");
+            CHECK_EGL_ERROR();
+        }
+    }
+}
+
+void EglData::destroySurface() {
+    if (surface != EGL_NO_SURFACE) {
+        eglDestroySurface(display, surface);
+        surface = EGL_NO_SURFACE;
+        ALOGI("EGL: Destroyed surface");
+    }
 }
 
 EglData::~EglData() {
@@ -3,11 +3,22 @@
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
 
+#include <cstdint>
 #include <memory>
 
+/// What the window surface should be like, each falls back quietly where the device can't do it.
+struct EglSurfaceOptions {
+    /// Stream frame rate, the panel gets asked to run at a multiple of it. 0 leaves the refresh rate alone.
+    int32_t frame_rate = 0;
+    /// Render straight into the buffer on screen, letting the compositor refresh it by itself. May tear.
+    bool front_buffer = false;
+    /// R10G10B10A2 instead of R8G8B8A8, for 10 bit streams decoded into P010 buffers.
+    bool ten_bit = false;
+};
+
 struct EglData {
-    /// Creates an R8G8B8A8 ES3 context
-    explicit EglData(ANativeWindow *window);
+    /// Creates an ES3 context, R8G8B8A8 unless the options ask for 10 bit
+    explicit EglData(ANativeWindow *window, const EglSurfaceOptions &options = {});
 
     /// Calls reset
     ~EglData();
@@ -24,14 +35,28 @@ struct EglData {
     // do not copy
     EglData &operator=(EglData &&) = delete;
 
+    /// For a new window, the context and everything shared with it stay as they are.
+    void createSurface(ANativeWindow *window);
+
+    /// Before the window goes away. The context must not be current with the surface anywhere.
+    void destroySurface();
+
     bool isReady() const;
 
     void makeCurrent() const;
 
     void makeNotCurrent() const;
 
+    /// Whether the default display has a 10 bit window config, without creating anything.
+    static bool supportsTenBit();
+
     EGLDisplay display = EGL_NO_DISPLAY;
     EGLContext context = EGL_NO_CONTEXT;
     EGLSurface surface = EGL_NO_SURFACE;
     EGLConfig config = nullptr;
+
+    EglSurfaceOptions options;
+    /// What the surface ended up with.
+    bool front_buffer = false;
+    bool ten_bit = false;
 };
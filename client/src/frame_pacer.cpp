@@ -0,0 +1,188 @@
+#include "frame_pacer.hpp"
+
+#include <cstring>
+#include <ctime>
+
+#include "stream/utils/logger.h"
+
+namespace {
+
+constexpr int64_t DEFAULT_VSYNC_PERIOD_NS = 1000000000LL / 60;
+
+/// Without vsync callbacks we still need to wake up now and then, e.g. to notice the server going away.
+constexpr int FALLBACK_POLL_TIMEOUT_MS = 100;
+
+/// How long teardown waits for the vsync callback in flight. It comes within a frame unless the display is off.
+constexpr int64_t CALLBACK_DRAIN_TIMEOUT_NS = 100000000LL;
+
+int64_t now_ns() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+} // namespace
+
+/// Choreographer callbacks can't be cancelled, so the pacer waits for the one in flight before freeing this. Should it
+/// not come in time, the state is orphaned and the callback frees it.
+struct FramePacer::CallbackState {
+    FramePacer *pacer;
+    bool pending;
+    bool orphaned;
+
+    static void dispatch(CallbackState *state, int64_t frame_time_ns) {
+        state->pending = false;
+        if (state->orphaned) {
+            delete state;
+            return;
+        }
+        if (state->pacer != nullptr) {
+            state->pacer->onVsync(frame_time_ns);
+        }
+    }
+
+#if __ANDROID_API__ >= 29
+    static void callback(int64_t frame_time_ns, void *data) {
+        dispatch(static_cast<CallbackState *>(data), frame_time_ns);
+    }
+#else
+    static void callback(long frame_time_ns, void *data) {
+        dispatch(static_cast<CallbackState *>(data), frame_time_ns);
+    }
+#endif
+};
+
+PacingPolicy pacing_policy_from_string(const std::string &str) {
+    return str == "smooth" ? PacingPolicy::Smooth : PacingPolicy::Latest;
+}
+
+FramePacer::FramePacer(MyStreamApp *stream_app, EGLDisplay display, EGLSurface surface, PacingPolicy policy)
+    : stream_app_(stream_app), display_(display), surface_(surface), policy_(policy) {
+    choreographer_ = AChoreographer_getInstance();
+    if (choreographer_ == nullptr) {
+        ALOGW("%s: No choreographer on this thread, presenting frames as they arrive", __FUNCTION__);
+        policy_ = PacingPolicy::Latest;
+    } else {
+        callback_state_ = new CallbackState{this, false, false};
+        postVsyncCallback();
+    }
+
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (extensions != nullptr && strstr(extensions, "EGL_ANDROID_presentation_time") != nullptr) {
+        eglPresentationTimeANDROID_ =
+            (PFNEGLPRESENTATIONTIMEANDROIDPROC)eglGetProcAddress("eglPresentationTimeANDROID");
+    }
+
+    ALOGI("%s: %s pacing, presentation time %s",
+          __FUNCTION__,
+          policy_ == PacingPolicy::Smooth ? "smooth" : "latest",
+          eglPresentationTimeANDROID_ ? "supported" : "unsupported");
+}
+
+FramePacer::~FramePacer() {
+    if (callback_state_ != nullptr) {
+        callback_state_->pacer = nullptr;
+        // There is always a callback posted. This is the thread whose looper runs it.
+        const int64_t deadline_ns = now_ns() + CALLBACK_DRAIN_TIMEOUT_NS;
+        int64_t remaining_ns;
+        while (callback_state_->pending && (remaining_ns = deadline_ns - now_ns()) > 0) {
+            ALooper_pollOnce((int)(remaining_ns / 1000000) + 1, nullptr, nullptr, nullptr);
+        }
+        if (callback_state_->pending) {
+            ALOGW("%s: vsync callback still pending, leaving its state to it", __FUNCTION__);
+            callback_state_->orphaned = true;
+        } else {
+            delete callback_state_;
+        }
+    }
+    if (queued_ != nullptr) {
+        stream_app_release_sample(stream_app_, queued_);
+    }
+}
+
+void FramePacer::postVsyncCallback() {
+    callback_state_->pending = true;
+#if __ANDROID_API__ >= 29
+    AChoreographer_postFrameCallback64(choreographer_, &CallbackState::callback, callback_state_);
+#else
+    AChoreographer_postFrameCallback(choreographer_, &CallbackState::callback, callback_state_);
+#endif
+}
+
+void FramePacer::onVsync(int64_t frame_time_ns) {
+    if (last_vsync_ns_ != 0) {
+        const int64_t delta = frame_time_ns - last_vsync_ns_;
+        if (vsync_period_ns_ == 0) {
+            vsync_period_ns_ = delta;
+        } else if (delta < vsync_period_ns_ * 3 / 2) {
+            vsync_period_ns_ += (delta - vsync_period_ns_) / 8;
+            rejected_periods_ = 0;
+        } else if (++rejected_periods_ >= 8) {
+            // Not a missed callback but a lower refresh rate.
+            vsync_period_ns_ = delta;
+            rejected_periods_ = 0;
+        }
+    }
+    last_vsync_ns_ = frame_time_ns;
+
+    vsync_pending_ = true;
+    presented_since_vsync_ = false;
+
+    postVsyncCallback();
+}
+
+int FramePacer::pollTimeoutMs() const {
+    return choreographer_ != nullptr ? -1 : FALLBACK_POLL_TIMEOUT_MS;
+}
+
+MySample *FramePacer::acquireFrame() {
+    struct timespec decode_end {};
+
+    if (policy_ == PacingPolicy::Smooth) {
+        if (!vsync_pending_) {
+            return nullptr;
+        }
+        vsync_pending_ = false;
+
+        // Present what we buffered on the previous vsync, and buffer the newest frame for the next one. After an
+        // underrun (or on the first frame) this presents nothing and builds up the buffer again.
+        MySample *out = queued_;
+        queued_ = stream_app_try_pull_sample(stream_app_, &decode_end);
+        return out;
+    }
+
+    MySample *latest = stream_app_try_pull_sample(stream_app_, &decode_end);
+    if (latest != nullptr) {
+        if (queued_ != nullptr) {
+            stream_app_release_sample(stream_app_, queued_);
+        }
+        queued_ = latest;
+    }
+    vsync_pending_ = false;
+
+    // The compositor only shows one frame per vsync, presenting more just queues up latency.
+    if (queued_ == nullptr || (choreographer_ != nullptr && presented_since_vsync_)) {
+        return nullptr;
+    }
+    presented_since_vsync_ = true;
+
+    MySample *out = queued_;
+    queued_ = nullptr;
+    return out;
+}
+
+int64_t FramePacer::nextVsyncAfter(int64_t time_ns) const {
+    const int64_t period = vsync_period_ns_ > 0 ? vsync_period_ns_ : DEFAULT_VSYNC_PERIOD_NS;
+    if (time_ns < last_vsync_ns_) {
+        return last_vsync_ns_;
+    }
+    const int64_t periods = (time_ns - last_vsync_ns_) / period + 1;
+    return last_vsync_ns_ + periods * period;
+}
+
+void FramePacer::beforeSwap() {
+    if (eglPresentationTimeANDROID_ == nullptr || last_vsync_ns_ == 0) {
+        return;
+    }
+    eglPresentationTimeANDROID_(display_, surface_, nextVsyncAfter(now_ns()));
+}
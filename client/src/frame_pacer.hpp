@@ -0,0 +1,81 @@
+#pragma once
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <android/choreographer.h>
+#include <android/looper.h>
+
+#include <cstdint>
+#include <string>
+
+#include "stream/stream_app.h"
+
+enum class PacingPolicy {
+    /// Present the newest decoded frame right away, at most once per vsync.
+    Latest,
+    /// Keep one frame buffered and present one frame per vsync, trading a frame of latency for an even cadence.
+    Smooth,
+};
+
+/// "smooth" or "latest", anything else is treated as latest.
+PacingPolicy pacing_policy_from_string(const std::string &str);
+
+/**
+ * Decides when the render loop presents a frame, based on AChoreographer vsync callbacks.
+ *
+ * Must be created and used on the render thread, whose looper dispatches the vsync callbacks. The render loop blocks
+ * in ALooper_pollOnce until either a vsync callback ran or the stream app decoded a new sample, so nothing spins
+ * between frames.
+ */
+class FramePacer {
+public:
+    FramePacer(MyStreamApp *stream_app, EGLDisplay display, EGLSurface surface, PacingPolicy policy);
+
+    /// Releases any buffered sample, so it must go before the stream app. Polls the looper for the vsync callback still
+    /// in flight, so it must run on the render thread too.
+    ~FramePacer();
+
+    FramePacer(const FramePacer &) = delete;
+    FramePacer &operator=(const FramePacer &) = delete;
+
+    /// How long the render loop may block waiting for events.
+    int pollTimeoutMs() const;
+
+    /**
+     * Get the sample to present now, if any.
+     *
+     * The caller owns the returned sample and releases it with stream_app_release_sample.
+     */
+    MySample *acquireFrame();
+
+    /// Call right before eglSwapBuffers, tells the compositor which vsync the frame is meant for.
+    void beforeSwap();
+
+private:
+    struct CallbackState;
+
+    void postVsyncCallback();
+    void onVsync(int64_t frame_time_ns);
+    int64_t nextVsyncAfter(int64_t time_ns) const;
+
+    MyStreamApp *stream_app_;
+    EGLDisplay display_;
+    EGLSurface surface_;
+    PacingPolicy policy_;
+
+    AChoreographer *choreographer_ = nullptr;
+    CallbackState *callback_state_ = nullptr;
+    PFNEGLPRESENTATIONTIMEANDROIDPROC eglPresentationTimeANDROID_ = nullptr;
+
+    int64_t last_vsync_ns_ = 0;
+    int64_t vsync_period_ns_ = 0;
+    int32_t rejected_periods_ = 0;
+
+    /// A vsync happened since the last call to acquireFrame.
+    bool vsync_pending_ = false;
+    /// A frame was presented since the last vsync.
+    bool presented_since_vsync_ = false;
+
+    /// Pulled but not yet presented.
+    MySample *queued_ = nullptr;
+};
@@ -6,6 +6,18 @@
 #include "stream/input.h"
 #include "stream/utils/logger.h"
 
+// Input logging runs for every sample, so it is compiled out unless asked for. Arguments are still type checked.
+#ifdef RSTREAM_INPUT_LOGGING
+    #define INPUT_LOG(...) ALOGD(__VA_ARGS__)
+#else
+    #define INPUT_LOG(...)            \
+        do {                          \
+            if (0) {                  \
+                ALOGD(__VA_ARGS__);   \
+            }                         \
+        } while (0)
+#endif
+
 int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
     int32_t source = AInputEvent_getSource(event);
 
@@ -34,21 +46,21 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
             float rt_value = AMotionEvent_getAxisValue(event, AMOTION_EVENT_AXIS_RTRIGGER, 0);
 
             if (abs(state_.prev_lt - lt_value) > 0.001) {
-                ALOGD("Gamepad Left Trigger pressed: %.3f", lt_value);
+                INPUT_LOG("Gamepad Left Trigger pressed: %.3f", lt_value);
                 state_.prev_lt = lt_value;
                 my_connection_send_input_event(state_.connection, InputType::GamepadButtonLT, lt_value, 0);
                 return 1;
             }
 
             if (abs(state_.prev_rt - rt_value) > 0.001) {
-                ALOGD("Gamepad Right Trigger pressed: %.3f", rt_value);
+                INPUT_LOG("Gamepad Right Trigger pressed: %.3f", rt_value);
                 state_.prev_rt = rt_value;
                 my_connection_send_input_event(state_.connection, InputType::GamepadButtonRT, rt_value, 0);
                 return 1;
             }
 
             if (abs(state_.prev_lx - lx) > 0.001 || abs(state_.prev_ly - ly) > 0.001) {
-                ALOGD("Gamepad JOYSTICK L(%.1f, %.1f) ", lx, ly);
+                INPUT_LOG("Gamepad JOYSTICK L(%.1f, %.1f) ", lx, ly);
                 state_.prev_lx = lx;
                 state_.prev_ly = ly;
                 my_connection_send_input_event(state_.connection,
@@ -59,7 +71,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
             }
 
             if (abs(state_.prev_rx - rx) > 0.001 || abs(state_.prev_ry - ry) > 0.001) {
-                ALOGD("Gamepad JOYSTICK R(%.1f, %.1f)", rx, ry);
+                INPUT_LOG("Gamepad JOYSTICK R(%.1f, %.1f)", rx, ry);
                 state_.prev_rx = rx;
                 state_.prev_ry = ry;
                 my_connection_send_input_event(state_.connection,
@@ -84,7 +96,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                pressed ? 1 : 0,
                                                0);
 
-                ALOGD("Gamepad A pressed: %d", pressed);
+                INPUT_LOG("Gamepad A pressed: %d", pressed);
             } break;
             case AKEYCODE_BUTTON_B: {
                 my_connection_send_input_event(state_.connection,
@@ -92,7 +104,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                pressed ? 1 : 0,
                                                0);
 
-                ALOGD("Gamepad B pressed: %d", pressed);
+                INPUT_LOG("Gamepad B pressed: %d", pressed);
             } break;
             case AKEYCODE_BUTTON_X: {
                 my_connection_send_input_event(state_.connection,
@@ -100,7 +112,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                pressed ? 1 : 0,
                                                0);
 
-                ALOGD("Gamepad X pressed: %d", pressed);
+                INPUT_LOG("Gamepad X pressed: %d", pressed);
             } break;
             case AKEYCODE_BUTTON_Y: {
                 my_connection_send_input_event(state_.connection,
@@ -108,7 +120,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                pressed ? 1 : 0,
                                                0);
 
-                ALOGD("Gamepad Y pressed: %d", pressed);
+                INPUT_LOG("Gamepad Y pressed: %d", pressed);
             } break;
             case AKEYCODE_BUTTON_L1: {
                 my_connection_send_input_event(state_.connection,
@@ -116,7 +128,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                pressed ? 1 : 0,
                                                0);
 
-                ALOGD("Gamepad L1 pressed: %d", pressed);
+                INPUT_LOG("Gamepad L1 pressed: %d", pressed);
             } break;
             case AKEYCODE_BUTTON_R1: {
                 my_connection_send_input_event(state_.connection,
@@ -124,7 +136,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                pressed ? 1 : 0,
                                                0);
 
-                ALOGD("Gamepad R1 pressed: %d", pressed);
+                INPUT_LOG("Gamepad R1 pressed: %d", pressed);
             } break;
                 //            case AKEYCODE_BUTTON_L2: {
                 //                my_connection_send_input_event(state_.connection,
@@ -143,7 +155,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                 //                ALOGI("Gamepad R2 pressed: %d", pressed);
                 //            } break;
             case AKEYCODE_DPAD_UP: {
-                ALOGD("Gamepad D-Pad UP pressed: %d", pressed);
+                INPUT_LOG("Gamepad D-Pad UP pressed: %d", pressed);
 
                 my_connection_send_input_event(state_.connection,
                                                static_cast<int>(InputType::GamepadUp),
@@ -151,7 +163,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                0);
             } break;
             case AKEYCODE_DPAD_DOWN: {
-                ALOGD("Gamepad D-Pad DOWN pressed: %d", pressed);
+                INPUT_LOG("Gamepad D-Pad DOWN pressed: %d", pressed);
 
                 my_connection_send_input_event(state_.connection,
                                                static_cast<int>(InputType::GamepadDown),
@@ -159,7 +171,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                0);
             } break;
             case AKEYCODE_DPAD_LEFT: {
-                ALOGD("Gamepad D-Pad LEFT pressed: %d", pressed);
+                INPUT_LOG("Gamepad D-Pad LEFT pressed: %d", pressed);
 
                 my_connection_send_input_event(state_.connection,
                                                static_cast<int>(InputType::GamepadLeft),
@@ -167,7 +179,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                0);
             } break;
             case AKEYCODE_DPAD_RIGHT: {
-                ALOGD("Gamepad D-Pad RIGHT pressed: %d", pressed);
+                INPUT_LOG("Gamepad D-Pad RIGHT pressed: %d", pressed);
 
                 my_connection_send_input_event(state_.connection,
                                                static_cast<int>(InputType::GamepadRight),
@@ -175,15 +187,25 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                0);
             } break;
             case AKEYCODE_BUTTON_START: {
-                ALOGD("Gamepad START pressed: %d", pressed);
+                INPUT_LOG("Gamepad START pressed: %d", pressed);
 
                 my_connection_send_input_event(state_.connection,
                                                static_cast<int>(InputType::GamepadButtonStart),
                                                pressed ? 1 : 0,
                                                0);
             } break;
+            case AKEYCODE_BUTTON_THUMBL:
+            case AKEYCODE_BUTTON_THUMBR: {
+                // Clicking both sticks toggles the performance overlay, the server never sees these.
+                (key_code == AKEYCODE_BUTTON_THUMBL ? state_.hud_combo_left : state_.hud_combo_right) = pressed;
+                if (pressed && state_.hud_combo_left && state_.hud_combo_right) {
+                    const bool visible = !state_.hud_visible.load();
+                    state_.hud_visible = visible;
+                    ALOGI("Performance overlay %s", visible ? "shown" : "hidden");
+                }
+            } break;
             case AKEYCODE_BUTTON_SELECT: {
-                ALOGD("Gamepad SELECT pressed: %d", pressed);
+                INPUT_LOG("Gamepad SELECT pressed: %d", pressed);
 
                 my_connection_send_input_event(state_.connection,
                                                static_cast<int>(InputType::GamepadButtonSelect),
@@ -191,7 +213,7 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
                                                0);
             } break;
             default: {
-                ALOGD("Gamepad Unhandled key: %d", key_code);
+                INPUT_LOG("Gamepad Unhandled key: %d", key_code);
                 return 0;
             } break;
         }
@@ -201,6 +223,12 @@ int32_t handle_gamepad_key_event(const AInputEvent* event, MyState& state_) {
     return 0; // Event not handled by our logic
 }
 
+static void update_cursor(MyState& state_, float x, float y, uint32_t sequence, int64_t time_ns, bool down) {
+    // The render thread reads it to draw the cursor.
+    std::lock_guard<std::mutex> lock(state_.cursor_mutex);
+    my_cursor_predictor_update(&state_.cursor_predictor, x, y, sequence, time_ns, down);
+}
+
 int32_t handle_input(AInputEvent* event, MyState& state_) {
     if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_KEY) {
         int32_t key_code = AKeyEvent_getKeyCode(event);
@@ -228,46 +256,37 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
     if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION) {
         int32_t action = AMotionEvent_getAction(event);
 
-        float x = AMotionEvent_getX(event, 0);
-        float y = AMotionEvent_getY(event, 0);
-
-        bool outside_host_screen = false;
-        if (x < state_.h_margin) {
-            x = state_.h_margin;
-            outside_host_screen = true;
-        }
-        if (x > state_.window_width - state_.h_margin) {
-            x = state_.window_width;
-            outside_host_screen = true;
-        }
-        if (y < state_.v_margin) {
-            y = state_.v_margin;
-            outside_host_screen = true;
+        TouchViewport viewport{};
+        viewport.window_width = state_.window_width;
+        viewport.window_height = state_.window_height;
+        {
+            // All from the same frame, a resolution change must not mix the old margins with the new size.
+            std::lock_guard<std::mutex> lock(state_.layout_mutex);
+            viewport.h_margin = state_.layout.h_margin;
+            viewport.v_margin = state_.layout.v_margin;
+            viewport.render_width = state_.layout.render_width;
+            viewport.render_height = state_.layout.render_height;
         }
-        if (y > state_.window_height - state_.v_margin) {
-            y = state_.window_height;
-            outside_host_screen = true;
-        }
-        x -= state_.h_margin;
-        y -= state_.v_margin;
+        viewport.video_width = state_.stream_width;
+        viewport.video_height = state_.stream_height;
+
+        // Track pointers even for events we ignore, so the pointer list stays in sync with Android's.
+        state_.input_capture.onMotionEvent(event, viewport);
 
-        if (outside_host_screen) {
+        float client_x, client_y;
+        if (!viewport.toVideo(AMotionEvent_getX(event, 0), AMotionEvent_getY(event, 0), &client_x, &client_y)) {
             return 0;
         }
 
-        //        bool single_touch = AMotionEvent_getPointerCount(event) == 1;
-
-        float x_ratio = x / (float)state_.render_width;
-        float y_ratio = y / (float)state_.render_height;
-
-        float client_x = x_ratio * stream_app_get_video_width(state_.stream_app);
-        float client_y = y_ratio * stream_app_get_video_height(state_.stream_app);
+        // Same clock as CLOCK_MONOTONIC, so the server can line it up with its own.
+        const int64_t event_time_ns = AMotionEvent_getEventTime(event);
+        const auto pointer_id = static_cast<uint8_t>(AMotionEvent_getPointerId(event, 0));
 
         // AMotionEvent_getDownTime
 
         switch (action & AMOTION_EVENT_ACTION_MASK) {
             case AMOTION_EVENT_ACTION_DOWN: {
-                ALOGD("INPUT: DOWN (%.1f, %.1f)", client_x, client_y);
+                INPUT_LOG("INPUT: DOWN (%.1f, %.1f)", client_x, client_y);
                 state_.pressed = true;
                 state_.press_time = g_get_monotonic_time();
                 state_.press_pos_x = client_x;
@@ -286,13 +305,17 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                     new_client_x = state_.last_cursor_down_pos_x;
                     new_client_y = state_.last_cursor_down_pos_y;
 
-                    ALOGD("INPUT: double click (%.1f, %.1f), interval %.1f", new_client_x, new_client_y, down_interval);
+                    INPUT_LOG(
+                        "INPUT: double click (%.1f, %.1f), interval %.1f", new_client_x, new_client_y, down_interval);
                 }
 
-                my_connection_send_input_event(state_.connection,
-                                               static_cast<int>(InputType::CursorLeftDown),
-                                               new_client_x,
-                                               new_client_y);
+                uint32_t sequence = my_connection_send_pointer_event(state_.connection,
+                                                                     static_cast<int>(InputType::CursorLeftDown),
+                                                                     pointer_id,
+                                                                     new_client_x,
+                                                                     new_client_y,
+                                                                     event_time_ns);
+                update_cursor(state_, new_client_x, new_client_y, sequence, event_time_ns, true);
 
                 state_.last_time_cursor_down = now;
                 state_.last_cursor_down_pos_x = client_x;
@@ -304,8 +327,8 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                 size_t pointer_index =
                     (action & AMOTION_EVENT_ACTION_POINTER_INDEX_MASK) >> AMOTION_EVENT_ACTION_POINTER_INDEX_SHIFT;
 
-                ALOGD("INPUT: pointer index %zu, action code %d", pointer_index, action_code);
-                size_t pointer_count = AMotionEvent_getPointerCount(event);
+                INPUT_LOG("INPUT: pointer index %zu, action code %d", pointer_index, action_code);
+                size_t pointer_count = state_.input_capture.pointerCount();
 
                 if (pointer_count > 1) {
                     if (pointer_count > 2) {
@@ -324,31 +347,25 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                         state_.press_time.reset();
                     }
 
-                    float x0 = AMotionEvent_getX(event, 0);
-                    float y0 = AMotionEvent_getY(event, 0);
+                    const TouchSample &p0 = state_.input_capture.pointer(0).latest;
+                    const TouchSample &p1 = state_.input_capture.pointer(1).latest;
 
-                    float x1 = AMotionEvent_getX(event, 1);
-                    float y1 = AMotionEvent_getY(event, 1);
-
-                    float x_center = (x0 + x1) * 0.5f;
-                    float y_center = (y0 + y1) * 0.5f;
+                    float x_center = (p0.window_x + p1.window_x) * 0.5f;
+                    float y_center = (p0.window_y + p1.window_y) * 0.5f;
 
                     state_.prev_pos_center_x = x_center;
                     state_.prev_pos_center_y = y_center;
 
-                    ALOGD("INPUT: Multiple touch down %zu", pointer_count);
+                    INPUT_LOG("INPUT: Multiple touch down %zu", pointer_count);
                 }
             } break;
             case AMOTION_EVENT_ACTION_MOVE:
-                if (AMotionEvent_getPointerCount(event) > 1) {
-                    float x0 = AMotionEvent_getX(event, 0);
-                    float y0 = AMotionEvent_getY(event, 0);
-
-                    float x1 = AMotionEvent_getX(event, 1);
-                    float y1 = AMotionEvent_getY(event, 1);
+                if (state_.input_capture.pointerCount() > 1) {
+                    const TouchSample &p0 = state_.input_capture.pointer(0).latest;
+                    const TouchSample &p1 = state_.input_capture.pointer(1).latest;
 
-                    float x_center = (x0 + x1) / 2;
-                    float y_center = (y0 + y1) / 2;
+                    float x_center = (p0.window_x + p1.window_x) / 2;
+                    float y_center = (p0.window_y + p1.window_y) / 2;
 
                     float dx = x_center - state_.prev_pos_center_x;
                     float dy = y_center - state_.prev_pos_center_y;
@@ -356,7 +373,7 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                     if (dx == 0 || dy == 0) {
                         break;
                     }
-                    ALOGD("INPUT: SCROLL (%.1f, %.1f)", dx, dy);
+                    INPUT_LOG("INPUT: SCROLL (%.1f, %.1f)", dx, dy);
                     my_connection_send_input_event(state_.connection,
                                                    static_cast<int>(InputType::CursorScroll),
                                                    dx,
@@ -367,11 +384,17 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
 
                     state_.scrolling = true;
                 } else {
-                    ALOGD("INPUT: MOVE (%.1f, %.1f)", client_x, client_y);
-                    my_connection_send_input_event(state_.connection,
-                                                   static_cast<int>(InputType::CursorMove),
-                                                   client_x,
-                                                   client_y);
+                    // Every sample since the last event, not just the newest, or strokes come out jagged.
+                    for (const TouchSample &sample : state_.input_capture.primarySamples()) {
+                        INPUT_LOG("INPUT: MOVE (%.1f, %.1f)", sample.x, sample.y);
+                        uint32_t sequence = my_connection_send_pointer_event(state_.connection,
+                                                                             static_cast<int>(InputType::CursorMove),
+                                                                             pointer_id,
+                                                                             sample.x,
+                                                                             sample.y,
+                                                                             sample.time_ns);
+                        update_cursor(state_, sample.x, sample.y, sequence, sample.time_ns, true);
+                    }
                 }
 
                 // Cancel right click
@@ -381,7 +404,7 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                 state_.prev_pos_y = client_y;
                 break;
             case AMOTION_EVENT_ACTION_UP:
-                ALOGD("INPUT: UP (%.1f, %.1f)", client_x, client_y);
+                INPUT_LOG("INPUT: UP (%.1f, %.1f)", client_x, client_y);
 
                 if (state_.scrolling) {
                     state_.scrolling = false;
@@ -399,13 +422,16 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                 }
 
                 state_.pressed = false;
-                my_connection_send_input_event(state_.connection,
-                                               static_cast<int>(InputType::CursorLeftUp),
-                                               client_x,
-                                               client_y);
+                uint32_t sequence = my_connection_send_pointer_event(state_.connection,
+                                                                     static_cast<int>(InputType::CursorLeftUp),
+                                                                     pointer_id,
+                                                                     client_x,
+                                                                     client_y,
+                                                                     event_time_ns);
+                update_cursor(state_, client_x, client_y, sequence, event_time_ns, false);
 
                 if (right_click) {
-                    ALOGD("INPUT: RIGHT CLICK (%.1f, %.1f)", client_x, client_y);
+                    INPUT_LOG("INPUT: RIGHT CLICK (%.1f, %.1f)", client_x, client_y);
                     my_connection_send_input_event(state_.connection,
                                                    static_cast<int>(InputType::CursorRightClick),
                                                    client_x,
@@ -414,7 +440,7 @@ int32_t handle_input(AInputEvent* event, MyState& state_) {
                 }
 
                 if (std::abs(state_.press_pos_x - client_x) < 10 && std::abs(state_.press_pos_y - client_y) < 10) {
-                    ALOGD("INPUT: CLICK (%.1f, %.1f)", client_x, client_y);
+                    INPUT_LOG("INPUT: CLICK (%.1f, %.1f)", client_x, client_y);
 
                     my_connection_send_input_event(state_.connection,
                                                    static_cast<int>(InputType::CursorLeftClick),
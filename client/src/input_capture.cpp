@@ -0,0 +1,63 @@
+#include "input_capture.hpp"
+
+#include <algorithm>
+
+bool TouchViewport::toVideo(float window_x, float window_y, float *out_x, float *out_y) const {
+    const float x = std::clamp(window_x, (float)h_margin, (float)(window_width - h_margin)) - (float)h_margin;
+    const float y = std::clamp(window_y, (float)v_margin, (float)(window_height - v_margin)) - (float)v_margin;
+
+    *out_x = x / (float)render_width * (float)video_width;
+    *out_y = y / (float)render_height * (float)video_height;
+
+    return window_x >= h_margin && window_x <= window_width - h_margin && window_y >= v_margin &&
+           window_y <= window_height - v_margin;
+}
+
+static TouchSample make_sample(const TouchViewport &viewport, float window_x, float window_y, int64_t time_ns) {
+    TouchSample sample{};
+    sample.window_x = window_x;
+    sample.window_y = window_y;
+    sample.time_ns = time_ns;
+    viewport.toVideo(window_x, window_y, &sample.x, &sample.y);
+    return sample;
+}
+
+void InputCapture::onMotionEvent(const AInputEvent *event, const TouchViewport &viewport) {
+    const int32_t action = AMotionEvent_getAction(event) & AMOTION_EVENT_ACTION_MASK;
+    const size_t count = std::min(AMotionEvent_getPointerCount(event), MAX_TOUCH_POINTERS);
+    const size_t history_size = AMotionEvent_getHistorySize(event);
+
+    // Historical samples only come with moves, and they are shared by all pointers of the event.
+    primary_samples_.clear();
+    if (count > 0) {
+        for (size_t h = 0; h < history_size; h++) {
+            primary_samples_.push_back(make_sample(viewport,
+                                                   AMotionEvent_getHistoricalX(event, 0, h),
+                                                   AMotionEvent_getHistoricalY(event, 0, h),
+                                                   AMotionEvent_getHistoricalEventTime(event, h)));
+        }
+    }
+
+    const int64_t time_ns = AMotionEvent_getEventTime(event);
+    for (size_t i = 0; i < count; i++) {
+        pointers_[i].id = AMotionEvent_getPointerId(event, i);
+        pointers_[i].latest = make_sample(viewport, AMotionEvent_getX(event, i), AMotionEvent_getY(event, i), time_ns);
+    }
+    if (count > 0) {
+        primary_samples_.push_back(pointers_[0].latest);
+    }
+
+    // The event still lists the pointer going up, drop it afterwards.
+    pointer_count_ = count;
+    if (action == AMOTION_EVENT_ACTION_UP || action == AMOTION_EVENT_ACTION_CANCEL) {
+        pointer_count_ = 0;
+    } else if (action == AMOTION_EVENT_ACTION_POINTER_UP) {
+        const size_t up_index =
+            (AMotionEvent_getAction(event) & AMOTION_EVENT_ACTION_POINTER_INDEX_MASK) >>
+            AMOTION_EVENT_ACTION_POINTER_INDEX_SHIFT;
+        if (up_index < pointer_count_) {
+            std::move(pointers_.begin() + up_index + 1, pointers_.begin() + pointer_count_, pointers_.begin() + up_index);
+            pointer_count_--;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <android/input.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Android reports at most this many pointers on the devices we care about, extra ones are ignored.
+constexpr size_t MAX_TOUCH_POINTERS = 10;
+
+/// Video rectangle in window pixels, letterboxed to keep the aspect of the current frame.
+struct VideoLayout {
+    int32_t h_margin;
+    int32_t v_margin;
+    int32_t render_width;
+    int32_t render_height;
+};
+
+/// Where the video sits in the window, to map touch positions into video pixels.
+struct TouchViewport {
+    int32_t window_width;
+    int32_t window_height;
+    int32_t h_margin;
+    int32_t v_margin;
+    int32_t render_width;
+    int32_t render_height;
+    uint32_t video_width;
+    uint32_t video_height;
+
+    /// @return false if the position is outside the video, the output is clamped to its edge then.
+    bool toVideo(float window_x, float window_y, float *out_x, float *out_y) const;
+};
+
+struct TouchSample {
+    /// Window coordinates.
+    float window_x;
+    float window_y;
+    /// Video pixels.
+    float x;
+    float y;
+    /// CLOCK_MONOTONIC, when the touch panel reported the sample.
+    int64_t time_ns;
+};
+
+struct TouchPointer {
+    int32_t id;
+    TouchSample latest;
+};
+
+/**
+ * Keeps every sample of a motion event instead of just the newest one.
+ *
+ * Android folds all samples since the last frame into one ACTION_MOVE, the older ones only show up as historical
+ * samples. Touch panels sample at 120 to 240 Hz, so reading just the current position loses most of a stroke.
+ *
+ * Only used on the android_main thread, which dispatches input.
+ */
+class InputCapture {
+public:
+    /// Update the pointers from a motion event and collect the samples of the primary pointer.
+    void onMotionEvent(const AInputEvent *event, const TouchViewport &viewport);
+
+    /// Samples of the primary (first) pointer in the last event, oldest first, the current one last.
+    const std::vector<TouchSample> &primarySamples() const {
+        return primary_samples_;
+    }
+
+    /// Pointers down after the last event, in the order Android reports them.
+    size_t pointerCount() const {
+        return pointer_count_;
+    }
+
+    const TouchPointer &pointer(size_t index) const {
+        return pointers_[index];
+    }
+
+private:
+    std::array<TouchPointer, MAX_TOUCH_POINTERS> pointers_{};
+    size_t pointer_count_ = 0;
+    std::vector<TouchSample> primary_samples_;
+};
@@ -10,6 +10,7 @@
 #include <pthread.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cerrno>
@@ -24,17 +25,114 @@
 #include "input.h"
 #include "state.h"
 #include "stream/connection.h"
+#include "stream/decoder_select.h"
 #include "stream/input.h"
 #include "stream/render/render.hpp"
 #include "stream/render/render_api.h"
 #include "stream/sample.h"
+#include "stream/startup_profile.h"
 #include "stream/stream_app.h"
 
 struct MyState state_ = {};
-struct MySample *prev_sample;
+
+/// The looper thread only handles events now, it still has to notice the server going away.
+constexpr int SERVER_CLOSED_POLL_MS = 100;
+
+/// Used in WebRTC mode unless the intent names another one.
+constexpr const char *DEFAULT_STUN_SERVER = "stun://stun.l.google.com:19302";
 
 namespace {
 
+/// Loads the GStreamer plugins and the decoder catalog while the window is still on its way.
+std::thread init_thread_;
+
+void start_init(JavaVM *vm, std::string cache_dir) {
+    init_thread_ = std::thread([vm, cache_dir]() {
+        JNIEnv *env = nullptr;
+        vm->AttachCurrentThread(&env, NULL);
+
+        ALOGD("Initialize GStreamer.");
+        gst_init(NULL, NULL);
+        my_startup_profile_mark(MY_STARTUP_PHASE_GST_INIT);
+
+        // Set up gst logger
+        gst_debug_set_default_threshold(GST_LEVEL_WARNING);
+
+        state_.decoder_catalog = my_decoder_catalog_load_or_probe(cache_dir.c_str(), env);
+        my_startup_profile_mark(MY_STARTUP_PHASE_DECODER_CATALOG);
+
+        vm->DetachCurrentThread();
+    });
+}
+
+bool is_replay() {
+    return state_.replay.capture_path[0] != '\0';
+}
+
+/// Numeric intent extra, @p fallback if missing or malformed.
+float parse_float(const std::string &value, float fallback) {
+    char *end = nullptr;
+    const float parsed = std::strtof(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0' ? parsed : fallback;
+}
+
+/// Everything GStreamer needs to wait for this.
+void wait_for_init() {
+    if (init_thread_.joinable()) {
+        init_thread_.join();
+    }
+}
+
+void query_window_size() {
+    EGLint window_width = 0;
+    EGLint window_height = 0;
+    eglQuerySurface(state_.egl_data->display, state_.egl_data->surface, EGL_WIDTH, &window_width);
+    eglQuerySurface(state_.egl_data->display, state_.egl_data->surface, EGL_HEIGHT, &window_height);
+    state_.window_width = window_width;
+    state_.window_height = window_height;
+}
+
+/// Tear down the stream app, connection and EGL, after the render thread is gone.
+void stop_session() {
+    stream_app_stop(state_.stream_app);
+
+    g_clear_object(&state_.stream_app);
+
+    my_connection_disconnect(state_.connection);
+
+    g_clear_object(&state_.connection);
+
+    ALOGD("Reset render thread and EGL data.");
+    state_.render_thread.reset();
+    state_.egl_data.reset();
+    state_.suspended = false;
+}
+
+/// Bring a suspended session back on a new window: only the EGL surface and the render thread are new.
+void resume_session(ANativeWindow *window) {
+    ALOGI("%s: resuming the suspended stream", __FUNCTION__);
+    my_startup_profile_begin();
+    my_startup_profile_mark(MY_STARTUP_PHASE_WINDOW);
+
+    state_.egl_data->createSurface(window);
+    state_.egl_data->makeCurrent();
+    query_window_size();
+    state_.egl_data->makeNotCurrent();
+
+    // The stream app still holds the old thread's looper in its new-sample callback. The new thread replaces it, and
+    // only then does the old looper get released.
+    std::unique_ptr<RenderThread> old_render_thread = std::move(state_.render_thread);
+    state_.render_thread =
+        std::make_unique<RenderThread>(state_, *state_.egl_data, state_.stream_app, state_.frame_pacing);
+    old_render_thread.reset();
+
+    // Both run in order on the stream app's main loop thread.
+    stream_app_resume(state_.stream_app);
+    my_connection_resume(state_.connection);
+
+    state_.suspended = false;
+}
+
 void onAppCmd(struct android_app *app, int32_t cmd) {
     switch (cmd) {
         case APP_CMD_START:
@@ -58,17 +156,14 @@ void onAppCmd(struct android_app *app, int32_t cmd) {
             // The app's window (Surface) is being destroyed.
             ALOGD("APP_CMD_INIT_WINDOW");
 
-            state_.egl_data = std::make_unique<EglData>(app->window);
-            state_.egl_data->makeCurrent();
+            if (state_.suspended) {
+                resume_session(app->window);
+                break;
+            }
+            my_startup_profile_mark(MY_STARTUP_PHASE_WINDOW);
 
-            eglQuerySurface(state_.egl_data->display, state_.egl_data->surface, EGL_WIDTH, &state_.window_width);
-            eglQuerySurface(state_.egl_data->display, state_.egl_data->surface, EGL_HEIGHT, &state_.window_height);
-
-            state_.stream_app = my_stream_app_new();
-            stream_app_set_egl_context(state_.stream_app,
-                                       state_.egl_data->context,
-                                       state_.egl_data->display,
-                                       state_.egl_data->surface);
+            // The codecs we advertise come from the decoder catalog.
+            wait_for_init();
 
             std::string websocket_uri = "ws://" + state_.host_ip + ":5600/ws";
             state_.connection = g_object_ref_sink(my_connection_new(websocket_uri.c_str(), state_.host_ip.c_str()));
@@ -87,49 +182,93 @@ void onAppCmd(struct android_app *app, int32_t cmd) {
                 config.video_height = 2160;
             }
 
+            state_.stream_width = config.video_width;
+            state_.stream_height = config.video_height;
+
             config.framerate = state_.framerate;
             config.bitrate = state_.bitrate;
+            // Nothing would take our encoder requests during a replay.
+            config.adaptive_bitrate = !is_replay();
             config.pin[4] = '\0';
             state_.pin.copy(config.pin, 4);
+            config.codec_count =
+                my_decoder_catalog_get_codec_support(state_.decoder_catalog, config.codecs, MY_VIDEO_CODEC_COUNT);
+            config.codec = is_replay() ? state_.replay_codec : MY_VIDEO_CODEC_H264;
+            config.fec_percentage = state_.fec_percentage;
+            // A capture holds plain RTP, there is no peer to negotiate with.
+            config.transport = is_replay() ? MY_TRANSPORT_RTP : state_.transport;
+            // Nor a stream_info with the displays' SSRCs, everything in the capture goes to the one display.
+            config.display_count = is_replay() || config.transport == MY_TRANSPORT_WEBRTC ? 1 : state_.display_count;
+            state_.stun_server.copy(config.stun_server, sizeof(config.stun_server) - 1);
+            config.jitter_preset = state_.jitter_preset;
+            config.jitter_floor_ms = state_.jitter_floor_ms;
+            config.jitter_ceiling_ms = state_.jitter_ceiling_ms;
+            // GstGL converts to RGBA8, only the hardware buffer path gets P010 frames to the surface as they are.
+            config.ten_bit = state_.ten_bit && state_.decode_path == MY_DECODE_PATH_HARDWARE_BUFFER &&
+                             EglData::supportsTenBit();
 
             my_connection_set_stream_config(state_.connection, &config);
 
-            my_connection_connect(state_.connection);
+            // Connect first, the ENet handshake runs on its own thread during the EGL setup. The WebSocket one goes
+            // on once the main loop runs, next to the pipeline being built on the prebuild thread.
+            if (!is_replay()) {
+                my_connection_connect(state_.connection);
+            }
+
+            EglSurfaceOptions surface_options;
+            surface_options.frame_rate = (int32_t)state_.framerate;
+            surface_options.front_buffer = state_.front_buffer;
+            surface_options.ten_bit = config.ten_bit;
+            state_.egl_data = std::make_unique<EglData>(app->window, surface_options);
+            state_.egl_data->makeCurrent();
+            query_window_size();
+            my_startup_profile_mark(MY_STARTUP_PHASE_EGL);
+
+            state_.stream_app = my_stream_app_new();
+            stream_app_set_decode_path(state_.stream_app, state_.decode_path);
+            stream_app_set_decoder_catalog(state_.stream_app, state_.decoder_catalog);
+            stream_app_set_egl_context(state_.stream_app,
+                                       state_.egl_data->context,
+                                       state_.egl_data->display,
+                                       state_.egl_data->surface);
+
+            // The render thread takes the context over.
+            state_.egl_data->makeNotCurrent();
+            state_.render_thread =
+                std::make_unique<RenderThread>(state_, *state_.egl_data, state_.stream_app, state_.frame_pacing);
 
             ALOGD("%s: starting stream client mainloop thread", __FUNCTION__);
             stream_app_spawn_thread(state_.stream_app, state_.connection);
-
-            try {
-                ALOGD("%s: Setup renderer...", __FUNCTION__);
-                state_.renderer = std::make_unique<Renderer>();
-                state_.renderer->setupRender();
-            } catch (std::exception const &e) {
-                ALOGE("%s: Caught exception setting up renderer: %s", __FUNCTION__, e.what());
-                state_.renderer.reset();
-                abort();
+            if (is_replay()) {
+                my_connection_start_replay(state_.connection, &state_.replay);
             }
         } break;
         case APP_CMD_TERM_WINDOW: {
             ALOGD("APP_CMD_TERM_WINDOW");
 
-            stream_app_stop(state_.stream_app);
-
-            g_clear_object(&state_.stream_app);
-
-            my_connection_disconnect(state_.connection);
-
-            g_clear_object(&state_.connection);
+            // Hands back its samples before the stream app goes away.
+            state_.render_thread->stop();
+
+            if (state_.session_resume && !app->destroyRequested &&
+                !my_connection_server_closed(state_.connection)) {
+                // Only the surface goes with the window. The render thread object stays until the next window, the
+                // paused stream app may still signal a sample or two.
+                ALOGI("Suspending the stream until the next window.");
+                stream_app_suspend(state_.stream_app);
+                my_connection_suspend(state_.connection);
+                state_.egl_data->destroySurface();
+                state_.suspended = true;
+                break;
+            }
 
-            ALOGD("Reset renderer and EGL data.");
-            state_.renderer.reset();
-            state_.egl_data.reset();
+            stop_session();
         } break;
         case APP_CMD_WINDOW_RESIZED:
         case APP_CMD_CONFIG_CHANGED: {
             ALOGD("APP_CMD_CONFIG_CHANGED");
             state_.window_width = ANativeWindow_getWidth(app->window);
             state_.window_height = ANativeWindow_getHeight(app->window);
-            ALOGD("Native window size %d %d", state_.window_width, state_.window_height);
+            ALOGD("Native window size %d %d", state_.window_width.load(), state_.window_height.load());
         } break;
         default:
             break;
@@ -140,21 +279,25 @@ void onAppCmd(struct android_app *app, int32_t cmd) {
  * Poll for Android events, and handle them
  *
  * @param state app state
+ * @param active_timeout How long to block while the window is up, 0 to only drain pending events
  *
  * @return true if we should go to the render code
  */
-bool poll_events(struct android_app *app) {
+bool poll_events(struct android_app *app, int active_timeout) {
     // Poll Android events
     for (;;) {
         int events;
         struct android_poll_source *source;
         bool wait = !app->window || app->activityState != APP_CMD_RESUME;
-        int timeout = wait ? -1 : 0;
+        int timeout = wait ? -1 : active_timeout;
         if (ALooper_pollAll(timeout, NULL, &events, (void **)&source) >= 0) {
             if (source) {
                 source->process(app, source);
             }
 
+            // Got woken up, drain whatever else is pending without blocking again.
+            active_timeout = 0;
+
             if (timeout == 0 && (!app->window || app->activityState != APP_CMD_RESUME)) {
                 break;
             }
@@ -203,6 +346,9 @@ std::string retrieve_data_string(JNIEnv *env, jobject intentObject, jmethodID ge
 }
 
 void android_main(struct android_app *app) {
+    my_startup_profile_begin();
+    start_init(app->activity->vm, app->activity->internalDataPath);
+
     JNIEnv *env = nullptr;
     (*app->activity->vm).AttachCurrentThread(&env, NULL);
 
@@ -225,6 +371,7 @@ void android_main(struct android_app *app) {
             __android_log_print(ANDROID_LOG_ERROR, "NATIVE_LOG", "Failed to find getIntent() method.");
             // Detach and return or handle error
             app->activity->vm->DetachCurrentThread();
+            wait_for_init();
             return;
         }
 
@@ -243,6 +390,63 @@ void android_main(struct android_app *app) {
         state_.framerate = std::stoi(retrieve_data_string(env, intentObject, getStringExtraMethod, "framerate"));
         state_.bitrate = std::stoi(retrieve_data_string(env, intentObject, getStringExtraMethod, "bitrate"));
         state_.pin = retrieve_data_string(env, intentObject, getStringExtraMethod, "pin");
+        state_.frame_pacing =
+            pacing_policy_from_string(retrieve_data_string(env, intentObject, getStringExtraMethod, "frame_pacing"));
+        state_.decode_path =
+            retrieve_data_string(env, intentObject, getStringExtraMethod, "decode_path") == "hardware_buffer"
+                ? MY_DECODE_PATH_HARDWARE_BUFFER
+                : MY_DECODE_PATH_GL;
+        state_.fec_percentage =
+            std::stoi(retrieve_data_string(env, intentObject, getStringExtraMethod, "fec_percentage"));
+        state_.jitter_preset = my_jitter_preset_from_string(
+            retrieve_data_string(env, intentObject, getStringExtraMethod, "jitter_preset").c_str());
+        state_.jitter_floor_ms =
+            std::stoi(retrieve_data_string(env, intentObject, getStringExtraMethod, "jitter_floor_ms"));
+        state_.jitter_ceiling_ms =
+            std::stoi(retrieve_data_string(env, intentObject, getStringExtraMethod, "jitter_ceiling_ms"));
+        state_.upscale = retrieve_data_string(env, intentObject, getStringExtraMethod, "upscaling") == "sharpen";
+        state_.front_buffer =
+            retrieve_data_string(env, intentObject, getStringExtraMethod, "present_mode") == "front_buffer";
+        state_.ten_bit = retrieve_data_string(env, intentObject, getStringExtraMethod, "ten_bit") == "true";
+        state_.session_resume =
+            retrieve_data_string(env, intentObject, getStringExtraMethod, "session_resume") != "false";
+        // Optional, a single display unless asked for more.
+        state_.display_count = std::clamp(
+            (int)std::strtol(
+                retrieve_data_string(env, intentObject, getStringExtraMethod, "display_count").c_str(), nullptr, 10),
+            1,
+            MY_MAX_DISPLAYS);
+        state_.transport = retrieve_data_string(env, intentObject, getStringExtraMethod, "transport") == "webrtc"
+                               ? MY_TRANSPORT_WEBRTC
+                               : MY_TRANSPORT_RTP;
+        state_.stun_server = retrieve_data_string(env, intentObject, getStringExtraMethod, "stun_server");
+        if (state_.stun_server.empty()) {
+            state_.stun_server = DEFAULT_STUN_SERVER;
+        }
+
+        // Only benchmark runs pass a capture, e.g. `am start ... --es replay_capture /sdcard/Download/session.pcap`.
+        const std::string replay_capture =
+            retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_capture");
+        if (!replay_capture.empty()) {
+            replay_capture.copy(state_.replay.capture_path, sizeof(state_.replay.capture_path) - 1);
+            state_.replay.speed =
+                parse_float(retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_speed"), 1.0f);
+            state_.replay.loss_percent =
+                parse_float(retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_loss"), 0.0f);
+            state_.replay.jitter_ms =
+                parse_float(retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_jitter_ms"), 0.0f);
+            state_.replay.reorder_percent =
+                parse_float(retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_reorder"), 0.0f);
+            state_.replay.seed = (uint32_t)std::strtoul(
+                retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_seed").c_str(), nullptr, 10);
+            const std::string codec = retrieve_data_string(env, intentObject, getStringExtraMethod, "replay_codec");
+            if (!my_video_codec_from_name(codec.c_str(), &state_.replay_codec)) {
+                state_.replay_codec = MY_VIDEO_CODEC_H264;
+            }
+            ALOGI("Benchmark run, replaying %s as %s",
+                  state_.replay.capture_path,
+                  my_video_codec_get_desc(state_.replay_codec)->name);
+        }
 
         ALOGI(
             "Got intent strings from native: host_ip: %s video_quality: %s framerate: %d bitrate: %d "
@@ -257,90 +461,36 @@ void android_main(struct android_app *app) {
         env->DeleteLocalRef(intentObject);
     }
 
-    ALOGD("Initialize GStreamer.");
-    gst_init(NULL, NULL);
-
-    // Set up gst logger
-    gst_debug_set_default_threshold(GST_LEVEL_WARNING);
-
     ALOGD("Starting main loop");
 
     bool server_close_notified = false;
 
-    // Main rendering loop.
+    // Event loop, frames are presented on the render thread.
     while (!app->destroyRequested) {
-        if (!poll_events(app)) {
+        if (!poll_events(app, SERVER_CLOSED_POLL_MS)) {
             break;
         }
 
-        if (!state_.egl_data || !state_.renderer || !state_.stream_app) {
-            continue;
-        }
-
         // Exit the native activity upon connection loss.
-        if (my_connection_server_closed(state_.connection)) {
-            if (!server_close_notified) {
-                ALOGI("Server closed, call ANativeActivity_finish.");
-                ANativeActivity_finish(app->activity);
-                server_close_notified = true;
-            }
-            continue;
+        // A suspended stream reconnects once the window is back.
+        if (state_.connection != nullptr && !state_.suspended && my_connection_server_closed(state_.connection) &&
+            !server_close_notified) {
+            ALOGI("Server closed, call ANativeActivity_finish.");
+            ANativeActivity_finish(app->activity);
+            server_close_notified = true;
         }
+    }
 
-        state_.egl_data->makeCurrent();
-
-        struct timespec decodeEndTime{};
-        struct MySample *sample = stream_app_try_pull_sample(state_.stream_app, &decodeEndTime);
-
-        uint32_t video_width = stream_app_get_video_width(state_.stream_app);
-        uint32_t video_height = stream_app_get_video_height(state_.stream_app);
-
-        if (sample == nullptr || video_width * video_height == 0) {
-            if (prev_sample) {
-                // Reuse previous sample.
-                // sample = prev_sample;
-            }
-            continue;
-        }
-
-        float video_aspect = (float)video_width / (float)video_height;
-        float window_aspect = (float)state_.window_width / (float)state_.window_height;
-
-        // Align height
-        if (window_aspect > video_aspect) {
-            state_.render_height = state_.window_height;
-            state_.render_width = state_.render_height * video_aspect;
-        }
-        // Align width
-        else {
-            state_.render_width = state_.window_width;
-            state_.render_height = (float)state_.render_width / video_aspect;
-        }
-
-        state_.h_margin = (state_.window_width - state_.render_width) / 2;
-        state_.v_margin = (state_.window_height - state_.render_height) / 2;
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glViewport(state_.h_margin, state_.v_margin, state_.render_width, state_.render_height);
-
-        state_.renderer->draw(sample->frame_texture_id, sample->frame_texture_target);
-
-        eglSwapBuffers(state_.egl_data->display, state_.egl_data->surface);
-
-        // Release the previous sample
-        if (prev_sample != NULL) {
-            stream_app_release_sample(state_.stream_app, prev_sample);
-        }
-        prev_sample = sample;
+    ALOGI("Exited main loop, cleaning up");
 
-        state_.egl_data->makeNotCurrent();
+    // Left over if the activity finished while in the background.
+    if (state_.suspended) {
+        stop_session();
     }
+    wait_for_init();
 
-    ALOGI("Exited main loop, cleaning up");
+    my_decoder_catalog_destroy(state_.decoder_catalog);
+    state_.decoder_catalog = nullptr;
 
     //
     // Clean up
@@ -0,0 +1,376 @@
+#include "render_thread.hpp"
+
+#include <GLES3/gl3.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "state.h"
+#include "stream/sample.h"
+#include "stream/startup_profile.h"
+
+/// Stops below full sharpening, FSR's default.
+static constexpr float UPSCALE_SHARPNESS_STOPS = 0.2f;
+
+/// Network counters change slowly, and reading them looks up the FEC decoder.
+static constexpr int64_t HUD_STATS_INTERVAL_NS = 250 * 1000 * 1000;
+
+/// Letterbox a video into a cell of the window, the cell starting at h_offset.
+static VideoLayout fitVideo(
+    uint32_t video_width, uint32_t video_height, int32_t h_offset, int32_t cell_width, int32_t cell_height) {
+    float video_aspect = (float)video_width / (float)video_height;
+    float cell_aspect = (float)cell_width / (float)cell_height;
+
+    int32_t render_width;
+    int32_t render_height;
+    // Align height
+    if (cell_aspect > video_aspect) {
+        render_height = cell_height;
+        render_width = render_height * video_aspect;
+    }
+    // Align width
+    else {
+        render_width = cell_width;
+        render_height = (float)render_width / video_aspect;
+    }
+
+    return {h_offset + (cell_width - render_width) / 2, (cell_height - render_height) / 2, render_width, render_height};
+}
+
+RenderThread::RenderThread(MyState &state, EglData &egl_data, MyStreamApp *stream_app, PacingPolicy pacing)
+    : state_(state), egl_data_(egl_data), stream_app_(stream_app), pacing_(pacing) {
+    os_thread_helper_init(&thread_);
+
+    // Asks for SCHED_FIFO in case the device permits it, apps usually end up on the nice value.
+    os_thread_params params{};
+    params.name = "render";
+    params.nice = OS_THREAD_PRIORITY_URGENT_DISPLAY;
+    params.fifo_priority = 2;
+    params.cpus = OS_THREAD_CPUS_BIG;
+    if (os_thread_helper_start_with_params(&thread_, &RenderThread::threadFunc, this, &params) != 0) {
+        ALOGE("%s: failed to start the render thread", __FUNCTION__);
+        abort();
+    }
+
+    // The looper only exists once the thread runs, and frames must not be signalled before that.
+    pthread_mutex_lock(&thread_.mutex);
+    while (looper_ == nullptr) {
+        pthread_cond_wait(&thread_.cond, &thread_.mutex);
+    }
+    ALooper *looper = looper_;
+    pthread_mutex_unlock(&thread_.mutex);
+
+    // Wake the render loop up as soon as a frame is decoded.
+    stream_app_set_new_sample_callback(
+        stream_app_, [](void *looper) { ALooper_wake((ALooper *)looper); }, looper);
+}
+
+void RenderThread::stop() {
+    pthread_mutex_lock(&thread_.mutex);
+    const bool was_running = thread_.running;
+    thread_.running = false;
+    pthread_mutex_unlock(&thread_.mutex);
+
+    if (was_running) {
+        ALooper_wake(looper_);
+        pthread_join(thread_.thread, nullptr);
+    }
+}
+
+RenderThread::~RenderThread() {
+    stop();
+    // Outlives the thread, a late new-sample callback may still wake it.
+    ALooper_release(looper_);
+}
+
+void *RenderThread::threadFunc(void *ptr) {
+    static_cast<RenderThread *>(ptr)->run();
+    return nullptr;
+}
+
+bool RenderThread::running() {
+    pthread_mutex_lock(&thread_.mutex);
+    const bool running = thread_.running;
+    pthread_mutex_unlock(&thread_.mutex);
+    return running;
+}
+
+void RenderThread::run() {
+    ALooper *looper = ALooper_prepare(0);
+    ALooper_acquire(looper);
+
+    pthread_mutex_lock(&thread_.mutex);
+    looper_ = looper;
+    pthread_cond_broadcast(&thread_.cond);
+    pthread_mutex_unlock(&thread_.mutex);
+
+    egl_data_.makeCurrent();
+
+    try {
+        ALOGD("%s: Setup renderer...", __FUNCTION__);
+        renderer_ = std::make_unique<Renderer>();
+        renderer_->setupRender();
+        if (state_.upscale) {
+            renderer_->setupUpscaling(UPSCALE_SHARPNESS_STOPS);
+        }
+    } catch (std::exception const &e) {
+        ALOGE("%s: Caught exception setting up renderer: %s", __FUNCTION__, e.what());
+        abort();
+    }
+
+    // Needs the looper of this thread for its vsync callbacks.
+    frame_pacer_ = std::make_unique<FramePacer>(stream_app_, egl_data_.display, egl_data_.surface, pacing_);
+
+    // Lets the system raise clocks before a frame runs late, rather than after.
+    const int32_t tid = gettid();
+    perf_hint_ = os_perf_hint_session_create(&tid, 1, frameIntervalNs());
+
+    while (running()) {
+        // Vsync callbacks and decoded frames wake the looper, so there is no need to spin.
+        ALooper_pollOnce(frame_pacer_->pollTimeoutMs(), nullptr, nullptr, nullptr);
+        renderFrame();
+    }
+
+    // Samples point into the stream app, hand them back before it goes away.
+    frame_pacer_.reset();
+    if (prev_sample_ != nullptr) {
+        stream_app_release_sample(stream_app_, prev_sample_);
+        prev_sample_ = nullptr;
+    }
+    for (int i = 0; i < MY_MAX_DISPLAYS; i++) {
+        releaseDisplaySamples(i);
+    }
+    // The stream app outlives this thread, and gets finalized with no context current.
+    stream_app_release_gl_resources(stream_app_);
+    renderer_.reset();
+
+    os_perf_hint_session_destroy(perf_hint_);
+    perf_hint_ = nullptr;
+
+    egl_data_.makeNotCurrent();
+}
+
+int64_t RenderThread::frameIntervalNs() const {
+    return 1000000000LL / std::max<uint32_t>(state_.framerate, 1);
+}
+
+void RenderThread::renderFrame() {
+    const int64_t work_start_ns = my_telemetry_now_ns();
+
+    struct MySample *sample = frame_pacer_->acquireFrame();
+    if (sample == nullptr) {
+        return;
+    }
+
+    // The size of this very frame, so a resolution change takes effect exactly with its first frame.
+    const uint32_t video_width = sample->width;
+    const uint32_t video_height = sample->height;
+    if (video_width * video_height == 0) {
+        stream_app_release_sample(stream_app_, sample);
+        return;
+    }
+
+    const int32_t window_width = state_.window_width;
+    const int32_t window_height = state_.window_height;
+
+    // Host monitors get a cell each, side by side, the primary one first.
+    const int display_count = stream_app_get_display_count(stream_app_);
+    const int32_t cell_width = window_width / display_count;
+
+    const VideoLayout layout = fitVideo(video_width, video_height, 0, cell_width, window_height);
+    const int32_t render_width = layout.render_width;
+    const int32_t render_height = layout.render_height;
+    if (layout.h_margin != layout_.h_margin || layout.v_margin != layout_.v_margin ||
+        layout.render_width != layout_.render_width || layout.render_height != layout_.render_height) {
+        // Input maps touches through this, on the looper thread.
+        std::lock_guard<std::mutex> lock(state_.layout_mutex);
+        state_.layout = layout;
+        layout_ = layout;
+    }
+
+    // Either way the driver doesn't load the last frame into the tiles, only letterbox bars need the clear.
+    if (render_width == window_width && render_height == window_height) {
+        renderer_->discard();
+    } else {
+        renderer_->clear();
+    }
+
+    drawDisplays(display_count, cell_width, window_height);
+    // Last, so the cursor below is drawn into its viewport.
+    drawVideo(sample, layout);
+    stream_app_mark_sample(stream_app_, sample, MY_LATENCY_STAGE_DRAW);
+
+    drawPredictedCursor(sample);
+    drawHud();
+
+    frame_pacer_->beforeSwap();
+    eglSwapBuffers(egl_data_.display, egl_data_.surface);
+    const int64_t swap_ns = my_telemetry_now_ns();
+    stream_app_mark_sample(stream_app_, sample, MY_LATENCY_STAGE_SWAP);
+    updateHud(sample, swap_ns);
+    my_startup_profile_mark(MY_STARTUP_PHASE_FIRST_PRESENTED);
+
+    // Only frames that got drawn count as work, idle wakeups would drag the estimate down.
+    os_perf_hint_session_report(perf_hint_, my_telemetry_now_ns() - work_start_ns);
+
+    // Release the previous sample
+    if (prev_sample_ != nullptr) {
+        stream_app_release_sample(stream_app_, prev_sample_);
+    }
+    prev_sample_ = sample;
+}
+
+/// The further host monitors show their latest frame, they are paced along with the primary one.
+void RenderThread::drawDisplays(int display_count, int32_t cell_width, int32_t cell_height) {
+    for (int i = 1; i < MY_MAX_DISPLAYS; i++) {
+        if (i >= display_count) {
+            // Left over from a session with more of them.
+            releaseDisplaySamples(i);
+            continue;
+        }
+
+        struct timespec decode_end;
+        struct MySample *next = stream_app_try_pull_display_sample(stream_app_, i, &decode_end);
+        if (next != nullptr) {
+            // Kept for another frame, like prev_sample_, the GPU may still read it.
+            if (display_prev_samples_[i] != nullptr) {
+                stream_app_release_sample(stream_app_, display_prev_samples_[i]);
+            }
+            display_prev_samples_[i] = display_samples_[i];
+            display_samples_[i] = next;
+        }
+
+        struct MySample *sample = display_samples_[i];
+        if (sample == nullptr || sample->width * sample->height == 0) {
+            continue;
+        }
+        drawVideo(sample, fitVideo(sample->width, sample->height, i * cell_width, cell_width, cell_height));
+    }
+}
+
+void RenderThread::releaseDisplaySamples(int index) {
+    if (display_samples_[index] != nullptr) {
+        stream_app_release_sample(stream_app_, display_samples_[index]);
+        display_samples_[index] = nullptr;
+    }
+    if (display_prev_samples_[index] != nullptr) {
+        stream_app_release_sample(stream_app_, display_prev_samples_[index]);
+        display_prev_samples_[index] = nullptr;
+    }
+}
+
+void RenderThread::drawVideo(struct MySample *sample, const VideoLayout &layout) {
+    // Only worth the extra pass where the window has more pixels than the stream.
+    if (renderer_->hasUpscaling() &&
+        (layout.render_width > (int32_t)sample->width || layout.render_height > (int32_t)sample->height)) {
+        const GLint viewport[4] = {layout.h_margin, layout.v_margin, layout.render_width, layout.render_height};
+        renderer_->drawUpscaled(sample->frame_texture_id,
+                                sample->frame_texture_target,
+                                sample->uv_scale_x,
+                                sample->uv_scale_y,
+                                (int32_t)sample->width,
+                                (int32_t)sample->height,
+                                viewport);
+    } else {
+        renderer_->setViewport(layout.h_margin, layout.v_margin, layout.render_width, layout.render_height);
+        renderer_->draw(
+            sample->frame_texture_id, sample->frame_texture_target, sample->uv_scale_x, sample->uv_scale_y);
+    }
+}
+
+void RenderThread::drawHud() {
+    if (!hud_shown_) {
+        return;
+    }
+    const int32_t window_width = state_.window_width;
+    const int32_t window_height = state_.window_height;
+
+    // Covers the letterbox bars as well.
+    renderer_->setViewport(0, 0, window_width, window_height);
+    renderer_->drawHud(hud_.build(window_width, window_height), window_width, window_height);
+}
+
+void RenderThread::updateHud(struct MySample *sample, int64_t swap_ns) {
+    if (!state_.hud_visible.load(std::memory_order_relaxed)) {
+        hud_shown_ = false;
+        return;
+    }
+    if (!hud_shown_) {
+        // Start over, the graphs would show the gap since it was last hidden.
+        hud_.clear();
+        hud_shown_ = true;
+        hud_last_swap_ns_ = 0;
+        hud_stats_ns_ = 0;
+    }
+
+    if (hud_last_swap_ns_ != 0) {
+        hud_.push(HudMetric::FrameTime, (float)(swap_ns - hud_last_swap_ns_) / 1e6f);
+    }
+    hud_last_swap_ns_ = swap_ns;
+
+    int64_t decoded_ns;
+    if (stream_app_get_sample_stage_time(stream_app_, sample, MY_LATENCY_STAGE_DECODED, &decoded_ns)) {
+        hud_.push(HudMetric::DecodeToPresent, (float)(swap_ns - decoded_ns) / 1e6f);
+    }
+
+    if (swap_ns - hud_stats_ns_ < HUD_STATS_INTERVAL_NS) {
+        return;
+    }
+    struct my_stream_stats stats;
+    stream_app_get_stream_stats(stream_app_, &stats);
+    if (hud_stats_ns_ != 0) {
+        const float seconds = (float)(swap_ns - hud_stats_ns_) / 1e9f;
+        const uint64_t received = stats.video_packets_received - hud_stats_.video_packets_received;
+        const uint64_t lost = stats.video_packets_lost - hud_stats_.video_packets_lost;
+        // A new pipeline brings a new FEC decoder, counting from zero.
+        const uint32_t recovered = stats.fec_recovered >= hud_stats_.fec_recovered
+                                       ? stats.fec_recovered - hud_stats_.fec_recovered
+                                       : stats.fec_recovered;
+
+        hud_.push(HudMetric::Bitrate,
+                  (float)(stats.video_bytes_received - hud_stats_.video_bytes_received) * 8.0f / 1e6f / seconds);
+        hud_.push(HudMetric::PacketLoss, received + lost > 0 ? 100.0f * (float)lost / (float)(received + lost) : 0.0f);
+        hud_.push(HudMetric::FecRecovered, (float)recovered / seconds);
+        hud_.push(HudMetric::JitterBuffer, (float)stats.jitterbuffer_latency_ms);
+    }
+    hud_stats_ = stats;
+    hud_stats_ns_ = swap_ns;
+}
+
+/// Draw the local cursor until the video shows the server cursor at the same spot.
+void RenderThread::drawPredictedCursor(struct MySample *sample) {
+    int64_t capture_ns;
+    uint32_t acked_sequence;
+    int64_t acked_time_ns;
+    const bool confirmed = stream_app_get_sample_capture_time(stream_app_, sample, &capture_ns) &&
+                           my_connection_get_input_ack(state_.connection, &acked_sequence, &acked_time_ns);
+
+    // The frame shows up on the next vsync.
+    const int64_t display_time_ns = my_telemetry_now_ns() + frameIntervalNs();
+
+    float x, y;
+    {
+        std::lock_guard<std::mutex> lock(state_.cursor_mutex);
+        if (confirmed) {
+            my_cursor_predictor_confirm(&state_.cursor_predictor, capture_ns, acked_sequence, acked_time_ns);
+        }
+        if (!my_cursor_predictor_get_position(&state_.cursor_predictor, display_time_ns, &x, &y)) {
+            return;
+        }
+    }
+
+    // Positions are in pixels of the negotiated resolution, like all input.
+    const float stream_width = (float)state_.stream_width;
+    const float stream_height = (float)state_.stream_height;
+
+    // About the size of a fingertip, in pixels of the viewport.
+    constexpr float cursor_radius_px = 24.0f;
+    renderer_->drawCursor(x / stream_width * 2.0f - 1.0f,
+                          1.0f - y / stream_height * 2.0f,
+                          2.0f * cursor_radius_px / (float)layout_.render_width,
+                          2.0f * cursor_radius_px / (float)layout_.render_height);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <android/looper.h>
+
+#include <memory>
+
+#include "egl_data.hpp"
+#include "frame_pacer.hpp"
+#include "input_capture.hpp"
+#include "stream/render/render.hpp"
+#include "stream/stream_app.h"
+#include "stream/thread.h"
+
+struct MyState;
+
+/**
+ * Presents decoded frames on a thread of its own.
+ *
+ * The android_main thread only handles lifecycle and input events, so neither can hold up eglSwapBuffers anymore. The
+ * render thread prepares its own looper, which gets the choreographer vsync callbacks and the new-sample wakeups, and
+ * is the only thread with the EGL context current while it runs.
+ */
+class RenderThread {
+public:
+    /**
+     * Start presenting frames from the stream app.
+     *
+     * The EGL context must not be current on the calling thread. Registers the new-sample callback, so create it
+     * before spawning the stream app thread.
+     */
+    RenderThread(MyState &state, EglData &egl_data, MyStreamApp *stream_app, PacingPolicy pacing);
+
+    /**
+     * Stop the thread, which hands back all samples and frees its GL resources first.
+     *
+     * The stream app may still signal new samples afterwards, so keep the object around until the stream app stopped.
+     */
+    void stop();
+
+    /// Stops the thread if still running.
+    ~RenderThread();
+
+    RenderThread(const RenderThread &) = delete;
+    RenderThread &operator=(const RenderThread &) = delete;
+
+private:
+    static void *threadFunc(void *ptr);
+    void run();
+    bool running();
+    int64_t frameIntervalNs() const;
+    void renderFrame();
+    void drawDisplays(int display_count, int32_t cell_width, int32_t cell_height);
+    void releaseDisplaySamples(int index);
+    void drawVideo(struct MySample *sample, const VideoLayout &layout);
+    void drawPredictedCursor(struct MySample *sample);
+    void drawHud();
+    void updateHud(struct MySample *sample, int64_t swap_ns);
+
+    MyState &state_;
+    EglData &egl_data_;
+    MyStreamApp *stream_app_;
+    PacingPolicy pacing_;
+
+    struct os_thread_helper thread_ {};
+    /// Set by the render thread once it is up, guarded by the helper's mutex.
+    ALooper *looper_ = nullptr;
+
+    // Only touched on the render thread.
+    std::unique_ptr<Renderer> renderer_;
+    std::unique_ptr<FramePacer> frame_pacer_;
+    struct MySample *prev_sample_ = nullptr;
+    /// Latest and previous frame of each further host monitor, index 0 is the primary one and stays unused.
+    struct MySample *display_samples_[MY_MAX_DISPLAYS] = {};
+    struct MySample *display_prev_samples_[MY_MAX_DISPLAYS] = {};
+    /// NULL where performance hints aren't supported.
+    struct os_perf_hint_session *perf_hint_ = nullptr;
+    /// Last one published to the state.
+    VideoLayout layout_{};
+
+    // Performance overlay, only sampled while shown.
+    Hud hud_;
+    bool hud_shown_ = false;
+    int64_t hud_last_swap_ns_ = 0;
+    int64_t hud_stats_ns_ = 0;
+    struct my_stream_stats hud_stats_ {};
+};
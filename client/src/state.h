@@ -1,23 +1,31 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <optional>
 #include <string>
 
 #include "egl_data.hpp"
+#include "frame_pacer.hpp"
+#include "input_capture.hpp"
+#include "render_thread.hpp"
 #include "stream/connection.h"
-#include "stream/render/render.hpp"
+#include "stream/cursor_predictor.h"
 #include "stream/stream_app.h"
 
 struct MyState {
-    // Window size.
-    int32_t window_width;
-    int32_t window_height;
-    // Video size.
-    int32_t render_width;
-    int32_t render_height;
+    // Window size, written by the looper thread.
+    std::atomic<int32_t> window_width;
+    std::atomic<int32_t> window_height;
 
-    int32_t h_margin;
-    int32_t v_margin;
+    /// Where the video sits in the window, written by the render thread when the window or the frame size changes.
+    std::mutex layout_mutex;
+    VideoLayout layout{};
+
+    /// Resolution the stream was negotiated with. Input positions stay in its pixels when the stream drops to a
+    /// lower one, the server maps them with it too.
+    uint32_t stream_width;
+    uint32_t stream_height;
 
     bool pressed;
     float press_pos_x;
@@ -32,23 +40,64 @@ struct MyState {
 
     std::optional<int64_t> press_time;
 
+    InputCapture input_capture;
+
+    /// Local cursor shown ahead of the video, fed by input and drawn by the render thread.
+    std::mutex cursor_mutex;
+    struct my_cursor_predictor cursor_predictor;
+
     int64_t last_time_cursor_down;
     float last_cursor_down_pos_x;
     float last_cursor_down_pos_y;
 
     MyConnection *connection;
     MyStreamApp *stream_app;
+    struct my_decoder_catalog *decoder_catalog;
 
     std::string host_ip;
     std::string video_quality;
     uint32_t framerate;
     uint32_t bitrate;
     std::string pin;
-
-    std::unique_ptr<Renderer> renderer;
+    PacingPolicy frame_pacing;
+    enum my_decode_path decode_path;
+    /// ULPFEC overhead to request from the server, 0 disables FEC.
+    int fec_percentage;
+    /// Jitterbuffer latency preset and user bounds in ms, 0 keeps the preset's.
+    enum my_jitter_preset jitter_preset;
+    int jitter_floor_ms;
+    int jitter_ceiling_ms;
+    /// Upscale and sharpen streams smaller than the window, instead of plain bilinear filtering.
+    bool upscale;
+    /// Opt-in single buffered presentation, see EglSurfaceOptions.
+    bool front_buffer;
+    /// Ask for a 10 bit stream, only honoured on the hardware buffer path.
+    bool ten_bit;
+    /// Keep the stream paused while the window is gone, instead of tearing it down.
+    bool session_resume;
+    /// Host monitors to stream side by side, the server may offer fewer.
+    int display_count;
+    /// RTP to fixed ports on the LAN, or WebRTC for anything NAT sits in front of.
+    enum my_transport transport;
+    /// STUN server for WebRTC, as a stun:// URI.
+    std::string stun_server;
+    /// Stream app and connection outlive the window, waiting for the next one.
+    bool suspended;
+    /// Benchmark run: play this capture into the pipeline instead of connecting, when its path is set.
+    struct my_rtp_replay_config replay;
+    /// Codec of the replayed capture, there is no server to tell us.
+    enum my_video_codec replay_codec;
 
     std::unique_ptr<EglData> egl_data;
 
+    std::unique_ptr<RenderThread> render_thread;
+
+    /// Performance overlay, toggled by the looper thread and read by the render thread.
+    std::atomic<bool> hud_visible{false};
+    // Stick buttons currently held, for the overlay combo.
+    bool hud_combo_left = false;
+    bool hud_combo_right = false;
+
     pthread_t listener_tid;
 
     float prev_lt = 0;
@@ -0,0 +1,423 @@
+#include "audio_player.h"
+
+#include <aaudio/AAudio.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/logger.h"
+
+/// Ring buffer size, a power of two. Far more than the target ever is, a stalled device just fills it.
+#define RING_FRAMES 16384
+#define RING_MASK (RING_FRAMES - 1)
+
+/// Cubic interpolation reads one frame behind the read position and two ahead.
+#define HISTORY_FRAMES 1
+#define LOOKAHEAD_FRAMES 2
+
+/// What we start with, the openslessink buffer time we used before.
+#define INITIAL_TARGET_MS 20.0f
+#define MIN_TARGET_MS 5.0f
+#define MAX_TARGET_MS 150.0f
+
+/// Fill swings through this window tell how much the buffer needs to ride out bursts.
+#define BURST_WINDOW_S 2.0f
+/// Headroom on top of half the swing, for callback timing.
+#define BURST_SAFETY_MS 3.0f
+/// Part of the excess over what the last window needed that gets dropped per window.
+#define DECREASE_FRACTION 0.25f
+/// An underrun raises the target by this factor right away.
+#define UNDERRUN_INCREASE_FACTOR 1.5f
+
+/// Smoothing of the fill level, long enough to average out the packet sawtooth.
+#define FILL_TIME_CONSTANT_S 0.2f
+/// Drift controller gains: speed change per ms of error, and its integral, which settles on the clock drift.
+#define KP_PER_MS 1e-4f
+#define KI_PER_MS_S 2e-5f
+/// Clock drift is tens of ppm, anything up to 0.5% speed change goes unnoticed.
+#define MAX_DRIFT 0.002f
+#define MAX_CORRECTION 0.005f
+/// Past this much excess, skip ahead rather than taking a minute to play it down.
+#define MAX_EXCESS_MS 60.0f
+
+/// How often the push thread refreshes the output latency.
+#define LATENCY_INTERVAL_NS (500 * 1000 * 1000)
+
+/// Only touched by the AAudio callback.
+struct playout {
+    uint64_t read_pos;
+    /// Position between read_pos and the next frame.
+    double phase;
+    double ratio;
+    /// Filling up to the target before playing, after the start or an underrun.
+    bool buffering;
+
+    float filtered_ms;
+    float integral;
+    /// Target from the burstiness, before the video delay is taken into account.
+    float needed_ms;
+
+    float window_min_ms;
+    float window_max_ms;
+    float window_elapsed_s;
+};
+
+struct my_audio_player {
+    /// Guards opening, closing and pausing the stream, never taken by the callback.
+    pthread_mutex_t stream_mutex;
+    AAudioStream *stream;
+    bool paused;
+    /// Set by the error callback, the push thread opens a new stream.
+    _Atomic bool disconnected;
+
+    float ring[RING_FRAMES * MY_AUDIO_CHANNELS];
+    /// Frames ever written and read, only the low bits index the ring.
+    _Atomic uint64_t write_pos;
+    _Atomic uint64_t read_pos;
+    _Atomic bool flush_requested;
+
+    struct playout playout;
+
+    /// Written by the main loop, in microseconds.
+    _Atomic int32_t video_delay_us;
+    /// Written by the push thread, in microseconds.
+    _Atomic int32_t output_latency_us;
+    int64_t latency_checked_ns;
+
+    // Written by the callback, for the stats.
+    _Atomic int32_t buffered_us;
+    _Atomic int32_t target_us;
+    _Atomic int32_t correction_ppm;
+    _Atomic uint32_t underruns;
+    _Atomic uint32_t skips;
+    _Atomic bool exclusive;
+};
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static float clampf(float value, float lo, float hi) {
+    return value < lo ? lo : (value > hi ? hi : value);
+}
+
+static float frames_to_ms(double frames) {
+    return (float)(frames * 1000.0 / MY_AUDIO_SAMPLE_RATE);
+}
+
+/// Catmull-Rom spline through p1 and p2, at t in [0, 1).
+static float interpolate(float p0, float p1, float p2, float p3, float t) {
+    return p1 + 0.5f * t * (p2 - p0 + t * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3 + t * (3.0f * (p1 - p2) + p3 - p0)));
+}
+
+static void reset_window(struct playout *p) {
+    p->window_min_ms = INFINITY;
+    p->window_max_ms = 0.0f;
+    p->window_elapsed_s = 0.0f;
+}
+
+/// Adjust the target to the burstiness seen over the last window.
+static void update_needed(struct playout *p, float fill_ms, float dt_s) {
+    p->window_min_ms = fminf(p->window_min_ms, fill_ms);
+    p->window_max_ms = fmaxf(p->window_max_ms, fill_ms);
+    p->window_elapsed_s += dt_s;
+    if (p->window_elapsed_s < BURST_WINDOW_S) {
+        return;
+    }
+
+    // With the average on the target, the fill dips half the swing below it.
+    const float needed = 0.5f * (p->window_max_ms - p->window_min_ms) + BURST_SAFETY_MS;
+    if (needed > p->needed_ms) {
+        p->needed_ms = needed;
+    } else {
+        p->needed_ms -= (p->needed_ms - needed) * DECREASE_FRACTION;
+    }
+    p->needed_ms = clampf(p->needed_ms, MIN_TARGET_MS, MAX_TARGET_MS);
+    reset_window(p);
+}
+
+/// Drift control, once per callback before playing its frames.
+static void update_ratio(struct my_audio_player *player, uint64_t write_pos, int32_t num_frames) {
+    struct playout *p = &player->playout;
+    const float dt_s = (float)num_frames / MY_AUDIO_SAMPLE_RATE;
+    float fill_ms = frames_to_ms((double)(write_pos - p->read_pos) - p->phase);
+
+    // Audio can't reach the speaker before the picture does, the device buffer counts towards that too.
+    const float follow_ms = (float)(atomic_load_explicit(&player->video_delay_us, memory_order_relaxed) -
+                                    atomic_load_explicit(&player->output_latency_us, memory_order_relaxed)) /
+                            1000.0f;
+    const float target_ms = clampf(fmaxf(p->needed_ms, follow_ms), MIN_TARGET_MS, MAX_TARGET_MS);
+    atomic_store_explicit(&player->target_us, (int32_t)(target_ms * 1000.0f), memory_order_relaxed);
+
+    if (p->buffering) {
+        if (fill_ms < target_ms) {
+            return;
+        }
+        p->buffering = false;
+        p->filtered_ms = fill_ms;
+        reset_window(p);
+    }
+
+    if (fill_ms > target_ms + MAX_EXCESS_MS) {
+        const uint64_t skip = (uint64_t)((fill_ms - target_ms) * MY_AUDIO_SAMPLE_RATE / 1000.0f);
+        p->read_pos += skip;
+        fill_ms = target_ms;
+        p->filtered_ms = target_ms;
+        atomic_fetch_add_explicit(&player->skips, 1, memory_order_relaxed);
+    }
+
+    update_needed(p, fill_ms, dt_s);
+
+    p->filtered_ms += (fill_ms - p->filtered_ms) * dt_s / (dt_s + FILL_TIME_CONSTANT_S);
+    const float error_ms = p->filtered_ms - target_ms;
+    p->integral = clampf(p->integral + KI_PER_MS_S * error_ms * dt_s, -MAX_DRIFT, MAX_DRIFT);
+    const float correction = clampf(KP_PER_MS * error_ms + p->integral, -MAX_CORRECTION, MAX_CORRECTION);
+    p->ratio = 1.0 + correction;
+
+    atomic_store_explicit(&player->buffered_us, (int32_t)(p->filtered_ms * 1000.0f), memory_order_relaxed);
+    atomic_store_explicit(&player->correction_ppm, (int32_t)(correction * 1e6f), memory_order_relaxed);
+}
+
+static aaudio_data_callback_result_t on_audio_data(AAudioStream *stream,
+                                                   void *user_data,
+                                                   void *audio_data,
+                                                   int32_t num_frames) {
+    (void)stream;
+    struct my_audio_player *player = (struct my_audio_player *)user_data;
+    struct playout *p = &player->playout;
+    float *out = (float *)audio_data;
+
+    const uint64_t write_pos = atomic_load_explicit(&player->write_pos, memory_order_acquire);
+    if (atomic_exchange_explicit(&player->flush_requested, false, memory_order_relaxed)) {
+        p->read_pos = write_pos;
+        p->phase = 0.0;
+        p->buffering = true;
+    }
+
+    update_ratio(player, write_pos, num_frames);
+
+    int32_t i = 0;
+    if (!p->buffering) {
+        for (; i < num_frames && p->read_pos + LOOKAHEAD_FRAMES < write_pos; i++) {
+            const float t = (float)p->phase;
+            const float *p0 = &player->ring[((p->read_pos - 1) & RING_MASK) * MY_AUDIO_CHANNELS];
+            const float *p1 = &player->ring[(p->read_pos & RING_MASK) * MY_AUDIO_CHANNELS];
+            const float *p2 = &player->ring[((p->read_pos + 1) & RING_MASK) * MY_AUDIO_CHANNELS];
+            const float *p3 = &player->ring[((p->read_pos + 2) & RING_MASK) * MY_AUDIO_CHANNELS];
+            for (int c = 0; c < MY_AUDIO_CHANNELS; c++) {
+                out[i * MY_AUDIO_CHANNELS + c] = interpolate(p0[c], p1[c], p2[c], p3[c], t);
+            }
+
+            p->phase += p->ratio;
+            const double whole = floor(p->phase);
+            p->read_pos += (uint64_t)whole;
+            p->phase -= whole;
+        }
+
+        if (i < num_frames) {
+            // Ran dry, give the buffer more room and refill it before playing on.
+            p->buffering = true;
+            p->needed_ms = clampf(p->needed_ms * UNDERRUN_INCREASE_FACTOR, MIN_TARGET_MS, MAX_TARGET_MS);
+            atomic_fetch_add_explicit(&player->underruns, 1, memory_order_relaxed);
+        }
+    }
+    memset(out + i * MY_AUDIO_CHANNELS, 0, (size_t)(num_frames - i) * MY_AUDIO_CHANNELS * sizeof(float));
+
+    atomic_store_explicit(&player->read_pos, p->read_pos, memory_order_release);
+    return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+static void on_audio_error(AAudioStream *stream, void *user_data, aaudio_result_t error) {
+    (void)stream;
+    struct my_audio_player *player = (struct my_audio_player *)user_data;
+    // Closing the stream from here isn't allowed, the push thread takes care of it.
+    ALOGW("%s: %s", __FUNCTION__, AAudio_convertResultToText(error));
+    if (error == AAUDIO_ERROR_DISCONNECTED) {
+        atomic_store(&player->disconnected, true);
+    }
+}
+
+/// With the stream mutex held.
+static bool open_stream(struct my_audio_player *player) {
+    AAudioStreamBuilder *builder = NULL;
+    aaudio_result_t result = AAudio_createStreamBuilder(&builder);
+    if (result != AAUDIO_OK) {
+        ALOGE("%s: AAudio_createStreamBuilder failed: %s", __FUNCTION__, AAudio_convertResultToText(result));
+        return false;
+    }
+
+    AAudioStreamBuilder_setDirection(builder, AAUDIO_DIRECTION_OUTPUT);
+    AAudioStreamBuilder_setPerformanceMode(builder, AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+    // MMAP straight into the device buffer, where the device has it. We get a shared stream otherwise.
+    AAudioStreamBuilder_setSharingMode(builder, AAUDIO_SHARING_MODE_EXCLUSIVE);
+    AAudioStreamBuilder_setFormat(builder, AAUDIO_FORMAT_PCM_FLOAT);
+    AAudioStreamBuilder_setSampleRate(builder, MY_AUDIO_SAMPLE_RATE);
+    AAudioStreamBuilder_setChannelCount(builder, MY_AUDIO_CHANNELS);
+    AAudioStreamBuilder_setDataCallback(builder, on_audio_data, player);
+    AAudioStreamBuilder_setErrorCallback(builder, on_audio_error, player);
+
+    result = AAudioStreamBuilder_openStream(builder, &player->stream);
+    AAudioStreamBuilder_delete(builder);
+    if (result != AAUDIO_OK) {
+        ALOGE("%s: AAudioStreamBuilder_openStream failed: %s", __FUNCTION__, AAudio_convertResultToText(result));
+        player->stream = NULL;
+        return false;
+    }
+
+    // Two bursts is as small as it gets without glitching, our own buffer rides out the network.
+    const int32_t burst = AAudioStream_getFramesPerBurst(player->stream);
+    AAudioStream_setBufferSizeInFrames(player->stream, burst * 2);
+
+    const bool exclusive = AAudioStream_getSharingMode(player->stream) == AAUDIO_SHARING_MODE_EXCLUSIVE;
+    atomic_store(&player->exclusive, exclusive);
+    ALOGI("%s: %s stream, %d Hz, bursts of %d frames, low latency: %s",
+          __FUNCTION__,
+          exclusive ? "exclusive" : "shared",
+          AAudioStream_getSampleRate(player->stream),
+          burst,
+          AAudioStream_getPerformanceMode(player->stream) == AAUDIO_PERFORMANCE_MODE_LOW_LATENCY ? "yes" : "no");
+
+    if (!player->paused) {
+        result = AAudioStream_requestStart(player->stream);
+        if (result != AAUDIO_OK) {
+            ALOGE("%s: AAudioStream_requestStart failed: %s", __FUNCTION__, AAudio_convertResultToText(result));
+        }
+    }
+    return true;
+}
+
+/// With the stream mutex held.
+static void close_stream(struct my_audio_player *player) {
+    if (player->stream != NULL) {
+        AAudioStream_requestStop(player->stream);
+        AAudioStream_close(player->stream);
+        player->stream = NULL;
+    }
+}
+
+struct my_audio_player *my_audio_player_create(void) {
+    struct my_audio_player *player = calloc(1, sizeof(struct my_audio_player));
+    if (player == NULL) {
+        ALOGE("%s: failed to allocate", __FUNCTION__);
+        return NULL;
+    }
+    pthread_mutex_init(&player->stream_mutex, NULL);
+    player->playout.ratio = 1.0;
+    player->playout.buffering = true;
+    player->playout.needed_ms = INITIAL_TARGET_MS;
+    reset_window(&player->playout);
+
+    pthread_mutex_lock(&player->stream_mutex);
+    const bool opened = open_stream(player);
+    pthread_mutex_unlock(&player->stream_mutex);
+    if (!opened) {
+        my_audio_player_destroy(player);
+        return NULL;
+    }
+    return player;
+}
+
+void my_audio_player_destroy(struct my_audio_player *player) {
+    if (player == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&player->stream_mutex);
+    close_stream(player);
+    pthread_mutex_unlock(&player->stream_mutex);
+
+    pthread_mutex_destroy(&player->stream_mutex);
+    free(player);
+}
+
+/// Where AAudio reports its position, on the push thread.
+static void update_output_latency(struct my_audio_player *player) {
+    const int64_t now = now_ns();
+    if (now - player->latency_checked_ns < LATENCY_INTERVAL_NS) {
+        return;
+    }
+    player->latency_checked_ns = now;
+
+    if (pthread_mutex_trylock(&player->stream_mutex) != 0) {
+        return;
+    }
+    int64_t position = 0;
+    int64_t position_ns = 0;
+    if (player->stream != NULL && !player->paused &&
+        AAudioStream_getTimestamp(player->stream, CLOCK_MONOTONIC, &position, &position_ns) == AAUDIO_OK) {
+        const int64_t written = AAudioStream_getFramesWritten(player->stream);
+        const double presented = (double)position + (double)(now - position_ns) * MY_AUDIO_SAMPLE_RATE / 1e9;
+        const float latency_ms = frames_to_ms((double)written - presented);
+        atomic_store_explicit(&player->output_latency_us, (int32_t)(fmaxf(latency_ms, 0.0f) * 1000.0f),
+                              memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&player->stream_mutex);
+}
+
+void my_audio_player_push(struct my_audio_player *player, const int16_t *samples, size_t frame_count) {
+    if (atomic_exchange(&player->disconnected, false)) {
+        // Headphones unplugged or the like, the device we played on is gone.
+        pthread_mutex_lock(&player->stream_mutex);
+        close_stream(player);
+        open_stream(player);
+        pthread_mutex_unlock(&player->stream_mutex);
+    }
+
+    const uint64_t write_pos = atomic_load_explicit(&player->write_pos, memory_order_relaxed);
+    const uint64_t read_pos = atomic_load_explicit(&player->read_pos, memory_order_acquire);
+    const uint64_t space = RING_FRAMES - HISTORY_FRAMES - (write_pos - read_pos);
+    if (frame_count > space) {
+        // Only if the device stopped pulling, the callback skips ahead long before this.
+        frame_count = (size_t)space;
+    }
+
+    for (size_t i = 0; i < frame_count; i++) {
+        float *frame = &player->ring[((write_pos + i) & RING_MASK) * MY_AUDIO_CHANNELS];
+        for (int c = 0; c < MY_AUDIO_CHANNELS; c++) {
+            frame[c] = (float)samples[i * MY_AUDIO_CHANNELS + c] / 32768.0f;
+        }
+    }
+    atomic_store_explicit(&player->write_pos, write_pos + frame_count, memory_order_release);
+
+    update_output_latency(player);
+}
+
+void my_audio_player_flush(struct my_audio_player *player) {
+    atomic_store(&player->flush_requested, true);
+}
+
+void my_audio_player_set_video_delay(struct my_audio_player *player, float delay_ms) {
+    atomic_store_explicit(&player->video_delay_us, (int32_t)(fmaxf(delay_ms, 0.0f) * 1000.0f), memory_order_relaxed);
+}
+
+void my_audio_player_set_paused(struct my_audio_player *player, bool paused) {
+    pthread_mutex_lock(&player->stream_mutex);
+    if (player->paused != paused && player->stream != NULL) {
+        aaudio_result_t result =
+            paused ? AAudioStream_requestPause(player->stream) : AAudioStream_requestStart(player->stream);
+        if (result != AAUDIO_OK) {
+            ALOGW("%s: %s", __FUNCTION__, AAudio_convertResultToText(result));
+        }
+    }
+    player->paused = paused;
+    pthread_mutex_unlock(&player->stream_mutex);
+
+    if (!paused) {
+        // Whatever is left from before the pause is stale by now.
+        my_audio_player_flush(player);
+    }
+}
+
+void my_audio_player_get_stats(struct my_audio_player *player, struct my_audio_player_stats *out_stats) {
+    out_stats->buffered_ms = (float)atomic_load(&player->buffered_us) / 1000.0f;
+    out_stats->target_ms = (float)atomic_load(&player->target_us) / 1000.0f;
+    out_stats->correction_ppm = atomic_load(&player->correction_ppm);
+    out_stats->output_latency_ms = (float)atomic_load(&player->output_latency_us) / 1000.0f;
+    out_stats->exclusive = atomic_load(&player->exclusive);
+    out_stats->underruns = atomic_load(&player->underruns);
+    out_stats->skips = atomic_load(&player->skips);
+}
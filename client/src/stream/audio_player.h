@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Opus always decodes at 48 kHz, and the server captures stereo.
+#define MY_AUDIO_SAMPLE_RATE 48000
+#define MY_AUDIO_CHANNELS 2
+
+struct my_audio_player_stats {
+    /// Decoded audio waiting to be played, smoothed.
+    float buffered_ms;
+    /// What the drift controller steers the buffer towards.
+    float target_ms;
+    /// How much faster than the server we play to hold the target, in parts per million.
+    int32_t correction_ppm;
+    /// From handing a frame to AAudio to it leaving the device.
+    float output_latency_ms;
+    /// Got an exclusive (MMAP) stream.
+    bool exclusive;
+    // Cumulative.
+    uint32_t underruns;
+    uint32_t skips;
+};
+
+/*!
+ * Plays decoded audio through AAudio, in low latency mode and exclusive (MMAP) where the device allows.
+ *
+ * Audio comes in on a GStreamer streaming thread and goes into a ring buffer, the AAudio callback reads it back through
+ * a resampler. The resampling ratio is steered so the ring buffer holds a target amount, so drift between the server
+ * and our audio clock gets absorbed instead of growing the buffer. The target follows how bursty audio arrives, and how
+ * far behind the video is shown.
+ */
+struct my_audio_player;
+
+/// @return NULL if AAudio can't open an output stream.
+struct my_audio_player *my_audio_player_create(void);
+
+void my_audio_player_destroy(struct my_audio_player *player);
+
+/*!
+ * Queue interleaved S16 frames, at @ref MY_AUDIO_SAMPLE_RATE with @ref MY_AUDIO_CHANNELS.
+ *
+ * Must only be called from a single thread.
+ */
+void my_audio_player_push(struct my_audio_player *player, const int16_t *samples, size_t frame_count);
+
+/// Discard queued audio, e.g. when the pipeline goes away.
+void my_audio_player_flush(struct my_audio_player *player);
+
+/*!
+ * How much later than audio the video reaches the screen, past the jitterbuffer both go through.
+ *
+ * The player holds at least this much, minus the device's own latency, so sound doesn't run ahead of the picture.
+ */
+void my_audio_player_set_video_delay(struct my_audio_player *player, float delay_ms);
+
+/// Stop the device while there is no window, without giving up the stream.
+void my_audio_player_set_paused(struct my_audio_player *player, bool paused);
+
+void my_audio_player_get_stats(struct my_audio_player *player, struct my_audio_player_stats *out_stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
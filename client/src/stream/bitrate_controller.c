@@ -0,0 +1,174 @@
+#include "bitrate_controller.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "utils/logger.h"
+
+/// Loss above which we back off, and below which the link counts as clean.
+#define LOSS_HIGH 0.10f
+#define LOSS_LOW 0.02f
+
+/// Back off on delay growth of this much over the clean-link baseline.
+#define JITTER_MARGIN_MS 10.0f
+/// Back off when the one way delay grows this much per packet group on average, a queue filling up.
+#define TWCC_DELAY_GRADIENT_HIGH_MS 0.5f
+
+/// Don't probe up again this soon after a decrease.
+#define HOLD_AFTER_DECREASE_NS 2000000000LL
+/// Increases are batched up to this interval, decreases are always sent immediately.
+#define MIN_SEND_INTERVAL_NS 1000000000LL
+
+#define INCREASE_FACTOR 1.05f
+#define DELAY_DECREASE_FACTOR 0.85f
+
+/// Bits per pixel per frame thresholds for switching resolution steps.
+#define BPP_STEP_DOWN 0.04f
+#define BPP_STEP_UP 0.08f
+
+/// Resolution ladder, as fractions of the configured resolution.
+static const float resolution_scales[] = {1.0f, 0.75f, 0.5f};
+#define RESOLUTION_STEP_COUNT ((int32_t)(sizeof(resolution_scales) / sizeof(resolution_scales[0])))
+
+static void apply_resolution_step(struct my_bitrate_controller *ctrl) {
+    float scale = resolution_scales[ctrl->resolution_step];
+    // Encoders want even dimensions.
+    ctrl->target.width = ((int32_t)((float)ctrl->config.max_width * scale)) & ~1;
+    ctrl->target.height = ((int32_t)((float)ctrl->config.max_height * scale)) & ~1;
+}
+
+static float bits_per_pixel(const struct my_bitrate_controller *ctrl, int32_t step) {
+    float scale = resolution_scales[step];
+    float pixels_per_second =
+        (float)ctrl->config.max_width * scale * (float)ctrl->config.max_height * scale * (float)ctrl->config.framerate;
+    if (pixels_per_second <= 0) {
+        return 0;
+    }
+    return (float)ctrl->target.bitrate_kbps * 1000.0f / pixels_per_second;
+}
+
+void my_bitrate_controller_init(struct my_bitrate_controller *ctrl, const struct my_bitrate_controller_config *config) {
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->config = *config;
+    if (ctrl->config.min_bitrate_kbps <= 0 || ctrl->config.min_bitrate_kbps > ctrl->config.max_bitrate_kbps) {
+        ctrl->config.min_bitrate_kbps = ctrl->config.max_bitrate_kbps / 10;
+    }
+
+    // Start at what the user asked for, the server is already encoding that.
+    ctrl->target.bitrate_kbps = ctrl->config.max_bitrate_kbps;
+    apply_resolution_step(ctrl);
+    ctrl->last_sent = ctrl->target;
+    ctrl->baseline_jitter_ms = -1;
+}
+
+static void update_resolution(struct my_bitrate_controller *ctrl) {
+    // At the full bitrate the link carries whatever the user picked, however low the bits per pixel.
+    const bool at_max = ctrl->target.bitrate_kbps >= ctrl->config.max_bitrate_kbps;
+
+    if (!at_max && ctrl->resolution_step + 1 < RESOLUTION_STEP_COUNT &&
+        bits_per_pixel(ctrl, ctrl->resolution_step) < BPP_STEP_DOWN) {
+        ctrl->resolution_step++;
+    } else if (ctrl->resolution_step > 0 && (at_max || bits_per_pixel(ctrl, ctrl->resolution_step - 1) > BPP_STEP_UP)) {
+        ctrl->resolution_step--;
+    } else {
+        return;
+    }
+    apply_resolution_step(ctrl);
+}
+
+bool my_bitrate_controller_update(struct my_bitrate_controller *ctrl,
+                                  const struct my_network_sample *sample,
+                                  struct my_bitrate_target *out_target) {
+    const uint32_t expected = sample->packets_received + sample->packets_lost + sample->packets_recovered;
+    if (expected == 0) {
+        // Nothing arrived, which is a stall rather than congestion we can measure.
+        return false;
+    }
+    // What the decoder sees, and what the link actually dropped.
+    const float loss = (float)sample->packets_lost / (float)expected;
+    float wire_loss = (float)(sample->packets_lost + sample->packets_recovered) / (float)expected;
+    if (sample->has_twcc) {
+        // Retransmissions hide the wire loss from the jitterbuffer, the feedback doesn't.
+        wire_loss = fmaxf(wire_loss, sample->twcc_loss_percent / 100.0f);
+    }
+
+    // Track the clean-link jitter: follow it down quickly, and up only very slowly.
+    if (ctrl->baseline_jitter_ms < 0 || sample->jitter_ms < ctrl->baseline_jitter_ms) {
+        ctrl->baseline_jitter_ms = sample->jitter_ms;
+    } else {
+        ctrl->baseline_jitter_ms += (sample->jitter_ms - ctrl->baseline_jitter_ms) * 0.01f;
+    }
+
+    const float frame_ms = ctrl->config.framerate > 0 ? 1000.0f / (float)ctrl->config.framerate : 16.7f;
+    const bool queue_growing = sample->has_twcc && sample->twcc_delay_gradient_ms > TWCC_DELAY_GRADIENT_HIGH_MS;
+    const bool delay_growing = sample->jitter_ms > ctrl->baseline_jitter_ms + JITTER_MARGIN_MS ||
+                               sample->decode_delay_ms > 2 * frame_ms || queue_growing;
+
+    float bitrate = (float)ctrl->target.bitrate_kbps;
+    bool decreased = false;
+
+    if (loss > LOSS_HIGH) {
+        bitrate *= 1.0f - 0.5f * loss;
+        decreased = true;
+    } else if (delay_growing || wire_loss > LOSS_HIGH) {
+        // FEC still covers it, but the link is dropping enough that it soon won't.
+        bitrate *= DELAY_DECREASE_FACTOR;
+        decreased = true;
+    } else if (wire_loss < LOSS_LOW && sample->now_ns - ctrl->last_decrease_ns > HOLD_AFTER_DECREASE_NS) {
+        bitrate *= INCREASE_FACTOR;
+    }
+    if (queue_growing && sample->twcc_received_kbps > 0) {
+        // Sending more than what gets through only fills the queue further.
+        bitrate = fminf(bitrate, DELAY_DECREASE_FACTOR * (float)sample->twcc_received_kbps);
+    }
+
+    if (bitrate < (float)ctrl->config.min_bitrate_kbps) {
+        bitrate = (float)ctrl->config.min_bitrate_kbps;
+    }
+    if (bitrate > (float)ctrl->config.max_bitrate_kbps) {
+        bitrate = (float)ctrl->config.max_bitrate_kbps;
+    }
+
+    ctrl->target.bitrate_kbps = (int32_t)bitrate;
+    if (decreased) {
+        ctrl->last_decrease_ns = sample->now_ns;
+    }
+
+    update_resolution(ctrl);
+
+    const bool resolution_changed =
+        ctrl->target.width != ctrl->last_sent.width || ctrl->target.height != ctrl->last_sent.height;
+    const float change = ctrl->last_sent.bitrate_kbps > 0
+                             ? fabsf((float)(ctrl->target.bitrate_kbps - ctrl->last_sent.bitrate_kbps)) /
+                                   (float)ctrl->last_sent.bitrate_kbps
+                             : 1.0f;
+    const bool bitrate_dropped = ctrl->target.bitrate_kbps < ctrl->last_sent.bitrate_kbps;
+
+    if (!resolution_changed && change < 0.05f) {
+        return false;
+    }
+    if (!resolution_changed && !bitrate_dropped && sample->now_ns - ctrl->last_sent_ns < MIN_SEND_INTERVAL_NS) {
+        return false;
+    }
+
+    ALOGI("[abr] loss %.1f%% (%.1f%% before FEC), jitter %.1f ms (baseline %.1f), decode delay %.1f ms -> %d kbps, %dx%d",
+          loss * 100.0f,
+          wire_loss * 100.0f,
+          sample->jitter_ms,
+          ctrl->baseline_jitter_ms,
+          sample->decode_delay_ms,
+          ctrl->target.bitrate_kbps,
+          ctrl->target.width,
+          ctrl->target.height);
+    if (sample->has_twcc) {
+        ALOGI("[abr] twcc: received %d kbps, loss %.1f%%, delay gradient %.2f ms",
+              sample->twcc_received_kbps,
+              sample->twcc_loss_percent,
+              sample->twcc_delay_gradient_ms);
+    }
+
+    ctrl->last_sent = ctrl->target;
+    ctrl->last_sent_ns = sample->now_ns;
+    *out_target = ctrl->target;
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct my_bitrate_controller_config {
+    /// Ceiling, the bitrate the user picked.
+    int32_t max_bitrate_kbps;
+    int32_t min_bitrate_kbps;
+    /// Resolution the user picked, also the top of the resolution ladder.
+    int32_t max_width;
+    int32_t max_height;
+    int32_t framerate;
+};
+
+/// Network and decoder observations over one controller interval.
+struct my_network_sample {
+    int64_t now_ns;
+    /// Packets that made it to udpsrc during the interval.
+    uint32_t packets_received;
+    /// Packets the jitterbuffer gave up on during the interval, after FEC.
+    uint32_t packets_lost;
+    /// Packets FEC rebuilt during the interval, not part of the two counts above.
+    uint32_t packets_recovered;
+    /// RFC 3550 interarrival jitter.
+    float jitter_ms;
+    /// Time from depayloader output to decoder output, p95.
+    float decode_delay_ms;
+
+    // Transport-wide congestion control feedback, from the sender's side of the link. WebRTC transport only.
+    bool has_twcc;
+    /// What we acknowledged receiving, headers, audio and retransmissions included.
+    int32_t twcc_received_kbps;
+    /// Loss on the wire, before retransmissions.
+    float twcc_loss_percent;
+    /// Mean change of the one way delay between packet groups, positive while a queue builds up.
+    float twcc_delay_gradient_ms;
+};
+
+struct my_bitrate_target {
+    int32_t bitrate_kbps;
+    int32_t width;
+    int32_t height;
+};
+
+/*!
+ * Loss and delay based congestion controller.
+ *
+ * Backs off multiplicatively on loss or growing jitter/decode delay, probes up slowly once the link has been clean
+ * for a while, and steps the resolution down/up when the bitrate gets too low/high for the current one. Loss that FEC
+ * recovered holds off probing, and backs off gently once it gets high enough to eat into the FEC headroom.
+ *
+ * With TWCC feedback a growing one way delay backs off before the jitter shows it, to no more than what actually got
+ * through, so a bloated queue drains instead of dropping frames.
+ *
+ * Not thread safe, it is driven from the stream app main loop.
+ */
+struct my_bitrate_controller {
+    struct my_bitrate_controller_config config;
+    struct my_bitrate_target target;
+
+    /// Index into the resolution ladder, 0 is full resolution.
+    int32_t resolution_step;
+
+    /// Jitter of a clean link, slowly tracking the minimum.
+    float baseline_jitter_ms;
+    int64_t last_decrease_ns;
+    int64_t last_sent_ns;
+    struct my_bitrate_target last_sent;
+};
+
+void my_bitrate_controller_init(struct my_bitrate_controller *ctrl, const struct my_bitrate_controller_config *config);
+
+/*!
+ * Feed one interval of observations.
+ *
+ * @param[out] out_target The new target, only written when returning true.
+ * @return true if the target changed enough that it should be sent to the server.
+ */
+bool my_bitrate_controller_update(struct my_bitrate_controller *ctrl,
+                                  const struct my_network_sample *sample,
+                                  struct my_bitrate_target *out_target);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,165 @@
+#include "clock_sync.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/logger.h"
+
+/// Samples considered by the minimum-RTT filter.
+#define SAMPLE_COUNT 8
+
+#define PING_INTERVAL_FAST_NS 100000000LL
+#define PING_INTERVAL_NS 1000000000LL
+
+struct clock_sample {
+    int64_t offset_ns;
+    int64_t rtt_ns;
+};
+
+struct my_clock_sync {
+    // Only touched by the ENet thread.
+    struct clock_sample samples[SAMPLE_COUNT];
+    uint32_t sample_count;
+    uint32_t next_seq;
+    int64_t last_ping_ns;
+
+    // Published estimate.
+    _Atomic bool valid;
+    _Atomic int64_t offset_ns;
+    _Atomic int64_t rtt_ns;
+};
+
+struct my_clock_sync *my_clock_sync_create(void) {
+    struct my_clock_sync *cs = calloc(1, sizeof(struct my_clock_sync));
+    if (cs == NULL) {
+        ALOGE("%s: failed to allocate", __FUNCTION__);
+    }
+    return cs;
+}
+
+void my_clock_sync_destroy(struct my_clock_sync *cs) {
+    free(cs);
+}
+
+void my_clock_sync_reset(struct my_clock_sync *cs) {
+    memset(cs->samples, 0, sizeof(cs->samples));
+    cs->sample_count = 0;
+    cs->last_ping_ns = 0;
+    atomic_store(&cs->valid, false);
+}
+
+static void write_i64(uint8_t *buffer, size_t *offset, int64_t value) {
+    // Little-endian on the wire, same as input commands.
+    memcpy(buffer + *offset, &value, sizeof(int64_t));
+    *offset += sizeof(int64_t);
+}
+
+static int64_t read_i64(const uint8_t *data, size_t *offset) {
+    int64_t value;
+    memcpy(&value, data + *offset, sizeof(int64_t));
+    *offset += sizeof(int64_t);
+    return value;
+}
+
+size_t my_clock_sync_poll_ping(struct my_clock_sync *cs, uint8_t *buffer, size_t size, int64_t now_ns) {
+    if (size < MY_CLOCK_SYNC_PING_SIZE) {
+        return 0;
+    }
+
+    int64_t interval = cs->sample_count < SAMPLE_COUNT ? PING_INTERVAL_FAST_NS : PING_INTERVAL_NS;
+    if (cs->last_ping_ns != 0 && now_ns - cs->last_ping_ns < interval) {
+        return 0;
+    }
+    cs->last_ping_ns = now_ns;
+
+    uint32_t seq = cs->next_seq++;
+
+    size_t offset = 0;
+    buffer[offset++] = MY_CLOCK_SYNC_PING;
+    memcpy(buffer + offset, &seq, sizeof(uint32_t));
+    offset += sizeof(uint32_t);
+    write_i64(buffer, &offset, now_ns);
+
+    return offset;
+}
+
+bool my_clock_sync_handle_pong(struct my_clock_sync *cs, const uint8_t *data, size_t size, int64_t now_ns) {
+    if (size != MY_CLOCK_SYNC_PONG_SIZE || data[0] != MY_CLOCK_SYNC_PONG) {
+        return false;
+    }
+
+    size_t offset = 1;
+    uint8_t flags = data[offset++];
+    offset += sizeof(uint32_t); // seq, only useful for debugging
+    int64_t t0 = read_i64(data, &offset);
+    int64_t t1 = read_i64(data, &offset);
+    int64_t t2 = read_i64(data, &offset);
+    int64_t t3 = now_ns;
+
+    // Server timestamps are meaningless while its pipeline is not running.
+    if (!(flags & MY_CLOCK_SYNC_FLAG_SERVER_RUNNING)) {
+        return true;
+    }
+
+    struct clock_sample sample = {
+        .offset_ns = ((t1 - t0) + (t2 - t3)) / 2,
+        .rtt_ns = (t3 - t0) - (t2 - t1),
+    };
+    if (sample.rtt_ns < 0) {
+        ALOGW("%s: dropping clock sample with negative RTT", __FUNCTION__);
+        return true;
+    }
+
+    cs->samples[cs->sample_count % SAMPLE_COUNT] = sample;
+    cs->sample_count++;
+
+    // The sample with the lowest RTT has the least queuing asymmetry, so it gives the best offset.
+    uint32_t n = cs->sample_count < SAMPLE_COUNT ? cs->sample_count : SAMPLE_COUNT;
+    struct clock_sample best = cs->samples[0];
+    for (uint32_t i = 1; i < n; i++) {
+        if (cs->samples[i].rtt_ns < best.rtt_ns) {
+            best = cs->samples[i];
+        }
+    }
+
+    atomic_store_explicit(&cs->offset_ns, best.offset_ns, memory_order_relaxed);
+    atomic_store_explicit(&cs->rtt_ns, best.rtt_ns, memory_order_relaxed);
+    atomic_store_explicit(&cs->valid, true, memory_order_release);
+
+    return true;
+}
+
+bool my_clock_sync_get_estimate(struct my_clock_sync *cs, struct my_clock_estimate *out_estimate) {
+    if (!atomic_load_explicit(&cs->valid, memory_order_acquire)) {
+        return false;
+    }
+    out_estimate->offset_ns = atomic_load_explicit(&cs->offset_ns, memory_order_relaxed);
+    out_estimate->rtt_ns = atomic_load_explicit(&cs->rtt_ns, memory_order_relaxed);
+    return true;
+}
+
+bool my_clock_sync_rtp_to_local_ns(struct my_clock_sync *cs,
+                                   uint32_t rtp_timestamp,
+                                   uint32_t clock_rate,
+                                   int64_t now_ns,
+                                   int64_t *out_local_ns) {
+    struct my_clock_estimate estimate;
+    if (clock_rate == 0 || !my_clock_sync_get_estimate(cs, &estimate)) {
+        return false;
+    }
+
+    const int64_t rtp_ns = (int64_t)((uint64_t)rtp_timestamp * 1000000000ULL / clock_rate);
+    const int64_t wrap_ns = (int64_t)((1ULL << 32) * 1000000000ULL / clock_rate);
+    const int64_t server_now_ns = now_ns + estimate.offset_ns;
+
+    // Pick the wrap that puts the capture closest to the current server time.
+    int64_t wraps = (server_now_ns - rtp_ns + wrap_ns / 2) / wrap_ns;
+    if (wraps < 0) {
+        wraps = 0;
+    }
+    const int64_t capture_server_ns = rtp_ns + wraps * wrap_ns;
+
+    *out_local_ns = capture_server_ns - estimate.offset_ns;
+    return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// ENet channel used for clock synchronization, input stays on channel 0.
+#define MY_CLOCK_SYNC_ENET_CHANNEL 1
+
+/// Message types on @ref MY_CLOCK_SYNC_ENET_CHANNEL. Must match the server.
+enum my_clock_sync_message_type {
+    MY_CLOCK_SYNC_PING = 1,
+    MY_CLOCK_SYNC_PONG = 2,
+};
+
+/// Set in the pong flags when the server timestamps are pipeline running time.
+#define MY_CLOCK_SYNC_FLAG_SERVER_RUNNING 0x1
+
+/// u8 type, u32 seq, i64 client send time
+#define MY_CLOCK_SYNC_PING_SIZE 13
+/// u8 type, u8 flags, u32 seq, i64 client send time, i64 server receive time, i64 server send time
+#define MY_CLOCK_SYNC_PONG_SIZE 30
+
+struct my_clock_estimate {
+    /// Server running time minus client CLOCK_MONOTONIC, in nanoseconds.
+    int64_t offset_ns;
+    /// Round trip time of the sample the offset comes from.
+    int64_t rtt_ns;
+};
+
+/*!
+ * NTP-style offset/RTT estimator between the client monotonic clock and the server pipeline running time.
+ *
+ * Pongs are handled on the ENet thread, while estimates are read from the streaming and render threads, so the current
+ * estimate is published through atomics.
+ */
+struct my_clock_sync;
+
+struct my_clock_sync *my_clock_sync_create(void);
+
+void my_clock_sync_destroy(struct my_clock_sync *cs);
+
+/// Forget all samples, e.g. when reconnecting to a (possibly different) server.
+void my_clock_sync_reset(struct my_clock_sync *cs);
+
+/*!
+ * Build the next ping if one is due.
+ *
+ * Pings go out quickly until the filter is primed, then once a second.
+ *
+ * @return Number of bytes written to @p buffer, or 0 if no ping is due.
+ */
+size_t my_clock_sync_poll_ping(struct my_clock_sync *cs, uint8_t *buffer, size_t size, int64_t now_ns);
+
+/*!
+ * Feed a pong received on @ref MY_CLOCK_SYNC_ENET_CHANNEL.
+ *
+ * @return true if the message was a valid pong.
+ */
+bool my_clock_sync_handle_pong(struct my_clock_sync *cs, const uint8_t *data, size_t size, int64_t now_ns);
+
+/// @return false until at least one usable sample was received.
+bool my_clock_sync_get_estimate(struct my_clock_sync *cs, struct my_clock_estimate *out_estimate);
+
+/*!
+ * Map an RTP timestamp onto the client monotonic clock.
+ *
+ * The server payloads with a zero timestamp offset, so RTP time is its pipeline running time at capture, modulo the
+ * 32-bit wrap. The wrap is resolved against the current server time estimate.
+ *
+ * @return false if there is no clock estimate yet.
+ */
+bool my_clock_sync_rtp_to_local_ns(struct my_clock_sync *cs,
+                                   uint32_t rtp_timestamp,
+                                   uint32_t clock_rate,
+                                   int64_t now_ns,
+                                   int64_t *out_local_ns);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
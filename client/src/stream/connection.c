@@ -1,14 +1,25 @@
 #include "connection.h"
 
+#include <errno.h>
 #include <gst/gstelement.h>
 #include <gst/gstobject.h>
+#include <gst/sdp/sdp.h>
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup-message.h>
 #include <libsoup/soup-session.h>
+#include <poll.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
+#include "clock_sync.h"
+#include "startup_profile.h"
 #include "status.h"
+#include "telemetry.h"
 #include "utils/logger.h"
 
 // clang-format off
@@ -17,12 +28,77 @@
 // clang-format on
 
 #include "input.h"
+#include "input_batch.h"
+#include "input_queue.h"
+#include "rtp_replay.h"
 #include "stream_config.h"
 #include "thread.h"
 
 #define SERVER_ADDRESS "192.168.31.178"
 #define DEFAULT_WEBSOCKET_URI "ws://" SERVER_ADDRESS ":5600/ws"
 
+#define ENET_CHANNEL_INPUT 0
+/// Reliable control messages, clock sync is on channel 1.
+#define ENET_CHANNEL_CONTROL 2
+#define ENET_CHANNEL_COUNT 3
+
+/// Message types on ENET_CHANNEL_CONTROL. Must match the server.
+enum control_message_type {
+    CONTROL_KEYFRAME_REQUEST = 1,
+    /// Server to client: u8 type, u32 sequence, i64 server running time the command was injected at.
+    CONTROL_INPUT_ACK = 2,
+};
+
+#define CONTROL_INPUT_ACK_SIZE 13
+
+/// Data channels standing in for the ENet channels in WebRTC mode. The server creates them, with these labels.
+enum data_channel {
+    DATA_CHANNEL_INPUT,
+    /// Batches of only continuous commands, unordered and never retransmitted, see send_input_batch.
+    DATA_CHANNEL_INPUT_UNRELIABLE,
+    DATA_CHANNEL_CLOCK_SYNC,
+    DATA_CHANNEL_CONTROL,
+    /// Input acks from the server, a newer one replaces a lost one.
+    DATA_CHANNEL_CONTROL_UNRELIABLE,
+    DATA_CHANNEL_COUNT,
+};
+
+#define DATA_CHANNELS_ALL_OPEN ((1u << DATA_CHANNEL_COUNT) - 1)
+
+struct data_channel_desc {
+    const char *label;
+    /// The ENet channel its messages are handled as.
+    uint8_t enet_channel;
+};
+
+static const struct data_channel_desc data_channel_descs[DATA_CHANNEL_COUNT] = {
+    [DATA_CHANNEL_INPUT] = {"input", ENET_CHANNEL_INPUT},
+    [DATA_CHANNEL_INPUT_UNRELIABLE] = {"input-unreliable", ENET_CHANNEL_INPUT},
+    [DATA_CHANNEL_CLOCK_SYNC] = {"clock-sync", MY_CLOCK_SYNC_ENET_CHANNEL},
+    [DATA_CHANNEL_CONTROL] = {"control", ENET_CHANNEL_CONTROL},
+    [DATA_CHANNEL_CONTROL_UNRELIABLE] = {"control-unreliable", ENET_CHANNEL_CONTROL},
+};
+
+/// A data channel message on its way from the webrtcbin's thread to the ENet thread.
+struct data_channel_message {
+    uint8_t enet_channel;
+    /// Pongs need their arrival time, not when the ENet thread got to them.
+    int64_t received_ns;
+    GBytes *data;
+};
+
+/// How long the ENet thread sleeps with nothing to do. Input and control messages wake it up right away, this only paces
+/// ENet's own timers: retransmits while reliable commands are in flight, and pings otherwise.
+#define ENET_RETRANSMIT_POLL_MS 10
+#define ENET_IDLE_POLL_MS 50
+
+/// How often a replay is checked for having sent everything, and how long the pipeline gets to drain afterwards.
+#define REPLAY_POLL_INTERVAL_MS 100
+#define REPLAY_DRAIN_NS (1000 * 1000 * 1000LL)
+
+/// Loss within this window after a request is repaired by the keyframe already on its way.
+#define KEYFRAME_REQUEST_MIN_INTERVAL_NS (100 * 1000 * 1000LL)
+
 /*!
  * Data required for the handshake to complete and to maintain the connection.
  */
@@ -44,9 +120,51 @@ struct _MyConnection {
     ENetHost *client;
     ENetPeer *peer;
     struct os_thread_helper enet_thread;
-    GAsyncQueue *packet_queue;
+    /// Commands from the input thread, batched up by the ENet thread.
+    struct my_input_queue input_queue;
+    /// eventfd the ENet thread polls next to its socket, written whenever there is something to send. Lives as long as
+    /// the connection, input may come in from any thread at any time.
+    int enet_wake_fd;
+    /// Only accessed from the ENet thread.
+    bool enet_connected;
+
+    /// WebRTC transport, ENet traffic goes over data channels. Set by my_connection_connect before the ENet thread
+    /// starts, only the thread is left then, without an ENet host.
+    bool webrtc;
+    /// Set from the webrtcbin's thread, sent on from the ENet thread.
+    GMutex data_channel_lock;
+    GstWebRTCDataChannel *data_channels[DATA_CHANNEL_COUNT];
+    /// Bit per enum data_channel.
+    _Atomic uint32_t data_channels_open;
+    /// struct data_channel_message, handled on the ENet thread.
+    GAsyncQueue *data_channel_inbox;
+    /// Newest report the server forwarded, see my_connection_take_twcc_stats. Main loop thread only.
+    struct my_twcc_stats twcc_stats;
+    bool twcc_stats_fresh;
+
+    struct my_clock_sync *clock_sync;
+
+    /// Last sequence handed out to an input command.
+    _Atomic uint32_t input_sequence;
+    /// Newest command the server injected, and when, on our clock. Written by the ENet thread, time first.
+    _Atomic uint32_t acked_input_sequence;
+    _Atomic int64_t acked_input_time_ns;
+
+    /// Set by my_connection_request_keyframe on any thread, sent by the ENet thread.
+    _Atomic bool keyframe_request_pending;
+    _Atomic int64_t last_keyframe_request_ns;
 
     bool server_closed;
+    /// Set by my_connection_resume until the main loop handled it, a lost connection is about to be re-established.
+    _Atomic bool resume_pending;
+
+    /// From the last stream_info, sent with the next stream config to resume the session. Main loop thread only.
+    gchar *session_token;
+
+    /// Stands in for the server while a capture gets replayed, see my_connection_start_replay. Main loop thread only.
+    struct my_rtp_replay *replay;
+    struct my_rtp_replay_config replay_config;
+    guint replay_poll_id;
 
     struct StreamConfig config;
 };
@@ -64,6 +182,7 @@ enum {
     SIGNAL_STATUS_CHANGE,
     SIGNAL_ON_NEED_PIPELINE,
     SIGNAL_ON_DROP_PIPELINE,
+    SIGNAL_ON_REPLAY_DONE,
     N_SIGNALS
 };
 
@@ -129,10 +248,22 @@ static void my_connection_get_property(GObject *object, guint property_id, GValu
     }
 }
 
+static void data_channel_message_free(gpointer data) {
+    struct data_channel_message *msg = data;
+    g_bytes_unref(msg->data);
+    g_free(msg);
+}
+
 static void my_connection_init(MyConnection *conn) {
     conn->ws_cancel = g_cancellable_new();
     conn->soup_session = soup_session_new();
     conn->websocket_uri = g_strdup(DEFAULT_WEBSOCKET_URI);
+    conn->clock_sync = my_clock_sync_create();
+    my_input_queue_init(&conn->input_queue);
+    conn->enet_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    g_assert(conn->enet_wake_fd >= 0);
+    g_mutex_init(&conn->data_channel_lock);
+    conn->data_channel_inbox = g_async_queue_new_full(data_channel_message_free);
 }
 
 static void my_connection_dispose(GObject *object) {
@@ -148,6 +279,11 @@ static void my_connection_finalize(GObject *object) {
     MyConnection *self = MY_CONNECTION(object);
 
     g_free(self->websocket_uri);
+    g_free(self->session_token);
+    g_clear_pointer(&self->clock_sync, my_clock_sync_destroy);
+    g_clear_pointer(&self->data_channel_inbox, g_async_queue_unref);
+    close(self->enet_wake_fd);
+    g_mutex_clear(&self->data_channel_lock);
 }
 
 static void my_connection_class_init(MyConnectionClass *klass) {
@@ -294,18 +430,87 @@ static void my_connection_class_init(MyConnectionClass *klass) {
                                                     NULL,
                                                     G_TYPE_NONE,
                                                     0);
+
+    /**
+     * MyConnection::on-replay-done
+     * @object: the #MyConnection
+     *
+     * A replay started with my_connection_start_replay sent its whole capture and the pipeline had time to drain.
+     * Emitted before the connection reports itself closed.
+     */
+    signals[SIGNAL_ON_REPLAY_DONE] = g_signal_new("on-replay-done",
+                                                  G_OBJECT_CLASS_TYPE(klass),
+                                                  G_SIGNAL_RUN_LAST,
+                                                  0,
+                                                  NULL,
+                                                  NULL,
+                                                  NULL,
+                                                  G_TYPE_NONE,
+                                                  0);
     ALOGI("%s: End", __FUNCTION__);
 }
 
+static void wake_enet_thread(MyConnection *conn) {
+    const uint64_t one = 1;
+    if (write(conn->enet_wake_fd, &one, sizeof(one)) < 0) {
+        ALOGW("%s: failed to wake the ENet thread", __FUNCTION__);
+    }
+}
+
+static void stop_enet_thread(MyConnection *conn) {
+    // Clear the flag first, so the thread can't go back to sleep after our wakeup.
+    pthread_mutex_lock(&conn->enet_thread.mutex);
+    const bool running = conn->enet_thread.running;
+    conn->enet_thread.running = false;
+    pthread_mutex_unlock(&conn->enet_thread.mutex);
+
+    if (running) {
+        wake_enet_thread(conn);
+        pthread_join(conn->enet_thread.thread, NULL);
+        ALOGI("ENet thread stopped.");
+    }
+}
+
+/// Drop the data channels of the last peer connection, the ENet thread must be stopped.
+static void clear_data_channels(MyConnection *conn) {
+    atomic_store(&conn->data_channels_open, 0);
+    g_mutex_lock(&conn->data_channel_lock);
+    for (int i = 0; i < DATA_CHANNEL_COUNT; i++) {
+        if (conn->data_channels[i] != NULL) {
+            g_signal_handlers_disconnect_by_data(conn->data_channels[i], conn);
+        }
+        g_clear_object(&conn->data_channels[i]);
+    }
+    g_mutex_unlock(&conn->data_channel_lock);
+
+    struct data_channel_message *msg;
+    while ((msg = g_async_queue_try_pop(conn->data_channel_inbox)) != NULL) {
+        data_channel_message_free(msg);
+    }
+}
+
+static bool enet_thread_running(MyConnection *conn) {
+    pthread_mutex_lock(&conn->enet_thread.mutex);
+    const bool running = conn->enet_thread.running;
+    pthread_mutex_unlock(&conn->enet_thread.mutex);
+    return running;
+}
+
 void my_connection_disconnect(MyConnection *conn) {
     if (conn->ws_cancel != NULL) {
         g_cancellable_cancel(conn->ws_cancel);
         gst_clear_object(&conn->ws_cancel);
     }
 
+    // Stop feeding the pipeline before it goes away.
+    g_clear_handle_id(&conn->replay_poll_id, g_source_remove);
+    g_clear_pointer(&conn->replay, my_rtp_replay_destroy);
+
     // Notify stream app to drop the pipeline.
     ALOGI("Emit ON_DROP_PIPELINE upon WebSocket disconnection");
     g_signal_emit(conn, signals[SIGNAL_ON_DROP_PIPELINE], 0);
+    // The next stream_info needs a new one, and a webrtcbin can't negotiate a second peer connection.
+    gst_clear_object(&conn->pipeline);
 
     if (conn->ws) {
         ALOGI("Closing WebSocket connection.");
@@ -315,6 +520,12 @@ void my_connection_disconnect(MyConnection *conn) {
 
     conn_update_status(conn, MY_STATUS_IDLE_NOT_CONNECTED);
 
+    // ENet isn't thread safe, stop the thread before touching the peer.
+    stop_enet_thread(conn);
+    clear_data_channels(conn);
+
+    // Leftover input is dropped on the next connect.
+
     // ENet
     if (conn->peer) {
         enet_peer_disconnect(conn->peer, 0);
@@ -350,54 +561,401 @@ void my_connection_disconnect(MyConnection *conn) {
             enet_peer_reset(conn->peer);
         }
 
-        os_thread_helper_stop(&conn->enet_thread);
-        ALOGI("ENet thread stopped.");
-
-        // Drop the queue after stopping the ENet thread.
-        g_async_queue_unref(conn->packet_queue);
-
         enet_host_destroy(conn->client);
+        conn->client = NULL;
+        conn->peer = NULL;
         enet_deinitialize();
     }
 }
 
+static void conn_start_pipeline(MyConnection *conn) {
+    ALOGI("Creating pipeline for %s", my_video_codec_get_desc(conn->config.codec)->name);
+    g_assert_null(conn->pipeline);
+    g_signal_emit(conn, signals[SIGNAL_ON_NEED_PIPELINE], 0);
+    if (conn->pipeline == NULL) {
+        ALOGE("on-need-pipeline signal did not return a pipeline!");
+        my_connection_disconnect(conn);
+        return;
+    }
+
+    // OK, if we get here, we have a websocket connection, and a pipeline fully configured
+    // so we can start the pipeline playing
+
+    ALOGI("Setting pipeline state to PLAYING");
+    gst_element_set_state(GST_ELEMENT(conn->pipeline), GST_STATE_PLAYING);
+    my_startup_profile_mark(MY_STARTUP_PHASE_PLAYING);
+}
+
+static void conn_handle_stream_info(MyConnection *conn, JsonObject *msg) {
+    my_startup_profile_mark(MY_STARTUP_PHASE_STREAM_INFO);
+
+    if (conn->pipeline != NULL) {
+        ALOGW("%s: pipeline already running, ignoring", __FUNCTION__);
+        return;
+    }
+
+    const gchar *codec_name = json_object_has_member(msg, "codec") ? json_object_get_string_member(msg, "codec") : NULL;
+    if (!my_video_codec_from_name(codec_name, &conn->config.codec)) {
+        ALOGW("%s: unknown codec '%s', assuming h264", __FUNCTION__, codec_name ? codec_name : "(null)");
+        conn->config.codec = MY_VIDEO_CODEC_H264;
+    }
+    // Older servers only stream 8 bit.
+    conn->config.ten_bit = json_object_has_member(msg, "ten_bit") && json_object_get_boolean_member(msg, "ten_bit");
+
+    // Older servers only stream one display, and don't name its SSRC.
+    memset(conn->config.display_ssrcs, 0, sizeof(conn->config.display_ssrcs));
+    conn->config.display_count = 1;
+    JsonArray *ssrcs = json_object_has_member(msg, "display_ssrcs") ? json_object_get_array_member(msg, "display_ssrcs")
+                                                                    : NULL;
+    if (ssrcs != NULL && json_array_get_length(ssrcs) > 0) {
+        const guint count = MIN(json_array_get_length(ssrcs), MY_MAX_DISPLAYS);
+        for (guint i = 0; i < count; i++) {
+            conn->config.display_ssrcs[i] = (uint32_t)json_array_get_int_element(ssrcs, i);
+        }
+        conn->config.display_count = (int)count;
+        if (count > 1) {
+            ALOGI("%s: streaming %d displays", __FUNCTION__, conn->config.display_count);
+        }
+    }
+
+    if (json_object_has_member(msg, "session_token")) {
+        g_free(conn->session_token);
+        conn->session_token = g_strdup(json_object_get_string_member(msg, "session_token"));
+    }
+    if (json_object_has_member(msg, "resumed") && json_object_get_boolean_member(msg, "resumed")) {
+        // The server kept its pipeline, so there is no encoder warm-up, just the keyframe it forces.
+        ALOGI("%s: resumed the previous session", __FUNCTION__);
+    }
+
+    conn_start_pipeline(conn);
+}
+
+/*
+ * WebRTC transport
+ */
+
+struct ws_text {
+    MyConnection *conn;
+    gchar *text;
+};
+
+static gboolean send_ws_text_cb(gpointer user_data) {
+    struct ws_text *t = user_data;
+    if (t->conn->ws != NULL && !t->conn->server_closed) {
+        soup_websocket_connection_send_text(t->conn->ws, t->text);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void ws_text_free(gpointer user_data) {
+    struct ws_text *t = user_data;
+    g_object_unref(t->conn);
+    g_free(t->text);
+    g_free(t);
+}
+
+/// Send a message from any thread, WebSocket traffic stays on the main loop thread. Takes the JSON node.
+static void send_ws_json_threadsafe(MyConnection *conn, JsonNode *root) {
+    struct ws_text *t = g_new0(struct ws_text, 1);
+    t->conn = g_object_ref(conn);
+    t->text = json_to_string(root, FALSE);
+    json_node_unref(root);
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, send_ws_text_cb, t, ws_text_free);
+}
+
+static GstElement *conn_get_webrtcbin(MyConnection *conn) {
+    return conn->pipeline != NULL ? gst_bin_get_by_name(GST_BIN(conn->pipeline), "webrtc") : NULL;
+}
+
+static gboolean data_channels_open_cb(gpointer user_data) {
+    MyConnection *conn = user_data;
+    if (atomic_load(&conn->data_channels_open) == DATA_CHANNELS_ALL_OPEN) {
+        conn_update_status(conn, MY_STATUS_CONNECTED);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/// Index of one of our data channels, -1 if it isn't one.
+static int data_channel_index(MyConnection *conn, GstWebRTCDataChannel *channel) {
+    int index = -1;
+    g_mutex_lock(&conn->data_channel_lock);
+    for (int i = 0; i < DATA_CHANNEL_COUNT; i++) {
+        if (conn->data_channels[i] == channel) {
+            index = i;
+            break;
+        }
+    }
+    g_mutex_unlock(&conn->data_channel_lock);
+    return index;
+}
+
+static void mark_data_channel_open(MyConnection *conn, int index) {
+    const uint32_t bit = 1u << index;
+    if ((atomic_fetch_or(&conn->data_channels_open, bit) & bit) != 0) {
+        return;
+    }
+    ALOGI("Data channel %s open", data_channel_descs[index].label);
+    if (atomic_load(&conn->data_channels_open) == DATA_CHANNELS_ALL_OPEN) {
+        g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, data_channels_open_cb, g_object_ref(conn), g_object_unref);
+        wake_enet_thread(conn);
+    }
+}
+
+static void on_data_channel_open_cb(GstWebRTCDataChannel *channel, MyConnection *conn) {
+    const int index = data_channel_index(conn, channel);
+    if (index >= 0) {
+        mark_data_channel_open(conn, index);
+    }
+}
+
+static void on_data_channel_close_cb(GstWebRTCDataChannel *channel, MyConnection *conn) {
+    const int index = data_channel_index(conn, channel);
+    if (index >= 0) {
+        atomic_fetch_and(&conn->data_channels_open, ~(1u << index));
+        ALOGW("Data channel %s closed", data_channel_descs[index].label);
+    }
+}
+
+static void on_data_channel_message_cb(GstWebRTCDataChannel *channel, GBytes *data, MyConnection *conn) {
+    const int index = data_channel_index(conn, channel);
+    if (index < 0 || data == NULL) {
+        return;
+    }
+
+    // Clock sync and acks belong to the ENet thread, like with ENet.
+    struct data_channel_message *msg = g_new0(struct data_channel_message, 1);
+    msg->enet_channel = data_channel_descs[index].enet_channel;
+    msg->received_ns = my_telemetry_now_ns();
+    msg->data = g_bytes_ref(data);
+    g_async_queue_push(conn->data_channel_inbox, msg);
+    wake_enet_thread(conn);
+}
+
+static void on_data_channel_cb(GstElement *webrtcbin, GstWebRTCDataChannel *channel, MyConnection *conn) {
+    g_autofree gchar *label = NULL;
+    g_object_get(channel, "label", &label, NULL);
+
+    int index = -1;
+    for (int i = 0; i < DATA_CHANNEL_COUNT; i++) {
+        if (g_strcmp0(label, data_channel_descs[i].label) == 0) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        ALOGW("%s: ignoring unknown data channel %s", __FUNCTION__, label);
+        return;
+    }
+
+    g_mutex_lock(&conn->data_channel_lock);
+    if (conn->data_channels[index] != NULL) {
+        g_signal_handlers_disconnect_by_data(conn->data_channels[index], conn);
+    }
+    g_set_object(&conn->data_channels[index], channel);
+    g_mutex_unlock(&conn->data_channel_lock);
+
+    g_signal_connect(channel, "on-open", G_CALLBACK(on_data_channel_open_cb), conn);
+    g_signal_connect(channel, "on-close", G_CALLBACK(on_data_channel_close_cb), conn);
+    g_signal_connect(channel, "on-message-data", G_CALLBACK(on_data_channel_message_cb), conn);
+
+    // Channels the remote end opened are usually open by the time we see them.
+    GstWebRTCDataChannelState state = GST_WEBRTC_DATA_CHANNEL_STATE_CLOSED;
+    g_object_get(channel, "ready-state", &state, NULL);
+    if (state == GST_WEBRTC_DATA_CHANNEL_STATE_OPEN) {
+        mark_data_channel_open(conn, index);
+    }
+}
+
+/// Send on one of our data channels, false if it isn't open. ENet thread only.
+static bool send_data_channel(MyConnection *conn, enum data_channel index, const uint8_t *data, size_t size) {
+    if ((atomic_load(&conn->data_channels_open) & (1u << index)) == 0) {
+        return false;
+    }
+
+    g_mutex_lock(&conn->data_channel_lock);
+    GstWebRTCDataChannel *channel =
+        conn->data_channels[index] != NULL ? g_object_ref(conn->data_channels[index]) : NULL;
+    g_mutex_unlock(&conn->data_channel_lock);
+    if (channel == NULL) {
+        return false;
+    }
+
+    GBytes *bytes = g_bytes_new(data, size);
+    GError *error = NULL;
+    const bool sent = gst_webrtc_data_channel_send_data_full(channel, bytes, &error);
+    if (!sent) {
+        ALOGW("%s: %s: %s", __FUNCTION__, data_channel_descs[index].label, error ? error->message : "unknown error");
+        g_clear_error(&error);
+    }
+    g_bytes_unref(bytes);
+    g_object_unref(channel);
+    return sent;
+}
+
+static void on_ice_candidate_cb(GstElement *webrtcbin, guint mline_index, gchar *candidate, MyConnection *conn) {
+    JsonBuilder *builder = json_builder_new();
+    json_builder_begin_object(builder);
+
+    json_builder_set_member_name(builder, "msg_type");
+    json_builder_add_string_value(builder, "candidate");
+
+    json_builder_set_member_name(builder, "candidate");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "candidate");
+    json_builder_add_string_value(builder, candidate);
+    json_builder_set_member_name(builder, "sdpMLineIndex");
+    json_builder_add_int_value(builder, mline_index);
+    json_builder_end_object(builder);
+
+    json_builder_end_object(builder);
+
+    send_ws_json_threadsafe(conn, json_builder_get_root(builder));
+    g_object_unref(builder);
+}
+
+struct answer_request {
+    MyConnection *conn;
+    GstElement *webrtcbin;
+};
+
+static void answer_request_free(gpointer data) {
+    struct answer_request *request = data;
+    g_object_unref(request->conn);
+    gst_object_unref(request->webrtcbin);
+    g_free(request);
+}
+
+/// Runs on the webrtcbin's thread.
+static void on_answer_created_cb(GstPromise *promise, gpointer user_data) {
+    struct answer_request *request = user_data;
+
+    GstWebRTCSessionDescription *answer = NULL;
+    if (gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED) {
+        const GstStructure *reply = gst_promise_get_reply(promise);
+        gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+    }
+    gst_promise_unref(promise);
+    if (answer == NULL) {
+        ALOGE("%s: webrtcbin could not answer the offer", __FUNCTION__);
+        return;
+    }
+
+    g_signal_emit_by_name(request->webrtcbin, "set-local-description", answer, NULL);
+
+    gchar *sdp = gst_sdp_message_as_text(answer->sdp);
+    JsonBuilder *builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msg_type");
+    json_builder_add_string_value(builder, "answer");
+    json_builder_set_member_name(builder, "sdp");
+    json_builder_add_string_value(builder, sdp);
+    json_builder_end_object(builder);
+
+    ALOGI("Sending SDP answer");
+    send_ws_json_threadsafe(request->conn, json_builder_get_root(builder));
+    g_object_unref(builder);
+    g_free(sdp);
+    gst_webrtc_session_description_free(answer);
+}
+
+static void conn_handle_offer(MyConnection *conn, JsonObject *msg) {
+    GstElement *webrtcbin = conn_get_webrtcbin(conn);
+    if (webrtcbin == NULL) {
+        ALOGW("%s: no webrtcbin to take the offer", __FUNCTION__);
+        return;
+    }
+
+    const gchar *text = json_object_has_member(msg, "sdp") ? json_object_get_string_member(msg, "sdp") : NULL;
+    GstSDPMessage *sdp = NULL;
+    if (text == NULL || gst_sdp_message_new_from_text(text, &sdp) != GST_SDP_OK) {
+        ALOGE("%s: bad SDP offer", __FUNCTION__);
+        gst_object_unref(webrtcbin);
+        return;
+    }
+    conn_update_status(conn, MY_STATUS_NEGOTIATING);
+
+    // Takes the SDP message.
+    GstWebRTCSessionDescription *offer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_OFFER, sdp);
+    g_signal_emit_by_name(webrtcbin, "set-remote-description", offer, NULL);
+    gst_webrtc_session_description_free(offer);
+
+    struct answer_request *request = g_new0(struct answer_request, 1);
+    request->conn = g_object_ref(conn);
+    request->webrtcbin = gst_object_ref(webrtcbin);
+    GstPromise *promise = gst_promise_new_with_change_func(on_answer_created_cb, request, answer_request_free);
+    g_signal_emit_by_name(webrtcbin, "create-answer", NULL, promise);
+
+    gst_object_unref(webrtcbin);
+}
+
+static void conn_handle_candidate(MyConnection *conn, JsonObject *msg) {
+    JsonObject *candidate =
+        json_object_has_member(msg, "candidate") ? json_object_get_object_member(msg, "candidate") : NULL;
+    if (candidate == NULL || !json_object_has_member(candidate, "candidate") ||
+        !json_object_has_member(candidate, "sdpMLineIndex")) {
+        ALOGW("%s: bad candidate", __FUNCTION__);
+        return;
+    }
+    const gchar *text = json_object_get_string_member(candidate, "candidate");
+    // An empty one ends the server's candidates.
+    if (text == NULL || text[0] == '\0') {
+        return;
+    }
+
+    GstElement *webrtcbin = conn_get_webrtcbin(conn);
+    if (webrtcbin == NULL) {
+        return;
+    }
+    const guint mline_index = (guint)json_object_get_int_member(candidate, "sdpMLineIndex");
+    g_signal_emit_by_name(webrtcbin, "add-ice-candidate", mline_index, text);
+    gst_object_unref(webrtcbin);
+}
+
+static double json_get_double_or_zero(JsonObject *msg, const gchar *name) {
+    return json_object_has_member(msg, name) ? json_object_get_double_member(msg, name) : 0.0;
+}
+
+static void conn_handle_twcc_stats(MyConnection *conn, JsonObject *msg) {
+    conn->twcc_stats.sent_kbps = (int32_t)json_get_double_or_zero(msg, "sent_kbps");
+    conn->twcc_stats.received_kbps = (int32_t)json_get_double_or_zero(msg, "received_kbps");
+    conn->twcc_stats.loss_percent = (float)json_get_double_or_zero(msg, "loss_percent");
+    conn->twcc_stats.delay_gradient_ms = (float)json_get_double_or_zero(msg, "delay_gradient_ms");
+    conn->twcc_stats_fresh = true;
+}
+
 static void conn_on_ws_message_cb(SoupWebsocketConnection *connection, gint type, GBytes *message, MyConnection *conn) {
-    // ALOGD("%s", __FUNCTION__);
     gsize length = 0;
     const gchar *msg_data = g_bytes_get_data(message, &length);
+    if (length > G_MAXSSIZE) {
+        return;
+    }
+
     JsonParser *parser = json_parser_new();
     GError *error = NULL;
 
-    // TODO convert gsize to gssize after range check
-
-    //    if (json_parser_load_from_data(parser, msg_data, length, &error)) {
-    //        JsonObject *msg = json_node_get_object(json_parser_get_root(parser));
-    //        const gchar *msg_type;
-    //
-    //        if (!json_object_has_member(msg, "msg")) {
-    //            // Invalid message
-    //            goto out;
-    //        }
-    //
-    //        msg_type = json_object_get_string_member(msg, "msg");
-    //        // ALOGI("Websocket message received: %s", msg_type);
-    //
-    //        if (g_str_equal(msg_type, "offer")) {
-    //            const gchar *offer_sdp = json_object_get_string_member(msg, "sdp");
-    //            conn_webrtc_process_sdp_offer(conn, offer_sdp);
-    //        } else if (g_str_equal(msg_type, "candidate")) {
-    //            JsonObject *candidate;
-    //
-    //            candidate = json_object_get_object_member(msg, "candidate");
-    //
-    //            conn_webrtc_process_candidate(conn,
-    //                                          json_object_get_int_member(candidate, "sdpMLineIndex"),
-    //                                          json_object_get_string_member(candidate, "candidate"));
-    //        }
-    //    } else {
-    //        g_debug("Error parsing message: %s", error->message);
-    //        g_clear_error(&error);
-    //    }
+    if (json_parser_load_from_data(parser, msg_data, (gssize)length, &error)) {
+        JsonNode *root = json_parser_get_root(parser);
+        JsonObject *msg = root != NULL && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+
+        if (msg == NULL || !json_object_has_member(msg, "msg_type")) {
+            // Not one of ours, e.g. relayed from another peer.
+            goto out;
+        }
+
+        const gchar *msg_type = json_object_get_string_member(msg, "msg_type");
+        if (g_strcmp0(msg_type, "stream_info") == 0) {
+            conn_handle_stream_info(conn, msg);
+        } else if (g_strcmp0(msg_type, "offer") == 0) {
+            conn_handle_offer(conn, msg);
+        } else if (g_strcmp0(msg_type, "candidate") == 0) {
+            conn_handle_candidate(conn, msg);
+        } else if (g_strcmp0(msg_type, "twcc_stats") == 0) {
+            conn_handle_twcc_stats(conn, msg);
+        }
+    } else {
+        ALOGW("Error parsing message: %s", error->message);
+        g_clear_error(&error);
+    }
 
 out:
     g_object_unref(parser);
@@ -433,6 +991,38 @@ void my_connection_send_stream_config(MyConnection *conn) {
     json_builder_set_member_name(builder, "pin");
     json_builder_add_string_value(builder, config.pin);
 
+    json_builder_set_member_name(builder, "fec_percentage");
+    json_builder_add_int_value(builder, config.fec_percentage);
+
+    json_builder_set_member_name(builder, "ten_bit");
+    json_builder_add_boolean_value(builder, config.ten_bit);
+
+    json_builder_set_member_name(builder, "display_count");
+    json_builder_add_int_value(builder, MAX(config.display_count, 1));
+
+    json_builder_set_member_name(builder, "transport");
+    json_builder_add_string_value(builder, config.transport == MY_TRANSPORT_WEBRTC ? "webrtc" : "rtp");
+
+    if (conn->session_token != NULL) {
+        json_builder_set_member_name(builder, "session_token");
+        json_builder_add_string_value(builder, conn->session_token);
+    }
+
+    // The server answers with stream_info, naming the first of these it can encode.
+    json_builder_set_member_name(builder, "codecs");
+    json_builder_begin_array(builder);
+    for (int i = 0; i < config.codec_count; i++) {
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "name");
+        json_builder_add_string_value(builder, my_video_codec_get_desc(config.codecs[i].codec)->name);
+        json_builder_set_member_name(builder, "max_width");
+        json_builder_add_int_value(builder, config.codecs[i].max_width);
+        json_builder_set_member_name(builder, "max_height");
+        json_builder_add_int_value(builder, config.codecs[i].max_height);
+        json_builder_end_object(builder);
+    }
+    json_builder_end_array(builder);
+
     json_builder_end_object(builder);
 
     JsonNode *root = json_builder_get_root(builder);
@@ -462,6 +1052,7 @@ static void conn_websocket_connected_cb(GObject *session, GAsyncResult *res, MyC
         return;
     }
     g_assert_no_error(error);
+    my_startup_profile_mark(MY_STARTUP_PHASE_WEBSOCKET_CONNECTED);
 
     my_connection_send_stream_config(conn);
 
@@ -472,21 +1063,8 @@ static void conn_websocket_connected_cb(GObject *session, GAsyncResult *res, MyC
 
     g_signal_connect(conn->ws, "closed", G_CALLBACK(conn_websocket_closed_cb), conn);
 
-    ALOGI("Creating pipeline upon WebSocket connection");
-    g_assert_null(conn->pipeline);
-    g_signal_emit(conn, signals[SIGNAL_ON_NEED_PIPELINE], 0);
-    if (conn->pipeline == NULL) {
-        ALOGE("on-need-pipeline signal did not return a pipeline!");
-        my_connection_disconnect(conn);
-        return;
-    }
-
-    // OK, if we get here, we have a websocket connection, and a pipeline fully configured
-    // so we can start the pipeline playing
-
-    ALOGI("Setting pipeline state to PLAYING");
-    gst_element_set_state(GST_ELEMENT(conn->pipeline), GST_STATE_PLAYING);
-    ALOGI("%s: Done with function", __FUNCTION__);
+    // The pipeline depends on the codec, it is created once the server's stream_info arrives.
+    ALOGI("%s: waiting for stream info", __FUNCTION__);
 }
 
 void my_connection_set_pipeline(MyConnection *conn, GstPipeline *pipeline) {
@@ -498,63 +1076,237 @@ void my_connection_set_pipeline(MyConnection *conn, GstPipeline *pipeline) {
     gst_clear_object(&conn->pipeline);
     conn->pipeline = gst_object_ref_sink(pipeline);
 
-    //    conn_update_status(conn, MY_STATUS_NEGOTIATING);
+    if (!conn->webrtc) {
+        return;
+    }
+    // The server offers once its pipeline plays, see conn_handle_offer.
+    GstElement *webrtcbin = conn_get_webrtcbin(conn);
+    if (webrtcbin == NULL) {
+        ALOGE("%s: WebRTC transport, but the pipeline has no webrtcbin", __FUNCTION__);
+        return;
+    }
+    if (conn->config.stun_server[0] != '\0') {
+        g_object_set(webrtcbin, "stun-server", conn->config.stun_server, NULL);
+    }
+    g_signal_connect(webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate_cb), conn);
+    g_signal_connect(webrtcbin, "on-data-channel", G_CALLBACK(on_data_channel_cb), conn);
+    gst_object_unref(webrtcbin);
+}
+
+static void handle_input_ack(MyConnection *conn, const uint8_t *data, size_t size) {
+    if (size != CONTROL_INPUT_ACK_SIZE) {
+        ALOGW("%s: bad size %zu", __FUNCTION__, size);
+        return;
+    }
+
+    uint32_t sequence;
+    int64_t server_time_ns;
+    memcpy(&sequence, data + 1, sizeof(sequence));
+    memcpy(&server_time_ns, data + 5, sizeof(server_time_ns));
+
+    struct my_clock_estimate estimate;
+    if (!my_clock_sync_get_estimate(conn->clock_sync, &estimate)) {
+        return;
+    }
+
+    // Only ever move forward, the predictor compares against the newest command it sent.
+    if ((int32_t)(sequence - atomic_load(&conn->acked_input_sequence)) <= 0) {
+        return;
+    }
+    atomic_store(&conn->acked_input_time_ns, server_time_ns - estimate.offset_ns);
+    atomic_store(&conn->acked_input_sequence, sequence);
+}
+
+static void handle_control_message(MyConnection *conn, const uint8_t *data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    switch (data[0]) {
+        case CONTROL_INPUT_ACK:
+            handle_input_ack(conn, data, size);
+            break;
+        default:
+            ALOGW("%s: unknown control message %u", __FUNCTION__, data[0]);
+            break;
+    }
+}
+
+/// A message from the server on an ENet channel, or the data channel standing in for it. ENet thread only.
+static void handle_channel_message(
+    MyConnection *conn, uint8_t channel_id, const uint8_t *data, size_t size, int64_t received_ns) {
+    if (channel_id == MY_CLOCK_SYNC_ENET_CHANNEL) {
+        if (!my_clock_sync_handle_pong(conn->clock_sync, data, size, received_ns)) {
+            ALOGW("Received an invalid clock sync packet.");
+        }
+    } else if (channel_id == ENET_CHANNEL_CONTROL) {
+        handle_control_message(conn, data, size);
+    } else {
+        ALOGI("Received a packet on channel %u.", channel_id);
+    }
 }
 
-void handle_enet_event(ENetEvent *event) {
+static void handle_data_channel_messages(MyConnection *conn) {
+    struct data_channel_message *msg;
+    while ((msg = g_async_queue_try_pop(conn->data_channel_inbox)) != NULL) {
+        gsize size = 0;
+        const uint8_t *data = g_bytes_get_data(msg->data, &size);
+        handle_channel_message(conn, msg->enet_channel, data, size, msg->received_ns);
+        data_channel_message_free(msg);
+    }
+}
+
+static void handle_enet_event(MyConnection *conn, ENetEvent *event) {
     switch (event->type) {
         case ENET_EVENT_TYPE_RECEIVE: {
-            ALOGI("ENet received a packet.");
+            handle_channel_message(
+                conn, event->channelID, event->packet->data, event->packet->dataLength, my_telemetry_now_ns());
             enet_packet_destroy(event->packet);
         } break;
         case ENET_EVENT_TYPE_DISCONNECT: {
             ALOGI("ENet disconnected.");
+            conn->enet_connected = false;
         } break;
         case ENET_EVENT_TYPE_NONE: {
             ALOGI("ENet none event.");
         } break;
         case ENET_EVENT_TYPE_CONNECT: {
             ALOGI("ENet connected.");
+            conn->enet_connected = true;
+            my_startup_profile_mark(MY_STARTUP_PHASE_ENET_CONNECTED);
         } break;
         case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
             ALOGI("ENet disconnect timeout.");
+            conn->enet_connected = false;
         } break;
     }
 }
 
-static void *enet_thread_func(void *ptr) {
-    MyConnection *conn = ptr;
+/*!
+ * Send on an ENet channel, or in WebRTC mode the data channel standing in for it. ENet thread only.
+ *
+ * Unreliable messages go unsequenced.
+ */
+static bool send_message(MyConnection *conn, uint8_t channel_id, bool reliable, const uint8_t *data, size_t size) {
+    if (conn->webrtc) {
+        enum data_channel index = DATA_CHANNEL_CONTROL;
+        if (channel_id == MY_CLOCK_SYNC_ENET_CHANNEL) {
+            index = DATA_CHANNEL_CLOCK_SYNC;
+        } else if (channel_id == ENET_CHANNEL_INPUT) {
+            index = reliable ? DATA_CHANNEL_INPUT : DATA_CHANNEL_INPUT_UNRELIABLE;
+        }
+        return send_data_channel(conn, index, data, size);
+    }
 
-    ENetEvent event = {0};
+    ENetPacket *packet =
+        enet_packet_create(data, size, reliable ? ENET_PACKET_FLAG_RELIABLE : ENET_PACKET_FLAG_UNSEQUENCED);
+    if (packet == NULL) {
+        return false;
+    }
+    int ret = enet_peer_send(conn->peer, channel_id, packet);
+    if (ret) {
+        // Destroy the packet because ENet didn't accept it.
+        enet_packet_destroy(packet);
+        return false;
+    }
+    return true;
+}
+
+/// Whether ENet, or all data channels in WebRTC mode, are connected. ENet thread only.
+static bool transport_connected(MyConnection *conn) {
+    if (conn->webrtc) {
+        return atomic_load(&conn->data_channels_open) == DATA_CHANNELS_ALL_OPEN;
+    }
+    return conn->enet_connected;
+}
+
+static void send_clock_sync_ping(MyConnection *conn) {
+    uint8_t buffer[MY_CLOCK_SYNC_PING_SIZE];
+    size_t size = my_clock_sync_poll_ping(conn->clock_sync, buffer, sizeof(buffer), my_telemetry_now_ns());
+    if (size == 0) {
+        return;
+    }
+
+    // Never retransmit: a resent ping would report a bogus RTT.
+    send_message(conn, MY_CLOCK_SYNC_ENET_CHANNEL, false, buffer, size);
+}
+
+static void send_keyframe_request(MyConnection *conn) {
+    const uint8_t message = CONTROL_KEYFRAME_REQUEST;
+    send_message(conn, ENET_CHANNEL_CONTROL, true, &message, sizeof(message));
+}
 
-    while (conn->enet_thread.running) {
-        if (!conn->client) {
-            continue;
+static void send_input_batch(MyConnection *conn, const struct my_input_batch *batch) {
+    uint8_t buffer[MY_INPUT_BATCH_MAX_SIZE];
+    struct my_clock_estimate estimate;
+    const bool have_clock = my_clock_sync_get_estimate(conn->clock_sync, &estimate);
+    const size_t size = my_input_batch_serialize(batch, have_clock ? &estimate : NULL, buffer, sizeof(buffer));
+    if (size == 0) {
+        return;
+    }
+
+    // A batch of only continuous commands is superseded by the next one, so it's not worth retransmitting.
+    if (!send_message(conn, ENET_CHANNEL_INPUT, batch->reliable, buffer, size)) {
+        ALOGE("%s: failed to send %zu bytes of input", __FUNCTION__, size);
+    }
+}
+
+/// Send everything queued since the last tick, as few packets as possible.
+static void flush_input(MyConnection *conn) {
+    struct my_input_batch batch;
+    my_input_batch_reset(&batch);
+
+    InputCommand cmd;
+    while (my_input_queue_pop(&conn->input_queue, &cmd)) {
+        if (!my_input_batch_add(&batch, &cmd)) {
+            send_input_batch(conn, &batch);
+            my_input_batch_reset(&batch);
+            my_input_batch_add(&batch, &cmd);
         }
+    }
+
+    send_input_batch(conn, &batch);
+}
+
+static void *enet_thread_func(void *ptr) {
+    MyConnection *conn = ptr;
 
-        ENetPacket *packet;
+    ENetEvent event = {0};
 
-        while ((packet = g_async_queue_try_pop(conn->packet_queue)) != NULL) {
-            int channel_id = 0;
-            int ret = enet_peer_send(conn->peer, channel_id, packet);
-            if (ret) {
-                ALOGE("enet_peer_send error: %d", ret);
-                // Destroy the packet because ENet didn't accept it.
-                enet_packet_destroy(packet);
+    // Data channel messages come in through the eventfd too, there is no socket of ours then.
+    struct pollfd fds[2] = {
+        {.fd = conn->enet_wake_fd, .events = POLLIN},
+        {.fd = conn->client != NULL ? conn->client->socket : -1, .events = POLLIN},
+    };
+    const nfds_t fd_count = conn->client != NULL ? 2 : 1;
+
+    while (enet_thread_running(conn)) {
+        handle_data_channel_messages(conn);
+        flush_input(conn);
+
+        if (transport_connected(conn)) {
+            send_clock_sync_ping(conn);
+            if (atomic_exchange(&conn->keyframe_request_pending, false)) {
+                send_keyframe_request(conn);
             }
         }
 
-        // Flush the host to ensure the packet is sent immediately
-        enet_host_flush(conn->client);
+        if (conn->client != NULL) {
+            // Handle everything that arrived, this also sends what we queued above and runs ENet's timers.
+            while (enet_host_service(conn->client, &event, 0) > 0) {
+                handle_enet_event(conn, &event);
+            }
 
-        // Block for up to 10 milliseconds, or until an event occurs
-        if (enet_host_service(conn->client, &event, 10) > 0) {
-            // Handle the event
-            handle_enet_event(&event);
+            // Flush the host to ensure the packet is sent immediately
+            enet_host_flush(conn->client);
+        }
 
-            // Check for more events that might have arrived quickly
-            while (enet_host_service(conn->client, &event, 0) > 0) {
-                handle_enet_event(&event);
+        const int timeout_ms = conn->peer != NULL && !enet_list_empty(&conn->peer->sentReliableCommands)
+                                   ? ENET_RETRANSMIT_POLL_MS
+                                   : ENET_IDLE_POLL_MS;
+        if (poll(fds, fd_count, timeout_ms) > 0 && (fds[0].revents & POLLIN)) {
+            uint64_t count;
+            if (read(conn->enet_wake_fd, &count, sizeof(count)) < 0) {
+                ALOGW("%s: failed to read the wakeup eventfd", __FUNCTION__);
             }
         }
     }
@@ -582,13 +1334,23 @@ void my_connection_connect(MyConnection *conn) {
                                          conn);                                                  // user_data
 
     conn_update_status(conn, MY_STATUS_CONNECTING);
+    conn->server_closed = false;
+
+    // In WebRTC mode the data channels come with the peer connection, only the ENet thread is left to run.
+    conn->webrtc = conn->config.transport == MY_TRANSPORT_WEBRTC;
+    conn->twcc_stats_fresh = false;
+
+    // ENet, deinitialized again by my_connection_disconnect.
+    if (!conn->webrtc) {
+        if (enet_initialize() != 0) {
+            ALOGE("An error occurred while initializing ENet.");
+            abort();
+        }
 
-    // ENet
-    {
         ENetHost *client = {0};
         client = enet_host_create(NULL /* create a client host */,
                                   1 /* only allow 1 outgoing connection */,
-                                  2 /* allow up 2 channels to be used, 0 and 1 */,
+                                  ENET_CHANNEL_COUNT /* input, clock sync and control */,
                                   0 /* assume any amount of incoming bandwidth */,
                                   0 /* assume any amount of outgoing bandwidth */);
         if (client == NULL) {
@@ -602,30 +1364,48 @@ void my_connection_connect(MyConnection *conn) {
         enet_address_set_host(&address, conn->host_address);
         address.port = 7777;
 
-        /* Initiate the connection, allocating the two channels 0 and 1. */
-        peer = enet_host_connect(client, &address, 2, 0);
+        /* Initiate the connection, allocating the channels 0 to 2. */
+        peer = enet_host_connect(client, &address, ENET_CHANNEL_COUNT, 0);
         if (peer == NULL) {
             ALOGE("No available peers for initiating an ENet connection.");
             exit(EXIT_FAILURE);
         }
         conn->peer = peer;
+    }
 
-        conn->packet_queue = g_async_queue_new_full((GDestroyNotify)enet_packet_destroy);
-
-        int ret = os_thread_helper_start(&conn->enet_thread, &enet_thread_func, conn);
-        (void)ret;
-        g_assert(ret == 0);
+    // Input and wakeups left over from the last connection. The ENet thread isn't running, so this is the consumer for
+    // now. The queue and eventfd stay, producers may still use them.
+    InputCommand stale_command;
+    while (my_input_queue_pop(&conn->input_queue, &stale_command)) {
+    }
+    uint64_t stale_wakeups;
+    if (read(conn->enet_wake_fd, &stale_wakeups, sizeof(stale_wakeups)) < 0 && errno != EAGAIN) {
+        ALOGW("%s: failed to reset the wakeup eventfd", __FUNCTION__);
     }
+
+    conn->enet_connected = false;
+    my_clock_sync_reset(conn->clock_sync);
+    atomic_store(&conn->keyframe_request_pending, false);
+    atomic_store(&conn->last_keyframe_request_ns, 0);
+    atomic_store(&conn->input_sequence, 0);
+    atomic_store(&conn->acked_input_sequence, 0);
+    atomic_store(&conn->acked_input_time_ns, 0);
+
+    // Input goes out from here, it should not wait behind decoding or UI work. The work is small, so any core
+    // that wakes up first will do.
+    const struct os_thread_params params = {
+        .name = "enet",
+        .nice = OS_THREAD_PRIORITY_DISPLAY,
+        .cpus = OS_THREAD_CPUS_ANY,
+    };
+    int ret = os_thread_helper_start_with_params(&conn->enet_thread, &enet_thread_func, conn, &params);
+    (void)ret;
+    g_assert(ret == 0);
 }
 
 /* public (non-GObject) methods */
 
 MyConnection *my_connection_new(const gchar *websocket_uri, const gchar *host_address) {
-    if (enet_initialize() != 0) {
-        printf("An error occurred while initializing ENet.\n");
-        abort();
-    }
-
     ALOGI("New connection to: %s", websocket_uri);
 
     MyConnection *conn = MY_CONNECTION(
@@ -637,11 +1417,6 @@ MyConnection *my_connection_new(const gchar *websocket_uri, const gchar *host_ad
 }
 
 MyConnection *my_connection_new_localhost() {
-    if (enet_initialize() != 0) {
-        printf("An error occurred while initializing ENet.\n");
-        abort();
-    }
-
     MyConnection *conn = MY_CONNECTION(g_object_new(MY_TYPE_CONNECTION, NULL));
 
     g_assert(os_thread_helper_init(&conn->enet_thread) >= 0);
@@ -659,65 +1434,245 @@ bool my_connection_send_bytes(MyConnection *conn, GBytes *bytes) {
 }
 
 bool my_connection_server_closed(MyConnection *conn) {
-    return conn->server_closed;
+    return conn->server_closed && !atomic_load(&conn->resume_pending);
 }
 
 void my_connection_set_stream_config(MyConnection *conn, struct StreamConfig *config) {
     conn->config = *config;
 }
 
-const int COMMAND_SIZE = sizeof(InputCommand);
+struct my_clock_sync *my_connection_get_clock_sync(MyConnection *conn) {
+    return conn->clock_sync;
+}
 
-void my_connection_send_input_command_via_enet(MyConnection *conn, InputCommand *input_data) {
-    ENetPacketFlag flag = ENET_PACKET_FLAG_RELIABLE;
+void my_connection_get_stream_config(MyConnection *conn, struct StreamConfig *out_config) {
+    *out_config = conn->config;
+}
 
-    // For input commands that are continuous.
-    if (input_data->type == CursorMove || input_data->type == CursorScroll || input_data->type == GamepadLeftStick ||
-        input_data->type == GamepadRightStick || input_data->type == GamepadButtonLT ||
-        input_data->type == GamepadButtonRT) {
-        flag = ENET_PACKET_FLAG_UNSEQUENCED;
+void my_connection_request_keyframe(MyConnection *conn) {
+    const int64_t now_ns = my_telemetry_now_ns();
+
+    int64_t interval_ns = KEYFRAME_REQUEST_MIN_INTERVAL_NS;
+    struct my_clock_estimate estimate;
+    if (my_clock_sync_get_estimate(conn->clock_sync, &estimate)) {
+        // The keyframe can't show up before a round trip.
+        interval_ns += estimate.rtt_ns;
     }
 
-    // To guarantee that the first byte of your ENet packet is exactly input_type and to avoid any compiler-imposed
-    // memory alignment headaches on ARM, you must create a plain char[] buffer and manually copy/serialize the fields
-    // one by one on the C++ client side.
-    //
-    // This is the only way to be 100% certain of the memory layout on an ambiguous architecture like ARM/Android.
-    uint8_t buffer[sizeof(InputCommand)];
-    size_t offset = 0;
-    {
-        // 1. input_type (u8): Copy raw byte
-        // This MUST be the first byte in the packet.
-        buffer[offset++] = input_data->type;
+    int64_t last_ns = atomic_load(&conn->last_keyframe_request_ns);
+    if (now_ns - last_ns < interval_ns) {
+        return;
+    }
+    // Loss is reported from several streaming threads, only one of them gets to send.
+    if (!atomic_compare_exchange_strong(&conn->last_keyframe_request_ns, &last_ns, now_ns)) {
+        return;
+    }
 
-        // 2. x_value (i32): Copy raw bytes
-        // We assume ARM/Android is Little-Endian, so raw copy is sufficient.
-        // Use htonl/ntohl if you wanted Big-Endian (Network Byte Order).
-        memcpy(buffer + offset, &input_data->data0, sizeof(int32_t));
-        offset += sizeof(int32_t);
+    ALOGI("%s: requesting a keyframe", __FUNCTION__);
+    atomic_store(&conn->keyframe_request_pending, true);
+    wake_enet_thread(conn);
+}
 
-        // 3. y_value (i32): Copy raw bytes
-        memcpy(buffer + offset, &input_data->data1, sizeof(int32_t));
-        offset += sizeof(int32_t);
+static void send_control_text(MyConnection *conn, const gchar *msg_type) {
+    gchar *msg_str = g_strdup_printf("{\"msg_type\":\"%s\"}", msg_type);
+    ALOGI("Sent %s", msg_str);
+    soup_websocket_connection_send_text(conn->ws, msg_str);
+    g_free(msg_str);
+}
+
+static gboolean suspend_cb(gpointer user_data) {
+    MyConnection *conn = user_data;
+    if (conn->replay != NULL) {
+        ALOGI("%s: replaying a capture, nothing to pause", __FUNCTION__);
+        return G_SOURCE_REMOVE;
     }
+    if (conn->ws != NULL && !conn->server_closed) {
+        send_control_text(conn, "suspend");
+    }
+    return G_SOURCE_REMOVE;
+}
 
-    // 5. Create and send the ENet packet from the guaranteed-clean buffer
-    if (offset == COMMAND_SIZE) {
-        ENetPacket *packet = enet_packet_create(buffer, COMMAND_SIZE, flag);
-        if (packet) {
-            // We cannot send it directly from here, as ENet is not thread safe.
-            g_async_queue_push(conn->packet_queue, packet);
-        }
-    } else {
-        ALOGE("Wrong command size: %zu", offset);
+static gboolean resume_cb(gpointer user_data) {
+    MyConnection *conn = user_data;
+
+    if (conn->replay != NULL) {
+        // There is no server to reconnect to, the replay just kept sending.
+        atomic_store(&conn->resume_pending, false);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (conn->ws == NULL || conn->server_closed) {
+        // Reconnecting with the session token still skips the server's capture and encoder setup.
+        ALOGI("%s: connection lost while suspended, reconnecting", __FUNCTION__);
+        my_connection_connect(conn);
+        atomic_store(&conn->resume_pending, false);
+        return G_SOURCE_REMOVE;
     }
+    atomic_store(&conn->resume_pending, false);
+
+    send_control_text(conn, "resume");
+
+    // The decoder has nothing to start from without a keyframe, don't let the throttling hold the request back.
+    atomic_store(&conn->last_keyframe_request_ns, 0);
+    my_connection_request_keyframe(conn);
+    return G_SOURCE_REMOVE;
 }
 
-void my_connection_send_input_event(MyConnection *conn, int type, float x, float y) {
+void my_connection_suspend(MyConnection *conn) {
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, suspend_cb, g_object_ref(conn), g_object_unref);
+}
+
+void my_connection_resume(MyConnection *conn) {
+    atomic_store(&conn->resume_pending, true);
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, resume_cb, g_object_ref(conn), g_object_unref);
+}
+
+static gboolean replay_poll_cb(gpointer user_data) {
+    MyConnection *conn = user_data;
+
+    struct my_rtp_replay_stats stats;
+    my_rtp_replay_get_stats(conn->replay, &stats);
+    if (!stats.finished || my_telemetry_now_ns() - stats.finished_ns < REPLAY_DRAIN_NS) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    ALOGI("%s: replay finished", __FUNCTION__);
+    conn->replay_poll_id = 0;
+    g_signal_emit(conn, signals[SIGNAL_ON_REPLAY_DONE], 0);
+    conn->server_closed = true;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean start_replay_cb(gpointer user_data) {
+    MyConnection *conn = user_data;
+
+    my_connection_disconnect(conn);
+    conn->server_closed = false;
+    conn->webrtc = false;
+
+    conn_start_pipeline(conn);
+    if (conn->pipeline == NULL) {
+        return G_SOURCE_REMOVE;
+    }
+
+    conn->replay = my_rtp_replay_start(&conn->replay_config);
+    if (conn->replay == NULL) {
+        ALOGE("%s: could not replay %s", __FUNCTION__, conn->replay_config.capture_path);
+        my_connection_disconnect(conn);
+        conn->server_closed = true;
+        return G_SOURCE_REMOVE;
+    }
+    conn_update_status(conn, MY_STATUS_CONNECTED);
+    conn->replay_poll_id = g_timeout_add(REPLAY_POLL_INTERVAL_MS, replay_poll_cb, conn);
+    return G_SOURCE_REMOVE;
+}
+
+void my_connection_start_replay(MyConnection *conn, const struct my_rtp_replay_config *config) {
+    conn->replay_config = *config;
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, start_replay_cb, g_object_ref(conn), g_object_unref);
+}
+
+bool my_connection_is_replay(MyConnection *conn) {
+    return conn->replay_config.capture_path[0] != '\0';
+}
+
+bool my_connection_get_replay_stats(MyConnection *conn, struct my_rtp_replay_stats *out_stats) {
+    if (conn->replay == NULL) {
+        return false;
+    }
+    my_rtp_replay_get_stats(conn->replay, out_stats);
+    return true;
+}
+
+void my_connection_send_encoder_config(MyConnection *conn, int bitrate_kbps, int video_width, int video_height) {
+    if (conn->ws == NULL) {
+        ALOGW("Cannot send encoder config without a WebSocket connection");
+        return;
+    }
+
+    JsonBuilder *builder = json_builder_new();
+    json_builder_begin_object(builder);
+
+    json_builder_set_member_name(builder, "msg_type");
+    json_builder_add_string_value(builder, "encoder_config");
+
+    json_builder_set_member_name(builder, "bitrate_kbps");
+    json_builder_add_int_value(builder, bitrate_kbps);
+
+    json_builder_set_member_name(builder, "video_width");
+    json_builder_add_int_value(builder, video_width);
+
+    json_builder_set_member_name(builder, "video_height");
+    json_builder_add_int_value(builder, video_height);
+
+    json_builder_end_object(builder);
+
+    JsonNode *root = json_builder_get_root(builder);
+
+    gchar *msg_str = json_to_string(root, FALSE);
+    ALOGI("Sent encoder config: %s", msg_str);
+
+    soup_websocket_connection_send_text(conn->ws, msg_str);
+
+    g_clear_pointer(&msg_str, g_free);
+
+    json_node_unref(root);
+    g_object_unref(builder);
+}
+
+static uint32_t queue_input_command(MyConnection *conn, InputCommand *input_data) {
+    input_data->sequence = atomic_fetch_add(&conn->input_sequence, 1) + 1;
+    if (input_data->timestamp_ns == 0) {
+        input_data->timestamp_ns = my_telemetry_now_ns();
+    }
+
+    // We cannot send it directly from here, as ENet is not thread safe. The ENet thread batches it with whatever else
+    // arrives before it gets to run.
+    if (!my_input_queue_push(&conn->input_queue, input_data)) {
+        ALOGW("%s: input queue full, dropping command %u", __FUNCTION__, input_data->type);
+        return 0;
+    }
+    wake_enet_thread(conn);
+    return input_data->sequence;
+}
+
+static uint32_t send_command(
+    MyConnection *conn, int type, uint8_t pointer_id, float x, float y, int64_t event_time_ns, uint8_t flags) {
     InputCommand cmd = {0};
     cmd.type = type;
     memcpy(&cmd.data0, &x, sizeof(uint32_t));
     memcpy(&cmd.data1, &y, sizeof(uint32_t));
+    cmd.pointer_id = pointer_id;
+    cmd.timestamp_ns = event_time_ns;
+    cmd.flags = flags;
+
+    return queue_input_command(conn, &cmd);
+}
+
+void my_connection_send_input_event(MyConnection *conn, int type, float x, float y) {
+    send_command(conn, type, 0, x, y, 0, 0);
+}
+
+uint32_t my_connection_send_pointer_event(
+    MyConnection *conn, int type, uint8_t pointer_id, float x, float y, int64_t event_time_ns) {
+    return send_command(conn, type, pointer_id, x, y, event_time_ns, MY_INPUT_COMMAND_FLAG_STROKE);
+}
 
-    my_connection_send_input_command_via_enet(conn, &cmd);
+bool my_connection_take_twcc_stats(MyConnection *conn, struct my_twcc_stats *out_stats) {
+    if (!conn->twcc_stats_fresh) {
+        return false;
+    }
+    conn->twcc_stats_fresh = false;
+    *out_stats = conn->twcc_stats;
+    return true;
+}
+
+bool my_connection_get_input_ack(MyConnection *conn, uint32_t *out_sequence, int64_t *out_time_ns) {
+    const uint32_t sequence = atomic_load(&conn->acked_input_sequence);
+    if (sequence == 0) {
+        return false;
+    }
+    *out_sequence = sequence;
+    *out_time_ns = atomic_load(&conn->acked_input_time_ns);
+    return true;
 }
@@ -4,12 +4,24 @@
 #include <gst/gstpipeline.h>
 #include <stdbool.h>
 
+#include "clock_sync.h"
+#include "rtp_replay.h"
 #include "stream_config.h"
 
 G_BEGIN_DECLS
 
 #define MY_TYPE_CONNECTION my_connection_get_type()
 
+/// Transport-wide congestion control feedback over one report interval, as the server's webrtcbin saw it.
+struct my_twcc_stats {
+    int32_t sent_kbps;
+    /// What the client acknowledged receiving.
+    int32_t received_kbps;
+    float loss_percent;
+    /// Mean change of the one way delay between packet groups, positive while a queue builds up.
+    float delay_gradient_ms;
+};
+
 G_DECLARE_FINAL_TYPE(MyConnection, my_connection, MY, CONNECTION, GObject)
 
 /*!
@@ -27,11 +39,49 @@ MyConnection *my_connection_new_localhost();
  */
 void my_connection_connect(MyConnection *conn);
 
+/*!
+ * Play a recorded capture into the pipeline instead of connecting to a server, for benchmarking.
+ *
+ * The pipeline gets built for the codec in the stream config and fed over loopback by @ref my_rtp_replay. Once it
+ * sent everything and the pipeline drained, on-replay-done is emitted and the connection reports itself closed. Use
+ * instead of @ref my_connection_connect.
+ *
+ * Thread safe, runs on the main loop thread.
+ */
+void my_connection_start_replay(MyConnection *conn, const struct my_rtp_replay_config *config);
+
+/// Whether @ref my_connection_start_replay was used, already true by the time on-need-pipeline is emitted.
+bool my_connection_is_replay(MyConnection *conn);
+
+/*!
+ * Progress of the running replay. Main loop thread only.
+ *
+ * @return false if nothing is being replayed.
+ */
+bool my_connection_get_replay_stats(MyConnection *conn, struct my_rtp_replay_stats *out_stats);
+
 /*!
  * Drop the server connection, if any.
  */
 void my_connection_disconnect(MyConnection *conn);
 
+/*!
+ * Tell the server we have no window to show the stream on, so it can pause encoding. The connection stays up.
+ *
+ * Thread safe, runs on the main loop thread.
+ */
+void my_connection_suspend(MyConnection *conn);
+
+/*!
+ * Undo @ref my_connection_suspend and ask for a keyframe right away.
+ *
+ * If the connection dropped meanwhile this reconnects, and the server resumes the session from the token it gave us,
+ * keeping its pipeline running.
+ *
+ * Thread safe, runs on the main loop thread.
+ */
+void my_connection_resume(MyConnection *conn);
+
 /*!
  * Send a message to the server over data channel.
  */
@@ -39,10 +89,36 @@ bool my_connection_send_bytes(MyConnection *conn, GBytes *bytes);
 
 void my_connection_send_input_event(MyConnection *conn, int type, float x, float y);
 
+/*!
+ * Send a touch or cursor command.
+ *
+ * Unlike @ref my_connection_send_input_event, moves are never coalesced with later ones, so every sample of a stroke
+ * reaches the server.
+ *
+ * Thread safe.
+ *
+ * @param pointer_id Touch pointer the command comes from.
+ * @param event_time_ns When the input happened, CLOCK_MONOTONIC. 0 for now.
+ * @return Sequence number of the command, 0 if it was dropped.
+ */
+uint32_t my_connection_send_pointer_event(
+    MyConnection *conn, int type, uint8_t pointer_id, float x, float y, int64_t event_time_ns);
+
+/*!
+ * Newest input command the server reported as injected.
+ *
+ * Thread safe.
+ *
+ * @param[out] out_time_ns When the server injected it, mapped to our CLOCK_MONOTONIC.
+ * @return false until the first acknowledgement with a clock estimate.
+ */
+bool my_connection_get_input_ack(MyConnection *conn, uint32_t *out_sequence, int64_t *out_time_ns);
+
 /*!
  * Assign a pipeline for use.
  *
- * Will be started when the websocket connection comes up in order to negotiate using the webrtcbin.
+ * Will be started when the websocket connection comes up. With the WebRTC transport its webrtcbin, named "webrtc",
+ * answers the server's offer.
  */
 void my_connection_set_pipeline(MyConnection *conn, GstPipeline *pipeline);
 
@@ -50,4 +126,34 @@ bool my_connection_server_closed(MyConnection *conn);
 
 void my_connection_set_stream_config(MyConnection *conn, struct StreamConfig *config);
 
+/*!
+ * Clock offset estimate against the server, maintained over ENet or its data channel.
+ *
+ * Owned by the connection and valid for its lifetime.
+ */
+struct my_clock_sync *my_connection_get_clock_sync(MyConnection *conn);
+
+void my_connection_get_stream_config(MyConnection *conn, struct StreamConfig *out_config);
+
+/*!
+ * Ask the server to re-target the running encoder.
+ *
+ * Must be called from the main loop thread, like all WebSocket traffic.
+ */
+void my_connection_send_encoder_config(MyConnection *conn, int bitrate_kbps, int video_width, int video_height);
+
+/*!
+ * Newest TWCC report the server forwarded, only in WebRTC mode. Main loop thread only.
+ *
+ * @return false if none arrived since the last call.
+ */
+bool my_connection_take_twcc_stats(MyConnection *conn, struct my_twcc_stats *out_stats);
+
+/*!
+ * Ask the server for a keyframe, e.g. after loss the jitterbuffer and FEC could not repair.
+ *
+ * Thread safe. Requests are dropped while one is still in flight, about a round trip.
+ */
+void my_connection_request_keyframe(MyConnection *conn);
+
 G_END_DECLS
@@ -0,0 +1,62 @@
+#include "cursor_predictor.h"
+
+#include <string.h>
+
+/// Weight of the newest velocity sample, touch reports are noisy enough that a single pair overshoots.
+#define VELOCITY_SMOOTHING 0.5f
+
+void my_cursor_predictor_reset(struct my_cursor_predictor *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+void my_cursor_predictor_update(
+    struct my_cursor_predictor *p, float x, float y, uint32_t sequence, int64_t event_time_ns, bool down) {
+    if (p->tracking && event_time_ns > p->last_event_ns) {
+        const float dt = (float)(event_time_ns - p->last_event_ns);
+        p->velocity_x += VELOCITY_SMOOTHING * ((x - p->x) / dt - p->velocity_x);
+        p->velocity_y += VELOCITY_SMOOTHING * ((y - p->y) / dt - p->velocity_y);
+    } else {
+        p->velocity_x = 0;
+        p->velocity_y = 0;
+    }
+
+    p->x = x;
+    p->y = y;
+    p->last_event_ns = event_time_ns;
+    p->tracking = down;
+    if (sequence != 0) {
+        p->sequence = sequence;
+        p->visible = true;
+    }
+}
+
+void my_cursor_predictor_confirm(struct my_cursor_predictor *p,
+                                 int64_t frame_capture_ns,
+                                 uint32_t acked_sequence,
+                                 int64_t acked_time_ns) {
+    if (!p->visible || (int32_t)(acked_sequence - p->sequence) < 0) {
+        return;
+    }
+    if (frame_capture_ns >= acked_time_ns) {
+        p->visible = false;
+    }
+}
+
+bool my_cursor_predictor_get_position(const struct my_cursor_predictor *p,
+                                      int64_t display_time_ns,
+                                      float *out_x,
+                                      float *out_y) {
+    if (!p->visible) {
+        return false;
+    }
+
+    *out_x = p->x;
+    *out_y = p->y;
+    // No new sample for that long means the finger rests, Android only reports moves.
+    const int64_t ahead_ns = display_time_ns - p->last_event_ns;
+    if (p->tracking && ahead_ns > 0 && ahead_ns <= MY_CURSOR_PREDICTION_MAX_NS) {
+        *out_x += p->velocity_x * (float)ahead_ns;
+        *out_y += p->velocity_y * (float)ahead_ns;
+    }
+    return true;
+}
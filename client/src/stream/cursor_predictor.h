@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Never extrapolate further ahead than this, a wrong guess gets worse the further out it goes. Beyond it the finger
+/// is treated as resting.
+#define MY_CURSOR_PREDICTION_MAX_NS (32 * 1000 * 1000LL)
+
+/*!
+ * Local cursor drawn on top of the video while the stream still shows an older cursor position.
+ *
+ * The cursor follows the newest touch sample, extrapolated to the time it gets displayed. Once a frame captured after
+ * the server injected that sample is on screen, the video shows the cursor in the same place and the overlay hides.
+ *
+ * Not thread safe, fed and drawn from the render loop, which is also where touch input gets handled.
+ */
+struct my_cursor_predictor {
+    /// In video pixels.
+    float x;
+    float y;
+    /// Smoothed, in video pixels per nanosecond.
+    float velocity_x;
+    float velocity_y;
+    int64_t last_event_ns;
+    /// Input command sequence of the newest sample.
+    uint32_t sequence;
+    /// Set while the finger is down, velocity is only meaningful between moves of one gesture.
+    bool tracking;
+    bool visible;
+};
+
+void my_cursor_predictor_reset(struct my_cursor_predictor *p);
+
+/*!
+ * Feed a touch sample that went out to the server.
+ *
+ * @param sequence As returned by my_connection_send_pointer_event, 0 if the command was dropped.
+ * @param down false for the final sample of a gesture, which stops extrapolation.
+ */
+void my_cursor_predictor_update(
+    struct my_cursor_predictor *p, float x, float y, uint32_t sequence, int64_t event_time_ns, bool down);
+
+/*!
+ * Hide the overlay once the video caught up.
+ *
+ * @param frame_capture_ns When the server captured the frame about to be shown, on our clock.
+ * @param acked_sequence,acked_time_ns Newest command the server injected and when, on our clock.
+ */
+void my_cursor_predictor_confirm(struct my_cursor_predictor *p,
+                                 int64_t frame_capture_ns,
+                                 uint32_t acked_sequence,
+                                 int64_t acked_time_ns);
+
+/*!
+ * Where to draw the cursor.
+ *
+ * @param display_time_ns When the frame is expected on screen.
+ * @return false if there is nothing to draw.
+ */
+bool my_cursor_predictor_get_position(const struct my_cursor_predictor *p,
+                                      int64_t display_time_ns,
+                                      float *out_x,
+                                      float *out_y);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
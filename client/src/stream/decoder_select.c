@@ -0,0 +1,465 @@
+#include "decoder_select.h"
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <media/NdkMediaFormat.h>
+#include <string.h>
+#include <sys/system_properties.h>
+
+#include "utils/logger.h"
+
+#define CACHE_FILE_NAME "decoders.ini"
+#define CACHE_GROUP "catalog"
+/// Bump when the cached fields change.
+#define CACHE_VERSION 2
+
+#define AMC_FACTORY_PREFIX "amcviddec-"
+#define AMC_LONGNAME_PREFIX "Android MediaCodec "
+
+/// MediaCodec takes this as "as fast as possible".
+#define OPERATING_RATE_MAX 32767
+
+struct my_decoder_catalog {
+    /// Sorted by score, best first.
+    GArray *decoders;
+};
+
+struct caps_mime {
+    const char *caps_name;
+    const char *mime;
+};
+
+static const struct caps_mime caps_mimes[] = {
+    {"video/x-h264", "video/avc"},
+    {"video/x-h265", "video/hevc"},
+    {"video/x-av1", "video/av01"},
+    {"video/x-vp9", "video/x-vnd.on2.vp9"},
+};
+
+static const char *const software_markers[] = {
+    "OMX.google.",
+    "c2.android.",
+    "c2.google.",
+    "OMX.ffmpeg.",
+    ".sw.",
+};
+
+static bool contains_ci(const char *haystack, const char *needle) {
+    g_autofree gchar *lower = g_ascii_strdown(haystack, -1);
+    return strstr(lower, needle) != NULL;
+}
+
+static bool is_software(const char *codec_name) {
+    for (size_t i = 0; i < G_N_ELEMENTS(software_markers); i++) {
+        if (strstr(codec_name, software_markers[i]) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int32_t score_decoder(const struct my_decoder_info *info) {
+    int32_t score = 0;
+    if (info->hardware) {
+        score += 100;
+    }
+    // Codec2 skips the OMX IL shim.
+    if (g_str_has_prefix(info->codec_name, "c2.")) {
+        score += 10;
+    }
+    // Vendors we know a low-latency extension for, see my_decoder_apply_low_latency.
+    if (contains_ci(info->codec_name, "qti") || contains_ci(info->codec_name, "qcom") ||
+        contains_ci(info->codec_name, "exynos") || contains_ci(info->codec_name, "hisi") ||
+        contains_ci(info->codec_name, "amlogic")) {
+        score += 5;
+    }
+    return score;
+}
+
+static const char *factory_mime(GstElementFactory *factory) {
+    for (const GList *l = gst_element_factory_get_static_pad_templates(factory); l != NULL; l = l->next) {
+        GstStaticPadTemplate *templ = l->data;
+        if (templ->direction != GST_PAD_SINK) {
+            continue;
+        }
+        g_autoptr(GstCaps) caps = gst_static_caps_get(&templ->static_caps);
+        for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+            const gchar *name = gst_structure_get_name(gst_caps_get_structure(caps, i));
+            for (size_t j = 0; j < G_N_ELEMENTS(caps_mimes); j++) {
+                if (g_str_equal(name, caps_mimes[j].caps_name)) {
+                    return caps_mimes[j].mime;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static gint compare_decoders(gconstpointer a, gconstpointer b) {
+    const struct my_decoder_info *da = a;
+    const struct my_decoder_info *db = b;
+    return db->score - da->score;
+}
+
+static void probe(struct my_decoder_catalog *catalog) {
+    GList *factories = gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DECODER |
+                                                                 GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO,
+                                                             GST_RANK_NONE);
+
+    for (GList *l = factories; l != NULL; l = l->next) {
+        GstElementFactory *factory = l->data;
+        const gchar *factory_name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory));
+        if (!g_str_has_prefix(factory_name, AMC_FACTORY_PREFIX)) {
+            continue;
+        }
+
+        const char *mime = factory_mime(factory);
+        if (mime == NULL) {
+            continue;
+        }
+
+        // The factory name is sanitized, the long name carries the real MediaCodec name.
+        const gchar *longname = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_LONGNAME);
+        const gchar *codec_name = longname != NULL && g_str_has_prefix(longname, AMC_LONGNAME_PREFIX)
+                                      ? longname + strlen(AMC_LONGNAME_PREFIX)
+                                      : factory_name + strlen(AMC_FACTORY_PREFIX);
+
+        // Secure decoders only output to protected surfaces.
+        if (g_str_has_suffix(codec_name, ".secure")) {
+            continue;
+        }
+
+        struct my_decoder_info info = {0};
+        g_strlcpy(info.mime, mime, sizeof(info.mime));
+        g_strlcpy(info.codec_name, codec_name, sizeof(info.codec_name));
+        g_strlcpy(info.factory_name, factory_name, sizeof(info.factory_name));
+        info.hardware = !is_software(codec_name);
+        info.score = score_decoder(&info);
+        g_array_append_val(catalog->decoders, info);
+    }
+
+    gst_plugin_feature_list_free(factories);
+}
+
+struct jni_ids {
+    jmethodID get_name;
+    jmethodID get_capabilities_for_type;
+    jmethodID get_video_capabilities;
+    jmethodID get_supported_widths;
+    jmethodID get_supported_heights;
+    jmethodID get_upper;
+    jmethodID int_value;
+};
+
+static bool jni_clear_exception(JNIEnv *env) {
+    if ((*env)->ExceptionCheck(env)) {
+        (*env)->ExceptionClear(env);
+        return true;
+    }
+    return false;
+}
+
+static int32_t range_upper(JNIEnv *env, const struct jni_ids *ids, jobject video_caps, jmethodID get_range) {
+    jobject range = (*env)->CallObjectMethod(env, video_caps, get_range);
+    if (jni_clear_exception(env) || range == NULL) {
+        return 0;
+    }
+    jobject upper = (*env)->CallObjectMethod(env, range, ids->get_upper);
+    if (jni_clear_exception(env) || upper == NULL) {
+        return 0;
+    }
+    jint value = (*env)->CallIntMethod(env, upper, ids->int_value);
+    return jni_clear_exception(env) ? 0 : value;
+}
+
+static void query_codec_info(JNIEnv *env, const struct jni_ids *ids, jobject codec_info, struct my_decoder_info *info) {
+    jstring mime = (*env)->NewStringUTF(env, info->mime);
+    // Throws IllegalArgumentException for types the codec doesn't support.
+    jobject caps = (*env)->CallObjectMethod(env, codec_info, ids->get_capabilities_for_type, mime);
+    if (jni_clear_exception(env) || caps == NULL) {
+        return;
+    }
+    jobject video_caps = (*env)->CallObjectMethod(env, caps, ids->get_video_capabilities);
+    if (jni_clear_exception(env) || video_caps == NULL) {
+        return;
+    }
+    info->max_width = range_upper(env, ids, video_caps, ids->get_supported_widths);
+    info->max_height = range_upper(env, ids, video_caps, ids->get_supported_heights);
+}
+
+static void query_max_sizes(struct my_decoder_catalog *catalog, JNIEnv *env) {
+    if (env == NULL || catalog->decoders->len == 0) {
+        return;
+    }
+    if ((*env)->PushLocalFrame(env, 16) != 0) {
+        jni_clear_exception(env);
+        return;
+    }
+
+    jclass list_class = (*env)->FindClass(env, "android/media/MediaCodecList");
+    jclass info_class = (*env)->FindClass(env, "android/media/MediaCodecInfo");
+    jclass caps_class = (*env)->FindClass(env, "android/media/MediaCodecInfo$CodecCapabilities");
+    jclass video_caps_class = (*env)->FindClass(env, "android/media/MediaCodecInfo$VideoCapabilities");
+    jclass range_class = (*env)->FindClass(env, "android/util/Range");
+    jclass integer_class = (*env)->FindClass(env, "java/lang/Integer");
+    if (jni_clear_exception(env)) {
+        goto out;
+    }
+
+    jmethodID list_init = (*env)->GetMethodID(env, list_class, "<init>", "(I)V");
+    jmethodID get_codec_infos =
+        (*env)->GetMethodID(env, list_class, "getCodecInfos", "()[Landroid/media/MediaCodecInfo;");
+    struct jni_ids ids = {
+        .get_name = (*env)->GetMethodID(env, info_class, "getName", "()Ljava/lang/String;"),
+        .get_capabilities_for_type =
+            (*env)->GetMethodID(env,
+                                info_class,
+                                "getCapabilitiesForType",
+                                "(Ljava/lang/String;)Landroid/media/MediaCodecInfo$CodecCapabilities;"),
+        .get_video_capabilities = (*env)->GetMethodID(
+            env, caps_class, "getVideoCapabilities", "()Landroid/media/MediaCodecInfo$VideoCapabilities;"),
+        .get_supported_widths =
+            (*env)->GetMethodID(env, video_caps_class, "getSupportedWidths", "()Landroid/util/Range;"),
+        .get_supported_heights =
+            (*env)->GetMethodID(env, video_caps_class, "getSupportedHeights", "()Landroid/util/Range;"),
+        .get_upper = (*env)->GetMethodID(env, range_class, "getUpper", "()Ljava/lang/Comparable;"),
+        .int_value = (*env)->GetMethodID(env, integer_class, "intValue", "()I"),
+    };
+    if (jni_clear_exception(env)) {
+        goto out;
+    }
+
+    // MediaCodecList.REGULAR_CODECS, the same set the androidmedia plugin registers.
+    jobject list = (*env)->NewObject(env, list_class, list_init, 0);
+    jobjectArray codec_infos = list != NULL ? (*env)->CallObjectMethod(env, list, get_codec_infos) : NULL;
+    if (jni_clear_exception(env) || codec_infos == NULL) {
+        goto out;
+    }
+
+    jsize count = (*env)->GetArrayLength(env, codec_infos);
+    for (jsize i = 0; i < count; i++) {
+        if ((*env)->PushLocalFrame(env, 16) != 0) {
+            jni_clear_exception(env);
+            break;
+        }
+
+        jobject codec_info = (*env)->GetObjectArrayElement(env, codec_infos, i);
+        jstring jname = codec_info != NULL ? (*env)->CallObjectMethod(env, codec_info, ids.get_name) : NULL;
+        const char *name = jname != NULL ? (*env)->GetStringUTFChars(env, jname, NULL) : NULL;
+        if (!jni_clear_exception(env) && name != NULL) {
+            for (guint j = 0; j < catalog->decoders->len; j++) {
+                struct my_decoder_info *info = &g_array_index(catalog->decoders, struct my_decoder_info, j);
+                if (g_str_equal(info->codec_name, name)) {
+                    query_codec_info(env, &ids, codec_info, info);
+                }
+            }
+        }
+        if (name != NULL) {
+            (*env)->ReleaseStringUTFChars(env, jname, name);
+        }
+
+        (*env)->PopLocalFrame(env, NULL);
+    }
+
+out:
+    (*env)->PopLocalFrame(env, NULL);
+}
+
+static gchar *device_fingerprint(void) {
+    char fingerprint[PROP_VALUE_MAX] = {0};
+    __system_property_get("ro.build.fingerprint", fingerprint);
+    // A GStreamer update can change what the plugin exposes.
+    g_autofree gchar *gst_version = gst_version_string();
+    return g_strdup_printf("%s|%s|%d", fingerprint, gst_version, CACHE_VERSION);
+}
+
+static bool load_cache(struct my_decoder_catalog *catalog, const char *path, const char *fingerprint) {
+    g_autoptr(GKeyFile) key_file = g_key_file_new();
+    if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL)) {
+        return false;
+    }
+
+    g_autofree gchar *cached_fingerprint = g_key_file_get_string(key_file, CACHE_GROUP, "fingerprint", NULL);
+    if (cached_fingerprint == NULL || !g_str_equal(cached_fingerprint, fingerprint)) {
+        ALOGI("%s: decoder cache is from a different build, probing again", __FUNCTION__);
+        return false;
+    }
+
+    gsize group_count = 0;
+    g_auto(GStrv) groups = g_key_file_get_groups(key_file, &group_count);
+    for (gsize i = 0; i < group_count; i++) {
+        if (!g_str_has_prefix(groups[i], "decoder ")) {
+            continue;
+        }
+        g_autofree gchar *mime = g_key_file_get_string(key_file, groups[i], "mime", NULL);
+        g_autofree gchar *factory_name = g_key_file_get_string(key_file, groups[i], "factory", NULL);
+        if (mime == NULL || factory_name == NULL) {
+            return false;
+        }
+
+        struct my_decoder_info info = {0};
+        g_strlcpy(info.mime, mime, sizeof(info.mime));
+        g_strlcpy(info.codec_name, groups[i] + strlen("decoder "), sizeof(info.codec_name));
+        g_strlcpy(info.factory_name, factory_name, sizeof(info.factory_name));
+        info.hardware = g_key_file_get_boolean(key_file, groups[i], "hardware", NULL);
+        info.max_width = g_key_file_get_integer(key_file, groups[i], "max-width", NULL);
+        info.max_height = g_key_file_get_integer(key_file, groups[i], "max-height", NULL);
+        info.score = g_key_file_get_integer(key_file, groups[i], "score", NULL);
+        g_array_append_val(catalog->decoders, info);
+    }
+
+    return true;
+}
+
+static void save_cache(const struct my_decoder_catalog *catalog, const char *path, const char *fingerprint) {
+    g_autoptr(GKeyFile) key_file = g_key_file_new();
+    g_key_file_set_string(key_file, CACHE_GROUP, "fingerprint", fingerprint);
+
+    for (guint i = 0; i < catalog->decoders->len; i++) {
+        const struct my_decoder_info *info = &g_array_index(catalog->decoders, struct my_decoder_info, i);
+        g_autofree gchar *group = g_strdup_printf("decoder %s", info->codec_name);
+        g_key_file_set_string(key_file, group, "mime", info->mime);
+        g_key_file_set_string(key_file, group, "factory", info->factory_name);
+        g_key_file_set_boolean(key_file, group, "hardware", info->hardware);
+        g_key_file_set_integer(key_file, group, "max-width", info->max_width);
+        g_key_file_set_integer(key_file, group, "max-height", info->max_height);
+        g_key_file_set_integer(key_file, group, "score", info->score);
+    }
+
+    g_autoptr(GError) error = NULL;
+    if (!g_key_file_save_to_file(key_file, path, &error)) {
+        ALOGW("%s: failed to write decoder cache: %s", __FUNCTION__, error->message);
+    }
+}
+
+struct my_decoder_catalog *my_decoder_catalog_load_or_probe(const char *cache_dir, JNIEnv *env) {
+    struct my_decoder_catalog *catalog = g_new0(struct my_decoder_catalog, 1);
+    catalog->decoders = g_array_new(FALSE, TRUE, sizeof(struct my_decoder_info));
+
+    g_autofree gchar *fingerprint = device_fingerprint();
+    g_autofree gchar *path = cache_dir != NULL ? g_build_filename(cache_dir, CACHE_FILE_NAME, NULL) : NULL;
+
+    const gint64 start_us = g_get_monotonic_time();
+    bool cached = path != NULL && load_cache(catalog, path, fingerprint);
+    if (!cached) {
+        g_array_set_size(catalog->decoders, 0);
+        probe(catalog);
+        query_max_sizes(catalog, env);
+        if (path != NULL) {
+            save_cache(catalog, path, fingerprint);
+        }
+    }
+    g_array_sort(catalog->decoders, compare_decoders);
+
+    ALOGI("%s: %u decoders (%s) in %" G_GINT64_FORMAT " us",
+          __FUNCTION__,
+          catalog->decoders->len,
+          cached ? "cached" : "probed",
+          g_get_monotonic_time() - start_us);
+    for (guint i = 0; i < catalog->decoders->len; i++) {
+        const struct my_decoder_info *info = &g_array_index(catalog->decoders, struct my_decoder_info, i);
+        ALOGI("    %s %s (%s), %s, up to %dx%d, score %d",
+              info->mime,
+              info->codec_name,
+              info->factory_name,
+              info->hardware ? "hardware" : "software",
+              info->max_width,
+              info->max_height,
+              info->score);
+    }
+
+    return catalog;
+}
+
+void my_decoder_catalog_destroy(struct my_decoder_catalog *catalog) {
+    if (catalog == NULL) {
+        return;
+    }
+    g_array_unref(catalog->decoders);
+    g_free(catalog);
+}
+
+const struct my_decoder_info *my_decoder_catalog_best(const struct my_decoder_catalog *catalog, const char *mime) {
+    for (guint i = 0; i < catalog->decoders->len; i++) {
+        const struct my_decoder_info *info = &g_array_index(catalog->decoders, struct my_decoder_info, i);
+        if (g_str_equal(info->mime, mime)) {
+            return info;
+        }
+    }
+    return NULL;
+}
+
+static bool factory_exists(const char *name) {
+    GstElementFactory *factory = gst_element_factory_find(name);
+    if (factory == NULL) {
+        return false;
+    }
+    gst_object_unref(factory);
+    return true;
+}
+
+int my_decoder_catalog_get_codec_support(const struct my_decoder_catalog *catalog,
+                                         struct my_codec_support *out,
+                                         int capacity) {
+    // Best compression first.
+    static const enum my_video_codec preference[] = {
+        MY_VIDEO_CODEC_H265,
+        MY_VIDEO_CODEC_AV1,
+        MY_VIDEO_CODEC_H264,
+    };
+
+    int count = 0;
+    for (size_t i = 0; i < G_N_ELEMENTS(preference) && count < capacity; i++) {
+        const struct my_video_codec_desc *desc = my_video_codec_get_desc(preference[i]);
+        const struct my_decoder_info *info = my_decoder_catalog_best(catalog, desc->mime);
+
+        if (preference[i] != MY_VIDEO_CODEC_H264) {
+            // A software HEVC or AV1 decoder won't keep up at the resolutions these are for.
+            if (info == NULL || !info->hardware) {
+                continue;
+            }
+            if (!factory_exists(desc->depayloader) || !factory_exists(desc->parser)) {
+                ALOGW("%s: %s decoder found, but %s or %s is missing",
+                      __FUNCTION__,
+                      desc->name,
+                      desc->depayloader,
+                      desc->parser);
+                continue;
+            }
+        }
+
+        out[count++] = (struct my_codec_support){
+            .codec = preference[i],
+            .max_width = info != NULL ? info->max_width : 0,
+            .max_height = info != NULL ? info->max_height : 0,
+        };
+    }
+    return count;
+}
+
+void my_decoder_apply_low_latency(AMediaFormat *format, const struct my_decoder_info *info) {
+    // Literal keys, the constants are only declared for newer API levels. Older platforms ignore them.
+    // KEY_LOW_LATENCY, Android 11.
+    AMediaFormat_setInt32(format, "low-latency", 1);
+    // Realtime priority, and run the codec as fast as it can instead of pacing it to the frame rate.
+    AMediaFormat_setInt32(format, "priority", 0);
+    AMediaFormat_setInt32(format, "operating-rate", OPERATING_RATE_MAX);
+
+    if (info == NULL) {
+        return;
+    }
+
+    const char *name = info->codec_name;
+    if (contains_ci(name, "qti") || contains_ci(name, "qcom")) {
+        AMediaFormat_setInt32(format, "vendor.qti-ext-dec-low-latency.enable", 1);
+        // Output in decode order, we never send B-frames.
+        AMediaFormat_setInt32(format, "vendor.qti-ext-dec-picture-order.enable", 1);
+    } else if (contains_ci(name, "exynos")) {
+        AMediaFormat_setInt32(format, "vendor.rtc-ext-dec-low-latency.enable", 1);
+    } else if (contains_ci(name, "hisi")) {
+        AMediaFormat_setInt32(format, "vendor.hisi-ext-low-latency-video-dec.video-scene-for-low-latency-req", 1);
+        AMediaFormat_setInt32(format, "vendor.hisi-ext-low-latency-video-dec.video-scene-for-low-latency-rdy", -1);
+    } else if (contains_ci(name, "amlogic")) {
+        AMediaFormat_setInt32(format, "vendor.low-latency.enable", 1);
+    }
+}
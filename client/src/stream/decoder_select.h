@@ -0,0 +1,80 @@
+#pragma once
+
+#include <jni.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stream_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AMediaFormat AMediaFormat;
+
+/// One MediaCodec video decoder, as exposed by the GStreamer androidmedia plugin.
+struct my_decoder_info {
+    /// MediaCodec MIME type, e.g. "video/avc".
+    char mime[32];
+    /// MediaCodec codec name, e.g. "c2.qti.avc.decoder".
+    char codec_name[96];
+    /// GStreamer element factory wrapping it, e.g. "amcviddec-c2qtiavcdecoder".
+    char factory_name[96];
+    bool hardware;
+    /// Largest supported frame from MediaCodecInfo.VideoCapabilities, 0 if it couldn't be queried.
+    int32_t max_width;
+    int32_t max_height;
+    /// Higher is better, only meaningful between decoders of the same MIME type.
+    int32_t score;
+};
+
+/*!
+ * Ranked list of the video decoders on this device.
+ *
+ * Probing walks the GStreamer registry for amcviddec-* factories. The result is cached in a key file together with the
+ * build fingerprint, so later launches on the same system image skip the scan. Size limits come from the Java
+ * MediaCodecList, the plugin's caps only carry a fixed range.
+ */
+struct my_decoder_catalog;
+
+/*!
+ * Load the cached catalog, or probe and write a new cache if it is missing or stale.
+ *
+ * Call after gst_init.
+ *
+ * @param cache_dir Directory for the cache file, may be NULL to always probe.
+ * @param env JNI environment of the calling thread, may be NULL to skip the size limits.
+ */
+struct my_decoder_catalog *my_decoder_catalog_load_or_probe(const char *cache_dir, JNIEnv *env);
+
+void my_decoder_catalog_destroy(struct my_decoder_catalog *catalog);
+
+/*!
+ * Best decoder for a MIME type.
+ *
+ * @return NULL if the device has none, the pointer is owned by the catalog.
+ */
+const struct my_decoder_info *my_decoder_catalog_best(const struct my_decoder_catalog *catalog, const char *mime);
+
+/*!
+ * Codecs worth advertising to the server, most preferred first.
+ *
+ * HEVC and AV1 are only listed with a hardware decoder and the matching depayloader and parser in the registry. H264 is
+ * always listed, decodebin3 covers devices without a MediaCodec decoder for it.
+ *
+ * @return Number of entries written to out.
+ */
+int my_decoder_catalog_get_codec_support(const struct my_decoder_catalog *catalog,
+                                         struct my_codec_support *out,
+                                         int capacity);
+
+/*!
+ * Set the standard and vendor-specific low-latency keys on a MediaCodec format.
+ *
+ * Keys a codec doesn't know are ignored by MediaCodec, so this sets every extension that matches the codec vendor.
+ */
+void my_decoder_apply_low_latency(AMediaFormat *format, const struct my_decoder_info *info);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,30 @@
+#include "frame_mailbox.h"
+
+#include <stdatomic.h>
+
+#define SLOT_MASK 0x3u
+
+void my_frame_mailbox_init(struct my_frame_mailbox *mb) {
+    mb->back = 0;
+    atomic_init(&mb->middle, 1);
+    mb->front = 2;
+}
+
+bool my_frame_mailbox_publish(struct my_frame_mailbox *mb) {
+    // Release pairs with the acquire in consume, so the slot contents are visible before its index is.
+    uint32_t prev = atomic_exchange_explicit(&mb->middle, mb->back | MY_FRAME_MAILBOX_FRESH, memory_order_acq_rel);
+    mb->back = prev & SLOT_MASK;
+    return (prev & MY_FRAME_MAILBOX_FRESH) != 0;
+}
+
+bool my_frame_mailbox_consume(struct my_frame_mailbox *mb, uint32_t *out_slot) {
+    if ((atomic_load_explicit(&mb->middle, memory_order_relaxed) & MY_FRAME_MAILBOX_FRESH) == 0) {
+        return false;
+    }
+
+    // Only the producer can set the flag, and only we clear it, so the slot we get back is fresh.
+    uint32_t prev = atomic_exchange_explicit(&mb->middle, mb->front, memory_order_acq_rel);
+    mb->front = prev & SLOT_MASK;
+    *out_slot = mb->front;
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MY_FRAME_MAILBOX_SLOT_COUNT 3
+
+/*!
+ * Lock-free triple buffer handing the latest slot from one producer thread to one consumer thread.
+ *
+ * Only slot indices move around: the producer fills the slot returned by @ref my_frame_mailbox_back and publishes it,
+ * the consumer picks up the most recently published slot. A slot that was published but never consumed comes back to
+ * the producer, which is how stale frames get dropped. Neither side ever waits on the other.
+ */
+struct my_frame_mailbox {
+    /// Index of the published slot, plus @ref MY_FRAME_MAILBOX_FRESH if the consumer has not seen it yet.
+    _Atomic uint32_t middle;
+    /// Owned by the producer.
+    uint32_t back;
+    /// Owned by the consumer.
+    uint32_t front;
+};
+
+#define MY_FRAME_MAILBOX_FRESH 0x4u
+
+void my_frame_mailbox_init(struct my_frame_mailbox *mb);
+
+/// Slot the producer may write to.
+static inline uint32_t my_frame_mailbox_back(const struct my_frame_mailbox *mb) {
+    return mb->back;
+}
+
+/*!
+ * Publish the back slot, and take over a new one.
+ *
+ * @return true if the slot now returned by @ref my_frame_mailbox_back was published before but never consumed.
+ */
+bool my_frame_mailbox_publish(struct my_frame_mailbox *mb);
+
+/*!
+ * Take the most recently published slot, if there is one the consumer has not seen yet.
+ *
+ * @param[out] out_slot The slot to read from, owned by the consumer until the next successful call.
+ */
+bool my_frame_mailbox_consume(struct my_frame_mailbox *mb, uint32_t *out_slot);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
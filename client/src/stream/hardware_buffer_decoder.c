@@ -0,0 +1,430 @@
+#include "hardware_buffer_decoder.h"
+
+#include <EGL/eglext.h>
+#include <GLES2/gl2ext.h>
+#include <android/hardware_buffer.h>
+#include <glib.h>
+#include <media/NdkImageReader.h>
+#include <media/NdkMediaCodec.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decoder_select.h"
+#include "frame_mailbox.h"
+#include "telemetry.h"
+#include "thread.h"
+#include "utils/logger.h"
+
+/// Frames held by the render loop (pacer queue, on screen, previous), the mailbox, and one being written.
+#define MAX_IMAGES 8
+
+/// EGLImages cached per hardware buffer, the image reader cycles through at most MAX_IMAGES of them.
+#define IMPORT_CACHE_SIZE MAX_IMAGES
+
+/// Input buffers are normally free right away, this only kicks in when the decoder falls behind.
+#define INPUT_TIMEOUT_US 20000
+#define OUTPUT_TIMEOUT_US 10000
+
+/// Maps the microsecond timestamps MediaCodec deals in back to buffer PTS.
+#define PTS_HISTORY_SIZE 32
+
+struct import_entry {
+    AHardwareBuffer *buffer;
+    EGLImageKHR image;
+    GLuint texture;
+};
+
+struct pts_entry {
+    int64_t pts_us;
+    uint64_t pts;
+};
+
+struct my_hwb_decoder {
+    AMediaCodec *codec;
+    AImageReader *reader;
+    struct my_telemetry *telemetry;
+
+    struct os_thread_helper output_thread;
+
+    // Written by the pushing thread, read on the image reader thread.
+    pthread_mutex_t pts_mutex;
+    struct pts_entry pts_history[PTS_HISTORY_SIZE];
+    uint32_t pts_next;
+
+    // Image reader thread to render thread.
+    struct my_frame_mailbox mailbox;
+    struct my_hwb_frame mailbox_slots[MY_FRAME_MAILBOX_SLOT_COUNT];
+
+    // Render thread only.
+    struct import_entry imports[IMPORT_CACHE_SIZE];
+    uint32_t import_next;
+    PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC eglGetNativeClientBufferANDROID;
+    PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
+    PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+    EGLDisplay import_display;
+};
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool output_thread_running(struct os_thread_helper *oth) {
+    pthread_mutex_lock(&oth->mutex);
+    bool running = oth->running;
+    pthread_mutex_unlock(&oth->mutex);
+    return running;
+}
+
+static bool lookup_pts(struct my_hwb_decoder *dec, int64_t pts_us, uint64_t *out_pts) {
+    bool found = false;
+    pthread_mutex_lock(&dec->pts_mutex);
+    for (uint32_t i = 0; i < PTS_HISTORY_SIZE; i++) {
+        if (dec->pts_history[i].pts_us == pts_us) {
+            *out_pts = dec->pts_history[i].pts;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dec->pts_mutex);
+    return found;
+}
+
+/// Runs on the image reader's own thread.
+static void on_image_available(void *context, AImageReader *reader) {
+    struct my_hwb_decoder *dec = (struct my_hwb_decoder *)context;
+
+    AImage *image = NULL;
+    media_status_t status = AImageReader_acquireLatestImage(reader, &image);
+    if (status != AMEDIA_OK) {
+        if (status == AMEDIA_IMGREADER_MAX_IMAGES_ACQUIRED) {
+            ALOGW("%s: all %d images are in use, the render loop is falling behind", __FUNCTION__, MAX_IMAGES);
+        }
+        return;
+    }
+
+    const int64_t decoded_ns = now_ns();
+
+    int32_t buffer_width = 0, buffer_height = 0;
+    AImage_getWidth(image, &buffer_width);
+    AImage_getHeight(image, &buffer_height);
+
+    AImageCropRect crop = {0, 0, buffer_width, buffer_height};
+    AImage_getCropRect(image, &crop);
+
+    int64_t timestamp_ns = 0;
+    AImage_getTimestamp(image, &timestamp_ns);
+
+    uint64_t frame_id = 0;
+    uint64_t pts;
+    if (dec->telemetry != NULL && lookup_pts(dec, timestamp_ns / 1000, &pts)) {
+        frame_id = my_telemetry_mark_pts(dec->telemetry, pts, MY_LATENCY_STAGE_DECODED, decoded_ns);
+        // Nothing sits between the decoder and the render loop on this path.
+        my_telemetry_mark(dec->telemetry, frame_id, MY_LATENCY_STAGE_APPSINK, decoded_ns);
+    }
+
+    struct my_hwb_frame *slot = &dec->mailbox_slots[my_frame_mailbox_back(&dec->mailbox)];
+    slot->image = image;
+    slot->width = crop.right - crop.left;
+    slot->height = crop.bottom - crop.top;
+    slot->uv_scale_x = buffer_width > 0 ? (float)slot->width / (float)buffer_width : 1.0f;
+    slot->uv_scale_y = buffer_height > 0 ? (float)slot->height / (float)buffer_height : 1.0f;
+    slot->frame_id = frame_id;
+    slot->decoded_ns = decoded_ns;
+
+    if (my_frame_mailbox_publish(&dec->mailbox)) {
+        // The render loop never picked up the frame we got back.
+        struct my_hwb_frame *stale = &dec->mailbox_slots[my_frame_mailbox_back(&dec->mailbox)];
+        g_clear_pointer(&stale->image, AImage_delete);
+        if (dec->telemetry != NULL) {
+            my_telemetry_on_frame_dropped(dec->telemetry);
+        }
+    }
+}
+
+static void *output_thread_func(void *ptr) {
+    struct my_hwb_decoder *dec = (struct my_hwb_decoder *)ptr;
+
+    while (output_thread_running(&dec->output_thread)) {
+        AMediaCodecBufferInfo info;
+        ssize_t index = AMediaCodec_dequeueOutputBuffer(dec->codec, &info, OUTPUT_TIMEOUT_US);
+        if (index >= 0) {
+            // Rendering to the surface queues the buffer to the image reader.
+            AMediaCodec_releaseOutputBuffer(dec->codec, index, info.size != 0);
+        } else if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+            AMediaFormat *format = AMediaCodec_getOutputFormat(dec->codec);
+            ALOGI("%s: output format changed: %s", __FUNCTION__, AMediaFormat_toString(format));
+            AMediaFormat_delete(format);
+        }
+    }
+
+    return NULL;
+}
+
+struct my_hwb_decoder *my_hwb_decoder_create(const struct my_decoder_info *decoder,
+                                             const char *mime,
+                                             int32_t width,
+                                             int32_t height,
+                                             struct my_telemetry *telemetry) {
+    struct my_hwb_decoder *dec = calloc(1, sizeof(struct my_hwb_decoder));
+    if (dec == NULL) {
+        ALOGE("%s: failed to allocate", __FUNCTION__);
+        return NULL;
+    }
+    dec->telemetry = telemetry;
+    pthread_mutex_init(&dec->pts_mutex, NULL);
+    my_frame_mailbox_init(&dec->mailbox);
+    os_thread_helper_init(&dec->output_thread);
+
+    for (uint32_t i = 0; i < PTS_HISTORY_SIZE; i++) {
+        dec->pts_history[i].pts_us = -1;
+    }
+
+    media_status_t status = AImageReader_newWithUsage(width,
+                                                      height,
+                                                      AIMAGE_FORMAT_PRIVATE,
+                                                      AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE,
+                                                      MAX_IMAGES,
+                                                      &dec->reader);
+    if (status != AMEDIA_OK) {
+        ALOGE("%s: AImageReader_newWithUsage failed: %d", __FUNCTION__, status);
+        goto fail;
+    }
+
+    AImageReader_ImageListener listener = {
+        .context = dec,
+        .onImageAvailable = on_image_available,
+    };
+    AImageReader_setImageListener(dec->reader, &listener);
+
+    ANativeWindow *window = NULL;
+    status = AImageReader_getWindow(dec->reader, &window);
+    if (status != AMEDIA_OK) {
+        ALOGE("%s: AImageReader_getWindow failed: %d", __FUNCTION__, status);
+        goto fail;
+    }
+
+    dec->codec = decoder != NULL ? AMediaCodec_createCodecByName(decoder->codec_name)
+                                 : AMediaCodec_createDecoderByType(mime);
+    if (dec->codec == NULL) {
+        ALOGE("%s: no decoder for %s", __FUNCTION__, decoder != NULL ? decoder->codec_name : mime);
+        goto fail;
+    }
+
+    AMediaFormat *format = AMediaFormat_new();
+    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, mime);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, width);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, height);
+    // Let the stream switch to lower resolutions without a reconfigure. Literal keys, the constants are only
+    // declared for newer API levels.
+    AMediaFormat_setInt32(format, "max-width", width);
+    AMediaFormat_setInt32(format, "max-height", height);
+    my_decoder_apply_low_latency(format, decoder);
+
+    status = AMediaCodec_configure(dec->codec, format, window, NULL, 0);
+    AMediaFormat_delete(format);
+    if (status != AMEDIA_OK) {
+        ALOGE("%s: AMediaCodec_configure failed: %d", __FUNCTION__, status);
+        goto fail;
+    }
+
+    status = AMediaCodec_start(dec->codec);
+    if (status != AMEDIA_OK) {
+        ALOGE("%s: AMediaCodec_start failed: %d", __FUNCTION__, status);
+        goto fail;
+    }
+
+    // Releasing output buffers is what gets frames to the image reader, so it runs at display priority.
+    const struct os_thread_params params = {
+        .name = "hwb-output",
+        .nice = OS_THREAD_PRIORITY_DISPLAY,
+        .cpus = OS_THREAD_CPUS_ANY,
+    };
+    if (os_thread_helper_start_with_params(&dec->output_thread, output_thread_func, dec, &params) != 0) {
+        ALOGE("%s: failed to start the output thread", __FUNCTION__);
+        goto fail;
+    }
+
+    ALOGI("%s: decoding %s at up to %dx%d into hardware buffers", __FUNCTION__, mime, width, height);
+    return dec;
+
+fail:
+    my_hwb_decoder_destroy(dec);
+    return NULL;
+}
+
+void my_hwb_decoder_destroy(struct my_hwb_decoder *dec) {
+    if (dec == NULL) {
+        return;
+    }
+
+    os_thread_helper_stop(&dec->output_thread);
+
+    if (dec->codec != NULL) {
+        AMediaCodec_stop(dec->codec);
+        AMediaCodec_delete(dec->codec);
+    }
+    if (dec->reader != NULL) {
+        AImageReader_setImageListener(dec->reader, NULL);
+    }
+
+    for (uint32_t i = 0; i < MY_FRAME_MAILBOX_SLOT_COUNT; i++) {
+        g_clear_pointer(&dec->mailbox_slots[i].image, AImage_delete);
+    }
+
+    // The GL side went with my_hwb_decoder_release_imports, or with the context.
+    for (uint32_t i = 0; i < IMPORT_CACHE_SIZE; i++) {
+        if (dec->imports[i].buffer != NULL) {
+            ALOGW("%s: imports left over, their GL objects leak", __FUNCTION__);
+            AHardwareBuffer_release(dec->imports[i].buffer);
+        }
+    }
+
+    if (dec->reader != NULL) {
+        AImageReader_delete(dec->reader);
+    }
+
+    pthread_mutex_destroy(&dec->pts_mutex);
+    free(dec);
+}
+
+bool my_hwb_decoder_push(struct my_hwb_decoder *dec, const uint8_t *data, size_t size, uint64_t pts) {
+    ssize_t index = AMediaCodec_dequeueInputBuffer(dec->codec, INPUT_TIMEOUT_US);
+    if (index < 0) {
+        ALOGW("%s: no input buffer available, dropping an access unit", __FUNCTION__);
+        return false;
+    }
+
+    size_t capacity = 0;
+    uint8_t *input = AMediaCodec_getInputBuffer(dec->codec, index, &capacity);
+    if (input == NULL || capacity < size) {
+        ALOGE("%s: access unit of %zu bytes does not fit into %zu", __FUNCTION__, size, capacity);
+        AMediaCodec_queueInputBuffer(dec->codec, index, 0, 0, 0, 0);
+        return false;
+    }
+    memcpy(input, data, size);
+
+    const int64_t pts_us = (int64_t)(pts / 1000);
+    pthread_mutex_lock(&dec->pts_mutex);
+    dec->pts_history[dec->pts_next++ % PTS_HISTORY_SIZE] = (struct pts_entry){pts_us, pts};
+    pthread_mutex_unlock(&dec->pts_mutex);
+
+    return AMediaCodec_queueInputBuffer(dec->codec, index, 0, size, pts_us, 0) == AMEDIA_OK;
+}
+
+void my_hwb_decoder_flush(struct my_hwb_decoder *dec) {
+    AMediaCodec_flush(dec->codec);
+}
+
+bool my_hwb_decoder_try_acquire(struct my_hwb_decoder *dec, struct my_hwb_frame *out_frame) {
+    uint32_t slot_index;
+    if (!my_frame_mailbox_consume(&dec->mailbox, &slot_index)) {
+        return false;
+    }
+
+    // Move the image out, the slot goes back to the producer on the next consume.
+    struct my_hwb_frame *slot = &dec->mailbox_slots[slot_index];
+    *out_frame = *slot;
+    slot->image = NULL;
+
+    return out_frame->image != NULL;
+}
+
+static bool load_import_functions(struct my_hwb_decoder *dec) {
+    if (dec->glEGLImageTargetTexture2DOES != NULL) {
+        return true;
+    }
+    dec->eglGetNativeClientBufferANDROID =
+        (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC)eglGetProcAddress("eglGetNativeClientBufferANDROID");
+    dec->eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    dec->eglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    dec->glEGLImageTargetTexture2DOES =
+        (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+
+    return dec->eglGetNativeClientBufferANDROID != NULL && dec->eglCreateImageKHR != NULL &&
+           dec->eglDestroyImageKHR != NULL && dec->glEGLImageTargetTexture2DOES != NULL;
+}
+
+static void release_import(struct my_hwb_decoder *dec, struct import_entry *entry) {
+    if (entry->buffer == NULL) {
+        return;
+    }
+    glDeleteTextures(1, &entry->texture);
+    dec->eglDestroyImageKHR(dec->import_display, entry->image);
+    AHardwareBuffer_release(entry->buffer);
+    memset(entry, 0, sizeof(*entry));
+}
+
+GLuint my_hwb_decoder_import(struct my_hwb_decoder *dec, EGLDisplay display, const struct my_hwb_frame *frame) {
+    AHardwareBuffer *buffer = NULL;
+    if (AImage_getHardwareBuffer(frame->image, &buffer) != AMEDIA_OK || buffer == NULL) {
+        ALOGE("%s: image has no hardware buffer", __FUNCTION__);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < IMPORT_CACHE_SIZE; i++) {
+        if (dec->imports[i].buffer == buffer) {
+            return dec->imports[i].texture;
+        }
+    }
+
+    if (!load_import_functions(dec)) {
+        ALOGE("%s: missing EGL_ANDROID_get_native_client_buffer or EGL image support", __FUNCTION__);
+        return 0;
+    }
+    dec->import_display = display;
+
+    // Evict the oldest import. The image reader recycles its buffers, so this only happens on a reconfigure.
+    struct import_entry *entry = &dec->imports[dec->import_next++ % IMPORT_CACHE_SIZE];
+    release_import(dec, entry);
+
+    const EGLint attributes[] = {EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE};
+    EGLImageKHR image = dec->eglCreateImageKHR(display,
+                                               EGL_NO_CONTEXT,
+                                               EGL_NATIVE_BUFFER_ANDROID,
+                                               dec->eglGetNativeClientBufferANDROID(buffer),
+                                               attributes);
+    if (image == EGL_NO_IMAGE_KHR) {
+        ALOGE("%s: eglCreateImageKHR failed: 0x%x", __FUNCTION__, eglGetError());
+        return 0;
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    dec->glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, (GLeglImageOES)image);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+    // Keep the buffer alive, so its address can't be reused for a different one while cached.
+    AHardwareBuffer_acquire(buffer);
+    entry->buffer = buffer;
+    entry->image = image;
+    entry->texture = texture;
+
+    AHardwareBuffer_Desc desc;
+    AHardwareBuffer_describe(buffer, &desc);
+    ALOGI("%s: imported a %ux%u hardware buffer as texture %u", __FUNCTION__, desc.width, desc.height, texture);
+
+    return texture;
+}
+
+void my_hwb_decoder_release_frame(struct my_hwb_decoder *dec, struct my_hwb_frame *frame) {
+    (void)dec;
+    g_clear_pointer(&frame->image, AImage_delete);
+}
+
+void my_hwb_decoder_release_imports(struct my_hwb_decoder *dec) {
+    for (uint32_t i = 0; i < IMPORT_CACHE_SIZE; i++) {
+        release_import(dec, &dec->imports[i]);
+    }
+    dec->import_next = 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct my_decoder_info;
+struct my_telemetry;
+
+typedef struct AImage AImage;
+
+/*!
+ * A decoded frame, backed by an AHardwareBuffer from the decoder's AImageReader.
+ */
+struct my_hwb_frame {
+    AImage *image;
+    /// Frame size after cropping.
+    int32_t width;
+    int32_t height;
+    /// Fraction of the buffer covered by the cropped frame, for texture coordinates.
+    float uv_scale_x;
+    float uv_scale_y;
+    uint64_t frame_id;
+    int64_t decoded_ns;
+};
+
+/*!
+ * MediaCodec decoder rendering straight into AHardwareBuffers, skipping GstGL altogether.
+ *
+ * Compressed access units come in on a GStreamer streaming thread, decoded frames come out on the render thread,
+ * which imports them as EGLImages. The AImageReader only hands out a frame once the decoder's acquire fence
+ * signalled, so there is no GL sync wait on the render side.
+ */
+struct my_hwb_decoder;
+
+/*!
+ * @param decoder Codec to use, or NULL to let MediaCodec pick one for the MIME type
+ * @param mime MediaCodec MIME type, e.g. "video/avc"
+ * @param width,height Largest resolution the stream will use
+ * @param telemetry Receives the decoded stage of each frame, may be NULL
+ */
+struct my_hwb_decoder *my_hwb_decoder_create(const struct my_decoder_info *decoder,
+                                             const char *mime,
+                                             int32_t width,
+                                             int32_t height,
+                                             struct my_telemetry *telemetry);
+
+/*!
+ * Stop decoding and free everything.
+ *
+ * All frames must have been released, and the imports with @ref my_hwb_decoder_release_imports. Needs no GL context.
+ */
+void my_hwb_decoder_destroy(struct my_hwb_decoder *dec);
+
+/*!
+ * Queue one access unit, in Annex B byte-stream format.
+ *
+ * Must only be called from a single thread.
+ *
+ * @param pts Buffer PTS in nanoseconds, used to find the frame again in the telemetry.
+ */
+bool my_hwb_decoder_push(struct my_hwb_decoder *dec, const uint8_t *data, size_t size, uint64_t pts);
+
+/// Discard queued input and output, e.g. when the pipeline goes away.
+void my_hwb_decoder_flush(struct my_hwb_decoder *dec);
+
+/*!
+ * Take the newest decoded frame, if there is one the caller has not seen yet.
+ *
+ * Render thread only. Frames need to be released with @ref my_hwb_decoder_release_frame.
+ */
+bool my_hwb_decoder_try_acquire(struct my_hwb_decoder *dec, struct my_hwb_frame *out_frame);
+
+/*!
+ * Get an external OES texture for the frame. EGLImages are cached per hardware buffer, so this only creates one the
+ * first time the image reader hands out a given buffer.
+ *
+ * Render thread only, with the EGL context current.
+ *
+ * @return 0 on failure
+ */
+GLuint my_hwb_decoder_import(struct my_hwb_decoder *dec, EGLDisplay display, const struct my_hwb_frame *frame);
+
+void my_hwb_decoder_release_frame(struct my_hwb_decoder *dec, struct my_hwb_frame *frame);
+
+/*!
+ * Free the EGLImages and textures of all imports, the next @ref my_hwb_decoder_import creates them again.
+ *
+ * Render thread only, with the EGL context current.
+ */
+void my_hwb_decoder_release_imports(struct my_hwb_decoder *dec);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
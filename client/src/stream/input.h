@@ -26,10 +26,21 @@ typedef enum : uint8_t {
     KeyboardSuper,
 } InputType;
 
+/// Part of a stroke, the batching must keep it even if a newer command of the same kind follows.
+#define MY_INPUT_COMMAND_FLAG_STROKE 0x1
+
 #pragma pack(push, 1)
 typedef struct {
     uint8_t type;
     uint32_t data0;
     uint32_t data1;
+    /// Touch pointer the command comes from, 0 for everything that isn't touch.
+    uint8_t pointer_id;
+    /// Assigned by the connection when the command is queued, one higher for every command.
+    uint32_t sequence;
+    /// When the input happened, CLOCK_MONOTONIC in nanoseconds. 0 means when it was queued.
+    int64_t timestamp_ns;
+    /// MY_INPUT_COMMAND_FLAG_*, only used on the client.
+    uint8_t flags;
 } InputCommand;
 #pragma pack(pop)
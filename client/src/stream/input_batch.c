@@ -0,0 +1,96 @@
+#include "input_batch.h"
+
+#include <string.h>
+
+bool my_input_command_is_continuous(uint8_t type) {
+    switch (type) {
+        case CursorMove:
+        case CursorScroll:
+        case GamepadLeftStick:
+        case GamepadRightStick:
+        case GamepadButtonLT:
+        case GamepadButtonRT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void my_input_batch_reset(struct my_input_batch *batch) {
+    batch->count = 0;
+    batch->reliable = false;
+}
+
+bool my_input_batch_add(struct my_input_batch *batch, const InputCommand *cmd) {
+    if (my_input_command_is_continuous(cmd->type) && !(cmd->flags & MY_INPUT_COMMAND_FLAG_STROKE)) {
+        // Only merge past other continuous commands. Moving a position across a discrete one, like a press, would
+        // make that land somewhere else.
+        for (uint32_t i = batch->count; i-- > 0;) {
+            if (!my_input_command_is_continuous(batch->commands[i].type)) {
+                break;
+            }
+            if (batch->commands[i].type != cmd->type || batch->commands[i].pointer_id != cmd->pointer_id ||
+                (batch->commands[i].flags & MY_INPUT_COMMAND_FLAG_STROKE)) {
+                continue;
+            }
+            // Scroll deltas add up, everything else is absolute. Either way the newer sequence and timestamp win.
+            InputCommand merged = *cmd;
+            if (cmd->type == CursorScroll) {
+                float x, y, prev_x, prev_y;
+                memcpy(&x, &cmd->data0, sizeof(x));
+                memcpy(&y, &cmd->data1, sizeof(y));
+                memcpy(&prev_x, &batch->commands[i].data0, sizeof(prev_x));
+                memcpy(&prev_y, &batch->commands[i].data1, sizeof(prev_y));
+                x += prev_x;
+                y += prev_y;
+                memcpy(&merged.data0, &x, sizeof(x));
+                memcpy(&merged.data1, &y, sizeof(y));
+            }
+            memmove(&batch->commands[i], &batch->commands[i + 1], (batch->count - i - 1) * sizeof(InputCommand));
+            batch->commands[batch->count - 1] = merged;
+            return true;
+        }
+    }
+
+    if (batch->count >= MY_INPUT_BATCH_MAX_COMMANDS) {
+        return false;
+    }
+    batch->commands[batch->count++] = *cmd;
+    if (!my_input_command_is_continuous(cmd->type)) {
+        batch->reliable = true;
+    }
+    return true;
+}
+
+static size_t write_u32(uint8_t *buffer, uint32_t value) {
+    memcpy(buffer, &value, sizeof(value));
+    return sizeof(value);
+}
+
+size_t my_input_batch_serialize(const struct my_input_batch *batch,
+                                const struct my_clock_estimate *clock,
+                                uint8_t *buffer,
+                                size_t size) {
+    const size_t total = MY_INPUT_BATCH_HEADER_SIZE + batch->count * MY_INPUT_COMMAND_WIRE_SIZE;
+    if (batch->count == 0 || size < total) {
+        return 0;
+    }
+
+    // Fields are copied one by one so the layout doesn't depend on the compiler, ARM is little endian like the server.
+    size_t offset = 0;
+    buffer[offset++] = MY_INPUT_BATCH_VERSION | MY_INPUT_BATCH_VERSION_FLAG;
+    buffer[offset++] = (uint8_t)batch->count;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const InputCommand *cmd = &batch->commands[i];
+        const int64_t timestamp = clock != NULL ? cmd->timestamp_ns + clock->offset_ns : 0;
+
+        buffer[offset++] = cmd->type;
+        buffer[offset++] = cmd->pointer_id;
+        offset += write_u32(buffer + offset, cmd->sequence);
+        memcpy(buffer + offset, &timestamp, sizeof(timestamp));
+        offset += sizeof(timestamp);
+        offset += write_u32(buffer + offset, cmd->data0);
+        offset += write_u32(buffer + offset, cmd->data1);
+    }
+    return offset;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "clock_sync.h"
+#include "input.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Commands per ENet packet, keeps a full batch well below the MTU.
+#define MY_INPUT_BATCH_MAX_COMMANDS 48
+
+/*!
+ * Version of the batch format. The first byte of a batch used to be the command count, which never exceeded 64, so the
+ * high bit tells a versioned batch apart from the original one.
+ */
+#define MY_INPUT_BATCH_VERSION 2
+#define MY_INPUT_BATCH_VERSION_FLAG 0x80
+
+/// u8 type, u8 pointer ID, u32 sequence, i64 timestamp, u32 data0, u32 data1, little endian.
+#define MY_INPUT_COMMAND_WIRE_SIZE 22
+/// u8 version | @ref MY_INPUT_BATCH_VERSION_FLAG, u8 command count, followed by the commands.
+#define MY_INPUT_BATCH_HEADER_SIZE 2
+#define MY_INPUT_BATCH_MAX_SIZE (MY_INPUT_BATCH_HEADER_SIZE + MY_INPUT_BATCH_MAX_COMMANDS * MY_INPUT_COMMAND_WIRE_SIZE)
+
+/*!
+ * Input commands collected over one ENet service tick, sent as a single packet.
+ *
+ * Continuous commands (cursor moves, sticks, triggers, scrolling) only matter with their latest value, so a new one
+ * replaces the pending one of the same type and pointer. It moves to the end of the batch, so it stays ordered after any discrete
+ * command that came in between, e.g. a cursor move after a button release still ends up where the finger left off.
+ * Stroke samples are the exception, they are all kept so the server can replay the path.
+ *
+ * Only touched by the ENet thread.
+ */
+struct my_input_batch {
+    InputCommand commands[MY_INPUT_BATCH_MAX_COMMANDS];
+    uint32_t count;
+    /// Set once a discrete command is in the batch, such a packet must not be lost.
+    bool reliable;
+};
+
+bool my_input_command_is_continuous(uint8_t type);
+
+void my_input_batch_reset(struct my_input_batch *batch);
+
+/*!
+ * Add a command, replacing a pending continuous one of the same kind unless a discrete command came after it.
+ *
+ * @return false if the batch is full and has to be sent first.
+ */
+bool my_input_batch_add(struct my_input_batch *batch, const InputCommand *cmd);
+
+/*!
+ * Serialize the batch for the wire.
+ *
+ * Timestamps are sent as server pipeline running time, so the server can compare them against its own clock. They are
+ * 0 until the clock sync has an estimate.
+ *
+ * @param clock Current clock estimate, may be NULL.
+ * @return Number of bytes written, at most @ref MY_INPUT_BATCH_MAX_SIZE, or 0 if the batch is empty or @p size too
+ * small.
+ */
+size_t my_input_batch_serialize(const struct my_input_batch *batch,
+                                const struct my_clock_estimate *clock,
+                                uint8_t *buffer,
+                                size_t size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
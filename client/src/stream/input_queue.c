@@ -0,0 +1,57 @@
+#include "input_queue.h"
+
+#include <stdatomic.h>
+
+#define MASK (MY_INPUT_QUEUE_CAPACITY - 1)
+
+void my_input_queue_init(struct my_input_queue *q) {
+    for (uint32_t i = 0; i < MY_INPUT_QUEUE_CAPACITY; i++) {
+        atomic_init(&q->cells[i].sequence, i);
+    }
+    atomic_init(&q->enqueue_pos, 0);
+    q->dequeue_pos = 0;
+}
+
+bool my_input_queue_push(struct my_input_queue *q, const InputCommand *cmd) {
+    uint32_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    struct my_input_queue_cell *cell;
+
+    for (;;) {
+        cell = &q->cells[pos & MASK];
+        const uint32_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const int32_t diff = (int32_t)(seq - pos);
+
+        if (diff == 0) {
+            // The cell is free for this position, try to claim it.
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer hasn't freed this cell since the last lap.
+            return false;
+        } else {
+            // Another producer claimed it first.
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->command = *cmd;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+bool my_input_queue_pop(struct my_input_queue *q, InputCommand *out_cmd) {
+    struct my_input_queue_cell *cell = &q->cells[q->dequeue_pos & MASK];
+    const uint32_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+    // Claimed but not yet written counts as empty, the producer's wakeup comes after the write.
+    if ((int32_t)(seq - (q->dequeue_pos + 1)) < 0) {
+        return false;
+    }
+
+    *out_cmd = cell->command;
+    atomic_store_explicit(&cell->sequence, q->dequeue_pos + MY_INPUT_QUEUE_CAPACITY, memory_order_release);
+    q->dequeue_pos++;
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "input.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Must be a power of two. Way more than one ENet tick's worth of input, even before coalescing.
+#define MY_INPUT_QUEUE_CAPACITY 1024
+
+struct my_input_queue_cell {
+    _Atomic uint32_t sequence;
+    InputCommand command;
+};
+
+/*!
+ * Bounded lock-free multi-producer single-consumer queue of input commands.
+ *
+ * Producers claim a cell by bumping the enqueue position, and publish it through the cell's sequence number, so
+ * neither side ever takes a lock or allocates. Only the ENet thread pops.
+ */
+struct my_input_queue {
+    struct my_input_queue_cell cells[MY_INPUT_QUEUE_CAPACITY];
+    _Atomic uint32_t enqueue_pos;
+    /// Owned by the consumer.
+    uint32_t dequeue_pos;
+};
+
+void my_input_queue_init(struct my_input_queue *q);
+
+/*!
+ * Thread safe.
+ *
+ * @return false if the queue is full and the command was dropped.
+ */
+bool my_input_queue_push(struct my_input_queue *q, const InputCommand *cmd);
+
+/*!
+ * Consumer thread only.
+ *
+ * @return false if the queue is empty.
+ */
+bool my_input_queue_pop(struct my_input_queue *q, InputCommand *out_cmd);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
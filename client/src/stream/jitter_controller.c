@@ -0,0 +1,130 @@
+#include "jitter_controller.h"
+
+#include <string.h>
+
+#include "utils/logger.h"
+
+/// Where a session starts, the fixed latency we used before adapting it.
+#define INITIAL_LATENCY_MS 20
+
+/// Latency the jitter calls for: a few times the average interarrival jitter, plus some slack for scheduling.
+#define JITTER_FACTOR 3.0f
+#define SCHEDULING_SLACK_MS 2.0f
+
+/// Late packets in this share of the pushed ones already make the frames stutter.
+#define LATE_RATIO_HIGH 0.002f
+#define LATE_INCREASE_FACTOR 1.5f
+
+/// Clean intervals before we start lowering the latency again, and the part of the excess dropped per interval.
+#define CLEAN_INTERVALS_BEFORE_DECREASE 3
+#define DECREASE_FRACTION 0.25f
+
+static const struct my_jitter_controller_config preset_configs[] = {
+    [MY_JITTER_PRESET_BALANCED] = {.floor_ms = 10, .ceiling_ms = 80},
+    [MY_JITTER_PRESET_ULTRA_LOW_LATENCY] = {.floor_ms = 2, .ceiling_ms = 30},
+    [MY_JITTER_PRESET_SMOOTH] = {.floor_ms = 30, .ceiling_ms = 200},
+};
+
+void my_jitter_preset_get_config(enum my_jitter_preset preset,
+                                 int32_t floor_ms,
+                                 int32_t ceiling_ms,
+                                 struct my_jitter_controller_config *out_config) {
+    if (preset < MY_JITTER_PRESET_BALANCED || preset > MY_JITTER_PRESET_SMOOTH) {
+        preset = MY_JITTER_PRESET_BALANCED;
+    }
+    *out_config = preset_configs[preset];
+    if (floor_ms > 0) {
+        out_config->floor_ms = floor_ms;
+    }
+    if (ceiling_ms > 0) {
+        out_config->ceiling_ms = ceiling_ms;
+    }
+    if (out_config->ceiling_ms < out_config->floor_ms) {
+        out_config->ceiling_ms = out_config->floor_ms;
+    }
+}
+
+enum my_jitter_preset my_jitter_preset_from_string(const char *str) {
+    if (str == NULL) {
+        return MY_JITTER_PRESET_BALANCED;
+    }
+    if (strcmp(str, "ultra_low_latency") == 0) {
+        return MY_JITTER_PRESET_ULTRA_LOW_LATENCY;
+    }
+    if (strcmp(str, "smooth") == 0) {
+        return MY_JITTER_PRESET_SMOOTH;
+    }
+    return MY_JITTER_PRESET_BALANCED;
+}
+
+static int32_t clamp_latency(const struct my_jitter_controller *ctrl, int32_t latency_ms) {
+    if (latency_ms < ctrl->config.floor_ms) {
+        return ctrl->config.floor_ms;
+    }
+    if (latency_ms > ctrl->config.ceiling_ms) {
+        return ctrl->config.ceiling_ms;
+    }
+    return latency_ms;
+}
+
+void my_jitter_controller_init(struct my_jitter_controller *ctrl, const struct my_jitter_controller_config *config) {
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->config = *config;
+    ctrl->latency_ms = clamp_latency(ctrl, INITIAL_LATENCY_MS);
+}
+
+bool my_jitter_controller_update(struct my_jitter_controller *ctrl, const struct my_jitterbuffer_stats *stats) {
+    // A new jitterbuffer starts its counters over.
+    if (!ctrl->primed || stats->num_pushed < ctrl->last.num_pushed) {
+        ctrl->primed = true;
+        ctrl->last = *stats;
+        return false;
+    }
+
+    const uint64_t pushed = stats->num_pushed - ctrl->last.num_pushed;
+    const uint64_t late = stats->num_late - ctrl->last.num_late;
+    const uint64_t lost = stats->num_lost - ctrl->last.num_lost;
+    const uint64_t duplicates = stats->num_duplicates - ctrl->last.num_duplicates;
+    ctrl->last = *stats;
+
+    if (pushed == 0) {
+        // Nothing streamed, nothing learned.
+        return false;
+    }
+
+    const int32_t needed_ms = (int32_t)(stats->avg_jitter_ms * JITTER_FACTOR + SCHEDULING_SLACK_MS + 0.5f);
+    int32_t latency_ms = ctrl->latency_ms;
+
+    if ((float)late > (float)pushed * LATE_RATIO_HIGH) {
+        // Every late packet is a broken frame, catch up in one go.
+        const int32_t increased = (int32_t)((float)latency_ms * LATE_INCREASE_FACTOR + 0.5f);
+        latency_ms = increased > needed_ms ? increased : needed_ms;
+        ctrl->clean_intervals = 0;
+    } else if (needed_ms > latency_ms) {
+        latency_ms = needed_ms;
+        ctrl->clean_intervals = 0;
+    } else if (late == 0 && ++ctrl->clean_intervals >= CLEAN_INTERVALS_BEFORE_DECREASE) {
+        int32_t step = (int32_t)((float)(latency_ms - needed_ms) * DECREASE_FRACTION);
+        if (step < 1 && latency_ms > needed_ms) {
+            step = 1;
+        }
+        latency_ms -= step;
+    }
+
+    latency_ms = clamp_latency(ctrl, latency_ms);
+    if (latency_ms == ctrl->latency_ms) {
+        return false;
+    }
+
+    ALOGI("%s: latency %d -> %d ms (jitter %.1f ms, pushed %llu, late %llu, lost %llu, duplicates %llu)",
+          __FUNCTION__,
+          ctrl->latency_ms,
+          latency_ms,
+          stats->avg_jitter_ms,
+          (unsigned long long)pushed,
+          (unsigned long long)late,
+          (unsigned long long)lost,
+          (unsigned long long)duplicates);
+    ctrl->latency_ms = latency_ms;
+    return true;
+}
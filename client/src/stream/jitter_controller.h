@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// How much latency we trade for smoothness, picked by the user.
+enum my_jitter_preset {
+    /// Some headroom for Wi-Fi, the default.
+    MY_JITTER_PRESET_BALANCED = 0,
+    /// Wired or short hops to the access point, runs the jitterbuffer as tight as the network allows.
+    MY_JITTER_PRESET_ULTRA_LOW_LATENCY,
+    /// Congested networks, rather a bit more latency than stutter.
+    MY_JITTER_PRESET_SMOOTH,
+};
+
+struct my_jitter_controller_config {
+    /// The rtpbin latency stays within these.
+    int32_t floor_ms;
+    int32_t ceiling_ms;
+};
+
+/*!
+ * Latency range of a preset.
+ *
+ * @param floor_ms, ceiling_ms User overrides, 0 to keep the preset's.
+ */
+void my_jitter_preset_get_config(enum my_jitter_preset preset,
+                                 int32_t floor_ms,
+                                 int32_t ceiling_ms,
+                                 struct my_jitter_controller_config *out_config);
+
+/// "ultra_low_latency", "smooth", anything else is balanced.
+enum my_jitter_preset my_jitter_preset_from_string(const char *str);
+
+/// Cumulative rtpjitterbuffer stats, as read from its "stats" property.
+struct my_jitterbuffer_stats {
+    uint64_t num_pushed;
+    uint64_t num_lost;
+    /// Arrived after their deadline, a too short latency shows up here.
+    uint64_t num_late;
+    uint64_t num_duplicates;
+    /// Jitterbuffer's running average of the interarrival jitter.
+    float avg_jitter_ms;
+};
+
+/*!
+ * Adapts the jitterbuffer latency to the network.
+ *
+ * Late packets raise the latency right away, as does jitter getting close to it. After a few clean intervals it creeps
+ * back down towards what the jitter needs, so a burst of trouble doesn't cost latency for the rest of the session.
+ *
+ * Not thread safe, it is driven from the stream app main loop.
+ */
+struct my_jitter_controller {
+    struct my_jitter_controller_config config;
+    int32_t latency_ms;
+
+    bool primed;
+    struct my_jitterbuffer_stats last;
+    int32_t clean_intervals;
+};
+
+void my_jitter_controller_init(struct my_jitter_controller *ctrl, const struct my_jitter_controller_config *config);
+
+/*!
+ * Feed the current stats.
+ *
+ * @return true if latency_ms changed and should be applied to rtpbin.
+ */
+bool my_jitter_controller_update(struct my_jitter_controller *ctrl, const struct my_jitterbuffer_stats *stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -17,10 +17,13 @@ extern "C" {
 
 bool checkGLError(const char *func, int line);
 
-#define CHECK_GL_ERROR() checkGLError(__FUNCTION__, __LINE__)
-
 void checkGLErrorWrap(const char *when, const char *expr, const char *func, int line);
 
+// glGetError waits for the GPU to catch up, so release builds only check with RSTREAM_GL_ERROR_CHECKS.
+#if !defined(NDEBUG) || defined(RSTREAM_GL_ERROR_CHECKS)
+
+#define CHECK_GL_ERROR() checkGLError(__FUNCTION__, __LINE__)
+
 #define CHK_GL(EXPR)                                               \
     do {                                                           \
         checkGLErrorWrap("before", #EXPR, __FUNCTION__, __LINE__); \
@@ -28,6 +31,17 @@ void checkGLErrorWrap(const char *when, const char *expr, const char *func, int
         checkGLErrorWrap("after", #EXPR, __FUNCTION__, __LINE__);  \
     } while (0)
 
+#else
+
+#define CHECK_GL_ERROR() ((void)0)
+
+#define CHK_GL(EXPR) \
+    do {             \
+        EXPR;        \
+    } while (0)
+
+#endif
+
 bool checkEGLError(const char *func, int line);
 
 #define CHECK_EGL_ERROR() checkEGLError(__FUNCTION__, __LINE__)
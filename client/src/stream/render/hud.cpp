@@ -0,0 +1,216 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief On-screen performance overlay, laid out on the CPU and drawn by Renderer::drawHud.
+ */
+
+#include "hud.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// 5x7 pixel font, one byte per row with the leftmost pixel in bit 4. Only what the labels and values need.
+static constexpr char kGlyphChars[] = "0123456789.%-/ABCDEFJLMOPRS";
+static constexpr uint8_t kGlyphRows[][7] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // 0
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 1
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // 2
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // 3
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // 4
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // 5
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // 6
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // 8
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // 9
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // .
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // -
+    {0x01, 0x02, 0x02, 0x04, 0x08, 0x08, 0x10}, // /
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // A
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // B
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // C
+    {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, // D
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // E
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, // F
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // J
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // L
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // O
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // P
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // R
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // S
+};
+static constexpr int kGlyphCount = sizeof(kGlyphRows) / sizeof(kGlyphRows[0]);
+static_assert(kGlyphCount == sizeof(kGlyphChars) - 1, "one bitmap per character");
+
+static constexpr int kGlyphWidth = 5;
+static constexpr int kGlyphHeight = 7;
+// One texel of padding keeps neighbours from bleeding in.
+static constexpr int kCellWidth = kGlyphWidth + 1;
+static constexpr int kCellHeight = kGlyphHeight + 1;
+// A solid cell after the glyphs, for backgrounds and graph bars.
+static constexpr int kSolidCell = kGlyphCount;
+static constexpr int kAtlasWidth = (kGlyphCount + 1) * kCellWidth;
+static constexpr int kAtlasHeight = kCellHeight;
+
+HudAtlas hudBuildAtlas() {
+    HudAtlas atlas{kAtlasWidth, kAtlasHeight, std::vector<uint8_t>(kAtlasWidth * kAtlasHeight, 0)};
+    for (int glyph = 0; glyph < kGlyphCount; glyph++) {
+        for (int row = 0; row < kGlyphHeight; row++) {
+            for (int col = 0; col < kGlyphWidth; col++) {
+                if (kGlyphRows[glyph][row] & (0x10 >> col)) {
+                    atlas.pixels[row * kAtlasWidth + glyph * kCellWidth + col] = 0xFF;
+                }
+            }
+        }
+    }
+    for (int row = 0; row < kCellHeight; row++) {
+        for (int col = 0; col < kCellWidth; col++) {
+            atlas.pixels[row * kAtlasWidth + kSolidCell * kCellWidth + col] = 0xFF;
+        }
+    }
+    return atlas;
+}
+
+namespace {
+
+struct MetricInfo {
+    const char *label;
+    const char *format;
+    /// Graphs scale to their largest value, but never below this.
+    float min_range;
+    uint8_t color[4];
+};
+
+constexpr MetricInfo kMetrics[] = {
+    {"FRAME", "%5.1f MS", 33.3f, {0x66, 0xBB, 0x6A, 0xD0}},
+    {"D2P", "%5.1f MS", 33.3f, {0x42, 0xA5, 0xF5, 0xD0}},
+    {"MBPS", "%5.1f", 10.0f, {0xAB, 0x47, 0xBC, 0xD0}},
+    {"LOSS", "%5.1f %%", 5.0f, {0xEF, 0x53, 0x50, 0xD0}},
+    {"FEC/S", "%5.0f", 10.0f, {0xFF, 0xCA, 0x28, 0xD0}},
+    {"JB", "%5.0f MS", 50.0f, {0x26, 0xC6, 0xDA, 0xD0}},
+};
+static_assert(sizeof(kMetrics) / sizeof(kMetrics[0]) == static_cast<size_t>(HudMetric::Count), "one per metric");
+
+constexpr uint8_t kPanelColor[4] = {0x00, 0x00, 0x00, 0xA0};
+constexpr uint8_t kGraphColor[4] = {0xFF, 0xFF, 0xFF, 0x18};
+constexpr uint8_t kTextColor[4] = {0xFF, 0xFF, 0xFF, 0xE6};
+
+/// Characters in the text column, label and value.
+constexpr int kTextColumns = 15;
+
+} // namespace
+
+Hud::Hud() {
+    vertices_.reserve(HUD_MAX_QUADS * 4);
+}
+
+void Hud::push(HudMetric metric, float value) {
+    Graph &graph = graphs_[static_cast<size_t>(metric)];
+    graph.values[graph.next] = value;
+    graph.next = (graph.next + 1) % HISTORY;
+    graph.count = std::min(graph.count + 1, HISTORY);
+}
+
+void Hud::clear() {
+    for (Graph &graph : graphs_) {
+        graph.next = 0;
+        graph.count = 0;
+    }
+}
+
+void Hud::addQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const uint8_t *color) {
+    if (vertices_.size() + 4 > HUD_MAX_QUADS * 4) {
+        return;
+    }
+    vertices_.push_back({x0, y0, u0, v0, {color[0], color[1], color[2], color[3]}});
+    vertices_.push_back({x0, y1, u0, v1, {color[0], color[1], color[2], color[3]}});
+    vertices_.push_back({x1, y1, u1, v1, {color[0], color[1], color[2], color[3]}});
+    vertices_.push_back({x1, y0, u1, v0, {color[0], color[1], color[2], color[3]}});
+}
+
+void Hud::addRect(float x0, float y0, float x1, float y1, const uint8_t *color) {
+    // Sample the middle of the solid cell, any filtering stays inside it.
+    const float u = ((float)(kSolidCell * kCellWidth) + kCellWidth * 0.5f) / kAtlasWidth;
+    const float v = (kCellHeight * 0.5f) / kAtlasHeight;
+    addQuad(x0, y0, x1, y1, u, v, u, v, color);
+}
+
+void Hud::addText(float x, float y, float scale, const char *text, const uint8_t *color) {
+    for (const char *c = text; *c != '\0'; c++, x += kCellWidth * scale) {
+        const char *found = strchr(kGlyphChars, *c);
+        if (*c == ' ' || found == nullptr) {
+            continue;
+        }
+        const int glyph = (int)(found - kGlyphChars);
+        const float u0 = (float)(glyph * kCellWidth) / kAtlasWidth;
+        const float u1 = (float)(glyph * kCellWidth + kGlyphWidth) / kAtlasWidth;
+        const float v1 = (float)kGlyphHeight / kAtlasHeight;
+        addQuad(x, y, x + kGlyphWidth * scale, y + kGlyphHeight * scale, u0, 0.0f, u1, v1, color);
+    }
+}
+
+const std::vector<HudVertex> &Hud::build(int32_t window_width, int32_t window_height) {
+    vertices_.clear();
+
+    // Font texels per screen pixel, readable from a couch on a TV and on a phone alike.
+    const float unit = std::max(1.0f, std::round((float)std::min(window_width, window_height) / 540.0f));
+    const float text_scale = 2.0f * unit;
+    const float margin = 8.0f * unit;
+    const float row_height = kGlyphHeight * text_scale + 8.0f * unit;
+    const float text_width = kTextColumns * kCellWidth * text_scale;
+    const float bar_width = 2.0f * unit;
+    const float graph_width = HISTORY * bar_width;
+
+    const float panel_x0 = margin;
+    const float panel_y0 = margin;
+    const float graph_x0 = panel_x0 + margin + text_width;
+    const float panel_x1 = graph_x0 + graph_width + margin;
+    const float panel_y1 = panel_y0 + margin + row_height * static_cast<float>(HudMetric::Count);
+    addRect(panel_x0, panel_y0, panel_x1, panel_y1, kPanelColor);
+
+    for (size_t i = 0; i < graphs_.size(); i++) {
+        const MetricInfo &info = kMetrics[i];
+        const Graph &graph = graphs_[i];
+        const float row_y0 = panel_y0 + margin * 0.5f + row_height * (float)i;
+
+        char text[32];
+        char value[16];
+        if (graph.count > 0) {
+            snprintf(value, sizeof(value), info.format, graph.values[(graph.next + HISTORY - 1) % HISTORY]);
+        } else {
+            snprintf(value, sizeof(value), "    -");
+        }
+        snprintf(text, sizeof(text), "%-5s %s", info.label, value);
+        addText(panel_x0 + margin, row_y0 + 4.0f * unit, text_scale, text, kTextColor);
+
+        const float graph_y0 = row_y0 + 2.0f * unit;
+        const float graph_y1 = row_y0 + row_height - 2.0f * unit;
+        addRect(graph_x0, graph_y0, graph_x0 + graph_width, graph_y1, kGraphColor);
+
+        float range = info.min_range;
+        for (size_t j = 0; j < graph.count; j++) {
+            range = std::max(range, graph.values[j]);
+        }
+
+        // Oldest on the left, so the newest point always sits at the right edge.
+        const size_t first = (graph.next + HISTORY - graph.count) % HISTORY;
+        const float bars_x0 = graph_x0 + (float)(HISTORY - graph.count) * bar_width;
+        for (size_t j = 0; j < graph.count; j++) {
+            const float value = graph.values[(first + j) % HISTORY];
+            const float height = std::min(value / range, 1.0f) * (graph_y1 - graph_y0);
+            if (height <= 0.0f) {
+                continue;
+            }
+            const float x = bars_x0 + (float)j * bar_width;
+            addRect(x, graph_y1 - height, x + bar_width, graph_y1, info.color);
+        }
+    }
+
+    return vertices_;
+}
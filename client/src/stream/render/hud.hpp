@@ -0,0 +1,86 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief On-screen performance overlay, laid out on the CPU and drawn by Renderer::drawHud.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class HudMetric {
+    FrameTime,
+    DecodeToPresent,
+    Bitrate,
+    PacketLoss,
+    FecRecovered,
+    JitterBuffer,
+    Count,
+};
+
+/// Pixel position from the top left of the window, texel in the glyph atlas and color.
+struct HudVertex {
+    float x;
+    float y;
+    float u;
+    float v;
+    uint8_t color[4];
+};
+
+/// Every quad is 4 vertices, Renderer::drawHud indexes them as two triangles.
+constexpr size_t HUD_MAX_QUADS = 4096;
+
+/// The glyph atlas, one byte of coverage per texel.
+struct HudAtlas {
+    int32_t width;
+    int32_t height;
+    std::vector<uint8_t> pixels;
+};
+
+HudAtlas hudBuildAtlas();
+
+/**
+ * Graphs of the last few seconds of every metric, with its current value as text.
+ *
+ * Not thread safe, lives on the render thread.
+ */
+class Hud {
+public:
+    Hud();
+
+    /// Add a point to the graph of a metric.
+    void push(HudMetric metric, float value);
+
+    /// Forget all history, e.g. when the overlay gets shown again.
+    void clear();
+
+    /**
+     * Lay out the overlay for a window size.
+     *
+     * @return Vertices of up to @ref HUD_MAX_QUADS quads, valid until the next call.
+     */
+    const std::vector<HudVertex> &build(int32_t window_width, int32_t window_height);
+
+private:
+    /// Points per graph, a few seconds of frames.
+    static constexpr size_t HISTORY = 120;
+
+    struct Graph {
+        std::array<float, HISTORY> values{};
+        size_t next = 0;
+        size_t count = 0;
+    };
+
+    void addQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const uint8_t *color);
+    void addRect(float x0, float y0, float x1, float y1, const uint8_t *color);
+    void addText(float x, float y, float scale, const char *text, const uint8_t *color);
+
+    std::array<Graph, static_cast<size_t>(HudMetric::Count)> graphs_;
+    std::vector<HudVertex> vertices_;
+};
@@ -11,10 +11,14 @@
 
 #include "render.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "../sample.h"
 #include "gl_debug.h"
@@ -25,10 +29,11 @@ static constexpr const GLchar *vertexShaderSource = R"(#version 300 es
     in vec3 position;
     in vec2 uv;
     out vec2 frag_uv;
+    uniform vec2 uvScale;
 
     void main() {
         gl_Position = vec4(position, 1.0);
-        frag_uv = uv;
+        frag_uv = uv * uvScale;
     }
 )";
 
@@ -48,6 +53,148 @@ static constexpr const GLchar *fragmentShaderSource = R"(#version 300 es
     }
 )";
 
+// Cursor overlay, a ring with a dark outline so it shows on any background
+static constexpr const GLchar *cursorVertexShaderSource = R"(#version 300 es
+    in vec3 position;
+    in vec2 uv;
+    out vec2 frag_pos;
+    uniform vec2 center;
+    uniform vec2 radius;
+
+    void main() {
+        gl_Position = vec4(center + position.xy * radius, 0.0, 1.0);
+        frag_pos = position.xy;
+    }
+)";
+
+static constexpr const GLchar *cursorFragmentShaderSource = R"(#version 300 es
+    precision mediump float;
+
+    in vec2 frag_pos;
+    out vec4 frag_color;
+
+    void main() {
+        float d = length(frag_pos);
+        if (d > 1.0) {
+            discard;
+        }
+        float ring = smoothstep(0.55, 0.65, d);
+        float outline = smoothstep(0.85, 0.95, d);
+        frag_color = vec4(mix(vec3(1.0), vec3(0.0), outline), ring * 0.9);
+    }
+)";
+
+// Performance overlay, glyphs and solid quads from one atlas
+static constexpr const GLchar *hudVertexShaderSource = R"(#version 300 es
+    in vec2 position;
+    in vec2 uv;
+    layout(location = 2) in vec4 color;
+    out vec2 frag_uv;
+    out vec4 frag_color_in;
+    uniform vec2 screenSize;
+
+    void main() {
+        gl_Position = vec4(position.x / screenSize.x * 2.0 - 1.0, 1.0 - position.y / screenSize.y * 2.0, 0.0, 1.0);
+        frag_uv = uv;
+        frag_color_in = color;
+    }
+)";
+
+static constexpr const GLchar *hudFragmentShaderSource = R"(#version 300 es
+    precision mediump float;
+
+    in vec2 frag_uv;
+    in vec4 frag_color_in;
+    out vec4 frag_color;
+    uniform sampler2D atlas;
+
+    void main() {
+        frag_color = vec4(frag_color_in.rgb, frag_color_in.a * texture(atlas, frag_uv).r);
+    }
+)";
+
+// Upscaling from the intermediate framebuffer, which holds the video upright in GL orientation
+static constexpr const GLchar *upscaleVertexShaderSource = R"(#version 300 es
+    in vec3 position;
+    out highp vec2 frag_uv;
+
+    void main() {
+        gl_Position = vec4(position, 1.0);
+        frag_uv = position.xy * 0.5 + 0.5;
+    }
+)";
+
+// Lanczos2 with the dering clamp of FSR's EASU, then RCAS-style sharpening against the nearest texel's cross, all
+// from the same 4x4 taps. SHARPEN and SHARPNESS are prepended per variant, see buildUpscaleProgram.
+static constexpr const GLchar *upscaleFragmentShaderBody = R"(
+    precision mediump float;
+
+    in highp vec2 frag_uv;
+    out vec4 frag_color;
+    uniform sampler2D source;
+    uniform highp vec2 sourceSize;
+
+    // Past this the sharpening can't be undone by the display's own filter, as in RCAS.
+    const float RCAS_LIMIT = 0.25 - 1.0 / 16.0;
+
+    float lanczos2(float x) {
+        x = abs(x);
+        if (x < 1e-4) {
+            return 1.0;
+        }
+        if (x >= 2.0) {
+            return 0.0;
+        }
+        float px = 3.14159265 * x;
+        return 2.0 * sin(px) * sin(px * 0.5) / (px * px);
+    }
+
+    void main() {
+        highp vec2 pos = frag_uv * sourceSize - 0.5;
+        highp vec2 base = floor(pos);
+        vec2 f = vec2(pos - base);
+        ivec2 origin = ivec2(base) - 1;
+        ivec2 last = ivec2(sourceSize) - 1;
+
+        vec3 taps[16];
+        vec3 sum = vec3(0.0);
+        float weight_sum = 0.0;
+        for (int y = 0; y < 4; y++) {
+            float wy = lanczos2(float(y - 1) - f.y);
+            for (int x = 0; x < 4; x++) {
+                vec3 c = texelFetch(source, clamp(origin + ivec2(x, y), ivec2(0), last), 0).rgb;
+                taps[y * 4 + x] = c;
+                float w = wy * lanczos2(float(x - 1) - f.x);
+                sum += c * w;
+                weight_sum += w;
+            }
+        }
+
+        // Negative lobes ring around edges, keep to the range of the four texels around us.
+        vec3 lo = min(min(taps[5], taps[6]), min(taps[9], taps[10]));
+        vec3 hi = max(max(taps[5], taps[6]), max(taps[9], taps[10]));
+        vec3 color = clamp(sum / weight_sum, lo, hi);
+
+#if SHARPEN
+        ivec2 n = ivec2(1) + ivec2(step(0.5, f));
+        vec3 north = taps[(n.y - 1) * 4 + n.x];
+        vec3 south = taps[(n.y + 1) * 4 + n.x];
+        vec3 west = taps[n.y * 4 + n.x - 1];
+        vec3 east = taps[n.y * 4 + n.x + 1];
+
+        vec3 min4 = min(min(north, south), min(west, east));
+        vec3 max4 = max(max(north, south), max(west, east));
+        vec3 hit_min = min4 / (4.0 * max4 + 1e-4);
+        vec3 hit_max = (1.0 - max4) / (4.0 * min4 - 4.0 - 1e-4);
+        vec3 lobe_rgb = max(-hit_min, hit_max);
+        float lobe = max(-RCAS_LIMIT, min(max(lobe_rgb.r, max(lobe_rgb.g, lobe_rgb.b)), 0.0)) * SHARPNESS;
+        color = clamp((lobe * (north + south + west + east) + color) / (4.0 * lobe + 1.0), 0.0, 1.0);
+#endif
+
+        frag_color = vec4(color, 1.0);
+    }
+)";
+
 // Function to check shader compilation errors
 void checkShaderCompilation(GLuint shader) {
     GLint success;
@@ -70,31 +217,57 @@ void checkProgramLinking(GLuint program) {
     }
 }
 
-void Renderer::setupShaders() {
-    // Compile the vertex shader
+static GLuint buildProgram(const GLchar *vertexSource, const GLchar *fragmentSource) {
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
+    glShaderSource(vertexShader, 1, &vertexSource, NULL);
     glCompileShader(vertexShader);
     checkShaderCompilation(vertexShader);
 
-    // Compile the fragment shader
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
     glCompileShader(fragmentShader);
     checkShaderCompilation(fragmentShader);
 
-    // Create and link the shader program
-    program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-    checkProgramLinking(program);
+    GLuint newProgram = glCreateProgram();
+    glAttachShader(newProgram, vertexShader);
+    glAttachShader(newProgram, fragmentShader);
+    // Both programs draw the same quad VAO.
+    glBindAttribLocation(newProgram, 0, "position");
+    glBindAttribLocation(newProgram, 1, "uv");
+    glLinkProgram(newProgram);
+    checkProgramLinking(newProgram);
 
-    // Clean up the shaders as they're no longer needed
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
+    return newProgram;
+}
+
+/// Sharpness is a constant of the shader variant, without it the sharpening isn't compiled in at all.
+static GLuint buildUpscaleProgram(float sharpness) {
+    char header[80];
+    snprintf(header,
+             sizeof(header),
+             "#version 300 es\n#define SHARPEN %d\n#define SHARPNESS %.4f\n",
+             sharpness > 0.0f ? 1 : 0,
+             sharpness);
+    const std::string source = std::string(header) + upscaleFragmentShaderBody;
+    return buildProgram(upscaleVertexShaderSource, source.c_str());
+}
+
+void Renderer::setupShaders() {
+    program = buildProgram(vertexShaderSource, fragmentShaderSource);
+
+    uvScaleLocation_ = glGetUniformLocation(program, "uvScale");
+
+    // Every sampler reads unit 0, that never changes.
+    state_.useProgram(program);
+    glUniform1i(glGetUniformLocation(program, "textureSampler"), 0);
+}
 
-    textureSamplerLocation_ = glGetUniformLocation(program, "textureSampler");
+void Renderer::setupCursorShaders() {
+    cursorProgram = buildProgram(cursorVertexShaderSource, cursorFragmentShaderSource);
+    cursorCenterLocation_ = glGetUniformLocation(cursorProgram, "center");
+    cursorRadiusLocation_ = glGetUniformLocation(cursorProgram, "radius");
 }
 
 struct TextureCoord {
@@ -127,7 +300,7 @@ void Renderer::setupQuadVertexData() {
     glGenVertexArrays(1, &quadVAO);
     glGenBuffers(1, &quadVBO);
 
-    glBindVertexArray(quadVAO);
+    state_.bindVertexArray(quadVAO);
     glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
 
@@ -138,8 +311,94 @@ void Renderer::setupQuadVertexData() {
 
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, kVertexBufferStride, (GLvoid *)offsetof(Vertex, texcoord));
     glEnableVertexAttribArray(1);
+}
+
+void Renderer::setupHud() {
+    hudProgram = buildProgram(hudVertexShaderSource, hudFragmentShaderSource);
+    hudScreenSizeLocation_ = glGetUniformLocation(hudProgram, "screenSize");
+    state_.useProgram(hudProgram);
+    glUniform1i(glGetUniformLocation(hudProgram, "atlas"), 0);
+
+    const HudAtlas atlas = hudBuildAtlas();
+    glGenTextures(1, &hudAtlasTexture);
+    glBindTexture(GL_TEXTURE_2D, hudAtlasTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_R8, atlas.width, atlas.height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // The font is scaled by whole texels, nearest keeps it crisp.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Two triangles per quad, shared by every batch.
+    std::vector<GLushort> indices(HUD_MAX_QUADS * 6);
+    for (size_t i = 0; i < HUD_MAX_QUADS; i++) {
+        const GLushort base = (GLushort)(i * 4);
+        const GLushort quad[] = {base, (GLushort)(base + 1), (GLushort)(base + 2),
+                                 base, (GLushort)(base + 2), (GLushort)(base + 3)};
+        std::copy(quad, quad + 6, indices.begin() + i * 6);
+    }
+    static_assert(HUD_MAX_QUADS * 4 <= 65536, "indices are 16 bit");
+
+    glGenVertexArrays(1, &hudVAO);
+    glGenBuffers(1, &hudVBO);
+    glGenBuffers(1, &hudIBO);
 
-    glBindVertexArray(0);
+    state_.bindVertexArray(hudVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, hudIBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, hudVBO);
+    glBufferData(GL_ARRAY_BUFFER, HUD_MAX_QUADS * 4 * sizeof(HudVertex), nullptr, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (GLvoid *)offsetof(HudVertex, x));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (GLvoid *)offsetof(HudVertex, u));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (GLvoid *)offsetof(HudVertex, color));
+    glEnableVertexAttribArray(2);
+}
+
+void Renderer::setupUpscaling(float sharpness_stops) {
+    if (upscaleProgram != 0) {
+        glDeleteProgram(upscaleProgram);
+    }
+    // Stops of sharpness taken away, as in RCAS: 0 is the sharpest.
+    upscaleProgram = buildUpscaleProgram(sharpness_stops >= 0.0f ? exp2f(-sharpness_stops) : 0.0f);
+    upscaleSourceSizeLocation_ = glGetUniformLocation(upscaleProgram, "sourceSize");
+    upscaleSourceSize_[0] = upscaleSourceSize_[1] = -1.0f;
+
+    state_.useProgram(upscaleProgram);
+    glUniform1i(glGetUniformLocation(upscaleProgram, "source"), 0);
+}
+
+void Renderer::ensureUpscaleTarget(int32_t width, int32_t height) {
+    if (upscaleFramebuffer != 0 && upscaleWidth_ == width && upscaleHeight_ == height) {
+        return;
+    }
+    if (upscaleTexture == 0) {
+        glGenTextures(1, &upscaleTexture);
+        glGenFramebuffers(1, &upscaleFramebuffer);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, upscaleTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    // Only read with texelFetch.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    state_.bindFramebuffer(upscaleFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, upscaleTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        ALOGE("%s: upscale framebuffer incomplete", __FUNCTION__);
+    }
+
+    upscaleWidth_ = width;
+    upscaleHeight_ = height;
+    ALOGI("%s: upscaling from %dx%d", __FUNCTION__, width, height);
 }
 
 Renderer::~Renderer() {
@@ -147,9 +406,19 @@ Renderer::~Renderer() {
 }
 
 void Renderer::setupRender() {
+    state_.invalidate();
+    uvScale_[0] = uvScale_[1] = -1.0f;
+
     registerGlDebugCallback();
     setupShaders();
+    setupCursorShaders();
     setupQuadVertexData();
+    setupHud();
+
+    // Nothing else draws on this context, so this stays set.
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glActiveTexture(GL_TEXTURE0);
+    state_.bindFramebuffer(0);
 }
 
 void Renderer::destroy() {
@@ -157,6 +426,10 @@ void Renderer::destroy() {
         glDeleteProgram(program);
         program = 0;
     }
+    if (cursorProgram != 0) {
+        glDeleteProgram(cursorProgram);
+        cursorProgram = 0;
+    }
     if (quadVAO != 0) {
         glDeleteVertexArrays(1, &quadVAO);
         quadVAO = 0;
@@ -165,21 +438,136 @@ void Renderer::destroy() {
         glDeleteBuffers(1, &quadVBO);
         quadVBO = 0;
     }
+    if (hudProgram != 0) {
+        glDeleteProgram(hudProgram);
+        hudProgram = 0;
+    }
+    if (hudVAO != 0) {
+        glDeleteVertexArrays(1, &hudVAO);
+        hudVAO = 0;
+    }
+    if (hudVBO != 0) {
+        glDeleteBuffers(1, &hudVBO);
+        hudVBO = 0;
+    }
+    if (hudIBO != 0) {
+        glDeleteBuffers(1, &hudIBO);
+        hudIBO = 0;
+    }
+    if (upscaleProgram != 0) {
+        glDeleteProgram(upscaleProgram);
+        upscaleProgram = 0;
+    }
+    if (upscaleFramebuffer != 0) {
+        glDeleteFramebuffers(1, &upscaleFramebuffer);
+        upscaleFramebuffer = 0;
+    }
+    if (upscaleTexture != 0) {
+        glDeleteTextures(1, &upscaleTexture);
+        upscaleTexture = 0;
+    }
+    upscaleWidth_ = 0;
+    upscaleHeight_ = 0;
+    state_.invalidate();
+    if (hudAtlasTexture != 0) {
+        glDeleteTextures(1, &hudAtlasTexture);
+        hudAtlasTexture = 0;
+    }
 }
 
-void Renderer::draw(GLuint texture, GLenum texture_target) const {
-    // Use the shader program
-    glUseProgram(program);
+void Renderer::setViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    state_.viewport(x, y, width, height);
+}
 
-    // Bind the texture
-    glActiveTexture(GL_TEXTURE0);
+void Renderer::clear() {
+    state_.bindFramebuffer(0);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void Renderer::discard() {
+    state_.bindFramebuffer(0);
+    // The default framebuffer names its attachments differently from FBOs.
+    static constexpr GLenum attachments[] = {GL_COLOR};
+    glInvalidateFramebuffer(GL_FRAMEBUFFER, 1, attachments);
+}
+
+void Renderer::draw(GLuint texture, GLenum texture_target, float uv_scale_x, float uv_scale_y) {
+    state_.useProgram(program);
+    if (uvScale_[0] != uv_scale_x || uvScale_[1] != uv_scale_y) {
+        glUniform2f(uvScaleLocation_, uv_scale_x, uv_scale_y);
+        uvScale_[0] = uv_scale_x;
+        uvScale_[1] = uv_scale_y;
+    }
+
+    // Not cached, the decoder binds textures on this context too.
     glBindTexture(texture_target, texture);
-    glUniform1i(textureSamplerLocation_, 0);
 
-    // Draw the quad
-    glBindVertexArray(quadVAO);
+    state_.setBlend(false);
+    state_.bindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    CHECK_GL_ERROR();
+}
+
+void Renderer::drawUpscaled(GLuint texture,
+                            GLenum texture_target,
+                            float uv_scale_x,
+                            float uv_scale_y,
+                            int32_t video_width,
+                            int32_t video_height,
+                            const GLint viewport[4]) {
+    // Gets us a texture texelFetch works on, and drops the decoder's padding on the way.
+    ensureUpscaleTarget(video_width, video_height);
+    state_.bindFramebuffer(upscaleFramebuffer);
+    state_.viewport(0, 0, video_width, video_height);
+    draw(texture, texture_target, uv_scale_x, uv_scale_y);
+
+    state_.bindFramebuffer(0);
+    state_.viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    state_.useProgram(upscaleProgram);
+    if (upscaleSourceSize_[0] != (float)video_width || upscaleSourceSize_[1] != (float)video_height) {
+        glUniform2f(upscaleSourceSizeLocation_, (float)video_width, (float)video_height);
+        upscaleSourceSize_[0] = (float)video_width;
+        upscaleSourceSize_[1] = (float)video_height;
+    }
+    glBindTexture(GL_TEXTURE_2D, upscaleTexture);
+
+    state_.bindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    CHECK_GL_ERROR();
+}
+
+void Renderer::drawCursor(float x, float y, float radius_x, float radius_y) {
+    state_.useProgram(cursorProgram);
+    glUniform2f(cursorCenterLocation_, x, y);
+    glUniform2f(cursorRadiusLocation_, radius_x, radius_y);
+
+    state_.setBlend(true);
+    state_.bindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-    glBindVertexArray(0);
+
+    CHECK_GL_ERROR();
+}
+
+void Renderer::drawHud(const std::vector<HudVertex> &vertices, int32_t window_width, int32_t window_height) {
+    const size_t quad_count = std::min(vertices.size() / 4, HUD_MAX_QUADS);
+    if (quad_count == 0) {
+        return;
+    }
+
+    state_.useProgram(hudProgram);
+    glUniform2f(hudScreenSizeLocation_, (float)window_width, (float)window_height);
+    glBindTexture(GL_TEXTURE_2D, hudAtlasTexture);
+
+    state_.setBlend(true);
+    state_.bindVertexArray(hudVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, hudVBO);
+    // Orphan the previous frame's batch instead of waiting for the GPU to be done with it.
+    glBufferData(GL_ARRAY_BUFFER, HUD_MAX_QUADS * 4 * sizeof(HudVertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, quad_count * 4 * sizeof(HudVertex), vertices.data());
+    glDrawElements(GL_TRIANGLES, (GLsizei)(quad_count * 6), GL_UNSIGNED_SHORT, nullptr);
 
     CHECK_GL_ERROR();
 }
@@ -13,7 +13,9 @@
 
 #include <memory>
 
+#include "hud.hpp"
 #include "render_api.h"
+#include "render_state.hpp"
 
 class Renderer {
 public:
@@ -32,16 +34,82 @@ public:
     /// Destroy resources. Must call with EGL context current.
     void destroy();
 
+    /// Set the viewport on whatever framebuffer is drawn next. Must call with EGL Context current.
+    void setViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    /// Clear the whole default framebuffer to black. Must call with EGL Context current.
+    void clear();
+
+    /// Drop the default framebuffer's contents instead of loading them, when every pixel gets drawn anyway. Must call
+    /// with EGL Context current.
+    void discard();
+
     /// Draw texture to framebuffer. Must call with EGL Context current.
-    void draw(GLuint texture, GLenum texture_target) const;
+    ///
+    /// @param uv_scale_x,uv_scale_y Crop the texture to this fraction of its size, from the top left.
+    void draw(GLuint texture, GLenum texture_target, float uv_scale_x = 1.0f, float uv_scale_y = 1.0f);
+
+    /// Compile the upscaling filter. Must call with EGL Context current.
+    ///
+    /// @param sharpness_stops How much to back off from full sharpening, negative disables it.
+    void setupUpscaling(float sharpness_stops);
+
+    bool hasUpscaling() const {
+        return upscaleProgram != 0;
+    }
+
+    /// Like draw, but through an intermediate framebuffer of the video size and the upscaling filter. Leaves the
+    /// default framebuffer bound with the given viewport. Must call with EGL Context current, after setupUpscaling.
+    void drawUpscaled(GLuint texture,
+                      GLenum texture_target,
+                      float uv_scale_x,
+                      float uv_scale_y,
+                      int32_t video_width,
+                      int32_t video_height,
+                      const GLint viewport[4]);
+
+    /// Draw the local cursor on top of the video. Must call with EGL Context current.
+    ///
+    /// @param x,y Center in normalized device coordinates of the current viewport.
+    /// @param radius_x,radius_y Size in normalized device coordinates, separate to keep it round in any viewport.
+    void drawCursor(float x, float y, float radius_x, float radius_y);
+
+    /// Draw the performance overlay in one call. Must call with EGL Context current and the viewport on the window.
+    ///
+    /// @param vertices As laid out by Hud::build, in pixels of a window this size.
+    void drawHud(const std::vector<HudVertex> &vertices, int32_t window_width, int32_t window_height);
 
 private:
     void setupShaders();
+    void setupCursorShaders();
     void setupQuadVertexData();
+    void setupHud();
+    void ensureUpscaleTarget(int32_t width, int32_t height);
 
     GLuint program = 0;
+    GLuint cursorProgram = 0;
     GLuint quadVAO = 0;
     GLuint quadVBO = 0;
 
-    GLint textureSamplerLocation_ = 0;
+    RenderStateCache state_;
+
+    GLint uvScaleLocation_ = 0;
+    float uvScale_[2] = {-1.0f, -1.0f};
+    GLint cursorCenterLocation_ = 0;
+    GLint cursorRadiusLocation_ = 0;
+
+    GLuint upscaleProgram = 0;
+    GLuint upscaleFramebuffer = 0;
+    GLuint upscaleTexture = 0;
+    int32_t upscaleWidth_ = 0;
+    int32_t upscaleHeight_ = 0;
+    GLint upscaleSourceSizeLocation_ = 0;
+    float upscaleSourceSize_[2] = {-1.0f, -1.0f};
+
+    GLuint hudProgram = 0;
+    GLuint hudVAO = 0;
+    GLuint hudVBO = 0;
+    GLuint hudIBO = 0;
+    GLuint hudAtlasTexture = 0;
+    GLint hudScreenSizeLocation_ = 0;
 };
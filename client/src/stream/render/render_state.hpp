@@ -0,0 +1,85 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief Skips GL state changes that wouldn't change anything.
+ */
+
+#pragma once
+
+#include "render_api.h"
+
+/**
+ * Last GL state the renderer set on its context, which stays current on the render thread.
+ *
+ * Texture bindings aren't tracked: the hardware buffer decoder binds textures on the same context to import frames,
+ * and the video texture is a new one most frames anyway.
+ */
+class RenderStateCache {
+public:
+    void useProgram(GLuint program) {
+        if (program_ == program) {
+            return;
+        }
+        glUseProgram(program);
+        program_ = program;
+    }
+
+    void bindVertexArray(GLuint vao) {
+        if (vao_ == vao) {
+            return;
+        }
+        glBindVertexArray(vao);
+        vao_ = vao;
+    }
+
+    void bindFramebuffer(GLuint framebuffer) {
+        if (framebuffer_ == framebuffer) {
+            return;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        framebuffer_ = framebuffer;
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+        if (viewport_[0] == x && viewport_[1] == y && viewport_[2] == width && viewport_[3] == height) {
+            return;
+        }
+        glViewport(x, y, width, height);
+        viewport_[0] = x;
+        viewport_[1] = y;
+        viewport_[2] = width;
+        viewport_[3] = height;
+    }
+
+    /// Blending is always source over, the only kind the overlays use.
+    void setBlend(bool enabled) {
+        if (blend_ == (enabled ? 1 : 0)) {
+            return;
+        }
+        if (enabled) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        } else {
+            glDisable(GL_BLEND);
+        }
+        blend_ = enabled ? 1 : 0;
+    }
+
+    /// Forget everything, the next call of each kind goes to GL again.
+    void invalidate() {
+        *this = RenderStateCache();
+    }
+
+private:
+    // Names GL never hands out, so nothing matches until it was set once.
+    static constexpr GLuint UNKNOWN = ~0u;
+
+    GLuint program_ = UNKNOWN;
+    GLuint vao_ = UNKNOWN;
+    GLuint framebuffer_ = UNKNOWN;
+    GLint viewport_[4] = {-1, -1, -1, -1};
+    int blend_ = -1;
+};
@@ -0,0 +1,90 @@
+#include "rtp_header_meta.h"
+
+#include <string.h>
+
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+
+GType my_rtp_header_meta_api_get_type(void) {
+    static gsize type = 0;
+    // The header stays valid however the payload gets transformed, so no tags.
+    static const gchar *tags[] = {NULL};
+
+    if (g_once_init_enter(&type)) {
+        GType api_type = gst_meta_api_type_register("MyRtpHeaderMetaAPI", tags);
+        g_once_init_leave(&type, api_type);
+    }
+    return type;
+}
+
+static gboolean rtp_header_meta_init(GstMeta *meta, gpointer params, GstBuffer *buffer) {
+    MyRtpHeaderMeta *rtp_meta = (MyRtpHeaderMeta *)meta;
+    memset(&rtp_meta->header, 0, sizeof(rtp_meta->header));
+    return TRUE;
+}
+
+static gboolean rtp_header_meta_transform(
+    GstBuffer *dest, GstMeta *meta, GstBuffer *buffer, GQuark type, gpointer data) {
+    if (!GST_META_TRANSFORM_IS_COPY(type)) {
+        return FALSE;
+    }
+
+    // A copy that doesn't start at the header has none.
+    const GstMetaTransformCopy *copy = data;
+    if (copy->region && copy->offset != 0) {
+        return TRUE;
+    }
+
+    my_buffer_add_rtp_header_meta(dest, &((MyRtpHeaderMeta *)meta)->header);
+    return TRUE;
+}
+
+const GstMetaInfo *my_rtp_header_meta_get_info(void) {
+    static const GstMetaInfo *meta_info = NULL;
+
+    if (g_once_init_enter((GstMetaInfo **)&meta_info)) {
+        const GstMetaInfo *info = gst_meta_register(MY_RTP_HEADER_META_API_TYPE,
+                                                    "MyRtpHeaderMeta",
+                                                    sizeof(MyRtpHeaderMeta),
+                                                    rtp_header_meta_init,
+                                                    NULL,
+                                                    rtp_header_meta_transform);
+        g_once_init_leave((GstMetaInfo **)&meta_info, (GstMetaInfo *)info);
+    }
+    return meta_info;
+}
+
+bool my_rtp_header_parse(const uint8_t *data, size_t size, struct my_rtp_header *out_header) {
+    if (size < RTP_HEADER_SIZE || (data[0] >> 6) != RTP_VERSION) {
+        return false;
+    }
+
+    out_header->marker = (data[1] & 0x80) != 0;
+    out_header->payload_type = data[1] & 0x7f;
+    out_header->seq_num = (uint16_t)((data[2] << 8) | data[3]);
+    out_header->timestamp =
+        ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | (uint32_t)data[7];
+    out_header->ssrc =
+        ((uint32_t)data[8] << 24) | ((uint32_t)data[9] << 16) | ((uint32_t)data[10] << 8) | (uint32_t)data[11];
+    return true;
+}
+
+MyRtpHeaderMeta *my_buffer_add_rtp_header_meta(GstBuffer *buffer, const struct my_rtp_header *header) {
+    MyRtpHeaderMeta *meta = (MyRtpHeaderMeta *)gst_buffer_add_meta(buffer, MY_RTP_HEADER_META_INFO, NULL);
+    if (meta != NULL) {
+        meta->header = *header;
+    }
+    return meta;
+}
+
+bool my_buffer_get_rtp_header(GstBuffer *buffer, struct my_rtp_header *out_header) {
+    const MyRtpHeaderMeta *meta = (MyRtpHeaderMeta *)gst_buffer_get_meta(buffer, MY_RTP_HEADER_META_API_TYPE);
+    if (meta != NULL) {
+        *out_header = meta->header;
+        return true;
+    }
+
+    uint8_t data[RTP_HEADER_SIZE];
+    const gsize size = gst_buffer_extract(buffer, 0, data, sizeof(data));
+    return my_rtp_header_parse(data, size, out_header);
+}
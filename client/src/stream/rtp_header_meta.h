@@ -0,0 +1,47 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+G_BEGIN_DECLS
+
+/// The fixed part of an RTP header, in host byte order.
+struct my_rtp_header {
+    uint16_t seq_num;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    uint8_t payload_type;
+    bool marker;
+};
+
+/*!
+ * RTP header of a packet, parsed once when it comes off the socket.
+ *
+ * Saves every probe along the receive path from mapping the buffer again. Packets that didn't come from
+ * myudpbatchsrc, e.g. ones recovered by FEC, don't carry it.
+ */
+typedef struct {
+    GstMeta meta;
+    struct my_rtp_header header;
+} MyRtpHeaderMeta;
+
+GType my_rtp_header_meta_api_get_type(void);
+#define MY_RTP_HEADER_META_API_TYPE (my_rtp_header_meta_api_get_type())
+
+const GstMetaInfo *my_rtp_header_meta_get_info(void);
+#define MY_RTP_HEADER_META_INFO (my_rtp_header_meta_get_info())
+
+/// @return false if @p data is too short or not RTP version 2.
+bool my_rtp_header_parse(const uint8_t *data, size_t size, struct my_rtp_header *out_header);
+
+MyRtpHeaderMeta *my_buffer_add_rtp_header_meta(GstBuffer *buffer, const struct my_rtp_header *header);
+
+/*!
+ * Get the RTP header of a packet, from its meta if it has one and by reading the buffer otherwise.
+ *
+ * @return false if the buffer doesn't hold an RTP packet.
+ */
+bool my_buffer_get_rtp_header(GstBuffer *buffer, struct my_rtp_header *out_header);
+
+G_END_DECLS
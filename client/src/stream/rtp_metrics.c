@@ -0,0 +1,232 @@
+#include "rtp_metrics.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils/logger.h"
+
+#define NS_PER_SEC 1000000000LL
+
+/// Sequence jumps past these are a restarted sender rather than loss or reordering, see RFC 3550 A.1.
+#define MAX_DROPOUT 3000
+#define MAX_MISORDER 100
+
+#define BUCKET_COUNT MY_RTP_HISTOGRAM_BUCKET_COUNT
+
+struct my_rtp_metrics {
+    uint32_t clock_rate;
+    int fec_payload_type;
+
+    // Only touched by the thread feeding packets.
+    bool primed;
+    uint16_t highest_seq;
+    int64_t prev_transit;
+    /// In RTP clock units.
+    double jitter;
+    int64_t window_start_ns;
+    uint64_t window_bytes;
+
+    _Atomic bool restart;
+
+    // Only written by the thread feeding packets.
+    _Atomic uint64_t packets;
+    _Atomic uint64_t fec_packets;
+    _Atomic uint64_t bytes;
+    _Atomic uint32_t bytes_per_second;
+    _Atomic uint64_t lost;
+    _Atomic uint64_t gaps;
+    _Atomic uint64_t reordered;
+    _Atomic uint64_t duplicates;
+    _Atomic uint32_t jitter_us;
+    _Atomic uint32_t gap_histogram[BUCKET_COUNT];
+    _Atomic uint32_t reorder_histogram[BUCKET_COUNT];
+    _Atomic uint32_t transit_histogram[BUCKET_COUNT];
+};
+
+// With a single writer a relaxed load and store is enough, and cheaper than an atomic add.
+static inline void add_u64(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void add_u32(_Atomic uint32_t *counter, uint32_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static int histogram_bucket(uint64_t value) {
+    int bucket = 0;
+    while (value > 0 && bucket < BUCKET_COUNT - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+struct my_rtp_metrics *my_rtp_metrics_create(uint32_t clock_rate, int fec_payload_type) {
+    struct my_rtp_metrics *m = calloc(1, sizeof(struct my_rtp_metrics));
+    if (m == NULL) {
+        ALOGE("%s: failed to allocate", __FUNCTION__);
+        return NULL;
+    }
+    m->clock_rate = clock_rate;
+    m->fec_payload_type = fec_payload_type;
+    return m;
+}
+
+void my_rtp_metrics_destroy(struct my_rtp_metrics *m) {
+    free(m);
+}
+
+static void update_sequence(struct my_rtp_metrics *m, uint16_t seq_num) {
+    const int16_t delta = (int16_t)(seq_num - m->highest_seq);
+
+    if (delta > MAX_DROPOUT || delta < -MAX_MISORDER) {
+        m->highest_seq = seq_num;
+    } else if (delta > 0) {
+        if (delta > 1) {
+            const uint32_t skipped = (uint32_t)delta - 1;
+            add_u64(&m->lost, skipped);
+            add_u64(&m->gaps, 1);
+            add_u32(&m->gap_histogram[histogram_bucket(skipped)], 1);
+        }
+        m->highest_seq = seq_num;
+    } else if (delta == 0) {
+        add_u64(&m->duplicates, 1);
+    } else {
+        add_u64(&m->reordered, 1);
+        add_u32(&m->reorder_histogram[histogram_bucket((uint64_t)-delta)], 1);
+    }
+}
+
+/// RFC 3550 interarrival jitter.
+static void update_jitter(struct my_rtp_metrics *m, uint32_t rtp_timestamp, int64_t arrival_ns) {
+    const int64_t arrival = (int64_t)((double)arrival_ns * m->clock_rate / NS_PER_SEC);
+    // Truncate to the RTP timestamp width, so wraparound cancels out in the difference below.
+    const int64_t transit = (int32_t)((uint32_t)arrival - rtp_timestamp);
+    if (!m->primed) {
+        m->prev_transit = transit;
+        return;
+    }
+
+    int64_t d = transit - m->prev_transit;
+    if (d < 0) {
+        d = -d;
+    }
+    m->prev_transit = transit;
+    m->jitter += ((double)d - m->jitter) / 16.0;
+
+    const uint64_t d_us = (uint64_t)d * 1000000 / m->clock_rate;
+    add_u32(&m->transit_histogram[histogram_bucket(d_us / MY_RTP_TRANSIT_BUCKET_UNIT_US)], 1);
+    atomic_store_explicit(&m->jitter_us, (uint32_t)(m->jitter * 1e6 / m->clock_rate), memory_order_relaxed);
+}
+
+void my_rtp_metrics_on_packet(struct my_rtp_metrics *m,
+                              uint16_t seq_num,
+                              uint32_t rtp_timestamp,
+                              uint8_t payload_type,
+                              size_t size,
+                              int64_t arrival_ns) {
+    // Only pay for the exchange when a restart is actually pending.
+    if (atomic_load_explicit(&m->restart, memory_order_relaxed) &&
+        atomic_exchange_explicit(&m->restart, false, memory_order_acquire)) {
+        m->primed = false;
+        m->jitter = 0;
+        m->window_start_ns = 0;
+        m->window_bytes = 0;
+        atomic_store_explicit(&m->jitter_us, 0, memory_order_relaxed);
+        atomic_store_explicit(&m->bytes_per_second, 0, memory_order_relaxed);
+    }
+
+    add_u64(&m->packets, 1);
+    if (payload_type == m->fec_payload_type) {
+        add_u64(&m->fec_packets, 1);
+    }
+    add_u64(&m->bytes, size);
+
+    if (m->window_start_ns == 0) {
+        m->window_start_ns = arrival_ns;
+    } else if (arrival_ns - m->window_start_ns >= NS_PER_SEC) {
+        const int64_t elapsed_ns = arrival_ns - m->window_start_ns;
+        atomic_store_explicit(
+            &m->bytes_per_second, (uint32_t)(m->window_bytes * NS_PER_SEC / elapsed_ns), memory_order_relaxed);
+        m->window_start_ns = arrival_ns;
+        m->window_bytes = 0;
+    }
+    m->window_bytes += size;
+
+    if (m->primed) {
+        update_sequence(m, seq_num);
+    } else {
+        m->highest_seq = seq_num;
+    }
+    update_jitter(m, rtp_timestamp, arrival_ns);
+    m->primed = true;
+}
+
+void my_rtp_metrics_restart(struct my_rtp_metrics *m) {
+    atomic_store_explicit(&m->restart, true, memory_order_release);
+    // Don't report the old stream until the next packet, the feeding thread clears them again then.
+    atomic_store_explicit(&m->jitter_us, 0, memory_order_relaxed);
+    atomic_store_explicit(&m->bytes_per_second, 0, memory_order_relaxed);
+}
+
+void my_rtp_metrics_snapshot(struct my_rtp_metrics *m, struct my_rtp_metrics_snapshot *out_snapshot) {
+    out_snapshot->packets = atomic_load_explicit(&m->packets, memory_order_relaxed);
+    out_snapshot->fec_packets = atomic_load_explicit(&m->fec_packets, memory_order_relaxed);
+    out_snapshot->bytes = atomic_load_explicit(&m->bytes, memory_order_relaxed);
+    out_snapshot->bytes_per_second = atomic_load_explicit(&m->bytes_per_second, memory_order_relaxed);
+    out_snapshot->lost = atomic_load_explicit(&m->lost, memory_order_relaxed);
+    out_snapshot->gaps = atomic_load_explicit(&m->gaps, memory_order_relaxed);
+    out_snapshot->reordered = atomic_load_explicit(&m->reordered, memory_order_relaxed);
+    out_snapshot->duplicates = atomic_load_explicit(&m->duplicates, memory_order_relaxed);
+    out_snapshot->jitter_ms = (float)atomic_load_explicit(&m->jitter_us, memory_order_relaxed) / 1000.0f;
+
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        out_snapshot->gap_histogram[i] = atomic_load_explicit(&m->gap_histogram[i], memory_order_relaxed);
+        out_snapshot->reorder_histogram[i] = atomic_load_explicit(&m->reorder_histogram[i], memory_order_relaxed);
+        out_snapshot->transit_histogram[i] = atomic_load_explicit(&m->transit_histogram[i], memory_order_relaxed);
+    }
+}
+
+static void format_histogram(const uint32_t *histogram, char *out, size_t size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i < BUCKET_COUNT && len < size; i++) {
+        const int written = snprintf(out + len, size - len, i == 0 ? "%u" : " %u", histogram[i]);
+        if (written < 0) {
+            break;
+        }
+        len += (size_t)written;
+    }
+}
+
+void my_rtp_metrics_log(const char *name, const struct my_rtp_metrics_snapshot *snapshot) {
+    if (snapshot->packets == 0) {
+        return;
+    }
+
+    ALOGI("[rtp] %s: %.1f kB/s, %" PRIu64 " packets (%" PRIu64 " FEC), %" PRIu64 " lost in %" PRIu64
+          " gaps, %" PRIu64 " reordered, %" PRIu64 " duplicates, jitter %.2f ms",
+          name,
+          (float)snapshot->bytes_per_second / 1000.0f,
+          snapshot->packets,
+          snapshot->fec_packets,
+          snapshot->lost,
+          snapshot->gaps,
+          snapshot->reordered,
+          snapshot->duplicates,
+          snapshot->jitter_ms);
+
+    char buckets[BUCKET_COUNT * 11];
+    format_histogram(snapshot->transit_histogram, buckets, sizeof(buckets));
+    ALOGI("[rtp] %s: transit change histogram (x%d us, log2): %s", name, MY_RTP_TRANSIT_BUCKET_UNIT_US, buckets);
+    if (snapshot->gaps != 0) {
+        format_histogram(snapshot->gap_histogram, buckets, sizeof(buckets));
+        ALOGI("[rtp] %s: gap size histogram (log2): %s", name, buckets);
+    }
+    if (snapshot->reordered != 0) {
+        format_histogram(snapshot->reorder_histogram, buckets, sizeof(buckets));
+        ALOGI("[rtp] %s: reorder distance histogram (log2): %s", name, buckets);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * Buckets of the snapshot histograms.
+ *
+ * Bucket 0 holds 0, bucket i holds values from 2^(i - 1) up to 2^i - 1, the last one everything above.
+ */
+#define MY_RTP_HISTOGRAM_BUCKET_COUNT 12
+
+/// Unit of @ref my_rtp_metrics_snapshot::transit_histogram.
+#define MY_RTP_TRANSIT_BUCKET_UNIT_US 100
+
+struct my_rtp_metrics_snapshot {
+    /// All packets, FEC included.
+    uint64_t packets;
+    uint64_t fec_packets;
+    uint64_t bytes;
+    /// Over the last full second of arrivals.
+    uint32_t bytes_per_second;
+
+    /// Sequence numbers skipped when a packet arrived, reordered ones this filled in later included.
+    uint64_t lost;
+    uint64_t gaps;
+    /// Arrived after a higher sequence number.
+    uint64_t reordered;
+    uint64_t duplicates;
+
+    /// RFC 3550 interarrival jitter.
+    float jitter_ms;
+
+    /// Packets skipped per gap.
+    uint32_t gap_histogram[MY_RTP_HISTOGRAM_BUCKET_COUNT];
+    /// How many sequence numbers late reordered packets were.
+    uint32_t reorder_histogram[MY_RTP_HISTOGRAM_BUCKET_COUNT];
+    /// Per packet change in transit time, the jitter sample, in @ref MY_RTP_TRANSIT_BUCKET_UNIT_US.
+    uint32_t transit_histogram[MY_RTP_HISTOGRAM_BUCKET_COUNT];
+};
+
+/*!
+ * Receive side counters of one RTP stream, for the lifetime of a stream app.
+ *
+ * Packets get accounted from their header only. All sequence and timing state belongs to the one thread feeding
+ * packets, and the outputs are plain atomics written by that thread alone, so accounting a packet never locks or does
+ * a read-modify-write.
+ */
+struct my_rtp_metrics;
+
+/*!
+ * @param clock_rate RTP clock rate of the stream, for the jitter.
+ * @param fec_payload_type Packets of this type are counted as FEC, -1 for streams without any.
+ */
+struct my_rtp_metrics *my_rtp_metrics_create(uint32_t clock_rate, int fec_payload_type);
+
+void my_rtp_metrics_destroy(struct my_rtp_metrics *m);
+
+/*!
+ * Account a packet that just came off the socket.
+ *
+ * Must only be called from one thread at a time, e.g. the source's streaming thread.
+ */
+void my_rtp_metrics_on_packet(struct my_rtp_metrics *m,
+                              uint16_t seq_num,
+                              uint32_t rtp_timestamp,
+                              uint8_t payload_type,
+                              size_t size,
+                              int64_t arrival_ns);
+
+/*!
+ * Start sequence and jitter tracking over with the next packet, e.g. after a pause or with a new stream.
+ *
+ * Totals are kept. Thread safe.
+ */
+void my_rtp_metrics_restart(struct my_rtp_metrics *m);
+
+/// Thread safe.
+void my_rtp_metrics_snapshot(struct my_rtp_metrics *m, struct my_rtp_metrics_snapshot *out_snapshot);
+
+void my_rtp_metrics_log(const char *name, const struct my_rtp_metrics_snapshot *snapshot);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
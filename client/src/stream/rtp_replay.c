@@ -0,0 +1,393 @@
+#include "rtp_replay.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+#include "thread.h"
+#include "utils/logger.h"
+
+#define VIDEO_PORT 5601
+#define AUDIO_PORT 5602
+
+#define PCAP_MAGIC_US 0xa1b2c3d4u
+#define PCAP_MAGIC_NS 0xa1b23c4du
+#define PCAP_GLOBAL_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+// Link types we can take apart.
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_VLAN 0x8100
+
+/// Anything a UDP datagram can be, records are read into a buffer this large.
+#define RECORD_SIZE_MAX 65536
+
+/// Longest sleep before checking whether we should stop.
+#define SLEEP_SLICE_NS 50000000LL
+
+struct held_packet {
+    bool valid;
+    uint16_t port;
+    size_t size;
+    uint8_t data[RECORD_SIZE_MAX];
+};
+
+struct my_rtp_replay {
+    struct my_rtp_replay_config config;
+
+    FILE *file;
+    bool swapped;
+    bool nanoseconds;
+    uint32_t link_type;
+    int fd;
+
+    // Only touched by the replay thread.
+    uint64_t rng_state;
+    uint8_t record[RECORD_SIZE_MAX];
+    struct held_packet held;
+
+    struct os_thread_helper thread;
+    _Atomic bool stop;
+
+    _Atomic uint64_t packets_sent;
+    _Atomic uint64_t packets_dropped;
+    _Atomic uint64_t packets_reordered;
+    _Atomic uint64_t records_skipped;
+    _Atomic bool finished;
+    int64_t started_ns;
+    _Atomic int64_t finished_ns;
+};
+
+static uint32_t read_u32(const struct my_rtp_replay *r, const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return r->swapped ? __builtin_bswap32(value) : value;
+}
+
+static uint16_t read_be16(const uint8_t *data) {
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+/// xorshift64*, reseeded per replay so impairments repeat exactly.
+static double next_random(struct my_rtp_replay *r) {
+    r->rng_state ^= r->rng_state >> 12;
+    r->rng_state ^= r->rng_state << 25;
+    r->rng_state ^= r->rng_state >> 27;
+    const uint64_t value = r->rng_state * 0x2545F4914F6CDD1DULL;
+    return (double)(value >> 11) / (double)(1ULL << 53);
+}
+
+static bool open_capture(struct my_rtp_replay *r) {
+    r->file = fopen(r->config.capture_path, "rb");
+    if (r->file == NULL) {
+        ALOGE("%s: Could not open %s: %s", __FUNCTION__, r->config.capture_path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[PCAP_GLOBAL_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), r->file) != sizeof(header)) {
+        ALOGE("%s: %s is too short for a pcap file", __FUNCTION__, r->config.capture_path);
+        return false;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, header, sizeof(magic));
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+        r->swapped = false;
+    } else if (__builtin_bswap32(magic) == PCAP_MAGIC_US || __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+        r->swapped = true;
+        magic = __builtin_bswap32(magic);
+    } else {
+        ALOGE("%s: %s is not a pcap file, pcapng isn't supported", __FUNCTION__, r->config.capture_path);
+        return false;
+    }
+    r->nanoseconds = magic == PCAP_MAGIC_NS;
+
+    r->link_type = read_u32(r, header + 20) & 0xffff;
+    if (r->link_type != LINKTYPE_NULL && r->link_type != LINKTYPE_ETHERNET && r->link_type != LINKTYPE_RAW &&
+        r->link_type != LINKTYPE_LINUX_SLL) {
+        ALOGE("%s: Unsupported link type %u", __FUNCTION__, r->link_type);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * Find the UDP payload in a captured frame.
+ *
+ * @return false if it isn't an unfragmented IPv4 UDP datagram to one of our ports.
+ */
+static bool parse_record(const struct my_rtp_replay *r,
+                         const uint8_t *data,
+                         size_t size,
+                         uint16_t *out_port,
+                         const uint8_t **out_payload,
+                         size_t *out_payload_size) {
+    size_t offset = 0;
+    switch (r->link_type) {
+        case LINKTYPE_NULL:
+            // Address family in the capturing host's byte order, only IPv4 gets through the version check below.
+            offset = 4;
+            break;
+        case LINKTYPE_ETHERNET: {
+            if (size < 14) {
+                return false;
+            }
+            uint16_t ethertype = read_be16(data + 12);
+            offset = 14;
+            if (ethertype == ETHERTYPE_VLAN && size >= 18) {
+                ethertype = read_be16(data + 16);
+                offset = 18;
+            }
+            if (ethertype != ETHERTYPE_IPV4) {
+                return false;
+            }
+        } break;
+        case LINKTYPE_LINUX_SLL:
+            if (size < 16 || read_be16(data + 14) != ETHERTYPE_IPV4) {
+                return false;
+            }
+            offset = 16;
+            break;
+        default:
+            break;
+    }
+
+    if (size < offset + 20 || (data[offset] >> 4) != 4) {
+        return false;
+    }
+    const uint8_t *ip = data + offset;
+    const size_t ip_header_size = (size_t)(ip[0] & 0x0f) * 4;
+    const uint16_t ip_total_size = read_be16(ip + 2);
+    const uint16_t fragment = read_be16(ip + 6);
+    // UDP, and neither more fragments to come nor a fragment offset.
+    if (ip[9] != 17 || (fragment & 0x3fff) != 0 || ip_header_size < 20 || ip_total_size > size - offset ||
+        ip_total_size < ip_header_size + 8) {
+        return false;
+    }
+
+    const uint8_t *udp = ip + ip_header_size;
+    const uint16_t port = read_be16(udp + 2);
+    const uint16_t udp_size = read_be16(udp + 4);
+    if ((port != VIDEO_PORT && port != AUDIO_PORT) || udp_size < 8 || udp_size > ip_total_size - ip_header_size) {
+        return false;
+    }
+
+    *out_port = port;
+    *out_payload = udp + 8;
+    *out_payload_size = udp_size - 8;
+    return true;
+}
+
+static void send_packet(struct my_rtp_replay *r, uint16_t port, const uint8_t *data, size_t size) {
+    const struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (sendto(r->fd, data, size, 0, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ALOGW("%s: sendto failed: %s", __FUNCTION__, strerror(errno));
+        return;
+    }
+    atomic_fetch_add(&r->packets_sent, 1);
+}
+
+/// @return false if we were told to stop meanwhile.
+static bool sleep_until(struct my_rtp_replay *r, int64_t due_ns) {
+    for (;;) {
+        if (atomic_load(&r->stop)) {
+            return false;
+        }
+        const int64_t remaining_ns = due_ns - my_telemetry_now_ns();
+        if (remaining_ns <= 0) {
+            return true;
+        }
+        const int64_t slice_ns = remaining_ns < SLEEP_SLICE_NS ? remaining_ns : SLEEP_SLICE_NS;
+        const struct timespec ts = {
+            .tv_sec = (time_t)(slice_ns / 1000000000),
+            .tv_nsec = (long)(slice_ns % 1000000000),
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void *replay_thread_func(void *ptr) {
+    struct my_rtp_replay *r = ptr;
+
+    const int64_t jitter_ns = (int64_t)(r->config.jitter_ms * 1e6f);
+    int64_t first_capture_ns = -1;
+    int64_t last_due_ns = 0;
+
+    uint8_t record_header[PCAP_RECORD_HEADER_SIZE];
+    while (fread(record_header, 1, sizeof(record_header), r->file) == sizeof(record_header)) {
+        const uint32_t seconds = read_u32(r, record_header);
+        const uint32_t fraction = read_u32(r, record_header + 4);
+        const uint32_t captured_size = read_u32(r, record_header + 8);
+
+        if (captured_size > sizeof(r->record)) {
+            // Not one of ours, jumbo frames don't get sent to us.
+            if (fseek(r->file, captured_size, SEEK_CUR) != 0) {
+                break;
+            }
+            atomic_fetch_add(&r->records_skipped, 1);
+            continue;
+        }
+        if (fread(r->record, 1, captured_size, r->file) != captured_size) {
+            ALOGW("%s: Capture ends in the middle of a record", __FUNCTION__);
+            break;
+        }
+
+        uint16_t port;
+        const uint8_t *payload;
+        size_t payload_size;
+        if (!parse_record(r, r->record, captured_size, &port, &payload, &payload_size)) {
+            atomic_fetch_add(&r->records_skipped, 1);
+            continue;
+        }
+
+        const int64_t capture_ns = (int64_t)seconds * 1000000000 + (r->nanoseconds ? fraction : fraction * 1000LL);
+        if (first_capture_ns < 0) {
+            first_capture_ns = capture_ns;
+        }
+
+        int64_t due_ns = r->started_ns;
+        if (r->config.speed > 0) {
+            due_ns += (int64_t)((double)(capture_ns - first_capture_ns) / r->config.speed);
+        }
+        if (jitter_ns > 0) {
+            due_ns += (int64_t)(next_random(r) * (double)jitter_ns);
+        }
+        // Delayed, but still in order.
+        if (due_ns < last_due_ns) {
+            due_ns = last_due_ns;
+        }
+        last_due_ns = due_ns;
+
+        if (!sleep_until(r, due_ns)) {
+            break;
+        }
+
+        if (next_random(r) * 100.0 < r->config.loss_percent) {
+            atomic_fetch_add(&r->packets_dropped, 1);
+            continue;
+        }
+
+        if (r->held.valid) {
+            // The held packet goes out right behind the one that overtook it.
+            send_packet(r, port, payload, payload_size);
+            send_packet(r, r->held.port, r->held.data, r->held.size);
+            r->held.valid = false;
+            atomic_fetch_add(&r->packets_reordered, 1);
+        } else if (next_random(r) * 100.0 < r->config.reorder_percent) {
+            r->held.valid = true;
+            r->held.port = port;
+            r->held.size = payload_size;
+            memcpy(r->held.data, payload, payload_size);
+        } else {
+            send_packet(r, port, payload, payload_size);
+        }
+    }
+
+    if (r->held.valid) {
+        send_packet(r, r->held.port, r->held.data, r->held.size);
+        r->held.valid = false;
+    }
+
+    atomic_store(&r->finished_ns, my_telemetry_now_ns());
+    atomic_store(&r->finished, true);
+    ALOGI("%s: Replay done, %" PRIu64 " packets sent", __FUNCTION__, atomic_load(&r->packets_sent));
+    return NULL;
+}
+
+struct my_rtp_replay *my_rtp_replay_start(const struct my_rtp_replay_config *config) {
+    struct my_rtp_replay *r = calloc(1, sizeof(struct my_rtp_replay));
+    if (r == NULL) {
+        ALOGE("%s: failed to allocate", __FUNCTION__);
+        return NULL;
+    }
+    r->config = *config;
+    r->config.capture_path[MY_RTP_REPLAY_PATH_MAX - 1] = '\0';
+    // xorshift gets stuck on 0.
+    r->rng_state = ((uint64_t)config->seed << 32) ^ 0x9E3779B97F4A7C15ULL;
+    r->fd = -1;
+
+    if (!open_capture(r)) {
+        my_rtp_replay_destroy(r);
+        return NULL;
+    }
+
+    r->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (r->fd < 0) {
+        ALOGE("%s: Could not create socket: %s", __FUNCTION__, strerror(errno));
+        my_rtp_replay_destroy(r);
+        return NULL;
+    }
+
+    if (os_thread_helper_init(&r->thread) < 0) {
+        my_rtp_replay_destroy(r);
+        return NULL;
+    }
+
+    r->started_ns = my_telemetry_now_ns();
+    const struct os_thread_params params = {
+        .name = "rtp-replay",
+        .nice = OS_THREAD_PRIORITY_DEFAULT,
+        .cpus = OS_THREAD_CPUS_LITTLE,
+    };
+    if (os_thread_helper_start_with_params(&r->thread, replay_thread_func, r, &params) != 0) {
+        ALOGE("%s: Could not start the replay thread", __FUNCTION__);
+        my_rtp_replay_destroy(r);
+        return NULL;
+    }
+
+    ALOGI("%s: Replaying %s at %.2fx, loss %.1f%%, jitter %.1f ms, reorder %.1f%%, seed %u",
+          __FUNCTION__,
+          r->config.capture_path,
+          r->config.speed,
+          r->config.loss_percent,
+          r->config.jitter_ms,
+          r->config.reorder_percent,
+          r->config.seed);
+    return r;
+}
+
+void my_rtp_replay_destroy(struct my_rtp_replay *r) {
+    if (r == NULL) {
+        return;
+    }
+
+    atomic_store(&r->stop, true);
+    if (r->thread.initialized) {
+        os_thread_helper_stop(&r->thread);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    if (r->file != NULL) {
+        fclose(r->file);
+    }
+    free(r);
+}
+
+void my_rtp_replay_get_stats(struct my_rtp_replay *r, struct my_rtp_replay_stats *out_stats) {
+    out_stats->packets_sent = atomic_load(&r->packets_sent);
+    out_stats->packets_dropped = atomic_load(&r->packets_dropped);
+    out_stats->packets_reordered = atomic_load(&r->packets_reordered);
+    out_stats->records_skipped = atomic_load(&r->records_skipped);
+    out_stats->finished = atomic_load(&r->finished);
+    out_stats->started_ns = r->started_ns;
+    out_stats->finished_ns = atomic_load(&r->finished_ns);
+}
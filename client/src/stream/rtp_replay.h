@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MY_RTP_REPLAY_PATH_MAX 512
+
+struct my_rtp_replay_config {
+    /*!
+     * Classic pcap file of the server's UDP traffic to ports 5601 and 5602, e.g. from tcpdump or Wireshark. Ethernet,
+     * raw IP, Linux cooked and loopback captures work, IPv4 only.
+     *
+     * Record from the start of a session, the decoder can't start before the first keyframe.
+     */
+    char capture_path[MY_RTP_REPLAY_PATH_MAX];
+    /// 1 replays in real time, 2 twice as fast. 0 sends as fast as the socket takes it.
+    float speed;
+    // Impairments, drawn from a generator seeded with seed so runs repeat exactly.
+    float loss_percent;
+    /// Each packet gets delayed by up to this much. Packets still leave in order, like behind a busy queue.
+    float jitter_ms;
+    /// Chance that a packet gets held back until after the next one.
+    float reorder_percent;
+    uint32_t seed;
+};
+
+struct my_rtp_replay_stats {
+    uint64_t packets_sent;
+    uint64_t packets_dropped;
+    uint64_t packets_reordered;
+    /// Capture records that weren't UDP to our ports.
+    uint64_t records_skipped;
+    bool finished;
+    int64_t started_ns;
+    /// Only set once finished.
+    int64_t finished_ns;
+};
+
+/*!
+ * Sends a recorded capture to the ports the pipeline listens on, over loopback, on a thread of its own.
+ *
+ * The receive path sees the packets the way it would see the server's, socket included, only the timing comes from
+ * the capture and the impairments.
+ */
+struct my_rtp_replay;
+
+/*!
+ * Open the capture and start sending.
+ *
+ * @return NULL if the capture can't be read.
+ */
+struct my_rtp_replay *my_rtp_replay_start(const struct my_rtp_replay_config *config);
+
+/// Stop sending if still at it.
+void my_rtp_replay_destroy(struct my_rtp_replay *r);
+
+/// Thread safe.
+void my_rtp_replay_get_stats(struct my_rtp_replay *r, struct my_rtp_replay_stats *out_stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
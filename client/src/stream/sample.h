@@ -10,6 +10,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
 
@@ -35,4 +36,12 @@
 struct MySample {
     GLuint frame_texture_id;
     GLenum frame_texture_target;
+    /// Part of the texture covered by the frame, less than 1 when the decoder pads its buffers.
+    float uv_scale_x;
+    float uv_scale_y;
+    /// Size of this frame, the stream may change resolution between any two.
+    uint32_t width;
+    uint32_t height;
+    /// Latency telemetry frame ID, 0 if the frame is not tracked.
+    uint64_t frame_id;
 };
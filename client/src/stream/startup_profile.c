@@ -0,0 +1,87 @@
+#include "startup_profile.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "telemetry.h"
+#include "utils/logger.h"
+
+/// CLOCK_MONOTONIC of each phase, 0 while not reached.
+static _Atomic int64_t phase_ns[MY_STARTUP_PHASE_COUNT];
+
+static void log_report(void) {
+    const int64_t begin_ns = atomic_load(&phase_ns[MY_STARTUP_PHASE_BEGIN]);
+    ALOGI("Startup profile, time to first frame %.1f ms:",
+          (double)(atomic_load(&phase_ns[MY_STARTUP_PHASE_FIRST_PRESENTED]) - begin_ns) / 1e6);
+    for (int i = MY_STARTUP_PHASE_BEGIN + 1; i < MY_STARTUP_PHASE_COUNT; i++) {
+        const int64_t ns = atomic_load(&phase_ns[i]);
+        if (ns == 0) {
+            // Skipped, e.g. no catalog on a resume.
+            continue;
+        }
+        ALOGI("  %-20s %8.1f ms", my_startup_phase_to_string(i), (double)(ns - begin_ns) / 1e6);
+    }
+}
+
+void my_startup_profile_begin(void) {
+    for (int i = 0; i < MY_STARTUP_PHASE_COUNT; i++) {
+        atomic_store(&phase_ns[i], 0);
+    }
+    atomic_store(&phase_ns[MY_STARTUP_PHASE_BEGIN], my_telemetry_now_ns());
+}
+
+void my_startup_profile_mark(enum my_startup_phase phase) {
+    if (phase <= MY_STARTUP_PHASE_BEGIN || phase >= MY_STARTUP_PHASE_COUNT) {
+        return;
+    }
+    // Nothing to measure against, or already reached.
+    int64_t expected = 0;
+    if (atomic_load(&phase_ns[MY_STARTUP_PHASE_BEGIN]) == 0 ||
+        !atomic_compare_exchange_strong(&phase_ns[phase], &expected, my_telemetry_now_ns())) {
+        return;
+    }
+    if (phase == MY_STARTUP_PHASE_FIRST_PRESENTED) {
+        log_report();
+    }
+}
+
+int64_t my_startup_profile_get(enum my_startup_phase phase) {
+    if (phase < 0 || phase >= MY_STARTUP_PHASE_COUNT) {
+        return -1;
+    }
+    const int64_t ns = atomic_load(&phase_ns[phase]);
+    return ns != 0 ? ns - atomic_load(&phase_ns[MY_STARTUP_PHASE_BEGIN]) : -1;
+}
+
+const char *my_startup_phase_to_string(enum my_startup_phase phase) {
+    switch (phase) {
+        case MY_STARTUP_PHASE_BEGIN:
+            return "begin";
+        case MY_STARTUP_PHASE_GST_INIT:
+            return "gst_init";
+        case MY_STARTUP_PHASE_DECODER_CATALOG:
+            return "decoder catalog";
+        case MY_STARTUP_PHASE_WINDOW:
+            return "window";
+        case MY_STARTUP_PHASE_EGL:
+            return "egl";
+        case MY_STARTUP_PHASE_PIPELINE_READY:
+            return "pipeline ready";
+        case MY_STARTUP_PHASE_ENET_CONNECTED:
+            return "enet connected";
+        case MY_STARTUP_PHASE_WEBSOCKET_CONNECTED:
+            return "websocket connected";
+        case MY_STARTUP_PHASE_STREAM_INFO:
+            return "stream info";
+        case MY_STARTUP_PHASE_PLAYING:
+            return "playing";
+        case MY_STARTUP_PHASE_FIRST_PACKET:
+            return "first packet";
+        case MY_STARTUP_PHASE_FIRST_DECODED:
+            return "first decoded";
+        case MY_STARTUP_PHASE_FIRST_PRESENTED:
+            return "first presented";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * Milestones from launch (or resume) to the first presented frame, in the order they usually happen.
+ *
+ * Several run in parallel, so the order isn't guaranteed, which is the point of recording them.
+ */
+enum my_startup_phase {
+    /// android_main started, or a suspended session got a new window. The origin of all other phases.
+    MY_STARTUP_PHASE_BEGIN = 0,
+    /// gst_init returned, the plugin registry is loaded.
+    MY_STARTUP_PHASE_GST_INIT,
+    /// The decoder catalog was loaded from the cache or probed.
+    MY_STARTUP_PHASE_DECODER_CATALOG,
+    /// APP_CMD_INIT_WINDOW arrived.
+    MY_STARTUP_PHASE_WINDOW,
+    /// EGL context and surface are up.
+    MY_STARTUP_PHASE_EGL,
+    /// The pipeline for the expected codec was built ahead of the server's answer, and is in READY.
+    MY_STARTUP_PHASE_PIPELINE_READY,
+    /// ENet connected.
+    MY_STARTUP_PHASE_ENET_CONNECTED,
+    /// The WebSocket handshake completed.
+    MY_STARTUP_PHASE_WEBSOCKET_CONNECTED,
+    /// The server answered with stream_info.
+    MY_STARTUP_PHASE_STREAM_INFO,
+    /// The pipeline went to PLAYING.
+    MY_STARTUP_PHASE_PLAYING,
+    /// First video RTP packet arrived.
+    MY_STARTUP_PHASE_FIRST_PACKET,
+    /// First decoded frame reached the render side.
+    MY_STARTUP_PHASE_FIRST_DECODED,
+    /// First frame was swapped to the screen, ends the profile.
+    MY_STARTUP_PHASE_FIRST_PRESENTED,
+    MY_STARTUP_PHASE_COUNT,
+};
+
+/*!
+ * Time-to-first-frame profile of the process.
+ *
+ * There is one per process, since it has to cover gst_init before any object exists. Marks are cheap and thread safe,
+ * only the first mark of each phase counts, and the breakdown gets logged with the first presented frame.
+ */
+
+/// Start a new profile now, forgetting all marks.
+void my_startup_profile_begin(void);
+
+/// Record a phase as reached now, if it wasn't already.
+void my_startup_profile_mark(enum my_startup_phase phase);
+
+/*!
+ * When a phase was reached.
+ *
+ * @return Nanoseconds since @ref MY_STARTUP_PHASE_BEGIN, or -1 if not reached yet.
+ */
+int64_t my_startup_profile_get(enum my_startup_phase phase);
+
+const char *my_startup_phase_to_string(enum my_startup_phase phase);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -12,26 +12,92 @@
 #include <gst/gstutils.h>
 #include <gst/video/video-frame.h>
 
+#include "audio_player.h"
+#include "bitrate_controller.h"
 #include "connection.h"
+#include "decoder_select.h"
+#include "frame_mailbox.h"
+#include "hardware_buffer_decoder.h"
+#include "jitter_controller.h"
+#include "rtp_header_meta.h"
+#include "rtp_metrics.h"
 #include "sample.h"
+#include "startup_profile.h"
+#include "telemetry.h"
+#include "udp_batch_src.h"
 
 // clang-format off
 #include <EGL/egl.h>
 #include <GLES2/gl2ext.h>
 // clang-format on
 
+#include <inttypes.h>
 #include <linux/time.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#include "gst/rtp/gstrtpbuffer.h"
 #include "thread.h"
 
+/// The render loop holds at most a paced frame, the sample being drawn and the previous one per display, keep some
+/// headroom.
+#define SAMPLE_POOL_SIZE (4 * MY_MAX_DISPLAYS)
+
+/// ULPFEC payload type, must match the server's rtpulpfecenc.
+#define VIDEO_FEC_PT 122
+/// How long media packets are kept around for FEC recovery, a few frames past the jitterbuffer latency.
+#define FEC_STORAGE_TIME (200 * GST_MSECOND)
+
+/// Room for this many latency ceilings of video in the socket buffer, so a burst survives a busy udpsrc thread.
+#define UDP_BUFFER_LATENCY_MULTIPLE 2
+#define UDP_BUFFER_SIZE_MIN 1000000
+
 struct MySampleImpl {
     struct MySample base;
+    /// Set on the GL path.
     GstSample *sample;
+    /// Set on the hardware buffer path.
+    struct my_hwb_frame hwb_frame;
+    bool in_use;
+};
+
+/// A decoded frame on its way from the appsink streaming thread to the render loop.
+struct mailbox_slot {
+    GstSample *sample;
+    struct timespec decode_end_ts;
+    uint64_t frame_id;
+};
+
+/*!
+ * The video of one host monitor, from its appsink to the render loop.
+ *
+ * Display 0 is the primary one: input maps to it, and telemetry, the bitrate controller and the hardware buffer path
+ * only follow it. The others always decode through GStreamer.
+ */
+struct video_display {
+    MyStreamApp *app;
+    int index;
+
+    GstElement *appsink;
+    /// GStreamer's EGL context the appsink's frames come from, looked up with the first one.
+    GstGLContext *context;
+
+    /// Hands decoded samples from on_new_sample_cb to stream_app_try_pull_display_sample.
+    struct my_frame_mailbox mailbox;
+    struct mailbox_slot mailbox_slots[MY_FRAME_MAILBOX_SLOT_COUNT];
+
+    // Render thread state, re-derived only when the appsink caps change.
+    GstCaps *video_caps;
+    GstVideoInfo video_info;
+    GLenum frame_texture_target;
+    int width;
+    int height;
+
+    /// Fed by the udpsrc probe, NULL for the primary display, whose packets go to _MyStreamApp::video_metrics.
+    struct my_rtp_metrics *metrics;
 };
 
 struct _MyStreamApp {
@@ -50,15 +116,33 @@ struct _MyStreamApp {
     /// Wrapped version of the android_main/render context
     GstGLContext *gst_gl_wrapped_context;
 
-    /// GStreamer-created EGL context for its own use
-    GstGLContext *context;
-
-    GstElement *appsink;
-
-    GLenum frame_texture_target;
-
-    int width;
-    int height;
+    /// Displays of the current pipeline, only the first display_count are in use.
+    struct video_display displays[MY_MAX_DISPLAYS];
+    /// Written on the main loop thread with every pipeline, read by the render thread.
+    _Atomic int display_count;
+    /// SSRC of each display's stream. Set before the pipeline plays, read by the streaming threads.
+    uint32_t display_ssrcs[MY_MAX_DISPLAYS];
+
+    /// Created with the first pipeline and kept until finalize, NULL where AAudio has no output stream for us.
+    struct my_audio_player *audio_player;
+    /// Don't try again with every pipeline, openslessink plays then.
+    bool audio_player_failed;
+
+    /// Falls back to the GL path when a pipeline build fails to create the decoder, read by the render thread.
+    _Atomic enum my_decode_path decode_path;
+    const struct my_decoder_catalog *decoder_catalog;
+    /// Created with the first pipeline on the hardware buffer path, and kept until finalize.
+    struct my_hwb_decoder *_Atomic hwb_decoder;
+    /// Created with a pipeline built ahead of time, published to hwb_decoder once the codec is confirmed.
+    struct my_hwb_decoder *pending_hwb_decoder;
+
+    /// Builds the pipeline for the codec we expect while the handshake is in flight, see stream_app_spawn_thread.
+    struct os_thread_helper prebuild_thread;
+    struct StreamConfig prebuild_config;
+    /// Codec, number of displays and transport app->pipeline was built for.
+    enum my_video_codec pipeline_codec;
+    int pipeline_display_count;
+    enum my_transport pipeline_transport;
 
     struct {
         EGLDisplay display;
@@ -68,14 +152,52 @@ struct _MyStreamApp {
 
     struct os_thread_helper play_thread;
 
-    bool received_first_frame;
-
-    GMutex sample_mutex;
-    GstSample *sample;
-    struct timespec sample_decode_end_ts;
+    _Atomic bool received_first_frame;
+
+    /// Samples handed out to the render loop, only touched by the render thread.
+    struct MySampleImpl sample_pool[SAMPLE_POOL_SIZE];
+
+    /// Held while calling the new-sample callback, so replacing it waits for a call still using the old one.
+    GMutex new_sample_callback_lock;
+    stream_app_new_sample_func new_sample_callback;
+    void *new_sample_callback_data;
+
+    /// Per-stage frame timestamps, see telemetry.h
+    struct my_telemetry *telemetry;
+
+    /// Fed by the udpsrc probes, or the jitterbuffer input ones over WebRTC, for the lifetime of the app.
+    struct my_rtp_metrics *video_metrics;
+    struct my_rtp_metrics *audio_metrics;
+    /// Video media packets at the last bitrate controller tick, only touched on the main loop thread.
+    uint64_t video_media_packets_seen;
+
+    // Jitterbuffer loss, written on the streaming threads and drained by the bitrate controller.
+    _Atomic uint32_t video_packets_lost;
+    _Atomic bool video_stream_started;
+    /// Never drained, see stream_app_get_stream_stats.
+    _Atomic uint64_t video_packets_lost_total;
+    _Atomic int32_t jitterbuffer_latency_ms;
+
+    /// rtpulpfecdec of the primary display's video stream, set from the rtpbin streaming thread.
+    GWeakRef fec_decoder;
+    /// Its cumulative counters at the last bitrate controller tick.
+    guint fec_recovered_seen;
+    guint fec_unrecovered_seen;
+
+    /// rtpjitterbuffer of the video stream, set from the rtpbin streaming thread.
+    GWeakRef video_jitterbuffer;
+
+    bool abr_enabled;
+    /// Fed from a replayed capture, see my_connection_start_replay. Stats then accumulate over the whole run.
+    bool benchmark;
+    /// No window to show frames on, see stream_app_suspend. Only touched on the main loop thread.
+    bool suspended;
+    struct my_bitrate_controller bitrate_controller;
+    /// Set up with the pipeline, driven by print_stats.
+    struct my_jitter_controller jitter_controller;
 
-    guint timeout_src_id_dot_data;
     guint timeout_src_id_print_stats;
+    guint timeout_src_id_abr;
 };
 
 G_DEFINE_TYPE(MyStreamApp, my_stream_app, G_TYPE_OBJECT)
@@ -98,6 +220,10 @@ static void *stream_app_thread_func(void *ptr);
 
 static void stream_client_set_connection(MyStreamApp *app, MyConnection *connection);
 
+static void *prebuild_thread_func(void *ptr);
+
+static void wait_for_prebuilt_pipeline(MyStreamApp *app);
+
 /* GObject method implementations */
 
 static void my_stream_app_init(MyStreamApp *app) {
@@ -106,24 +232,68 @@ static void my_stream_app_init(MyStreamApp *app) {
     memset(app, 0, sizeof(MyStreamApp));
 
     app->loop = g_main_loop_new(NULL, FALSE);
+    g_mutex_init(&app->new_sample_callback_lock);
 
     g_assert(os_thread_helper_init(&app->play_thread) >= 0);
-
-    g_mutex_init(&app->sample_mutex);
+    g_assert(os_thread_helper_init(&app->prebuild_thread) >= 0);
+
+    for (int i = 0; i < MY_MAX_DISPLAYS; i++) {
+        struct video_display *d = &app->displays[i];
+        d->app = app;
+        d->index = i;
+        my_frame_mailbox_init(&d->mailbox);
+        if (i > 0) {
+            d->metrics = my_rtp_metrics_create(90000, VIDEO_FEC_PT);
+            g_assert_nonnull(d->metrics);
+        }
+    }
+    atomic_init(&app->display_count, 1);
+    g_weak_ref_init(&app->fec_decoder, NULL);
+    g_weak_ref_init(&app->video_jitterbuffer, NULL);
+
+    app->telemetry = my_telemetry_create();
+    g_assert_nonnull(app->telemetry);
+    app->video_metrics = my_rtp_metrics_create(90000, VIDEO_FEC_PT);
+    app->audio_metrics = my_rtp_metrics_create(48000, -1);
+    g_assert_nonnull(app->video_metrics);
+    g_assert_nonnull(app->audio_metrics);
     ALOGI("%s: done creating stuff", __FUNCTION__);
 }
 
 static void stream_app_finalize(GObject *gobject) {
     MyStreamApp *app = MY_STREAM_APP(gobject);
 
-    gst_clear_object(&app->sample);
+    for (int i = 0; i < MY_MAX_DISPLAYS; i++) {
+        struct video_display *d = &app->displays[i];
+        for (int j = 0; j < MY_FRAME_MAILBOX_SLOT_COUNT; j++) {
+            gst_clear_sample(&d->mailbox_slots[j].sample);
+        }
+        gst_clear_caps(&d->video_caps);
+        gst_clear_object(&d->context);
+        gst_clear_object(&d->appsink);
+        g_clear_pointer(&d->metrics, my_rtp_metrics_destroy);
+    }
+    for (int i = 0; i < SAMPLE_POOL_SIZE; i++) {
+        gst_clear_sample(&app->sample_pool[i].sample);
+        if (app->sample_pool[i].hwb_frame.image != NULL) {
+            my_hwb_decoder_release_frame(app->hwb_decoder, &app->sample_pool[i].hwb_frame);
+        }
+    }
+    my_hwb_decoder_destroy(atomic_exchange(&app->hwb_decoder, NULL));
+    my_hwb_decoder_destroy(app->pending_hwb_decoder);
+    g_clear_pointer(&app->audio_player, my_audio_player_destroy);
     gst_clear_object(&app->pipeline);
     gst_clear_object(&app->gst_gl_display);
     gst_clear_object(&app->gst_gl_context);
     gst_clear_object(&app->gst_gl_other_context);
     gst_clear_object(&app->display);
-    gst_clear_object(&app->context);
-    gst_clear_object(&app->appsink);
+    g_weak_ref_clear(&app->fec_decoder);
+    g_weak_ref_clear(&app->video_jitterbuffer);
+
+    g_clear_pointer(&app->telemetry, my_telemetry_destroy);
+    g_clear_pointer(&app->video_metrics, my_rtp_metrics_destroy);
+    g_clear_pointer(&app->audio_metrics, my_rtp_metrics_destroy);
+    g_mutex_clear(&app->new_sample_callback_lock);
 
     G_OBJECT_CLASS(my_stream_app_parent_class)->finalize(gobject);
 }
@@ -159,6 +329,16 @@ void stream_app_set_egl_context(MyStreamApp *app, EGLContext context, EGLDisplay
 static GstBusSyncReply bus_sync_handler_cb(GstBus *bus, GstMessage *msg, MyStreamApp *app) {
     // LOG_MSG(msg);
 
+    // Posted by each new streaming thread itself. They start out with the affinity of whoever set the pipeline's
+    // state, usually the main loop on the little cores, and they carry the media.
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_STATUS) {
+        GstStreamStatusType type;
+        gst_message_parse_stream_status(msg, &type, NULL);
+        if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+            os_thread_set_cpus(OS_THREAD_CPUS_ANY);
+        }
+    }
+
     /* Do not let GstGL retrieve the display handle on its own
      * because then it believes it owns it and calls eglTerminate()
      * when disposed */
@@ -204,6 +384,10 @@ static gboolean gst_bus_cb(GstBus *bus, GstMessage *message, gpointer user_data)
             g_error_free(gerr);
             g_free(debug_msg);
         } break;
+        case GST_MESSAGE_LATENCY: {
+            // Sent when the jitterbuffer latency changes, see update_jitterbuffer_latency.
+            gst_bin_recalculate_latency(pipeline);
+        } break;
         case GST_MESSAGE_EOS: {
             //            g_error("gst_bus_cb: Got EOS!");
         } break;
@@ -214,9 +398,9 @@ static gboolean gst_bus_cb(GstBus *bus, GstMessage *message, gpointer user_data)
 }
 
 static GstFlowReturn on_new_sample_cb(GstAppSink *appsink, gpointer user_data) {
-    MyStreamApp *app = (MyStreamApp *)user_data;
+    struct video_display *d = user_data;
+    MyStreamApp *app = d->app;
 
-    // TODO record the frame ID, get frame pose
     struct timespec ts;
     int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
     if (ret != 0) {
@@ -227,64 +411,272 @@ static GstFlowReturn on_new_sample_cb(GstAppSink *appsink, gpointer user_data) {
     GstSample *sample = gst_app_sink_pull_sample(appsink);
     g_assert_nonnull(sample);
 
-    GstSample *prevSample = NULL;
+    // Telemetry only tracks the primary display's frames.
+    const bool primary = d->index == 0;
+    const int64_t now_ns = (int64_t)ts.tv_sec * GST_SECOND + ts.tv_nsec;
+    const uint64_t frame_id =
+        primary ? my_telemetry_mark_pts(
+                      app->telemetry, GST_BUFFER_PTS(gst_sample_get_buffer(sample)), MY_LATENCY_STAGE_APPSINK, now_ns)
+                : 0;
+
+    struct mailbox_slot *slot = &d->mailbox_slots[my_frame_mailbox_back(&d->mailbox)];
+    slot->sample = sample;
+    slot->decode_end_ts = ts;
+    slot->frame_id = frame_id;
+
+    if (my_frame_mailbox_publish(&d->mailbox)) {
+        // The render loop never picked up the sample we got back.
+        ALOGD("Discarding unused, replaced sample");
+        if (primary) {
+            my_telemetry_on_frame_dropped(app->telemetry);
+        }
+        gst_clear_sample(&d->mailbox_slots[my_frame_mailbox_back(&d->mailbox)].sample);
+    }
+    // The render loop paces itself by the primary display, the others are picked up along with it.
+    if (primary) {
+        atomic_store(&app->received_first_frame, true);
+        my_startup_profile_mark(MY_STARTUP_PHASE_FIRST_DECODED);
+
+        g_mutex_lock(&app->new_sample_callback_lock);
+        if (app->new_sample_callback != NULL) {
+            app->new_sample_callback(app->new_sample_callback_data);
+        }
+        g_mutex_unlock(&app->new_sample_callback_lock);
+    }
 
-    // Update client sample
-    {
-        g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&app->sample_mutex);
-        prevSample = app->sample;
-        app->sample = sample;
-        app->sample_decode_end_ts = ts;
-        app->received_first_frame = true;
+    return GST_FLOW_OK;
+}
+
+/// Hardware buffer path: the appsink gets access units, which go straight to MediaCodec.
+static GstFlowReturn on_new_encoded_sample_cb(GstAppSink *appsink, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+
+    g_autoptr(GstSample) sample = gst_app_sink_pull_sample(appsink);
+    g_assert_nonnull(sample);
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        ALOGE("%s: failed to map access unit", __FUNCTION__);
+        return GST_FLOW_OK;
     }
+    my_hwb_decoder_push(app->hwb_decoder, map.data, map.size, GST_BUFFER_PTS(buffer));
+    gst_buffer_unmap(buffer, &map);
 
-    // Previous client sample is not used.
-    if (prevSample) {
-        ALOGD("Discarding unused, replaced sample");
-        gst_sample_unref(prevSample);
+    return GST_FLOW_OK;
+}
+
+/// AAudio path: decoded audio goes to the player's ring buffer, its callback takes it from there.
+static GstFlowReturn on_new_audio_sample_cb(GstAppSink *appsink, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+
+    g_autoptr(GstSample) sample = gst_app_sink_pull_sample(appsink);
+    g_assert_nonnull(sample);
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        ALOGE("%s: failed to map audio", __FUNCTION__);
+        return GST_FLOW_OK;
     }
+    my_audio_player_push(
+        app->audio_player, (const int16_t *)map.data, map.size / (sizeof(int16_t) * MY_AUDIO_CHANNELS));
+    gst_buffer_unmap(buffer, &map);
 
     return GST_FLOW_OK;
 }
 
+/// Cumulative counters of the current FEC decoder, false if FEC is off or no stream has arrived yet.
+static bool get_fec_counters(MyStreamApp *app, guint *out_recovered, guint *out_unrecovered) {
+    GstElement *fec_decoder = g_weak_ref_get(&app->fec_decoder);
+    if (fec_decoder == NULL) {
+        return false;
+    }
+    g_object_get(fec_decoder, "recovered", out_recovered, "unrecovered", out_unrecovered, NULL);
+    gst_object_unref(fec_decoder);
+    return true;
+}
+
+static bool get_jitterbuffer_stats(MyStreamApp *app, struct my_jitterbuffer_stats *out_stats) {
+    GstElement *jitterbuffer = g_weak_ref_get(&app->video_jitterbuffer);
+    if (jitterbuffer == NULL) {
+        return false;
+    }
+
+    GstStructure *stats = NULL;
+    g_object_get(jitterbuffer, "stats", &stats, NULL);
+    gst_object_unref(jitterbuffer);
+    if (stats == NULL) {
+        return false;
+    }
+
+    guint64 avg_jitter_ns = 0;
+    gst_structure_get_uint64(stats, "num-pushed", &out_stats->num_pushed);
+    gst_structure_get_uint64(stats, "num-lost", &out_stats->num_lost);
+    gst_structure_get_uint64(stats, "num-late", &out_stats->num_late);
+    gst_structure_get_uint64(stats, "num-duplicates", &out_stats->num_duplicates);
+    gst_structure_get_uint64(stats, "avg-jitter", &avg_jitter_ns);
+    out_stats->avg_jitter_ms = (float)avg_jitter_ns / (float)GST_MSECOND;
+    gst_structure_free(stats);
+    return true;
+}
+
+static void update_jitterbuffer_latency(MyStreamApp *app) {
+    struct my_jitterbuffer_stats stats = {0};
+    if (!get_jitterbuffer_stats(app, &stats)) {
+        return;
+    }
+
+    ALOGI("Jitterbuffer stats: latency %d ms, jitter %.2f ms, pushed %llu, lost %llu, late %llu, duplicates %llu",
+          app->jitter_controller.latency_ms,
+          stats.avg_jitter_ms,
+          (unsigned long long)stats.num_pushed,
+          (unsigned long long)stats.num_lost,
+          (unsigned long long)stats.num_late,
+          (unsigned long long)stats.num_duplicates);
+
+    if (!my_jitter_controller_update(&app->jitter_controller, &stats)) {
+        return;
+    }
+    atomic_store(&app->jitterbuffer_latency_ms, app->jitter_controller.latency_ms);
+
+    // rtpbin hands it to all its jitterbuffers, which post a latency message for the pipeline to pick it up. webrtcbin
+    // passes it on to its own rtpbin.
+    GstElement *rtpbin = gst_bin_get_by_name(
+        GST_BIN(app->pipeline), app->pipeline_transport == MY_TRANSPORT_WEBRTC ? "webrtc" : "rtp");
+    if (rtpbin != NULL) {
+        g_object_set(rtpbin, "latency", (guint)app->jitter_controller.latency_ms, NULL);
+        gst_object_unref(rtpbin);
+    }
+}
+
+/// Hold audio back as long as video takes past the jitterbuffer, so sound doesn't run ahead of the picture.
+static void update_audio_delay(MyStreamApp *app, const struct my_latency_report *report) {
+    if (report->hops[MY_LATENCY_STAGE_SWAP].count > 0) {
+        float video_delay_ms = 0.0f;
+        for (int stage = MY_LATENCY_STAGE_DECODED; stage <= MY_LATENCY_STAGE_SWAP; stage++) {
+            video_delay_ms += report->hops[stage].p50_ms;
+        }
+        my_audio_player_set_video_delay(app->audio_player, video_delay_ms);
+    }
+
+    struct my_audio_player_stats stats;
+    my_audio_player_get_stats(app->audio_player, &stats);
+    ALOGI("Audio stats: %s, buffered %.1f ms of %.1f ms, output %.1f ms, drift correction %d ppm, underruns %u, "
+          "skips %u",
+          stats.exclusive ? "exclusive" : "shared",
+          stats.buffered_ms,
+          stats.target_ms,
+          stats.output_latency_ms,
+          stats.correction_ppm,
+          stats.underruns,
+          stats.skips);
+}
+
 static gboolean print_stats(MyStreamApp *app) {
     if (!app) {
         return G_SOURCE_CONTINUE;
     }
 
-    //    GstElement *rtpulpfecdec = gst_bin_get_by_name(GST_BIN(app->pipeline), "ulpfec");
-    //
-    //    if (rtpulpfecdec) {
-    //        GValue pt = G_VALUE_INIT;
-    //        GValue recovered = G_VALUE_INIT;
-    //        GValue unrecovered = G_VALUE_INIT;
-    //
-    //        g_object_get_property(G_OBJECT(rtpulpfecdec), "pt", &pt);
-    //        g_object_get_property(G_OBJECT(rtpulpfecdec), "recovered", &recovered);
-    //        g_object_get_property(G_OBJECT(rtpulpfecdec), "unrecovered", &unrecovered);
-    //
-    //        g_object_set(G_OBJECT(rtpulpfecdec), "passthrough", FALSE, NULL);
-    //
-    //        g_print("FEC stats: pt %u, recovered %u, unrecovered %u\n",
-    //                g_value_get_uint(&pt),
-    //                g_value_get_uint(&recovered),
-    //                g_value_get_uint(&unrecovered));
-    //
-    //        g_value_unset(&pt);
-    //        g_value_unset(&recovered);
-    //        g_value_unset(&unrecovered);
-    //    }
+    struct my_latency_report report;
+    my_telemetry_snapshot(app->telemetry, &report, !app->benchmark);
+    my_latency_report_log(&report);
+
+    struct my_rtp_metrics_snapshot metrics;
+    my_rtp_metrics_snapshot(app->video_metrics, &metrics);
+    my_rtp_metrics_log("video", &metrics);
+    for (int i = 1; i < atomic_load(&app->display_count); i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "video %d", i);
+        my_rtp_metrics_snapshot(app->displays[i].metrics, &metrics);
+        my_rtp_metrics_log(name, &metrics);
+    }
+    my_rtp_metrics_snapshot(app->audio_metrics, &metrics);
+    my_rtp_metrics_log("audio", &metrics);
+
+    guint recovered = 0;
+    guint unrecovered = 0;
+    if (get_fec_counters(app, &recovered, &unrecovered)) {
+        ALOGI("FEC stats: pt %u, recovered %u, unrecovered %u", VIDEO_FEC_PT, recovered, unrecovered);
+    }
+
+    if (app->pipeline != NULL) {
+        update_jitterbuffer_latency(app);
+    }
+
+    if (app->audio_player != NULL) {
+        update_audio_delay(app, &report);
+    }
 
     return G_SOURCE_CONTINUE;
 }
 
-static gboolean check_pipeline_dot_data(MyStreamApp *app) {
-    if (!app || !app->pipeline) {
+/// Drop what the counters picked up so far, the totals for stream_app_get_stream_stats stay.
+static void reset_network_counters(MyStreamApp *app) {
+    struct my_rtp_metrics_snapshot metrics;
+    my_rtp_metrics_snapshot(app->video_metrics, &metrics);
+    app->video_media_packets_seen = metrics.packets - metrics.fec_packets;
+
+    my_rtp_metrics_restart(app->video_metrics);
+    for (int i = 1; i < MY_MAX_DISPLAYS; i++) {
+        my_rtp_metrics_restart(app->displays[i].metrics);
+    }
+    my_rtp_metrics_restart(app->audio_metrics);
+    atomic_store(&app->video_packets_lost, 0);
+}
+
+static gboolean bitrate_controller_tick(MyStreamApp *app) {
+    if (!app || !app->pipeline || !app->abr_enabled || app->suspended) {
         return G_SOURCE_CONTINUE;
     }
 
-    gchar *dot_data = gst_debug_bin_to_dot_data(GST_BIN(app->pipeline), GST_DEBUG_GRAPH_SHOW_ALL);
-    g_free(dot_data);
+    struct my_latency_report report;
+    my_telemetry_snapshot(app->telemetry, &report, false);
+
+    guint recovered = 0;
+    guint unrecovered = 0;
+    uint32_t packets_recovered = 0;
+    if (get_fec_counters(app, &recovered, &unrecovered)) {
+        // A new stream gets a new decoder, with counters starting from zero.
+        if (recovered < app->fec_recovered_seen || unrecovered < app->fec_unrecovered_seen) {
+            app->fec_recovered_seen = 0;
+            app->fec_unrecovered_seen = 0;
+        }
+        packets_recovered = recovered - app->fec_recovered_seen;
+        app->fec_recovered_seen = recovered;
+        app->fec_unrecovered_seen = unrecovered;
+    }
+
+    struct my_rtp_metrics_snapshot metrics;
+    my_rtp_metrics_snapshot(app->video_metrics, &metrics);
+    const uint64_t media_packets = metrics.packets - metrics.fec_packets;
+
+    struct my_network_sample sample = {
+        .now_ns = my_telemetry_now_ns(),
+        .packets_received = (uint32_t)(media_packets - app->video_media_packets_seen),
+        .packets_lost = atomic_exchange(&app->video_packets_lost, 0),
+        .packets_recovered = packets_recovered,
+        .jitter_ms = metrics.jitter_ms,
+        .decode_delay_ms = report.hops[MY_LATENCY_STAGE_DECODED].p95_ms,
+    };
+
+    // The server forwards its webrtcbin's feedback about as often as we tick.
+    struct my_twcc_stats twcc;
+    if (my_connection_take_twcc_stats(app->connection, &twcc)) {
+        sample.has_twcc = true;
+        sample.twcc_received_kbps = twcc.received_kbps;
+        sample.twcc_loss_percent = twcc.loss_percent;
+        sample.twcc_delay_gradient_ms = twcc.delay_gradient_ms;
+    }
+
+    app->video_media_packets_seen = media_packets;
+
+    struct my_bitrate_target target;
+    if (my_bitrate_controller_update(&app->bitrate_controller, &sample, &target)) {
+        my_connection_send_encoder_config(app->connection, target.bitrate_kbps, target.width, target.height);
+    }
 
     return G_SOURCE_CONTINUE;
 }
@@ -294,7 +686,12 @@ static void drop_pipeline(MyStreamApp *app) {
         gst_element_set_state(app->pipeline, GST_STATE_NULL);
     }
     gst_clear_object(&app->pipeline);
-    gst_clear_object(&app->appsink);
+    for (int i = 0; i < MY_MAX_DISPLAYS; i++) {
+        gst_clear_object(&app->displays[i].appsink);
+    }
+    if (app->audio_player != NULL) {
+        my_audio_player_flush(app->audio_player);
+    }
 }
 
 static void *stream_app_thread_func(void *ptr) {
@@ -323,7 +720,28 @@ MyStreamApp *my_stream_app_new() {
 void stream_app_spawn_thread(MyStreamApp *app, MyConnection *connection) {
     ALOGI("%s: Starting stream client mainloop thread", __FUNCTION__);
     stream_client_set_connection(app, connection);
-    int ret = os_thread_helper_start(&app->play_thread, &stream_app_thread_func, app);
+
+    // Building the pipeline and starting the decoder take as long as the handshake, do both at once. The server picks
+    // the first codec in our list it can encode, usually that is the first one.
+    my_connection_get_stream_config(connection, &app->prebuild_config);
+    if (app->prebuild_config.codec_count > 0) {
+        app->prebuild_config.codec = app->prebuild_config.codecs[0].codec;
+    }
+    const struct os_thread_params prebuild_params = {
+        .name = "gst-prebuild",
+        .nice = OS_THREAD_PRIORITY_DEFAULT,
+        .cpus = OS_THREAD_CPUS_ANY,
+    };
+    if (os_thread_helper_start_with_params(&app->prebuild_thread, &prebuild_thread_func, app, &prebuild_params) != 0) {
+        ALOGW("%s: failed to start the prebuild thread, building on demand", __FUNCTION__);
+    }
+    // Only bus messages and timers run here, the media flows on GStreamer's own streaming threads.
+    const struct os_thread_params params = {
+        .name = "gst-mainloop",
+        .nice = OS_THREAD_PRIORITY_DEFAULT,
+        .cpus = OS_THREAD_CPUS_LITTLE,
+    };
+    int ret = os_thread_helper_start_with_params(&app->play_thread, &stream_app_thread_func, app, &params);
     (void)ret;
     g_assert(ret == 0);
 }
@@ -331,6 +749,8 @@ void stream_app_spawn_thread(MyStreamApp *app, MyConnection *connection) {
 void stream_app_stop(MyStreamApp *app) {
     ALOGI("%s: Stopping pipeline and ending thread", __FUNCTION__);
 
+    wait_for_prebuilt_pipeline(app);
+
     if (app->pipeline != NULL) {
         gst_element_send_event(app->pipeline, gst_event_new_eos());
 
@@ -348,9 +768,14 @@ void stream_app_stop(MyStreamApp *app) {
     }
 
     gst_clear_object(&app->pipeline);
-    gst_clear_object(&app->appsink);
+    for (int i = 0; i < MY_MAX_DISPLAYS; i++) {
+        gst_clear_object(&app->displays[i].appsink);
+        gst_clear_object(&app->displays[i].context);
+    }
 
-    gst_clear_object(&app->context);
+    // The sources live on the default main context, which outlives this app.
+    g_clear_handle_id(&app->timeout_src_id_print_stats, g_source_remove);
+    g_clear_handle_id(&app->timeout_src_id_abr, g_source_remove);
 
     g_main_loop_quit(app->loop);
     ALOGI("Quited gstreamer main loop.");
@@ -361,77 +786,200 @@ void stream_app_stop(MyStreamApp *app) {
     g_clear_object(&app->loop);
 }
 
+static gboolean suspend_cb(gpointer user_data) {
+    MyStreamApp *app = user_data;
+
+    app->suspended = true;
+    if (app->audio_player != NULL) {
+        my_audio_player_set_paused(app->audio_player, true);
+    }
+    if (app->pipeline != NULL) {
+        // PAUSED keeps the sockets, the decoder and its GL resources, only the data flow stops.
+        gst_element_set_state(app->pipeline, GST_STATE_PAUSED);
+        ALOGI("%s: pipeline paused", __FUNCTION__);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean resume_cb(gpointer user_data) {
+    MyStreamApp *app = user_data;
+
+    app->suspended = false;
+
+    // Whatever the counters picked up before pausing says nothing about the network now.
+    reset_network_counters(app);
+
+    if (app->audio_player != NULL) {
+        my_audio_player_set_paused(app->audio_player, false);
+    }
+    if (app->pipeline != NULL) {
+        gst_element_set_state(app->pipeline, GST_STATE_PLAYING);
+        ALOGI("%s: pipeline playing", __FUNCTION__);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void stream_app_suspend(MyStreamApp *app) {
+    // The pipeline is only ever touched from the main loop, queue behind whatever it is doing.
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, suspend_cb, g_object_ref(app), g_object_unref);
+}
+
+void stream_app_resume(MyStreamApp *app) {
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, resume_cb, g_object_ref(app), g_object_unref);
+}
+
+static struct MySampleImpl *acquire_pooled_sample(MyStreamApp *app) {
+    for (int i = 0; i < SAMPLE_POOL_SIZE; i++) {
+        struct MySampleImpl *impl = &app->sample_pool[i];
+        if (!impl->in_use) {
+            memset(impl, 0, sizeof(*impl));
+            impl->in_use = true;
+            return impl;
+        }
+    }
+    return NULL;
+}
+
+/// Re-parse the video info and texture target, but only when the caps actually changed.
+static void update_video_caps(struct video_display *d, GstCaps *caps) {
+    if (d->video_caps == caps || (d->video_caps != NULL && gst_caps_is_equal(d->video_caps, caps))) {
+        return;
+    }
+    gst_caps_replace(&d->video_caps, caps);
+
+    gst_video_info_from_caps(&d->video_info, caps);
+    d->width = GST_VIDEO_INFO_WIDTH(&d->video_info);
+    d->height = GST_VIDEO_INFO_HEIGHT(&d->video_info);
+    ALOGI("%s: display %d frame %d (w) x %d (h)", __FUNCTION__, d->index, d->width, d->height);
+
+    /* Check if we have 2D or OES textures */
+    GstStructure *s = gst_caps_get_structure(caps, 0);
+    const gchar *texture_target_str = gst_structure_get_string(s, "texture-target");
+    if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_EXTERNAL_OES_STR)) {
+        d->frame_texture_target = GL_TEXTURE_EXTERNAL_OES;
+    } else if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_2D_STR)) {
+        d->frame_texture_target = GL_TEXTURE_2D;
+        ALOGE("Got GL_TEXTURE_2D instead of expected GL_TEXTURE_EXTERNAL_OES");
+    } else {
+        g_assert_not_reached();
+    }
+}
+
+static struct MySample *try_pull_hardware_buffer_sample(MyStreamApp *app, struct timespec *out_decode_end) {
+    struct my_hwb_decoder *dec = atomic_load_explicit(&app->hwb_decoder, memory_order_acquire);
+    if (dec == NULL) {
+        // Not setup yet.
+        return NULL;
+    }
+
+    struct my_hwb_frame frame;
+    if (!my_hwb_decoder_try_acquire(dec, &frame)) {
+        return NULL;
+    }
+    my_startup_profile_mark(MY_STARTUP_PHASE_FIRST_DECODED);
+
+    struct MySampleImpl *ret = acquire_pooled_sample(app);
+    if (ret == NULL) {
+        ALOGE("%s: All %d samples are in use, is the render loop leaking them?", __FUNCTION__, SAMPLE_POOL_SIZE);
+        my_hwb_decoder_release_frame(dec, &frame);
+        return NULL;
+    }
+
+    ret->base.frame_texture_id = my_hwb_decoder_import(dec, app->egl.display, &frame);
+    if (ret->base.frame_texture_id == 0) {
+        my_hwb_decoder_release_frame(dec, &frame);
+        ret->in_use = false;
+        return NULL;
+    }
+    ret->base.frame_texture_target = GL_TEXTURE_EXTERNAL_OES;
+    ret->base.frame_id = frame.frame_id;
+    ret->base.uv_scale_x = frame.uv_scale_x;
+    ret->base.uv_scale_y = frame.uv_scale_y;
+    ret->hwb_frame = frame;
+    ret->base.width = frame.width;
+    ret->base.height = frame.height;
+
+    app->displays[0].width = frame.width;
+    app->displays[0].height = frame.height;
+
+    out_decode_end->tv_sec = frame.decoded_ns / GST_SECOND;
+    out_decode_end->tv_nsec = frame.decoded_ns % GST_SECOND;
+
+    return (struct MySample *)ret;
+}
+
 struct MySample *stream_app_try_pull_sample(MyStreamApp *app, struct timespec *out_decode_end) {
-    if (!app->appsink) {
+    return stream_app_try_pull_display_sample(app, 0, out_decode_end);
+}
+
+struct MySample *stream_app_try_pull_display_sample(MyStreamApp *app, int index, struct timespec *out_decode_end) {
+    if (index < 0 || index >= atomic_load(&app->display_count)) {
+        return NULL;
+    }
+    // Only the primary display ever has a hardware buffer decoder.
+    if (index == 0 && atomic_load(&app->decode_path) == MY_DECODE_PATH_HARDWARE_BUFFER) {
+        return try_pull_hardware_buffer_sample(app, out_decode_end);
+    }
+
+    struct video_display *d = &app->displays[index];
+    if (!d->appsink) {
         // Not setup yet.
         return NULL;
     }
 
     // We actually pull the sample in the new-sample signal handler,
     // so here we're just receiving the sample already pulled.
-    GstSample *sample = NULL;
-    struct timespec decode_end;
-    {
-        g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&app->sample_mutex);
-        sample = app->sample;
-        app->sample = NULL;
-        decode_end = app->sample_decode_end_ts;
-    }
-
-    if (sample == NULL) {
-        if (gst_app_sink_is_eos(GST_APP_SINK(app->appsink))) {
+    uint32_t slot_index;
+    if (!my_frame_mailbox_consume(&d->mailbox, &slot_index)) {
+        if (gst_app_sink_is_eos(GST_APP_SINK(d->appsink))) {
             //            ALOGW("%s: EOS", __FUNCTION__);
             // TODO trigger teardown?
         }
         return NULL;
     }
-    *out_decode_end = decode_end;
+    struct mailbox_slot *slot = &d->mailbox_slots[slot_index];
 
-    GstBuffer *buffer = gst_sample_get_buffer(sample);
-    GstCaps *caps = gst_sample_get_caps(sample);
+    // Move sample ownership out of the mailbox, the slot goes back to the producer on the next consume.
+    GstSample *sample = slot->sample;
+    slot->sample = NULL;
+    if (sample == NULL) {
+        return NULL;
+    }
 
-    GstVideoInfo info;
-    gst_video_info_from_caps(&info, caps);
-    gint width = GST_VIDEO_INFO_WIDTH(&info);
-    gint height = GST_VIDEO_INFO_HEIGHT(&info);
-    //    ALOGI("%s: frame %d (w) x %d (h)", __FUNCTION__, width, height);
+    struct MySampleImpl *ret = acquire_pooled_sample(app);
+    if (ret == NULL) {
+        ALOGE("%s: All %d samples are in use, is the render loop leaking them?", __FUNCTION__, SAMPLE_POOL_SIZE);
+        gst_sample_unref(sample);
+        return NULL;
+    }
+    *out_decode_end = slot->decode_end_ts;
+    ret->base.frame_id = slot->frame_id;
 
-    if (width != app->width || height != app->height) {
-        app->width = width;
-        app->height = height;
+    if (d->context == NULL) {
+        ALOGI("%s: Retrieving the GStreamer EGL context", __FUNCTION__);
+        /* Get GStreamer's gl context. */
+        gst_gl_query_local_gl_context(d->appsink, GST_PAD_SINK, &d->context);
     }
 
-    struct MySampleImpl *ret = calloc(1, sizeof(struct MySampleImpl));
+    update_video_caps(d, gst_sample_get_caps(sample));
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
 
     GstVideoFrame frame;
     GstMapFlags flags = (GstMapFlags)(GST_MAP_READ | GST_MAP_GL);
-    gst_video_frame_map(&frame, &info, buffer, flags);
+    gst_video_frame_map(&frame, &d->video_info, buffer, flags);
     ret->base.frame_texture_id = *(GLuint *)frame.data[0];
-
-    if (app->context == NULL) {
-        ALOGI("%s: Retrieving the GStreamer EGL context", __FUNCTION__);
-        /* Get GStreamer's gl context. */
-        gst_gl_query_local_gl_context(app->appsink, GST_PAD_SINK, &app->context);
-
-        /* Check if we have 2D or OES textures */
-        GstStructure *s = gst_caps_get_structure(caps, 0);
-        const gchar *texture_target_str = gst_structure_get_string(s, "texture-target");
-        if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_EXTERNAL_OES_STR)) {
-            app->frame_texture_target = GL_TEXTURE_EXTERNAL_OES;
-        } else if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_2D_STR)) {
-            app->frame_texture_target = GL_TEXTURE_2D;
-            ALOGE("Got GL_TEXTURE_2D instead of expected GL_TEXTURE_EXTERNAL_OES");
-        } else {
-            g_assert_not_reached();
-        }
-    }
-    ret->base.frame_texture_target = app->frame_texture_target;
+    ret->base.frame_texture_target = d->frame_texture_target;
+    ret->base.uv_scale_x = 1.0f;
+    ret->base.uv_scale_y = 1.0f;
+    ret->base.width = d->width;
+    ret->base.height = d->height;
 
     GstGLSyncMeta *sync_meta = gst_buffer_get_gl_sync_meta(buffer);
     if (sync_meta) {
         /* MOSHI: the set_sync() seems to be needed for resizing */
-        gst_gl_sync_meta_set_sync_point(sync_meta, app->context);
-        gst_gl_sync_meta_wait(sync_meta, app->context);
+        gst_gl_sync_meta_set_sync_point(sync_meta, d->context);
+        gst_gl_sync_meta_wait(sync_meta, d->context);
     }
 
     gst_video_frame_unmap(&frame);
@@ -444,21 +992,87 @@ struct MySample *stream_app_try_pull_sample(MyStreamApp *app, struct timespec *o
 void stream_app_release_sample(MyStreamApp *app, struct MySample *sample) {
     struct MySampleImpl *impl = (struct MySampleImpl *)sample;
     //    ALOGI("Releasing sample with texture ID %d", impl->base.frame_texture_id);
-    gst_sample_unref(impl->sample);
-    free(impl);
+    gst_clear_sample(&impl->sample);
+    if (impl->hwb_frame.image != NULL) {
+        my_hwb_decoder_release_frame(app->hwb_decoder, &impl->hwb_frame);
+    }
+    impl->in_use = false;
+}
+
+void stream_app_release_gl_resources(MyStreamApp *app) {
+    // Only the render thread imports, and a pending decoder has not been handed to it yet.
+    struct my_hwb_decoder *dec = atomic_load_explicit(&app->hwb_decoder, memory_order_acquire);
+    if (dec != NULL) {
+        my_hwb_decoder_release_imports(dec);
+    }
+}
+
+void stream_app_mark_sample(MyStreamApp *app, struct MySample *sample, enum my_latency_stage stage) {
+    my_telemetry_mark(app->telemetry, sample->frame_id, stage, my_telemetry_now_ns());
+}
+
+bool stream_app_get_sample_capture_time(MyStreamApp *app, struct MySample *sample, int64_t *out_capture_ns) {
+    return my_telemetry_get_capture_time(app->telemetry, sample->frame_id, out_capture_ns);
+}
+
+bool stream_app_get_sample_stage_time(MyStreamApp *app,
+                                      struct MySample *sample,
+                                      enum my_latency_stage stage,
+                                      int64_t *out_ns) {
+    return my_telemetry_get_stage_time(app->telemetry, sample->frame_id, stage, out_ns);
+}
+
+void stream_app_get_stream_stats(MyStreamApp *app, struct my_stream_stats *out_stats) {
+    struct my_rtp_metrics_snapshot metrics;
+    my_rtp_metrics_snapshot(app->video_metrics, &metrics);
+
+    out_stats->video_bytes_received = metrics.bytes;
+    out_stats->video_packets_received = metrics.packets - metrics.fec_packets;
+    out_stats->video_packets_lost = atomic_load(&app->video_packets_lost_total);
+    out_stats->jitterbuffer_latency_ms = atomic_load(&app->jitterbuffer_latency_ms);
+
+    guint recovered = 0;
+    guint unrecovered = 0;
+    get_fec_counters(app, &recovered, &unrecovered);
+    out_stats->fec_recovered = recovered;
+}
+
+void stream_app_get_latency_report(MyStreamApp *app, struct my_latency_report *out_report) {
+    my_telemetry_snapshot(app->telemetry, out_report, false);
+}
+
+void stream_app_set_decode_path(MyStreamApp *app, enum my_decode_path path) {
+    atomic_store(&app->decode_path, path);
+}
+
+void stream_app_set_decoder_catalog(MyStreamApp *app, const struct my_decoder_catalog *catalog) {
+    app->decoder_catalog = catalog;
+}
+
+void stream_app_set_new_sample_callback(MyStreamApp *app, stream_app_new_sample_func callback, void *user_data) {
+    g_mutex_lock(&app->new_sample_callback_lock);
+    app->new_sample_callback = callback;
+    app->new_sample_callback_data = user_data;
+    g_mutex_unlock(&app->new_sample_callback_lock);
 }
 
 uint32_t stream_app_get_video_width(MyStreamApp *app) {
-    return app->width;
+    return app->displays[0].width;
 }
 
 uint32_t stream_app_get_video_height(MyStreamApp *app) {
-    return app->height;
+    return app->displays[0].height;
+}
+
+int stream_app_get_display_count(MyStreamApp *app) {
+    return atomic_load(&app->display_count);
 }
 
 /* ------------------------------ */
 
 static GstPadProbeReturn lost_event_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+
     if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
         GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
 
@@ -474,6 +1088,13 @@ static GstPadProbeReturn lost_event_probe(GstPad *pad, GstPadProbeInfo *info, gp
             // The specific name for the packet loss event generated by rtpbin's jitterbuffer
             if (g_str_equal(name, "GstRTPPacketLost")) {
                 // *** Packet Loss Event Found! ***
+                atomic_fetch_add(&app->video_packets_lost, 1);
+                atomic_fetch_add(&app->video_packets_lost_total, 1);
+
+                // FEC sits in front of the depayloader, so this one is gone for good. Without a keyframe the picture
+                // stays broken until the next periodic one.
+                my_connection_request_keyframe(app->connection);
+
                 guint seqnum;
                 guint64 timestamp;
 
@@ -496,109 +1117,358 @@ static GstPadProbeReturn lost_event_probe(GstPad *pad, GstPadProbeInfo *info, gp
     return GST_PAD_PROBE_PASS;
 }
 
-static GstPadProbeReturn video_rtp_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+/// Which display a video SSRC belongs to, -1 for none. All packets go to the primary one in a single display session.
+static int display_for_ssrc(MyStreamApp *app, uint32_t ssrc) {
+    const int count = atomic_load(&app->display_count);
+    if (count <= 1) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (app->display_ssrcs[i] == ssrc) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    const GstClockTime pts = GST_BUFFER_PTS(buf);
-    const GstClockTime dts = GST_BUFFER_DTS(buf);
-    const GstClockTime duration = GST_BUFFER_DURATION(buf);
+static void on_video_rtp_packet(MyStreamApp *app, GstBuffer *buf, int64_t arrival_ns) {
+    struct my_rtp_header header;
+    if (!my_buffer_get_rtp_header(buf, &header)) {
+        return;
+    }
 
-    GstRTPBuffer rtp_buffer = {0};
-    guint32 rtp_timestamp = 0;
-    static guint32 rtp_timestamp_start = 0;
+    // The other displays only get counted, telemetry and the bitrate controller follow the primary one.
+    const int index = display_for_ssrc(app, header.ssrc);
+    if (index != 0) {
+        if (index > 0) {
+            my_rtp_metrics_on_packet(app->displays[index].metrics,
+                                     header.seq_num,
+                                     header.timestamp,
+                                     header.payload_type,
+                                     gst_buffer_get_size(buf),
+                                     arrival_ns);
+        }
+        return;
+    }
 
-    if (gst_rtp_buffer_map(buf, GST_MAP_READ, &rtp_buffer)) {
-        rtp_timestamp = gst_rtp_buffer_get_timestamp(&rtp_buffer);
-        gst_rtp_buffer_unmap(&rtp_buffer);
+    my_telemetry_on_rtp_packet(app->telemetry, header.timestamp, arrival_ns);
+    my_rtp_metrics_on_packet(app->video_metrics,
+                             header.seq_num,
+                             header.timestamp,
+                             header.payload_type,
+                             gst_buffer_get_size(buf),
+                             arrival_ns);
+}
+
+/// myudpbatchsrc pushes a buffer list when more than one packet was waiting.
+static GstPadProbeReturn video_rtp_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+    const int64_t arrival_ns = my_telemetry_now_ns();
+    my_startup_profile_mark(MY_STARTUP_PHASE_FIRST_PACKET);
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        const guint length = gst_buffer_list_length(list);
+        for (guint i = 0; i < length; i++) {
+            on_video_rtp_packet(app, gst_buffer_list_get(list, i), arrival_ns);
+        }
+    } else {
+        on_video_rtp_packet(app, GST_PAD_PROBE_INFO_BUFFER(info), arrival_ns);
     }
 
-    static uint16_t prev_seq_num_video = 0;
+    // We may have joined a running stream mid-GOP.
+    if (!atomic_exchange(&app->video_stream_started, true)) {
+        my_connection_request_keyframe(app->connection);
+    }
 
-    gdouble time_in_seconds = (gdouble)rtp_timestamp / 90000;
+    return GST_PAD_PROBE_OK;
+}
 
-    GstMapInfo map;
-    if (gst_buffer_map(buf, &map, GST_MAP_READ)) {
-        if (map.size >= 12) {
-            const guint8 *data = map.data;
-            const uint16_t seq_num = (data[2] << 8) | data[3]; // For big-endian systems
-            int32_t seq_num_diff = seq_num - prev_seq_num_video;
-
-            if (seq_num_diff > 1 && !(seq_num == 0 && prev_seq_num_video == 65535)) {
-                ALOGW("[udpsrc] Discontinuous video sequence number: PTS: %" GST_TIME_FORMAT
-                      ", RTP Timestamp: %u, RTP Time: %.4f, DTS: %" GST_TIME_FORMAT " Duration : %" GST_TIME_FORMAT
-                      ", SeqNum: %u, Previous SeqNum: %u, Lost Count: %d",
-                      GST_TIME_ARGS(pts),
-                      rtp_timestamp,
-                      time_in_seconds,
-                      GST_TIME_ARGS(dts),
-                      GST_TIME_ARGS(duration),
-                      seq_num,
-                      prev_seq_num_video,
-                      seq_num_diff - 1);
-            }
+static void on_audio_rtp_packet(MyStreamApp *app, GstBuffer *buf, int64_t arrival_ns) {
+    struct my_rtp_header header;
+    if (my_buffer_get_rtp_header(buf, &header)) {
+        my_rtp_metrics_on_packet(app->audio_metrics,
+                                 header.seq_num,
+                                 header.timestamp,
+                                 header.payload_type,
+                                 gst_buffer_get_size(buf),
+                                 arrival_ns);
+    }
+}
+
+static GstPadProbeReturn audio_rtp_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+    const int64_t arrival_ns = my_telemetry_now_ns();
 
-            prev_seq_num_video = seq_num;
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        const guint length = gst_buffer_list_length(list);
+        for (guint i = 0; i < length; i++) {
+            on_audio_rtp_packet(app, gst_buffer_list_get(list, i), arrival_ns);
         }
-        gst_buffer_unmap(buf, &map);
+    } else {
+        on_audio_rtp_packet(app, GST_PAD_PROBE_INFO_BUFFER(info), arrival_ns);
     }
 
     return GST_PAD_PROBE_OK;
 }
 
-static GstPadProbeReturn audio_rtp_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+/// Runs on the jitterbuffer output, which is where RTP packets get their PTS.
+static GstPadProbeReturn depay_sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    struct my_rtp_header header;
+    if (my_buffer_get_rtp_header(buf, &header)) {
+        my_telemetry_bind_pts(app->telemetry, header.timestamp, GST_BUFFER_PTS(buf));
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn depay_src_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
     GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
 
-    const GstClockTime pts = GST_BUFFER_PTS(buf);
-    const GstClockTime dts = GST_BUFFER_DTS(buf);
-    const GstClockTime duration = GST_BUFFER_DURATION(buf);
+    my_telemetry_mark_pts(app->telemetry, GST_BUFFER_PTS(buf), MY_LATENCY_STAGE_DEPAY, my_telemetry_now_ns());
 
-    GstRTPBuffer rtp_buffer = {0};
-    guint32 rtp_timestamp = 0;
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn decoded_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MyStreamApp *app = (MyStreamApp *)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    my_telemetry_mark_pts(app->telemetry, GST_BUFFER_PTS(buf), MY_LATENCY_STAGE_DECODED, my_telemetry_now_ns());
 
-    if (gst_rtp_buffer_map(buf, GST_MAP_READ, &rtp_buffer)) {
-        rtp_timestamp = gst_rtp_buffer_get_timestamp(&rtp_buffer);
-        gst_rtp_buffer_unmap(&rtp_buffer);
+    return GST_PAD_PROBE_OK;
+}
+
+/// Attach a buffer probe to a static pad of a named pipeline element.
+static void add_buffer_probe(MyStreamApp *app, const gchar *element_name, const gchar *pad_name, GstPadProbeCallback cb) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(app->pipeline), element_name);
+    if (element == NULL) {
+        ALOGE("Could not find %s for latency probe", element_name);
+        return;
+    }
+
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    if (pad != NULL) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb, app, NULL);
+        gst_object_unref(pad);
+    } else {
+        ALOGE("Could not find static %s pad in %s", pad_name, element_name);
+    }
+    gst_object_unref(element);
+}
+
+static GstElement *on_request_fec_decoder_cb(GstElement *rtpbin,
+                                             guint session_id,
+                                             guint ssrc,
+                                             guint pt,
+                                             MyStreamApp *app) {
+    // Audio goes without FEC.
+    if (session_id != 0) {
+        return NULL;
     }
 
-    static uint16_t prev_seq_num_video = 0;
+    GstElement *fec_decoder = gst_element_factory_make("rtpulpfecdec", NULL);
+    if (fec_decoder == NULL) {
+        ALOGE("%s: rtpulpfecdec is missing, receiving without FEC", __FUNCTION__);
+        return NULL;
+    }
 
-    gdouble time_in_seconds = (gdouble)rtp_timestamp / 48000;
+    // The decoder rebuilds lost packets from what the session storage kept.
+    GObject *storage = NULL;
+    g_signal_emit_by_name(rtpbin, "get-internal-storage", session_id, &storage);
+    g_object_set(fec_decoder, "pt", VIDEO_FEC_PT, "storage", storage, NULL);
+    g_clear_object(&storage);
 
-    GstMapInfo map;
-    if (gst_buffer_map(buf, &map, GST_MAP_READ)) {
-        if (map.size >= 12) {
-            const guint8 *data = map.data;
-            const uint16_t seq_num = (data[2] << 8) | data[3]; // For big-endian systems
-            int32_t seq_num_diff = seq_num - prev_seq_num_video;
-
-            if (seq_num_diff > 1 && !(seq_num == 0 && prev_seq_num_video == 65535)) {
-                ALOGW("[udpsrc] Discontinuous audio sequence number: PTS: %" GST_TIME_FORMAT
-                      ", RTP Timestamp: %u, RTP Time: %.4f, DTS: %" GST_TIME_FORMAT " Duration : %" GST_TIME_FORMAT
-                      ", SeqNum: %u, Previous SeqNum: %u, Lost Count: %d",
-                      GST_TIME_ARGS(pts),
-                      rtp_timestamp,
-                      time_in_seconds,
-                      GST_TIME_ARGS(dts),
-                      GST_TIME_ARGS(duration),
-                      seq_num,
-                      prev_seq_num_video,
-                      seq_num_diff - 1);
-            }
+    // Every display's stream gets one, the counters are the primary display's.
+    if (display_for_ssrc(app, ssrc) == 0) {
+        g_weak_ref_set(&app->fec_decoder, fec_decoder);
+    }
+    ALOGI("%s: FEC decoder for session %u, SSRC %u, PT %u", __FUNCTION__, session_id, ssrc, pt);
+    return fec_decoder;
+}
 
-            prev_seq_num_video = seq_num;
+static void add_arrival_probe(MyStreamApp *app, GstElement *element, const gchar *pad_name, GstPadProbeCallback cb) {
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    if (pad != NULL) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, cb, app, NULL);
+        gst_object_unref(pad);
+    } else {
+        ALOGE("Could not find static %s pad in %s", pad_name, GST_ELEMENT_NAME(element));
+    }
+}
+
+static void on_new_jitterbuffer_cb(GstElement *rtpbin,
+                                   GstElement *jitterbuffer,
+                                   guint session_id,
+                                   guint ssrc,
+                                   MyStreamApp *app) {
+    if (app->pipeline_transport == MY_TRANSPORT_WEBRTC) {
+        // Bundled, so audio shares the one session. Packets reach the jitterbuffer as they arrive, decrypted, so that
+        // is where they get accounted. Retransmissions show up as reordered packets.
+        const bool video = app->display_ssrcs[0] == 0 || ssrc == app->display_ssrcs[0];
+        add_arrival_probe(app, jitterbuffer, "sink", video ? video_rtp_probe : audio_rtp_probe);
+        if (video) {
+            g_weak_ref_set(&app->video_jitterbuffer, jitterbuffer);
         }
-        gst_buffer_unmap(buf, &map);
+        return;
     }
 
-    return GST_PAD_PROBE_OK;
+    if (session_id != 0 || display_for_ssrc(app, ssrc) != 0) {
+        return;
+    }
+    // Each new SSRC gets its own, the latest one is the one carrying the stream.
+    g_weak_ref_set(&app->video_jitterbuffer, jitterbuffer);
 }
 
-static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
-    ALOGI("%s", __FUNCTION__);
+/// Over WebRTC the streams come out of webrtcbin once negotiated, hand them to the depayloaders by media.
+static void on_webrtc_pad_added_cb(GstElement *webrtcbin, GstPad *pad, MyStreamApp *app) {
+    if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC) {
+        return;
+    }
 
-    g_assert_nonnull(app);
-    g_assert_nonnull(my_conn);
+    g_autoptr(GstCaps) caps = gst_pad_get_current_caps(pad);
+    if (caps == NULL) {
+        caps = gst_pad_query_caps(pad, NULL);
+    }
+    const GstStructure *structure = caps != NULL ? gst_caps_get_structure(caps, 0) : NULL;
+    const gchar *media = structure != NULL ? gst_structure_get_string(structure, "media") : NULL;
+
+    g_autoptr(GstObject) parent = gst_element_get_parent(webrtcbin);
+    g_autoptr(GstElement) depay = NULL;
+    if (g_strcmp0(media, "video") == 0) {
+        depay = gst_bin_get_by_name(GST_BIN(parent), "depay");
+    } else if (g_strcmp0(media, "audio") == 0) {
+        depay = gst_bin_get_by_name(GST_BIN(parent), "audiodepay");
+    }
+
+    g_autoptr(GstPad) sink_pad = depay != NULL ? gst_element_get_static_pad(depay, "sink") : NULL;
+    if (sink_pad != NULL && !gst_pad_is_linked(sink_pad) && gst_pad_link(pad, sink_pad) == GST_PAD_LINK_OK) {
+        ALOGI("%s: receiving %s", __FUNCTION__, media);
+        return;
+    }
+
+    ALOGW("%s: Nothing takes %s, discarding it", __FUNCTION__, media != NULL ? media : "unknown media");
+    GstElement *fakesink = gst_element_factory_make("fakesink", NULL);
+    g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(parent), fakesink);
+    gst_element_sync_state_with_parent(fakesink);
+    g_autoptr(GstPad) fakesink_pad = gst_element_get_static_pad(fakesink, "sink");
+    gst_pad_link(pad, fakesink_pad);
+}
+
+/// Ask for retransmissions of lost packets, there is no FEC over WebRTC.
+static void on_new_transceiver_cb(GstElement *webrtcbin, GObject *transceiver, MyStreamApp *app) {
+    g_object_set(transceiver, "do-nack", TRUE, NULL);
+}
+
+/// With more than one display rtpbin demuxes the session by SSRC, hand each stream to its display's depayloader.
+static void on_rtpbin_pad_added_cb(GstElement *rtpbin, GstPad *pad, MyStreamApp *app) {
+    g_autofree gchar *pad_name = gst_pad_get_name(pad);
+    guint session_id;
+    guint ssrc;
+    guint pt;
+    if (sscanf(pad_name, "recv_rtp_src_%u_%u_%u", &session_id, &ssrc, &pt) != 3 || session_id != 0) {
+        return;
+    }
+
+    g_autoptr(GstObject) parent = gst_element_get_parent(rtpbin);
+    const int index = display_for_ssrc(app, ssrc);
+    g_autoptr(GstElement) depay = NULL;
+    if (index == 0) {
+        depay = gst_bin_get_by_name(GST_BIN(parent), "depay");
+    } else if (index > 0) {
+        g_autofree gchar *depay_name = g_strdup_printf("depay%d", index);
+        depay = gst_bin_get_by_name(GST_BIN(parent), depay_name);
+    }
+
+    g_autoptr(GstPad) sink_pad = depay != NULL ? gst_element_get_static_pad(depay, "sink") : NULL;
+    if (sink_pad != NULL && !gst_pad_is_linked(sink_pad) && gst_pad_link(pad, sink_pad) == GST_PAD_LINK_OK) {
+        ALOGI("%s: SSRC %u goes to display %d", __FUNCTION__, ssrc, index);
+        return;
+    }
+
+    // Left unlinked the pad would fail the flow, and take the other streams out with it.
+    ALOGW("%s: No display for SSRC %u, discarding it", __FUNCTION__, ssrc);
+    GstElement *fakesink = gst_element_factory_make("fakesink", NULL);
+    g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(parent), fakesink);
+    gst_element_sync_state_with_parent(fakesink);
+    g_autoptr(GstPad) fakesink_pad = gst_element_get_static_pad(fakesink, "sink");
+    gst_pad_link(pad, fakesink_pad);
+}
 
+/// Put an appsink for a display into a glsinkbin of the pipeline.
+static void setup_gl_video_sink(MyStreamApp *app, struct video_display *d, const gchar *glsink_name) {
+    g_autoptr(GstElement) glsinkbin = gst_bin_get_by_name(GST_BIN(app->pipeline), glsink_name);
+
+    // We convert the string SINK_CAPS above into a GstCaps that elements below can understand.
+    // the "video/x-raw(" GST_CAPS_FEATURE_MEMORY_GL_MEMORY ")," part of the caps is read :
+    // video/x-raw(memory:GLMemory) and is really important for getting zero-copy gl textures.
+    // It tells the pipeline (especially the decoder) that an internal android:Surface should
+    // get created internally (using the provided gstgl contexts above) so that the appsink
+    // can basically pull the samples out using an GLConsumer (this is just for context, as
+    // all of those constructs will be hidden from you, but are turned on by that CAPS).
+    g_autoptr(GstCaps) caps = gst_caps_from_string(VIDEO_SINK_CAPS);
+
+    // FRED: We create the appsink 'manually' here because glsink's ALREADY a sink and so if we stick
+    //       glsinkbin ! appsink in our pipeline_string for automatic linking, gst_parse will NOT like this,
+    //       as glsinkbin (a sink) cannot link to anything upstream (appsink being 'another' sink). So we
+    //       manually link them below using glsinkbin's 'sink' pad -> appsink.
+    d->appsink = gst_element_factory_make("appsink", NULL);
+    g_object_set(d->appsink,
+                 // Set caps
+                 "caps",
+                 caps,
+                 // Fixed size buffer
+                 "max-buffers",
+                 1,
+                 // Drop old buffers when queue is filled
+                 "drop",
+                 true,
+                 // Terminator
+                 NULL);
+
+    // Lower overhead than new-sample signal.
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = on_new_sample_cb;
+    gst_app_sink_set_callbacks(GST_APP_SINK(d->appsink), &callbacks, d, NULL);
+
+    g_object_set(glsinkbin, "sink", d->appsink, NULL);
+
+    // (sync=false) Disable audio/video clock sync to reduce latency (we have to do this after setting sink
+    // manually)
+    g_object_set(glsinkbin, "sync", FALSE, NULL);
+}
+
+static GstCaps *on_request_pt_map_cb(GstElement *rtpbin, guint session_id, guint pt, MyStreamApp *app) {
+    // The media payload type is known from the udpsrc caps, the jitterbuffer still needs a clock rate for FEC.
+    if (session_id != 0 || pt != VIDEO_FEC_PT) {
+        return NULL;
+    }
+    return gst_caps_new_simple("application/x-rtp",
+                               "media",
+                               G_TYPE_STRING,
+                               "video",
+                               "payload",
+                               G_TYPE_INT,
+                               VIDEO_FEC_PT,
+                               "clock-rate",
+                               G_TYPE_INT,
+                               90000,
+                               "encoding-name",
+                               G_TYPE_STRING,
+                               "ULPFEC",
+                               NULL);
+}
+
+/// Parse the pipeline for a stream config into app->pipeline, with all callbacks and probes attached, and take it to
+/// READY. Runs on the prebuild thread or the main loop, never both at once.
+static void build_pipeline(MyStreamApp *app, const struct StreamConfig *stream_config) {
     //    GList *decoders = gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DECODABLE,
     //                                                            GST_RANK_MARGINAL);
     //
@@ -615,51 +1485,151 @@ static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
 
     // We'll need an active egl context below before setting up gstgl (as explained previously)
 
-    //    // clang-format off
-    //    gchar *pipeline_string = g_strdup_printf(
-    //        "webrtcbin name=webrtc bundle-policy=max-bundle latency=0 ! "
-    //        "decodebin3 ! "
-    ////        "amcviddec-c2qtiavcdecoder ! "        // Hardware
-    ////        "amcviddec-omxqcomvideodecoderavc ! " // Hardware
-    ////        "amcviddec-c2androidavcdecoder ! "    // Software
-    ////        "amcviddec-omxgoogleh264decoder ! "   // Software
-    ////
-    ///"video/x-raw(memory:GLMemory),format=(string)RGBA,width=(int)1280,height=(int)720,texture-target=(string)external-oes
-    ///! "
-    //        "glsinkbin name=glsink");
-    //    // clang-format on
-    //
-    //    sc->pipeline = gst_object_ref_sink(gst_parse_launch(pipeline_string, &error));
-    //    if (sc->pipeline == NULL) {
-    //        ALOGE("Failed creating pipeline : Bad source: %s", error->message);
-    //        abort();
-    //    }
-    //    if (error) {
-    //        ALOGE("Error creating a pipeline from string: %s", error ? error->message : "Unknown");
-    //        abort();
-    //    }
-
     GError *error = NULL;
 
-    gchar *pipeline_string = g_strdup_printf(
-        "rtpbin name=rtp latency=20 do-lost=true "
-        // Video
-        "udpsrc name=videoudpsrc port=5601 buffer-size=1000000 "
-        "caps=\"application/x-rtp,media=video,payload=96,clock-rate=90000,encoding-name=H264\" ! "
-        "rtp.recv_rtp_sink_0 "
-        "rtp. ! "
-        "rtph264depay name=depay ! "
-        "decodebin3 ! "
-        "glsinkbin name=glsink "
-        // Audio
-        "udpsrc name=audioudpsrc port=5602 "
-        "caps=\"application/x-rtp,media=audio,payload=127,clock-rate=48000,encoding-name=OPUS\" ! "
-        "rtp.recv_rtp_sink_1 "
-        "rtp. ! "
-        "rtpopusdepay name=audiodepay ! "
-        "opusdec ! "
-        // Set sync=false for correct A/V sync
-        "openslessink name=audiosink sync=true provide-clock=true buffer-time=20000 latency-time=20000 ");
+    bool hardware_buffer_path = atomic_load(&app->decode_path) == MY_DECODE_PATH_HARDWARE_BUFFER;
+
+    const struct StreamConfig config = *stream_config;
+    const bool webrtc = config.transport == MY_TRANSPORT_WEBRTC;
+
+    // Negotiated with the server, see my_decoder_catalog_get_codec_support.
+    const struct my_video_codec_desc *codec = my_video_codec_get_desc(config.codec);
+
+    const struct my_decoder_info *decoder =
+        app->decoder_catalog != NULL ? my_decoder_catalog_best(app->decoder_catalog, codec->mime) : NULL;
+    if (decoder != NULL) {
+        ALOGI("%s: Using %s (%s)", __FUNCTION__, decoder->codec_name, decoder->hardware ? "hardware" : "software");
+    }
+
+    if (hardware_buffer_path && app->hwb_decoder == NULL && app->pending_hwb_decoder == NULL) {
+        struct my_hwb_decoder *dec =
+            my_hwb_decoder_create(decoder, codec->mime, config.video_width, config.video_height, app->telemetry);
+        if (dec == NULL) {
+            ALOGE("%s: Falling back to decoding through GStreamer", __FUNCTION__);
+            atomic_store(&app->decode_path, MY_DECODE_PATH_GL);
+            hardware_buffer_path = false;
+        } else {
+            // The render thread only gets to see it once the codec is confirmed.
+            app->pending_hwb_decoder = dec;
+        }
+    }
+
+    // The hardware buffer path stops at the parser, we feed MediaCodec ourselves.
+    g_autofree gchar *video_sink = NULL;
+    if (hardware_buffer_path) {
+        // Repeat the parameter sets on every keyframe for H264/H265, av1parse has no such property.
+        const char *parser_options = config.codec == MY_VIDEO_CODEC_AV1 ? "" : " config-interval=-1";
+        video_sink = g_strdup_printf(
+            "%s%s ! %s ! appsink name=videosink sync=false ", codec->parser, parser_options, codec->parsed_caps);
+    } else if (decoder != NULL) {
+        video_sink = g_strdup_printf("%s ! %s ! glsinkbin name=glsink ", codec->parser, decoder->factory_name);
+    } else {
+        video_sink = g_strdup("decodebin3 ! glsinkbin name=glsink ");
+    }
+
+    // Further displays come in the same session, on_rtpbin_pad_added_cb links them up by SSRC. They always decode
+    // through GStreamer, there is only the one hardware buffer decoder. WebRTC streams just the one.
+    const int display_count = webrtc ? 1 : CLAMP(config.display_count, 1, MY_MAX_DISPLAYS);
+    g_autoptr(GString) display_sinks = g_string_new(NULL);
+    for (int i = 1; i < display_count; i++) {
+        if (decoder != NULL) {
+            g_string_append_printf(display_sinks,
+                                   "%s name=depay%d ! %s ! %s ! glsinkbin name=glsink%d ",
+                                   codec->depayloader,
+                                   i,
+                                   codec->parser,
+                                   decoder->factory_name,
+                                   i);
+        } else {
+            g_string_append_printf(
+                display_sinks, "%s name=depay%d ! decodebin3 ! glsinkbin name=glsink%d ", codec->depayloader, i, i);
+        }
+    }
+
+    if (app->audio_player == NULL && !app->audio_player_failed) {
+        app->audio_player = my_audio_player_create();
+        app->audio_player_failed = app->audio_player == NULL;
+        if (app->audio_player_failed) {
+            ALOGW("%s: No AAudio output, falling back to OpenSL ES", __FUNCTION__);
+        }
+    }
+
+    g_autofree gchar *audio_sink = NULL;
+    if (app->audio_player != NULL) {
+        // Nothing provides a clock then, so the pipeline runs on the system one. Video isn't synced to it anyway, and
+        // the player paces audio by its own buffer.
+        audio_sink = g_strdup_printf("audio/x-raw,format=S16LE,layout=interleaved,rate=%d,channels=%d ! "
+                                     "appsink name=audiosink sync=false ",
+                                     MY_AUDIO_SAMPLE_RATE,
+                                     MY_AUDIO_CHANNELS);
+    } else {
+        audio_sink = g_strdup("openslessink name=audiosink sync=true provide-clock=true buffer-time=20000 "
+                              "latency-time=20000 ");
+    }
+
+    struct my_jitter_controller_config jitter_config;
+    my_jitter_preset_get_config(
+        config.jitter_preset, config.jitter_floor_ms, config.jitter_ceiling_ms, &jitter_config);
+    my_jitter_controller_init(&app->jitter_controller, &jitter_config);
+    atomic_store(&app->jitterbuffer_latency_ms, app->jitter_controller.latency_ms);
+    g_weak_ref_set(&app->video_jitterbuffer, NULL);
+
+    // Same Mbps to bps conversion as the server. The bitrate is per display, and all of them share the video socket.
+    const int64_t bytes_per_second = (int64_t)config.bitrate * 1024 * 1024 / 8 * display_count;
+    int64_t udp_buffer_size = bytes_per_second * jitter_config.ceiling_ms / 1000 * UDP_BUFFER_LATENCY_MULTIPLE;
+    if (udp_buffer_size < UDP_BUFFER_SIZE_MIN) {
+        udp_buffer_size = UDP_BUFFER_SIZE_MIN;
+    }
+
+    if (!my_udp_batch_src_register()) {
+        ALOGE("%s: Could not register myudpbatchsrc", __FUNCTION__);
+        abort();
+    }
+
+    gchar *pipeline_string = NULL;
+    if (webrtc) {
+        // The connection negotiates the streams, on_webrtc_pad_added_cb links them up once they come.
+        pipeline_string = g_strdup_printf("webrtcbin name=webrtc bundle-policy=max-bundle latency=%d "
+                                          // Video
+                                          "%s name=depay ! "
+                                          "%s"
+                                          // Audio
+                                          "rtpopusdepay name=audiodepay ! "
+                                          "opusdec plc=true ! "
+                                          "%s",
+                                          app->jitter_controller.latency_ms,
+                                          codec->depayloader,
+                                          video_sink,
+                                          audio_sink);
+    } else {
+        pipeline_string = g_strdup_printf(
+            "rtpbin name=rtp latency=%d do-lost=true "
+            // Video
+            "myudpbatchsrc name=videoudpsrc port=5601 buffer-size=%d "
+            "caps=\"application/x-rtp,media=video,payload=96,clock-rate=90000,encoding-name=%s\" ! "
+            "rtp.recv_rtp_sink_0 "
+            "%s"
+            "%s name=depay ! "
+            "%s"
+            "%s"
+            // Audio
+            "myudpbatchsrc name=audioudpsrc port=5602 "
+            "caps=\"application/x-rtp,media=audio,payload=127,clock-rate=48000,encoding-name=OPUS\" ! "
+            "rtp.recv_rtp_sink_1 "
+            "rtp. ! "
+            "rtpopusdepay name=audiodepay ! "
+            // rtpbin reports lost packets, conceal them instead of leaving a gap.
+            "opusdec plc=true ! "
+            "%s",
+            app->jitter_controller.latency_ms,
+            (int)udp_buffer_size,
+            codec->encoding_name,
+            display_count > 1 ? "" : "rtp. ! ",
+            codec->depayloader,
+            video_sink,
+            display_sinks->str,
+            audio_sink);
+    }
 
     app->pipeline = gst_object_ref_sink(gst_parse_launch(pipeline_string, &error));
     if (app->pipeline == NULL) {
@@ -671,48 +1641,28 @@ static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
         abort();
     }
 
-    GstElement *glsinkbin = gst_bin_get_by_name(GST_BIN(app->pipeline), "glsink");
+    if (hardware_buffer_path) {
+        app->displays[0].appsink = gst_bin_get_by_name(GST_BIN(app->pipeline), "videosink");
 
-    // Set a custom appsink for glsinkbin
-    {
-        // We convert the string SINK_CAPS above into a GstCaps that elements below can understand.
-        // the "video/x-raw(" GST_CAPS_FEATURE_MEMORY_GL_MEMORY ")," part of the caps is read :
-        // video/x-raw(memory:GLMemory) and is really important for getting zero-copy gl textures.
-        // It tells the pipeline (especially the decoder) that an internal android:Surface should
-        // get created internally (using the provided gstgl contexts above) so that the appsink
-        // can basically pull the samples out using an GLConsumer (this is just for context, as
-        // all of those constructs will be hidden from you, but are turned on by that CAPS).
-        g_autoptr(GstCaps) caps = gst_caps_from_string(VIDEO_SINK_CAPS);
-
-        // FRED: We create the appsink 'manually' here because glsink's ALREADY a sink and so if we stick
-        //       glsinkbin ! appsink in our pipeline_string for automatic linking, gst_parse will NOT like this,
-        //       as glsinkbin (a sink) cannot link to anything upstream (appsink being 'another' sink). So we
-        //       manually link them below using glsinkbin's 'sink' pad -> appsink.
-        app->appsink = gst_element_factory_make("appsink", NULL);
-        g_object_set(app->appsink,
-                     // Set caps
-                     "caps",
-                     caps,
-                     // Fixed size buffer
-                     "max-buffers",
-                     1,
-                     // Drop old buffers when queue is filled
-                     "drop",
-                     true,
-                     // Terminator
-                     NULL);
-
-        // Lower overhead than new-sample signal.
         GstAppSinkCallbacks callbacks = {};
-        callbacks.new_sample = on_new_sample_cb;
-        gst_app_sink_set_callbacks(GST_APP_SINK(app->appsink), &callbacks, app, NULL);
-        app->received_first_frame = false;
+        callbacks.new_sample = on_new_encoded_sample_cb;
+        gst_app_sink_set_callbacks(GST_APP_SINK(app->displays[0].appsink), &callbacks, app, NULL);
+    } else {
+        setup_gl_video_sink(app, &app->displays[0], "glsink");
+    }
+    atomic_store(&app->received_first_frame, false);
+    for (int i = 1; i < display_count; i++) {
+        g_autofree gchar *glsink_name = g_strdup_printf("glsink%d", i);
+        setup_gl_video_sink(app, &app->displays[i], glsink_name);
+    }
 
-        g_object_set(glsinkbin, "sink", app->appsink, NULL);
+    if (app->audio_player != NULL) {
+        GstElement *audiosink = gst_bin_get_by_name(GST_BIN(app->pipeline), "audiosink");
 
-        // (sync=false) Disable audio/video clock sync to reduce latency (we have to do this after setting sink
-        // manually)
-        g_object_set(glsinkbin, "sync", FALSE, NULL);
+        GstAppSinkCallbacks callbacks = {};
+        callbacks.new_sample = on_new_audio_sample_cb;
+        gst_app_sink_set_callbacks(GST_APP_SINK(audiosink), &callbacks, app, NULL);
+        gst_object_unref(audiosink);
     }
 
     {
@@ -729,57 +1679,238 @@ static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
         g_object_unref(bus);
     }
 
+    if (webrtc) {
+        GstElement *webrtcbin = gst_bin_get_by_name(GST_BIN(app->pipeline), "webrtc");
+        g_signal_connect(webrtcbin, "pad-added", G_CALLBACK(on_webrtc_pad_added_cb), app);
+        g_signal_connect(webrtcbin, "on-new-transceiver", G_CALLBACK(on_new_transceiver_cb), app);
+
+        // webrtcbin keeps its rtpbin for itself, but it is there from the start.
+        GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(webrtcbin), "rtpbin");
+        if (rtpbin != NULL) {
+            g_object_set(rtpbin, "do-lost", TRUE, NULL);
+            g_signal_connect(rtpbin, "new-jitterbuffer", G_CALLBACK(on_new_jitterbuffer_cb), app);
+            gst_object_unref(rtpbin);
+        } else {
+            ALOGE("%s: webrtcbin has no rtpbin, receiving without RTP metrics", __FUNCTION__);
+        }
+        gst_object_unref(webrtcbin);
+    } else {
+        GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(app->pipeline), "rtp");
+        g_signal_connect(rtpbin, "new-jitterbuffer", G_CALLBACK(on_new_jitterbuffer_cb), app);
+        if (display_count > 1) {
+            g_signal_connect(rtpbin, "pad-added", G_CALLBACK(on_rtpbin_pad_added_cb), app);
+        }
+        gst_object_unref(rtpbin);
+    }
+
+    // Over WebRTC lost packets get retransmitted instead.
+    if (!webrtc && config.fec_percentage > 0) {
+        GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(app->pipeline), "rtp");
+
+        // The session already exists after parsing, so new-storage has fired. Storage keeps nothing by default.
+        GstElement *storage = NULL;
+        g_signal_emit_by_name(rtpbin, "get-storage", 0, &storage);
+        if (storage != NULL) {
+            g_object_set(storage, "size-time", (guint64)FEC_STORAGE_TIME, NULL);
+            gst_object_unref(storage);
+        }
+
+        g_signal_connect(rtpbin, "request-fec-decoder-full", G_CALLBACK(on_request_fec_decoder_cb), app);
+        g_signal_connect(rtpbin, "request-pt-map", G_CALLBACK(on_request_pt_map_cb), app);
+        gst_object_unref(rtpbin);
+    }
+
     GstElement *video_depay = gst_bin_get_by_name(GST_BIN(app->pipeline), "depay");
     if (video_depay) {
         GstPad *pad = gst_element_get_static_pad(video_depay, "sink");
         if (pad != NULL) {
-            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, lost_event_probe, NULL, NULL);
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, lost_event_probe, app, NULL);
             gst_object_unref(pad);
         } else {
             ALOGE("Could not find static sink pad in depay");
         }
     }
 
-    GstElement *video_udpsrc = gst_bin_get_by_name(GST_BIN(app->pipeline), "videoudpsrc");
-    {
-        GstPad *pad = gst_element_get_static_pad(video_udpsrc, "src");
-        if (pad != NULL) {
-            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, video_rtp_probe, app, NULL);
-            gst_object_unref(pad);
-        } else {
-            ALOGE("Could not find static src pad in video_udpsrc");
-        }
+    // Over WebRTC on_new_jitterbuffer_cb puts them on the jitterbuffers instead.
+    if (!webrtc) {
+        GstElement *video_udpsrc = gst_bin_get_by_name(GST_BIN(app->pipeline), "videoudpsrc");
+        add_arrival_probe(app, video_udpsrc, "src", video_rtp_probe);
+        gst_object_unref(video_udpsrc);
+
+        GstElement *audio_udpsrc = gst_bin_get_by_name(GST_BIN(app->pipeline), "audioudpsrc");
+        add_arrival_probe(app, audio_udpsrc, "src", audio_rtp_probe);
+        gst_object_unref(audio_udpsrc);
     }
-    gst_object_unref(video_udpsrc);
 
-    GstElement *audio_udpsrc = gst_bin_get_by_name(GST_BIN(app->pipeline), "audioudpsrc");
-    {
-        GstPad *pad = gst_element_get_static_pad(audio_udpsrc, "src");
-        if (pad != NULL) {
-            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, audio_rtp_probe, app, NULL);
-            gst_object_unref(pad);
-        } else {
-            ALOGE("Could not find static src pad in audio_udpsrc");
-        }
+    // Latency telemetry. The udpsrc side is recorded by video_rtp_probe.
+    add_buffer_probe(app, "depay", "sink", depay_sink_probe);
+    add_buffer_probe(app, "depay", "src", depay_src_probe);
+    if (!hardware_buffer_path) {
+        // The hardware buffer decoder marks this stage itself.
+        add_buffer_probe(app, "glsink", "sink", decoded_probe);
+    }
+
+    app->pipeline_codec = config.codec;
+    app->pipeline_display_count = display_count;
+    app->pipeline_transport = config.transport;
+
+    // Creates the elements' resources and binds the sockets, so going to PLAYING later is quick.
+    gst_element_set_state(app->pipeline, GST_STATE_READY);
+}
+
+static void *prebuild_thread_func(void *ptr) {
+    MyStreamApp *app = ptr;
+
+    build_pipeline(app, &app->prebuild_config);
+    my_startup_profile_mark(MY_STARTUP_PHASE_PIPELINE_READY);
+    ALOGI("%s: %s pipeline ready", __FUNCTION__, my_video_codec_get_desc(app->pipeline_codec)->name);
+
+    return NULL;
+}
+
+/// The prebuild thread touches the pipeline fields, anything else doing so has to wait for it first.
+static void wait_for_prebuilt_pipeline(MyStreamApp *app) {
+    os_thread_helper_stop(&app->prebuild_thread);
+}
+
+static void drop_pending_hwb_decoder(MyStreamApp *app) {
+    my_hwb_decoder_destroy(app->pending_hwb_decoder);
+    app->pending_hwb_decoder = NULL;
+}
+
+static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
+    ALOGI("%s", __FUNCTION__);
+
+    g_assert_nonnull(app);
+    g_assert_nonnull(my_conn);
+
+    struct StreamConfig config;
+    my_connection_get_stream_config(my_conn, &config);
+
+    // Usually done by now, the server's answer takes at least a round trip.
+    wait_for_prebuilt_pipeline(app);
+
+    const int display_count = CLAMP(config.display_count, 1, MY_MAX_DISPLAYS);
+    if (app->pipeline != NULL && app->pipeline_transport != config.transport) {
+        ALOGI("%s: transport changed, rebuilding the pipeline", __FUNCTION__);
+        drop_pipeline(app);
+        drop_pending_hwb_decoder(app);
+    } else if (app->pipeline != NULL && app->pipeline_codec != config.codec) {
+        ALOGI("%s: server picked %s, rebuilding the pipeline built for %s",
+              __FUNCTION__,
+              my_video_codec_get_desc(config.codec)->name,
+              my_video_codec_get_desc(app->pipeline_codec)->name);
+        drop_pipeline(app);
+        drop_pending_hwb_decoder(app);
+    } else if (app->pipeline != NULL && app->pipeline_display_count != display_count) {
+        ALOGI("%s: server streams %d displays, rebuilding the pipeline built for %d",
+              __FUNCTION__,
+              display_count,
+              app->pipeline_display_count);
+        drop_pipeline(app);
+        drop_pending_hwb_decoder(app);
+    }
+    if (app->pipeline == NULL) {
+        build_pipeline(app, &config);
+    } else {
+        ALOGI("%s: using the pipeline built ahead of time", __FUNCTION__);
+    }
+
+    if (app->pending_hwb_decoder != NULL) {
+        atomic_store_explicit(&app->hwb_decoder, app->pending_hwb_decoder, memory_order_release);
+        app->pending_hwb_decoder = NULL;
     }
-    gst_object_unref(audio_udpsrc);
+
+    // The streaming threads only route by SSRC once the pipeline plays.
+    memcpy(app->display_ssrcs, config.display_ssrcs, sizeof(app->display_ssrcs));
+    atomic_store(&app->display_count, display_count);
 
     // This actually hands over the pipeline. Once our own handler returns,
     // the pipeline will be started by the connection.
     g_signal_emit_by_name(my_conn, "set-pipeline", GST_PIPELINE(app->pipeline), NULL);
 
-    app->timeout_src_id_dot_data = g_timeout_add_seconds(3, G_SOURCE_FUNC(check_pipeline_dot_data), app);
+    g_clear_handle_id(&app->timeout_src_id_print_stats, g_source_remove);
     app->timeout_src_id_print_stats = g_timeout_add_seconds(3, G_SOURCE_FUNC(print_stats), app);
+
+    app->abr_enabled = config.adaptive_bitrate;
+    app->benchmark = my_connection_is_replay(my_conn);
+    if (app->benchmark) {
+        // Drop whatever an earlier window accounted, the report at the end covers exactly this run.
+        struct my_latency_report report;
+        my_telemetry_snapshot(app->telemetry, &report, true);
+    }
+
+    // Start the network counters from scratch for the new session.
+    reset_network_counters(app);
+    atomic_store(&app->video_stream_started, false);
+    app->fec_recovered_seen = 0;
+    app->fec_unrecovered_seen = 0;
+
+    g_clear_handle_id(&app->timeout_src_id_abr, g_source_remove);
+    if (app->abr_enabled) {
+        // Same Mbps to kbps conversion as the server.
+        const struct my_bitrate_controller_config abr_config = {
+            .max_bitrate_kbps = config.bitrate * 1024,
+            .min_bitrate_kbps = 1024,
+            .max_width = config.video_width,
+            .max_height = config.video_height,
+            .framerate = config.framerate,
+        };
+        my_bitrate_controller_init(&app->bitrate_controller, &abr_config);
+        app->timeout_src_id_abr = g_timeout_add(500, G_SOURCE_FUNC(bitrate_controller_tick), app);
+    }
 }
 
 static void on_drop_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
     ALOGI("%s", __FUNCTION__);
 
+    wait_for_prebuilt_pipeline(app);
+    drop_pending_hwb_decoder(app);
+
     if (app->pipeline) {
         gst_element_set_state(app->pipeline, GST_STATE_NULL);
     }
+    if (app->hwb_decoder != NULL) {
+        // Don't decode leftovers of the old stream into the next one.
+        my_hwb_decoder_flush(app->hwb_decoder);
+    }
     gst_clear_object(&app->pipeline);
-    gst_clear_object(&app->appsink);
+    for (int i = 0; i < MY_MAX_DISPLAYS; i++) {
+        gst_clear_object(&app->displays[i].appsink);
+    }
+
+    g_clear_handle_id(&app->timeout_src_id_abr, g_source_remove);
+}
+
+static void on_replay_done_cb(MyConnection *my_conn, MyStreamApp *app) {
+    struct my_rtp_replay_stats replay;
+    if (!my_connection_get_replay_stats(my_conn, &replay)) {
+        return;
+    }
+    const float duration_s = (float)(replay.finished_ns - replay.started_ns) / 1e9f;
+
+    struct my_latency_report report;
+    my_telemetry_snapshot(app->telemetry, &report, false);
+    // Every frame that got out of the decoder was either drawn or replaced in the mailbox.
+    const uint32_t decoded = report.total.count + report.frames_dropped;
+
+    ALOGI("[benchmark] Replayed for %.2f s: %" PRIu64 " packets sent, %" PRIu64 " lost, %" PRIu64
+          " reordered, %" PRIu64 " capture records skipped",
+          duration_s,
+          replay.packets_sent,
+          replay.packets_dropped,
+          replay.packets_reordered,
+          replay.records_skipped);
+    ALOGI("[benchmark] %u frames decoded, %.1f fps, %u drawn, %u replaced before they were drawn",
+          decoded,
+          duration_s > 0 ? (float)decoded / duration_s : 0.0f,
+          report.total.count,
+          report.frames_dropped);
+    my_latency_report_log(&report);
+
+    struct my_rtp_metrics_snapshot metrics;
+    my_rtp_metrics_snapshot(app->video_metrics, &metrics);
+    my_rtp_metrics_log("video", &metrics);
 }
 
 /*
@@ -787,11 +1918,14 @@ static void on_drop_pipeline_cb(MyConnection *my_conn, MyStreamApp *app) {
  */
 
 static void stream_client_set_connection(MyStreamApp *app, MyConnection *connection) {
+    my_telemetry_set_clock_sync(app->telemetry, NULL);
     g_clear_object(&app->connection);
     if (connection != NULL) {
         app->connection = g_object_ref(connection);
+        my_telemetry_set_clock_sync(app->telemetry, my_connection_get_clock_sync(app->connection));
         g_signal_connect(app->connection, "on-need-pipeline", G_CALLBACK(on_need_pipeline_cb), app);
         g_signal_connect(app->connection, "on-drop-pipeline", G_CALLBACK(on_drop_pipeline_cb), app);
+        g_signal_connect(app->connection, "on-replay-done", G_CALLBACK(on_replay_done_cb), app);
         ALOGI("%s: a connection assigned to the stream client", __FUNCTION__);
     }
 }
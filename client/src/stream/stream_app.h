@@ -15,10 +15,19 @@
 #include <stdbool.h>
 
 #include "connection.h"
+#include "telemetry.h"
 
 G_BEGIN_DECLS
 
 struct MySample;
+struct my_decoder_catalog;
+
+enum my_decode_path {
+    /// decodebin3 into glsinkbin, frames arrive as GstGL textures.
+    MY_DECODE_PATH_GL = 0,
+    /// Our own MediaCodec decoder rendering into AHardwareBuffers, imported as EGLImages.
+    MY_DECODE_PATH_HARDWARE_BUFFER,
+};
 
 #define MY_TYPE_STREAM_APP my_stream_app_get_type()
 
@@ -46,6 +55,20 @@ void stream_app_spawn_thread(MyStreamApp *app, MyConnection *connection);
  */
 void stream_app_stop(MyStreamApp *app);
 
+/*!
+ * Pause the pipeline while there is no window, keeping the decoder and sockets for @ref stream_app_resume.
+ *
+ * Thread safe, runs on the main loop thread. Stop the render thread first.
+ */
+void stream_app_suspend(MyStreamApp *app);
+
+/*!
+ * Set the pipeline playing again after @ref stream_app_suspend.
+ *
+ * Thread safe, runs on the main loop thread.
+ */
+void stream_app_resume(MyStreamApp *app);
+
 /*!
  * Attempt to retrieve a sample, if one has been decoded.
  *
@@ -56,13 +79,98 @@ void stream_app_stop(MyStreamApp *app);
  */
 struct MySample *stream_app_try_pull_sample(MyStreamApp *app, struct timespec *out_decode_end);
 
+/*!
+ * Like @ref stream_app_try_pull_sample, for one of the host monitors streamed in this session.
+ *
+ * Index 0 is the primary display, the one @ref stream_app_try_pull_sample returns.
+ */
+struct MySample *stream_app_try_pull_display_sample(MyStreamApp *app, int index, struct timespec *out_decode_end);
+
 /*!
  * Release a sample returned from @ref stream_app_try_pull_sample
  */
 void stream_app_release_sample(MyStreamApp *app, struct MySample *ems);
 
+/*!
+ * Free the GL objects the stream app made for its samples, once they are all released.
+ *
+ * Render thread only, with the EGL context current, before it lets go of the context.
+ */
+void stream_app_release_gl_resources(MyStreamApp *app);
+
+/*!
+ * Timestamp a render-side latency stage (draw, swap) for a pulled sample.
+ */
+void stream_app_mark_sample(MyStreamApp *app, struct MySample *sample, enum my_latency_stage stage);
+
+/*!
+ * When the server captured a pulled sample, on the client CLOCK_MONOTONIC.
+ *
+ * @return false if the frame isn't tracked or the clock sync has no estimate yet.
+ */
+bool stream_app_get_sample_capture_time(MyStreamApp *app, struct MySample *sample, int64_t *out_capture_ns);
+
+/*!
+ * When a pulled sample passed a latency stage, on the client CLOCK_MONOTONIC.
+ *
+ * @return false if the frame isn't tracked or hasn't been timestamped at that stage.
+ */
+bool stream_app_get_sample_stage_time(MyStreamApp *app,
+                                      struct MySample *sample,
+                                      enum my_latency_stage stage,
+                                      int64_t *out_ns);
+
+/// Counters of the video stream since the app was created, for the on-screen overlay.
+struct my_stream_stats {
+    uint64_t video_bytes_received;
+    /// Media packets, FEC packets are only counted in the bytes.
+    uint64_t video_packets_received;
+    uint64_t video_packets_lost;
+    /// Of the current FEC decoder, starts over with every pipeline.
+    uint32_t fec_recovered;
+    int32_t jitterbuffer_latency_ms;
+};
+
+/*!
+ * Thread safe, takes no locks besides looking up the FEC decoder.
+ */
+void stream_app_get_stream_stats(MyStreamApp *app, struct my_stream_stats *out_stats);
+
+/*!
+ * Get per-stage latency percentiles for the frames completed in the current reporting window.
+ */
+void stream_app_get_latency_report(MyStreamApp *app, struct my_latency_report *out_report);
+
+/*!
+ * Pick how video gets decoded. Takes effect with the next pipeline, so call it before spawning the thread.
+ *
+ * The hardware buffer path falls back to the GL path if no suitable decoder can be set up.
+ */
+void stream_app_set_decode_path(MyStreamApp *app, enum my_decode_path path);
+
+/*!
+ * Use the best decoder from the catalog instead of letting decodebin3 pick one.
+ *
+ * @param catalog Must outlive the app, may be NULL.
+ */
+void stream_app_set_decoder_catalog(MyStreamApp *app, const struct my_decoder_catalog *catalog);
+
+typedef void (*stream_app_new_sample_func)(void *user_data);
+
+/*!
+ * Get notified whenever a new sample becomes available to @ref stream_app_try_pull_sample.
+ *
+ * The callback runs on a GStreamer streaming thread and must not block. Set it before spawning the thread.
+ *
+ * Once this returns the previous callback is no longer running, nor called again. Pass NULL to clear it.
+ */
+void stream_app_set_new_sample_callback(MyStreamApp *app, stream_app_new_sample_func callback, void *user_data);
+
 uint32_t stream_app_get_video_width(MyStreamApp *app);
 
 uint32_t stream_app_get_video_height(MyStreamApp *app);
 
+/// Number of host monitors the current session streams, at least 1. Thread safe.
+int stream_app_get_display_count(MyStreamApp *app);
+
 G_END_DECLS
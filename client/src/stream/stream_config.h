@@ -1,9 +1,56 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jitter_controller.h"
+#include "video_codec.h"
+
+/// Most host monitors one session streams.
+#define MY_MAX_DISPLAYS 4
+
+/// How media and input travel between server and client.
+enum my_transport {
+    /// RTP to fixed UDP ports and input over ENet, for the LAN.
+    MY_TRANSPORT_RTP = 0,
+    /// A WebRTC peer connection: SRTP through ICE, TWCC feedback, and input over data channels.
+    MY_TRANSPORT_WEBRTC,
+};
+
+/// A codec the client can decode, with the largest frame its decoder takes (0 if unknown).
+struct my_codec_support {
+    enum my_video_codec codec;
+    int max_width;
+    int max_height;
+};
+
 struct StreamConfig {
     int video_width;
     int video_height;
     int framerate;
     int bitrate; // Mbps
     char pin[5]; // Ends in /0
+    /// Let the client adapt bitrate and resolution to the network, with the values above as ceiling.
+    bool adaptive_bitrate;
+    /// ULPFEC overhead the server should add, in percent of the media packets. 0 disables FEC.
+    int fec_percentage;
+    /// Advertised to the server in order of preference, see my_decoder_catalog_get_codec_support.
+    struct my_codec_support codecs[MY_VIDEO_CODEC_COUNT];
+    int codec_count;
+    /// Picked by the server from the list above, H264 until its stream_info arrives.
+    enum my_video_codec codec;
+    /// Ask for 10 bits per channel, set to what the server's stream_info says it streams.
+    bool ten_bit;
+    /// Jitterbuffer latency range, the bounds override the preset's unless 0. Stays on the client.
+    enum my_jitter_preset jitter_preset;
+    int jitter_floor_ms;
+    int jitter_ceiling_ms;
+    /// Host monitors to stream, each as a video stream of its own. Set to what the server's stream_info says.
+    int display_count;
+    /// SSRC of each display's video stream, from the stream_info. Unset with servers that don't name them.
+    uint32_t display_ssrcs[MY_MAX_DISPLAYS];
+    /// Picked by the user. WebRTC streams a single display, without FEC, and sessions don't resume.
+    enum my_transport transport;
+    /// STUN server for WebRTC, as a stun:// URI, empty for host candidates only.
+    char stun_server[128];
 };
@@ -0,0 +1,356 @@
+#include "telemetry.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "clock_sync.h"
+#include "utils/logger.h"
+
+/// Frames in flight we can track, must be a power of two.
+#define SLOT_COUNT 64
+#define SLOT_MASK (SLOT_COUNT - 1)
+
+/// Histogram bucket width (0.1 ms).
+#define BUCKET_NS 100000
+/// 200 ms range, anything slower lands in the last bucket.
+#define BUCKET_COUNT 2000
+
+/// RTP clock rate of the video stream.
+#define VIDEO_CLOCK_RATE 90000
+
+#define PTS_NONE UINT64_MAX
+
+struct telemetry_slot {
+    /// 0 while the slot is being (re)initialized.
+    _Atomic uint64_t frame_id;
+    _Atomic uint32_t rtp_timestamp;
+    _Atomic uint64_t pts;
+    _Atomic int64_t stage_ns[MY_LATENCY_STAGE_COUNT];
+};
+
+struct latency_histogram {
+    _Atomic uint32_t buckets[BUCKET_COUNT];
+    _Atomic uint32_t count;
+};
+
+struct my_telemetry {
+    struct telemetry_slot slots[SLOT_COUNT];
+
+    /// Only written by the udpsrc streaming thread.
+    _Atomic uint64_t last_frame_id;
+    uint32_t last_rtp_timestamp;
+
+    struct latency_histogram hops[MY_LATENCY_STAGE_COUNT];
+    struct latency_histogram total;
+    struct latency_histogram capture_to_photon;
+    _Atomic uint32_t frames_dropped;
+
+    struct my_clock_sync *_Atomic clock_sync;
+};
+
+struct my_telemetry *my_telemetry_create(void) {
+    struct my_telemetry *t = calloc(1, sizeof(struct my_telemetry));
+    if (t == NULL) {
+        ALOGE("%s: failed to allocate", __FUNCTION__);
+        return NULL;
+    }
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        atomic_init(&t->slots[i].pts, PTS_NONE);
+    }
+    return t;
+}
+
+void my_telemetry_destroy(struct my_telemetry *t) {
+    free(t);
+}
+
+void my_telemetry_set_clock_sync(struct my_telemetry *t, struct my_clock_sync *cs) {
+    atomic_store(&t->clock_sync, cs);
+}
+
+int64_t my_telemetry_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// Returns the slot if it still holds @p frame_id.
+static struct telemetry_slot *get_slot(struct my_telemetry *t, uint64_t frame_id) {
+    if (frame_id == 0) {
+        return NULL;
+    }
+    struct telemetry_slot *slot = &t->slots[frame_id & SLOT_MASK];
+    if (atomic_load_explicit(&slot->frame_id, memory_order_acquire) != frame_id) {
+        return NULL;
+    }
+    return slot;
+}
+
+/// Search the tracked frames from newest to oldest.
+static uint64_t find_frame(struct my_telemetry *t, bool by_pts, uint64_t value) {
+    uint64_t newest = atomic_load_explicit(&t->last_frame_id, memory_order_acquire);
+
+    for (uint64_t id = newest; id > 0 && newest - id < SLOT_COUNT; id--) {
+        struct telemetry_slot *slot = get_slot(t, id);
+        if (slot == NULL) {
+            continue;
+        }
+        uint64_t slot_value = by_pts ? atomic_load_explicit(&slot->pts, memory_order_relaxed)
+                                     : atomic_load_explicit(&slot->rtp_timestamp, memory_order_relaxed);
+        if (slot_value == value) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+uint64_t my_telemetry_on_rtp_packet(struct my_telemetry *t, uint32_t rtp_timestamp, int64_t now_ns) {
+    uint64_t last_id = atomic_load_explicit(&t->last_frame_id, memory_order_relaxed);
+
+    if (last_id != 0) {
+        if (rtp_timestamp == t->last_rtp_timestamp) {
+            return last_id;
+        }
+        // A late packet of an older frame, reordered by the network.
+        if ((int32_t)(rtp_timestamp - t->last_rtp_timestamp) < 0) {
+            return find_frame(t, false, rtp_timestamp);
+        }
+    }
+
+    uint64_t id = last_id + 1;
+    struct telemetry_slot *slot = &t->slots[id & SLOT_MASK];
+
+    // Invalidate first, so readers never see the new stamps under the old ID.
+    atomic_store_explicit(&slot->frame_id, 0, memory_order_release);
+    for (int i = 0; i < MY_LATENCY_STAGE_COUNT; i++) {
+        atomic_store_explicit(&slot->stage_ns[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&slot->pts, PTS_NONE, memory_order_relaxed);
+    atomic_store_explicit(&slot->rtp_timestamp, rtp_timestamp, memory_order_relaxed);
+    atomic_store_explicit(&slot->stage_ns[MY_LATENCY_STAGE_RTP_ARRIVAL], now_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->frame_id, id, memory_order_release);
+
+    t->last_rtp_timestamp = rtp_timestamp;
+    atomic_store_explicit(&t->last_frame_id, id, memory_order_release);
+
+    return id;
+}
+
+void my_telemetry_bind_pts(struct my_telemetry *t, uint32_t rtp_timestamp, uint64_t pts) {
+    if (pts == PTS_NONE) {
+        return;
+    }
+    struct telemetry_slot *slot = get_slot(t, find_frame(t, false, rtp_timestamp));
+    if (slot == NULL) {
+        return;
+    }
+    atomic_store_explicit(&slot->pts, pts, memory_order_relaxed);
+}
+
+static void histogram_add(struct latency_histogram *h, int64_t duration_ns) {
+    if (duration_ns < 0) {
+        return;
+    }
+    int64_t bucket = duration_ns / BUCKET_NS;
+    if (bucket >= BUCKET_COUNT) {
+        bucket = BUCKET_COUNT - 1;
+    }
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+}
+
+static void complete_frame(struct my_telemetry *t, struct telemetry_slot *slot) {
+    int64_t stage_ns[MY_LATENCY_STAGE_COUNT];
+    for (int i = 0; i < MY_LATENCY_STAGE_COUNT; i++) {
+        stage_ns[i] = atomic_load_explicit(&slot->stage_ns[i], memory_order_relaxed);
+    }
+
+    // Skip hops around stages we missed, e.g. when a probe could not be installed.
+    for (int i = 1; i < MY_LATENCY_STAGE_COUNT; i++) {
+        if (stage_ns[i - 1] != 0 && stage_ns[i] != 0) {
+            histogram_add(&t->hops[i], stage_ns[i] - stage_ns[i - 1]);
+        }
+    }
+
+    if (stage_ns[MY_LATENCY_STAGE_RTP_ARRIVAL] != 0) {
+        histogram_add(&t->total, stage_ns[MY_LATENCY_STAGE_SWAP] - stage_ns[MY_LATENCY_STAGE_RTP_ARRIVAL]);
+    }
+
+    struct my_clock_sync *cs = atomic_load(&t->clock_sync);
+    int64_t capture_ns;
+    if (cs != NULL && my_clock_sync_rtp_to_local_ns(cs,
+                                                    atomic_load_explicit(&slot->rtp_timestamp, memory_order_relaxed),
+                                                    VIDEO_CLOCK_RATE,
+                                                    stage_ns[MY_LATENCY_STAGE_SWAP],
+                                                    &capture_ns)) {
+        histogram_add(&t->capture_to_photon, stage_ns[MY_LATENCY_STAGE_SWAP] - capture_ns);
+    }
+}
+
+void my_telemetry_mark(struct my_telemetry *t, uint64_t frame_id, enum my_latency_stage stage, int64_t now_ns) {
+    struct telemetry_slot *slot = get_slot(t, frame_id);
+    if (slot == NULL) {
+        return;
+    }
+
+    atomic_store_explicit(&slot->stage_ns[stage], now_ns, memory_order_relaxed);
+
+    if (stage == MY_LATENCY_STAGE_SWAP) {
+        complete_frame(t, slot);
+    }
+}
+
+void my_telemetry_on_frame_dropped(struct my_telemetry *t) {
+    atomic_fetch_add_explicit(&t->frames_dropped, 1, memory_order_relaxed);
+}
+
+bool my_telemetry_get_capture_time(struct my_telemetry *t, uint64_t frame_id, int64_t *out_local_ns) {
+    struct telemetry_slot *slot = get_slot(t, frame_id);
+    struct my_clock_sync *cs = atomic_load(&t->clock_sync);
+    if (slot == NULL || cs == NULL) {
+        return false;
+    }
+    return my_clock_sync_rtp_to_local_ns(cs,
+                                         atomic_load_explicit(&slot->rtp_timestamp, memory_order_relaxed),
+                                         VIDEO_CLOCK_RATE,
+                                         my_telemetry_now_ns(),
+                                         out_local_ns);
+}
+
+bool my_telemetry_get_stage_time(struct my_telemetry *t,
+                                 uint64_t frame_id,
+                                 enum my_latency_stage stage,
+                                 int64_t *out_ns) {
+    struct telemetry_slot *slot = get_slot(t, frame_id);
+    if (slot == NULL) {
+        return false;
+    }
+    const int64_t ns = atomic_load_explicit(&slot->stage_ns[stage], memory_order_relaxed);
+    if (ns == 0) {
+        return false;
+    }
+    *out_ns = ns;
+    return true;
+}
+
+uint64_t my_telemetry_mark_pts(struct my_telemetry *t, uint64_t pts, enum my_latency_stage stage, int64_t now_ns) {
+    if (pts == PTS_NONE) {
+        return 0;
+    }
+    uint64_t frame_id = find_frame(t, true, pts);
+    my_telemetry_mark(t, frame_id, stage, now_ns);
+    return frame_id;
+}
+
+static void histogram_percentiles(struct latency_histogram *h, struct my_latency_percentiles *out, bool reset) {
+    uint32_t buckets[BUCKET_COUNT];
+    uint32_t count = 0;
+
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        buckets[i] = reset ? atomic_exchange_explicit(&h->buckets[i], 0, memory_order_relaxed)
+                           : atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        count += buckets[i];
+    }
+    if (reset) {
+        atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    }
+
+    *out = (struct my_latency_percentiles){0};
+    out->count = count;
+    if (count == 0) {
+        return;
+    }
+
+    const float bucket_ms = (float)BUCKET_NS / 1e6f;
+    const uint32_t p50_rank = (count * 50 + 99) / 100;
+    const uint32_t p95_rank = (count * 95 + 99) / 100;
+    const uint32_t p99_rank = (count * 99 + 99) / 100;
+
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        uint32_t prev_seen = seen;
+        seen += buckets[i];
+
+        // Report the bucket center.
+        float value_ms = ((float)i + 0.5f) * bucket_ms;
+        if (prev_seen < p50_rank && seen >= p50_rank) {
+            out->p50_ms = value_ms;
+        }
+        if (prev_seen < p95_rank && seen >= p95_rank) {
+            out->p95_ms = value_ms;
+        }
+        if (prev_seen < p99_rank && seen >= p99_rank) {
+            out->p99_ms = value_ms;
+            break;
+        }
+    }
+}
+
+void my_telemetry_snapshot(struct my_telemetry *t, struct my_latency_report *out_report, bool reset) {
+    *out_report = (struct my_latency_report){0};
+
+    for (int i = 1; i < MY_LATENCY_STAGE_COUNT; i++) {
+        histogram_percentiles(&t->hops[i], &out_report->hops[i], reset);
+    }
+    histogram_percentiles(&t->total, &out_report->total, reset);
+    histogram_percentiles(&t->capture_to_photon, &out_report->capture_to_photon, reset);
+    out_report->frames_dropped = reset ? atomic_exchange_explicit(&t->frames_dropped, 0, memory_order_relaxed)
+                                       : atomic_load_explicit(&t->frames_dropped, memory_order_relaxed);
+}
+
+#define MY_MAKE_CASE(E) \
+    case E:             \
+        return #E
+
+const char *my_latency_stage_to_string(enum my_latency_stage stage) {
+    switch (stage) {
+        MY_MAKE_CASE(MY_LATENCY_STAGE_RTP_ARRIVAL);
+        MY_MAKE_CASE(MY_LATENCY_STAGE_DEPAY);
+        MY_MAKE_CASE(MY_LATENCY_STAGE_DECODED);
+        MY_MAKE_CASE(MY_LATENCY_STAGE_APPSINK);
+        MY_MAKE_CASE(MY_LATENCY_STAGE_DRAW);
+        MY_MAKE_CASE(MY_LATENCY_STAGE_SWAP);
+        default:
+            return "Unknown!";
+    }
+}
+
+#undef MY_MAKE_CASE
+
+void my_latency_report_log(const struct my_latency_report *report) {
+    if (report->total.count == 0) {
+        return;
+    }
+
+    for (int i = 1; i < MY_LATENCY_STAGE_COUNT; i++) {
+        const struct my_latency_percentiles *p = &report->hops[i];
+        ALOGI("[latency] %s -> %s: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms (%u frames)",
+              my_latency_stage_to_string(i - 1),
+              my_latency_stage_to_string(i),
+              p->p50_ms,
+              p->p95_ms,
+              p->p99_ms,
+              p->count);
+    }
+
+    ALOGI("[latency] Total: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms (%u frames)",
+          report->total.p50_ms,
+          report->total.p95_ms,
+          report->total.p99_ms,
+          report->total.count);
+
+    if (report->capture_to_photon.count != 0) {
+        ALOGI("[latency] Capture to photon: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms (%u frames)",
+              report->capture_to_photon.p50_ms,
+              report->capture_to_photon.p95_ms,
+              report->capture_to_photon.p99_ms,
+              report->capture_to_photon.count);
+    }
+    if (report->frames_dropped != 0) {
+        ALOGI("[latency] %u decoded frames replaced before they were drawn", report->frames_dropped);
+    }
+}
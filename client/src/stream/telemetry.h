@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * Points in the receive path at which a video frame gets timestamped.
+ *
+ * Stages are listed in the order a frame passes through them.
+ */
+enum my_latency_stage {
+    /// First RTP packet of the frame left udpsrc.
+    MY_LATENCY_STAGE_RTP_ARRIVAL = 0,
+    /// The depayloader pushed the reassembled access unit.
+    MY_LATENCY_STAGE_DEPAY,
+    /// The decoder output reached glsinkbin.
+    MY_LATENCY_STAGE_DECODED,
+    /// appsink handed the sample over in the new-sample callback.
+    MY_LATENCY_STAGE_APPSINK,
+    /// The render loop submitted the GL draw.
+    MY_LATENCY_STAGE_DRAW,
+    /// eglSwapBuffers returned.
+    MY_LATENCY_STAGE_SWAP,
+    MY_LATENCY_STAGE_COUNT,
+};
+
+struct my_latency_percentiles {
+    /// Number of frames contributing to this entry.
+    uint32_t count;
+    float p50_ms;
+    float p95_ms;
+    float p99_ms;
+};
+
+struct my_latency_report {
+    /// hops[i] is the time spent between stage i - 1 and stage i. hops[0] is unused.
+    struct my_latency_percentiles hops[MY_LATENCY_STAGE_COUNT];
+    /// From RTP arrival to eglSwapBuffers.
+    struct my_latency_percentiles total;
+    /// From server capture to eglSwapBuffers, only counted once the clock sync has an estimate.
+    struct my_latency_percentiles capture_to_photon;
+    /// Decoded frames that got replaced before the render loop picked them up.
+    uint32_t frames_dropped;
+};
+
+/*!
+ * Per-session frame latency tracker.
+ *
+ * Every stage is written from a single thread (udpsrc, streaming threads, render loop), and all state is kept in
+ * fixed-size atomic arrays, so marking a frame never locks or allocates.
+ */
+struct my_telemetry;
+
+struct my_clock_sync;
+
+struct my_telemetry *my_telemetry_create(void);
+
+void my_telemetry_destroy(struct my_telemetry *t);
+
+/*!
+ * Use a server clock estimate to account capture-to-photon latency of completed frames.
+ *
+ * @param cs Must outlive the telemetry, or be unset again with NULL.
+ */
+void my_telemetry_set_clock_sync(struct my_telemetry *t, struct my_clock_sync *cs);
+
+/// CLOCK_MONOTONIC in nanoseconds, the time base of all stage timestamps.
+int64_t my_telemetry_now_ns(void);
+
+/*!
+ * Record an RTP packet arriving. The first packet of a new RTP timestamp starts a new frame.
+ *
+ * Must only be called from the udpsrc streaming thread.
+ *
+ * @return The frame ID the packet belongs to, or 0 if it belongs to a frame we no longer track.
+ */
+uint64_t my_telemetry_on_rtp_packet(struct my_telemetry *t, uint32_t rtp_timestamp, int64_t now_ns);
+
+/*!
+ * Associate a buffer PTS with the frame carrying the given RTP timestamp.
+ *
+ * The jitterbuffer assigns the PTS, so this has to be called on the output of rtpbin. Every later stage only sees the
+ * PTS and uses it to find the frame again.
+ */
+void my_telemetry_bind_pts(struct my_telemetry *t, uint32_t rtp_timestamp, uint64_t pts);
+
+/*!
+ * Timestamp a stage for the frame with the given PTS.
+ *
+ * @return The frame ID, or 0 if no tracked frame has this PTS.
+ */
+uint64_t my_telemetry_mark_pts(struct my_telemetry *t, uint64_t pts, enum my_latency_stage stage, int64_t now_ns);
+
+/*!
+ * Timestamp a stage for a frame ID, as returned by the calls above.
+ *
+ * Marking @ref MY_LATENCY_STAGE_SWAP completes the frame and accounts it in the report.
+ */
+void my_telemetry_mark(struct my_telemetry *t, uint64_t frame_id, enum my_latency_stage stage, int64_t now_ns);
+
+/// Count a decoded frame that never made it to the render loop. Thread safe.
+void my_telemetry_on_frame_dropped(struct my_telemetry *t);
+
+/*!
+ * When the server captured a tracked frame, on our CLOCK_MONOTONIC.
+ *
+ * @return false if the frame is no longer tracked or there is no clock estimate.
+ */
+bool my_telemetry_get_capture_time(struct my_telemetry *t, uint64_t frame_id, int64_t *out_local_ns);
+
+/*!
+ * When a tracked frame passed a stage, as marked above.
+ *
+ * @return false if the frame is no longer tracked or the stage wasn't marked yet.
+ */
+bool my_telemetry_get_stage_time(struct my_telemetry *t,
+                                 uint64_t frame_id,
+                                 enum my_latency_stage stage,
+                                 int64_t *out_ns);
+
+/*!
+ * Compute percentiles over the frames completed since the last reset.
+ *
+ * @param reset Start a new accounting window after taking the snapshot.
+ */
+void my_telemetry_snapshot(struct my_telemetry *t, struct my_latency_report *out_report, bool reset);
+
+const char *my_latency_stage_to_string(enum my_latency_stage stage);
+
+void my_latency_report_log(const struct my_latency_report *report);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
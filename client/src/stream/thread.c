@@ -1,7 +1,16 @@
 #include "thread.h"
 
+#include <dlfcn.h>
+#include <errno.h>
 #include <glib.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "utils/logger.h"
 
 /*!
  * Zeroes the correct amount of memory based on the type pointed-to by the
@@ -77,3 +86,255 @@ int os_thread_helper_stop(struct os_thread_helper *oth) {
 
     return ret;
 }
+
+/// Applied by the new thread to itself, then freed.
+struct thread_trampoline {
+    os_run_func_t func;
+    void *ptr;
+    struct os_thread_params params;
+    char name[16];
+};
+
+static void apply_params(const struct os_thread_params *params) {
+    pthread_setname_np(pthread_self(), params->name);
+
+    bool fifo = false;
+    if (params->fifo_priority > 0) {
+        struct sched_param sp = {.sched_priority = params->fifo_priority};
+        const int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        fifo = ret == 0;
+        if (!fifo) {
+            ALOGI("%s: %s: SCHED_FIFO not permitted (%s), using nice %d",
+                  __FUNCTION__,
+                  params->name,
+                  g_strerror(ret),
+                  params->nice);
+        }
+    }
+
+    // On Linux the nice value is per thread when given a thread ID. Not every device lets apps go as high as asked,
+    // step back towards the default until it is accepted.
+    for (int nice = params->nice; !fifo; nice = nice + 4 < 0 ? nice + 4 : 0) {
+        if (setpriority(PRIO_PROCESS, gettid(), nice) == 0) {
+            break;
+        }
+        const int err = errno;
+        ALOGW("%s: %s: failed to set nice %d: %s", __FUNCTION__, params->name, nice, g_strerror(err));
+        if (nice >= 0 || (err != EACCES && err != EPERM)) {
+            break;
+        }
+    }
+
+    os_thread_set_cpus(params->cpus);
+}
+
+static void *trampoline_func(void *ptr) {
+    struct thread_trampoline *t = ptr;
+    apply_params(&t->params);
+
+    os_run_func_t func = t->func;
+    void *func_ptr = t->ptr;
+    free(t);
+    return func(func_ptr);
+}
+
+int os_thread_helper_start_with_params(struct os_thread_helper *oth,
+                                       os_run_func_t func,
+                                       void *ptr,
+                                       const struct os_thread_params *params) {
+    struct thread_trampoline *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return ENOMEM;
+    }
+    t->func = func;
+    t->ptr = ptr;
+    t->params = *params;
+    g_strlcpy(t->name, params->name != NULL ? params->name : "", sizeof(t->name));
+    t->params.name = t->name;
+
+    const int ret = os_thread_helper_start(oth, &trampoline_func, t);
+    if (ret != 0) {
+        free(t);
+    }
+    return ret;
+}
+
+/* CPU clusters */
+
+#define MAX_CPUS 64
+
+static pthread_once_t cluster_once = PTHREAD_ONCE_INIT;
+static uint64_t all_mask;
+static uint64_t little_mask;
+static uint64_t big_mask;
+
+static long read_max_freq_khz(int cpu) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    long khz = -1;
+    if (fscanf(file, "%ld", &khz) != 1) {
+        khz = -1;
+    }
+    fclose(file);
+    return khz;
+}
+
+static void detect_clusters(void) {
+    long freqs[MAX_CPUS];
+    long min_freq = -1;
+    long max_freq = -1;
+
+    long count = sysconf(_SC_NPROCESSORS_CONF);
+    if (count > MAX_CPUS) {
+        count = MAX_CPUS;
+    }
+    for (int cpu = 0; cpu < count; cpu++) {
+        all_mask |= 1ULL << cpu;
+        freqs[cpu] = read_max_freq_khz(cpu);
+        if (freqs[cpu] <= 0) {
+            continue;
+        }
+        if (min_freq < 0 || freqs[cpu] < min_freq) {
+            min_freq = freqs[cpu];
+        }
+        if (freqs[cpu] > max_freq) {
+            max_freq = freqs[cpu];
+        }
+    }
+
+    // A single cluster, or no cpufreq at all: leave the masks empty, so threads may run anywhere.
+    if (min_freq < 0 || min_freq == max_freq) {
+        ALOGI("%s: no big.LITTLE clusters found", __FUNCTION__);
+        return;
+    }
+
+    for (int cpu = 0; cpu < count; cpu++) {
+        if (freqs[cpu] <= 0) {
+            continue;
+        }
+        if (freqs[cpu] == min_freq) {
+            little_mask |= 1ULL << cpu;
+        } else {
+            big_mask |= 1ULL << cpu;
+        }
+    }
+    ALOGI("%s: little cores 0x%" PRIx64 ", big cores 0x%" PRIx64, __FUNCTION__, little_mask, big_mask);
+}
+
+uint64_t os_thread_cpus_get_mask(enum os_thread_cpus cpus) {
+    pthread_once(&cluster_once, detect_clusters);
+    switch (cpus) {
+        case OS_THREAD_CPUS_LITTLE:
+            return little_mask != 0 ? little_mask : all_mask;
+        case OS_THREAD_CPUS_BIG:
+            return big_mask != 0 ? big_mask : all_mask;
+        default:
+            return all_mask;
+    }
+}
+
+void os_thread_set_cpus(enum os_thread_cpus cpus) {
+    // Set even for any CPU, threads start out with the affinity of the one creating them.
+    const uint64_t mask = os_thread_cpus_get_mask(cpus);
+    if (mask == 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (mask & (1ULL << cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (sched_setaffinity(gettid(), sizeof(set), &set) != 0) {
+        const int err = errno;
+        char name[16] = "";
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        ALOGW("%s: %s: failed to set affinity 0x%" PRIx64 ": %s", __FUNCTION__, name, mask, g_strerror(err));
+    }
+}
+
+/* Performance hints */
+
+typedef struct APerformanceHintManager APerformanceHintManager;
+typedef struct APerformanceHintSession APerformanceHintSession;
+
+// Android 13 API, looked up at runtime since we support older systems.
+struct perf_hint_api {
+    APerformanceHintManager *(*get_manager)(void);
+    APerformanceHintSession *(*create_session)(APerformanceHintManager *, const int32_t *, size_t, int64_t);
+    int (*update_target)(APerformanceHintSession *, int64_t);
+    int (*report_actual)(APerformanceHintSession *, int64_t);
+    void (*close_session)(APerformanceHintSession *);
+};
+
+struct os_perf_hint_session {
+    APerformanceHintSession *session;
+};
+
+static pthread_once_t perf_hint_once = PTHREAD_ONCE_INIT;
+static struct perf_hint_api perf_hint;
+
+static void load_perf_hint_api(void) {
+    void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+        return;
+    }
+    struct perf_hint_api api = {
+        .get_manager = dlsym(lib, "APerformanceHint_getManager"),
+        .create_session = dlsym(lib, "APerformanceHint_createSession"),
+        .update_target = dlsym(lib, "APerformanceHint_updateTargetWorkDuration"),
+        .report_actual = dlsym(lib, "APerformanceHint_reportActualWorkDuration"),
+        .close_session = dlsym(lib, "APerformanceHint_closeSession"),
+    };
+    // libandroid stays loaded for the process lifetime anyway, no need to dlclose.
+    if (api.get_manager && api.create_session && api.update_target && api.report_actual && api.close_session) {
+        perf_hint = api;
+    }
+}
+
+struct os_perf_hint_session *os_perf_hint_session_create(const int32_t *tids, size_t count, int64_t target_ns) {
+    pthread_once(&perf_hint_once, load_perf_hint_api);
+    if (perf_hint.get_manager == NULL) {
+        return NULL;
+    }
+
+    APerformanceHintManager *manager = perf_hint.get_manager();
+    APerformanceHintSession *session = manager ? perf_hint.create_session(manager, tids, count, target_ns) : NULL;
+    if (session == NULL) {
+        ALOGW("%s: failed to create a performance hint session", __FUNCTION__);
+        return NULL;
+    }
+
+    struct os_perf_hint_session *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        perf_hint.close_session(session);
+        return NULL;
+    }
+    s->session = session;
+    return s;
+}
+
+void os_perf_hint_session_update_target(struct os_perf_hint_session *session, int64_t target_ns) {
+    if (session != NULL && target_ns > 0) {
+        perf_hint.update_target(session->session, target_ns);
+    }
+}
+
+void os_perf_hint_session_report(struct os_perf_hint_session *session, int64_t actual_ns) {
+    if (session != NULL && actual_ns > 0) {
+        perf_hint.report_actual(session->session, actual_ns);
+    }
+}
+
+void os_perf_hint_session_destroy(struct os_perf_hint_session *session) {
+    if (session == NULL) {
+        return;
+    }
+    perf_hint.close_session(session->session);
+    free(session);
+}
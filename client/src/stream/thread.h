@@ -1,12 +1,18 @@
 #pragma once
 
 #include <linux/time.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*!
  * All in one helper that handles locking, waiting for change and starting a
  * thread.
@@ -43,3 +49,79 @@ int os_thread_helper_start(struct os_thread_helper *oth, os_run_func_t func, voi
  * @return 0 on success, or an error code.
  */
 int os_thread_helper_stop(struct os_thread_helper *oth);
+
+/// Nice values of Android's THREAD_PRIORITY_* levels that apps may use for their own threads.
+#define OS_THREAD_PRIORITY_DEFAULT 0
+#define OS_THREAD_PRIORITY_DISPLAY (-4)
+#define OS_THREAD_PRIORITY_URGENT_DISPLAY (-8)
+
+/// Cores a thread may run on. Clusters are told apart by their maximum frequency.
+enum os_thread_cpus {
+    OS_THREAD_CPUS_ANY = 0,
+    /// The slowest cluster, for work that is not latency critical.
+    OS_THREAD_CPUS_LITTLE,
+    /// Everything but the slowest cluster, so big and prime cores.
+    OS_THREAD_CPUS_BIG,
+};
+
+struct os_thread_params {
+    /// At most 15 characters, longer names get truncated.
+    const char *name;
+    /// Nice value, used when SCHED_FIFO isn't requested or not permitted.
+    int nice;
+    /// SCHED_FIFO priority to try first, 0 to stay on SCHED_OTHER. Apps usually lack the permission.
+    int fifo_priority;
+    enum os_thread_cpus cpus;
+};
+
+/*!
+ * Like @ref os_thread_helper_start, but the thread applies @p params to itself before running @p func.
+ *
+ * Failing to get a priority or affinity isn't fatal, the thread just runs with what it got.
+ *
+ * @param params Copied, need not outlive the call.
+ */
+int os_thread_helper_start_with_params(struct os_thread_helper *oth,
+                                       os_run_func_t func,
+                                       void *ptr,
+                                       const struct os_thread_params *params);
+
+/*!
+ * CPU mask of a cluster choice, a bit per CPU number.
+ *
+ * @return All CPUs for OS_THREAD_CPUS_ANY, or if the clusters can't be told apart. 0 only if there are no CPUs to count.
+ */
+uint64_t os_thread_cpus_get_mask(enum os_thread_cpus cpus);
+
+/*!
+ * Move the calling thread to a cluster choice.
+ *
+ * Threads inherit the affinity of the thread creating them, so OS_THREAD_CPUS_ANY widens it again. Failing isn't
+ * fatal, the thread just keeps running where it did.
+ */
+void os_thread_set_cpus(enum os_thread_cpus cpus);
+
+/*!
+ * Android performance hint session, so the system can size CPU frequency to a thread's per-frame work.
+ *
+ * APerformanceHintManager came with Android 13, on older systems creating a session fails.
+ */
+struct os_perf_hint_session;
+
+/*!
+ * @param tids Threads doing the work, usually just the calling one from gettid().
+ * @param target_ns Work duration per frame we aim for.
+ * @return NULL if performance hints are not supported.
+ */
+struct os_perf_hint_session *os_perf_hint_session_create(const int32_t *tids, size_t count, int64_t target_ns);
+
+void os_perf_hint_session_update_target(struct os_perf_hint_session *session, int64_t target_ns);
+
+/// Report how long one frame's work actually took.
+void os_perf_hint_session_report(struct os_perf_hint_session *session, int64_t actual_ns);
+
+void os_perf_hint_session_destroy(struct os_perf_hint_session *session);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,479 @@
+// recvmmsg
+#define _GNU_SOURCE
+
+#include "udp_batch_src.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "rtp_header_meta.h"
+#include "utils/logger.h"
+
+/// Datagrams read per recvmmsg call, a few milliseconds of a high bitrate stream.
+#define BATCH_SIZE 32
+
+/// The payloaders keep to a 1400 byte MTU, anything that doesn't fit is dropped as truncated.
+#define PACKET_SIZE_MAX 2048
+
+/// Allocated up front, about 50 ms of a 50 Mbps stream. The pool grows past it if the jitterbuffer holds more.
+#define POOL_MIN_BUFFERS 256
+
+#define DEFAULT_PORT 5004
+
+struct _MyUdpBatchSrc {
+    GstPushSrc parent;
+
+    // Properties, only read when the socket gets opened.
+    gint port;
+    /// SO_RCVBUF, 0 for the kernel default.
+    gint buffer_size;
+    gint busy_poll_us;
+    /// Guarded by the object lock.
+    GstCaps *caps;
+
+    int fd;
+    /// Wakes a blocked create up, see unlock.
+    int wake_fd;
+    GstBufferPool *pool;
+
+    /// Mapped buffers for the next recvmmsg. Slots that didn't get a packet keep theirs for the call after.
+    GstBuffer *buffers[BATCH_SIZE];
+    GstMapInfo maps[BATCH_SIZE];
+    struct iovec iovecs[BATCH_SIZE];
+    struct mmsghdr msgs[BATCH_SIZE];
+};
+
+G_DEFINE_TYPE(MyUdpBatchSrc, my_udp_batch_src, GST_TYPE_PUSH_SRC)
+
+typedef enum {
+    PROP_PORT = 1,
+    PROP_BUFFER_SIZE,
+    PROP_BUSY_POLL,
+    PROP_CAPS,
+    N_PROPERTIES
+} MyUdpBatchSrcProperty;
+
+static GstStaticPadTemplate src_template =
+    GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void close_socket(MyUdpBatchSrc *self) {
+    if (self->fd >= 0) {
+        close(self->fd);
+        self->fd = -1;
+    }
+    if (self->wake_fd >= 0) {
+        close(self->wake_fd);
+        self->wake_fd = -1;
+    }
+}
+
+static bool open_socket(MyUdpBatchSrc *self) {
+    self->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (self->fd < 0) {
+        GST_ELEMENT_ERROR(self, RESOURCE, OPEN_READ, (NULL), ("Could not create socket: %s", g_strerror(errno)));
+        return false;
+    }
+
+    const int one = 1;
+    if (setsockopt(self->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
+        ALOGW("%s: Could not set SO_REUSEADDR: %s", __FUNCTION__, g_strerror(errno));
+    }
+
+    if (self->buffer_size > 0) {
+        if (setsockopt(self->fd, SOL_SOCKET, SO_RCVBUF, &self->buffer_size, sizeof(self->buffer_size)) < 0) {
+            ALOGW("%s: Could not set SO_RCVBUF: %s", __FUNCTION__, g_strerror(errno));
+        }
+
+        // Linux reports twice what it grants, and grants at most net.core.rmem_max.
+        int granted = 0;
+        socklen_t len = sizeof(granted);
+        if (getsockopt(self->fd, SOL_SOCKET, SO_RCVBUF, &granted, &len) == 0 && granted / 2 < self->buffer_size) {
+            ALOGW("%s: Asked for a %d byte receive buffer, got %d. Bursts may overflow it",
+                  __FUNCTION__,
+                  self->buffer_size,
+                  granted / 2);
+        }
+    }
+
+    if (self->busy_poll_us > 0 &&
+        setsockopt(self->fd, SOL_SOCKET, SO_BUSY_POLL, &self->busy_poll_us, sizeof(self->busy_poll_us)) < 0) {
+        ALOGW("%s: Could not set SO_BUSY_POLL: %s", __FUNCTION__, g_strerror(errno));
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)self->port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(self->fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        GST_ELEMENT_ERROR(
+            self, RESOURCE, OPEN_READ, (NULL), ("Could not bind to port %d: %s", self->port, g_strerror(errno)));
+        close_socket(self);
+        return false;
+    }
+
+    self->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (self->wake_fd < 0) {
+        GST_ELEMENT_ERROR(self, RESOURCE, OPEN_READ, (NULL), ("Could not create eventfd: %s", g_strerror(errno)));
+        close_socket(self);
+        return false;
+    }
+
+    return true;
+}
+
+/// Give a buffer to every slot that doesn't have one.
+static GstFlowReturn fill_batch(MyUdpBatchSrc *self) {
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        if (self->buffers[i] != NULL) {
+            continue;
+        }
+
+        GstFlowReturn ret = gst_buffer_pool_acquire_buffer(self->pool, &self->buffers[i], NULL);
+        if (ret != GST_FLOW_OK) {
+            return ret;
+        }
+        if (!gst_buffer_map(self->buffers[i], &self->maps[i], GST_MAP_WRITE)) {
+            gst_clear_buffer(&self->buffers[i]);
+            GST_ELEMENT_ERROR(self, RESOURCE, FAILED, (NULL), ("Could not map a pool buffer"));
+            return GST_FLOW_ERROR;
+        }
+
+        self->iovecs[i].iov_base = self->maps[i].data;
+        self->iovecs[i].iov_len = self->maps[i].size;
+        self->msgs[i].msg_hdr = (struct msghdr){
+            .msg_iov = &self->iovecs[i],
+            .msg_iovlen = 1,
+        };
+    }
+    return GST_FLOW_OK;
+}
+
+static void release_batch(MyUdpBatchSrc *self) {
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        if (self->buffers[i] != NULL) {
+            gst_buffer_unmap(self->buffers[i], &self->maps[i]);
+            gst_clear_buffer(&self->buffers[i]);
+        }
+    }
+}
+
+/// Running time, which rtpjitterbuffer takes as the arrival time.
+static GstClockTime get_running_time(MyUdpBatchSrc *self) {
+    GstClock *clock = gst_element_get_clock(GST_ELEMENT(self));
+    if (clock == NULL) {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    const GstClockTime now = gst_clock_get_time(clock);
+    const GstClockTime base_time = gst_element_get_base_time(GST_ELEMENT(self));
+    gst_object_unref(clock);
+
+    return now >= base_time ? now - base_time : 0;
+}
+
+/// Block until at least one datagram is in and take whatever else the socket holds, up to a batch.
+static GstFlowReturn receive_batch(MyUdpBatchSrc *self, GstBuffer **out_buffers, guint *out_count) {
+    GstFlowReturn ret = fill_batch(self);
+    if (ret != GST_FLOW_OK) {
+        return ret;
+    }
+
+    int count;
+    while ((count = recvmmsg(self->fd, self->msgs, BATCH_SIZE, MSG_DONTWAIT, NULL)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            GST_ELEMENT_ERROR(self, RESOURCE, READ, (NULL), ("recvmmsg failed: %s", g_strerror(errno)));
+            return GST_FLOW_ERROR;
+        }
+
+        struct pollfd fds[] = {
+            {.fd = self->fd, .events = POLLIN},
+            {.fd = self->wake_fd, .events = POLLIN},
+        };
+        if (poll(fds, G_N_ELEMENTS(fds), -1) < 0 && errno != EINTR) {
+            GST_ELEMENT_ERROR(self, RESOURCE, READ, (NULL), ("poll failed: %s", g_strerror(errno)));
+            return GST_FLOW_ERROR;
+        }
+        if (fds[1].revents & POLLIN) {
+            return GST_FLOW_FLUSHING;
+        }
+    }
+
+    // They were all waiting by now, so they share one arrival time.
+    const GstClockTime running_time = get_running_time(self);
+
+    *out_count = 0;
+    for (int i = 0; i < count; i++) {
+        const struct mmsghdr *msg = &self->msgs[i];
+        if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+            ALOGW("%s: Dropped a datagram larger than %d bytes", __FUNCTION__, PACKET_SIZE_MAX);
+            continue;
+        }
+        if (msg->msg_len == 0) {
+            continue;
+        }
+
+        GstBuffer *buffer = self->buffers[i];
+        struct my_rtp_header header;
+        const bool is_rtp = my_rtp_header_parse(self->maps[i].data, msg->msg_len, &header);
+
+        gst_buffer_unmap(buffer, &self->maps[i]);
+        self->buffers[i] = NULL;
+
+        gst_buffer_set_size(buffer, msg->msg_len);
+        if (is_rtp) {
+            my_buffer_add_rtp_header_meta(buffer, &header);
+        }
+        GST_BUFFER_PTS(buffer) = running_time;
+        GST_BUFFER_DTS(buffer) = running_time;
+
+        out_buffers[(*out_count)++] = buffer;
+    }
+    return GST_FLOW_OK;
+}
+
+/* GstPushSrc method implementations */
+
+static GstFlowReturn my_udp_batch_src_create(GstPushSrc *push_src, GstBuffer **out_buffer) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(push_src);
+
+    GstBuffer *buffers[BATCH_SIZE];
+    guint count = 0;
+    while (count == 0) {
+        GstFlowReturn ret = receive_batch(self, buffers, &count);
+        if (ret != GST_FLOW_OK) {
+            return ret;
+        }
+    }
+
+    if (count == 1) {
+        *out_buffer = buffers[0];
+        return GST_FLOW_OK;
+    }
+
+    GstBufferList *list = gst_buffer_list_new_sized(count);
+    for (guint i = 0; i < count; i++) {
+        gst_buffer_list_add(list, buffers[i]);
+    }
+    // Pushed in one go after we return, which has to be without a buffer.
+    gst_base_src_submit_buffer_list(GST_BASE_SRC(self), list);
+    *out_buffer = NULL;
+    return GST_FLOW_OK;
+}
+
+/* GstBaseSrc method implementations */
+
+static gboolean my_udp_batch_src_start(GstBaseSrc *base_src) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(base_src);
+
+    self->pool = gst_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(self->pool);
+    gst_buffer_pool_config_set_params(config, NULL, PACKET_SIZE_MAX, POOL_MIN_BUFFERS, 0);
+    if (!gst_buffer_pool_set_config(self->pool, config) || !gst_buffer_pool_set_active(self->pool, TRUE)) {
+        GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS, (NULL), ("Could not set up the packet buffer pool"));
+        gst_clear_object(&self->pool);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean my_udp_batch_src_stop(GstBaseSrc *base_src) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(base_src);
+
+    release_batch(self);
+    if (self->pool != NULL) {
+        // Buffers still downstream get freed once they come back.
+        gst_buffer_pool_set_active(self->pool, FALSE);
+        gst_clear_object(&self->pool);
+    }
+    return TRUE;
+}
+
+static gboolean my_udp_batch_src_unlock(GstBaseSrc *base_src) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(base_src);
+
+    const uint64_t one = 1;
+    if (write(self->wake_fd, &one, sizeof(one)) < 0) {
+        ALOGW("%s: Failed to write the wakeup eventfd", __FUNCTION__);
+    }
+    return TRUE;
+}
+
+static gboolean my_udp_batch_src_unlock_stop(GstBaseSrc *base_src) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(base_src);
+
+    uint64_t value;
+    if (read(self->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        ALOGW("%s: Failed to read the wakeup eventfd", __FUNCTION__);
+    }
+    return TRUE;
+}
+
+static GstCaps *my_udp_batch_src_get_caps(GstBaseSrc *base_src, GstCaps *filter) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(base_src);
+
+    GST_OBJECT_LOCK(self);
+    GstCaps *caps = self->caps != NULL ? gst_caps_ref(self->caps) : gst_caps_new_any();
+    GST_OBJECT_UNLOCK(self);
+
+    if (filter != NULL) {
+        GstCaps *intersection = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref(caps);
+        caps = intersection;
+    }
+    return caps;
+}
+
+/* GstElement method implementations */
+
+static GstStateChangeReturn my_udp_batch_src_change_state(GstElement *element, GstStateChange transition) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(element);
+
+    if (transition == GST_STATE_CHANGE_NULL_TO_READY && !open_socket(self)) {
+        return GST_STATE_CHANGE_FAILURE;
+    }
+
+    GstStateChangeReturn ret = GST_ELEMENT_CLASS(my_udp_batch_src_parent_class)->change_state(element, transition);
+
+    if (transition == GST_STATE_CHANGE_READY_TO_NULL ||
+        (transition == GST_STATE_CHANGE_NULL_TO_READY && ret == GST_STATE_CHANGE_FAILURE)) {
+        close_socket(self);
+    }
+    return ret;
+}
+
+/* GObject method implementations */
+
+static void my_udp_batch_src_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(object);
+
+    switch ((MyUdpBatchSrcProperty)property_id) {
+        case PROP_PORT:
+            self->port = g_value_get_int(value);
+            break;
+        case PROP_BUFFER_SIZE:
+            self->buffer_size = g_value_get_int(value);
+            break;
+        case PROP_BUSY_POLL:
+            self->busy_poll_us = g_value_get_int(value);
+            break;
+        case PROP_CAPS: {
+            GstCaps *caps = g_value_dup_boxed(value);
+            GST_OBJECT_LOCK(self);
+            gst_caps_replace(&self->caps, caps);
+            GST_OBJECT_UNLOCK(self);
+            if (caps != NULL) {
+                gst_caps_unref(caps);
+            }
+            gst_pad_mark_reconfigure(GST_BASE_SRC_PAD(self));
+            break;
+        }
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void my_udp_batch_src_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(object);
+
+    switch ((MyUdpBatchSrcProperty)property_id) {
+        case PROP_PORT:
+            g_value_set_int(value, self->port);
+            break;
+        case PROP_BUFFER_SIZE:
+            g_value_set_int(value, self->buffer_size);
+            break;
+        case PROP_BUSY_POLL:
+            g_value_set_int(value, self->busy_poll_us);
+            break;
+        case PROP_CAPS:
+            GST_OBJECT_LOCK(self);
+            gst_value_set_caps(value, self->caps);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void my_udp_batch_src_init(MyUdpBatchSrc *self) {
+    self->port = DEFAULT_PORT;
+    self->fd = -1;
+    self->wake_fd = -1;
+
+    gst_base_src_set_live(GST_BASE_SRC(self), TRUE);
+    gst_base_src_set_format(GST_BASE_SRC(self), GST_FORMAT_TIME);
+}
+
+static void my_udp_batch_src_finalize(GObject *object) {
+    MyUdpBatchSrc *self = MY_UDP_BATCH_SRC(object);
+
+    close_socket(self);
+    gst_clear_caps(&self->caps);
+
+    G_OBJECT_CLASS(my_udp_batch_src_parent_class)->finalize(object);
+}
+
+static void my_udp_batch_src_class_init(MyUdpBatchSrcClass *klass) {
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSrcClass *base_src_class = GST_BASE_SRC_CLASS(klass);
+    GstPushSrcClass *push_src_class = GST_PUSH_SRC_CLASS(klass);
+
+    gobject_class->finalize = my_udp_batch_src_finalize;
+    gobject_class->set_property = my_udp_batch_src_set_property;
+    gobject_class->get_property = my_udp_batch_src_get_property;
+
+    const GParamFlags flags = G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS;
+    g_object_class_install_property(
+        gobject_class,
+        PROP_PORT,
+        g_param_spec_int("port", "Port", "UDP port to receive on.", 0, G_MAXUINT16, DEFAULT_PORT, flags));
+    g_object_class_install_property(
+        gobject_class,
+        PROP_BUFFER_SIZE,
+        g_param_spec_int(
+            "buffer-size", "Buffer size", "Socket receive buffer in bytes, 0 for the default.", 0, G_MAXINT, 0, flags));
+    g_object_class_install_property(
+        gobject_class,
+        PROP_BUSY_POLL,
+        g_param_spec_int(
+            "busy-poll", "Busy poll", "SO_BUSY_POLL in microseconds, 0 to leave it off.", 0, G_MAXINT, 0, flags));
+    g_object_class_install_property(
+        gobject_class,
+        PROP_CAPS,
+        g_param_spec_boxed("caps", "Caps", "Caps of the received packets.", GST_TYPE_CAPS, flags));
+
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+    gst_element_class_set_static_metadata(element_class,
+                                          "UDP batch source",
+                                          "Source/Network",
+                                          "Receives UDP packets in batches with recvmmsg",
+                                          "rstream");
+    element_class->change_state = my_udp_batch_src_change_state;
+
+    base_src_class->start = my_udp_batch_src_start;
+    base_src_class->stop = my_udp_batch_src_stop;
+    base_src_class->unlock = my_udp_batch_src_unlock;
+    base_src_class->unlock_stop = my_udp_batch_src_unlock_stop;
+    base_src_class->get_caps = my_udp_batch_src_get_caps;
+
+    push_src_class->create = my_udp_batch_src_create;
+}
+
+bool my_udp_batch_src_register(void) {
+    static gsize registered = 0;
+
+    if (g_once_init_enter(&registered)) {
+        const gboolean ok = gst_element_register(NULL, "myudpbatchsrc", GST_RANK_NONE, MY_TYPE_UDP_BATCH_SRC);
+        g_once_init_leave(&registered, ok ? 1 : 2);
+    }
+    return registered == 1;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <gst/base/gstpushsrc.h>
+#include <stdbool.h>
+
+G_BEGIN_DECLS
+
+#define MY_TYPE_UDP_BATCH_SRC my_udp_batch_src_get_type()
+
+/*!
+ * Receives RTP over UDP, a batch of datagrams per recvmmsg call.
+ *
+ * Stands in for udpsrc with the same port, buffer-size and caps properties. Packets land straight in buffers from a
+ * pool, so there is no copy and no allocation once the pool has grown to what the jitterbuffer holds. A batch goes
+ * downstream as one buffer list, each packet with a @ref MyRtpHeaderMeta. The socket is bound in READY, like udpsrc,
+ * so nothing the server sends before PLAYING is lost.
+ *
+ * Extra properties:
+ * - busy-poll: SO_BUSY_POLL in microseconds, 0 to leave it off. Needs CAP_NET_ADMIN and a driver that supports it,
+ *   so on most devices setting it only logs a warning.
+ */
+G_DECLARE_FINAL_TYPE(MyUdpBatchSrc, my_udp_batch_src, MY, UDP_BATCH_SRC, GstPushSrc)
+
+/*!
+ * Make the element available to gst_parse_launch as "myudpbatchsrc".
+ *
+ * Call after gst_init, calling it again does nothing.
+ */
+bool my_udp_batch_src_register(void);
+
+G_END_DECLS
@@ -0,0 +1,54 @@
+#include "video_codec.h"
+
+#include <string.h>
+
+static const struct my_video_codec_desc descs[MY_VIDEO_CODEC_COUNT] = {
+    [MY_VIDEO_CODEC_H264] =
+        {
+            .name = "h264",
+            .encoding_name = "H264",
+            .depayloader = "rtph264depay",
+            .parser = "h264parse",
+            .parsed_caps = "video/x-h264,stream-format=byte-stream,alignment=au",
+            .mime = "video/avc",
+        },
+    [MY_VIDEO_CODEC_H265] =
+        {
+            .name = "h265",
+            .encoding_name = "H265",
+            .depayloader = "rtph265depay",
+            .parser = "h265parse",
+            .parsed_caps = "video/x-h265,stream-format=byte-stream,alignment=au",
+            .mime = "video/hevc",
+        },
+    [MY_VIDEO_CODEC_AV1] =
+        {
+            .name = "av1",
+            .encoding_name = "AV1",
+            .depayloader = "rtpav1depay",
+            .parser = "av1parse",
+            // MediaCodec takes low-overhead OBUs, one temporal unit per buffer.
+            .parsed_caps = "video/x-av1,stream-format=obu-stream,alignment=tu",
+            .mime = "video/av01",
+        },
+};
+
+const struct my_video_codec_desc *my_video_codec_get_desc(enum my_video_codec codec) {
+    if (codec < 0 || codec >= MY_VIDEO_CODEC_COUNT) {
+        return &descs[MY_VIDEO_CODEC_H264];
+    }
+    return &descs[codec];
+}
+
+bool my_video_codec_from_name(const char *name, enum my_video_codec *out_codec) {
+    if (name == NULL) {
+        return false;
+    }
+    for (int i = 0; i < MY_VIDEO_CODEC_COUNT; i++) {
+        if (strcmp(descs[i].name, name) == 0) {
+            *out_codec = (enum my_video_codec)i;
+            return true;
+        }
+    }
+    return false;
+}
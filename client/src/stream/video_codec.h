@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum my_video_codec {
+    MY_VIDEO_CODEC_H264,
+    MY_VIDEO_CODEC_H265,
+    MY_VIDEO_CODEC_AV1,
+    MY_VIDEO_CODEC_COUNT,
+};
+
+/// How one codec is carried and parsed on the receive side.
+struct my_video_codec_desc {
+    /// Wire name in the config and stream_info messages, e.g. "h265".
+    const char *name;
+    /// RTP encoding-name of the udpsrc caps.
+    const char *encoding_name;
+    const char *depayloader;
+    const char *parser;
+    /// Parser output caps we hand to decoders, byte-stream and one access unit per buffer.
+    const char *parsed_caps;
+    /// MediaCodec MIME type.
+    const char *mime;
+};
+
+const struct my_video_codec_desc *my_video_codec_get_desc(enum my_video_codec codec);
+
+/*!
+ * @return false if the name is unknown, out_codec is left untouched.
+ */
+bool my_video_codec_from_name(const char *name, enum my_video_codec *out_codec);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,46 @@
+use byteorder::{LittleEndian, ReadBytesExt, WriteBytesExt};
+use std::io::Cursor;
+
+// Clock synchronization with the client, see client/src/stream/clock_sync.h.
+// The client sends pings on a dedicated ENet channel, and we answer with our pipeline running time,
+// which is also what the RTP timestamps are derived from.
+
+pub const ENET_CHANNEL_CLOCK: u8 = 1;
+
+const MSG_PING: u8 = 1;
+const MSG_PONG: u8 = 2;
+
+const FLAG_SERVER_RUNNING: u8 = 0x1;
+
+const PING_SIZE: usize = 13;
+
+/// Build the pong for a ping packet, or `None` if the packet is not a valid ping.
+pub fn handle_ping(data: &[u8]) -> Option<Vec<u8>> {
+    let receive_time = crate::stream::pipeline_running_time();
+
+    if data.len() != PING_SIZE || data[0] != MSG_PING {
+        return None;
+    }
+
+    let mut cursor = Cursor::new(&data[1..]);
+    let seq = cursor.read_u32::<LittleEndian>().ok()?;
+    let client_send_time = cursor.read_i64::<LittleEndian>().ok()?;
+
+    let send_time = crate::stream::pipeline_running_time();
+
+    let (flags, t1, t2) = match (receive_time, send_time) {
+        (Some(t1), Some(t2)) => (FLAG_SERVER_RUNNING, t1 as i64, t2 as i64),
+        // No pipeline yet, the client only gets an RTT out of this.
+        _ => (0, 0, 0),
+    };
+
+    let mut pong = Vec::with_capacity(30);
+    pong.write_u8(MSG_PONG).ok()?;
+    pong.write_u8(flags).ok()?;
+    pong.write_u32::<LittleEndian>(seq).ok()?;
+    pong.write_i64::<LittleEndian>(client_send_time).ok()?;
+    pong.write_i64::<LittleEndian>(t1).ok()?;
+    pong.write_i64::<LittleEndian>(t2).ok()?;
+
+    Some(pong)
+}
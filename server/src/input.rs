@@ -1,6 +1,7 @@
+use crate::clock_sync;
 use crate::stream::STREAMING_STATE_GUARD;
 use async_std::task;
-use byteorder::{LittleEndian, ReadBytesExt};
+use byteorder::{LittleEndian, ReadBytesExt, WriteBytesExt};
 use enigo::Coordinate::Abs;
 use enigo::Direction::{Click, Press, Release};
 use enigo::{Button, Direction, Enigo, Key, Keyboard, Mouse, Settings};
@@ -14,7 +15,13 @@ use vigem_client::{self as vigem, Client, TargetId, XGamepad, Xbox360Wired};
 
 // --- ENet Configuration ---
 const ENET_PORT: u16 = 7777; // Dedicated ENet port for input
-                             // const ENET_CHANNEL_INPUT: u8 = 0; // Channel 0 for reliable input commands
+pub(crate) const ENET_CHANNEL_INPUT: u8 = 0; // Channel 0 for input batches
+pub(crate) const ENET_CHANNEL_CONTROL: u8 = 2; // Reliable control messages from the client
+const ENET_CHANNEL_COUNT: usize = 3;
+
+// Message types on ENET_CHANNEL_CONTROL, see client/src/stream/connection.c.
+const CONTROL_KEYFRAME_REQUEST: u8 = 1;
+const CONTROL_INPUT_ACK: u8 = 2;
 
 // A thread-safe global container for the Enigo instance.
 // Mutex: Ensures exclusive access when a thread is using Enigo.
@@ -22,6 +29,10 @@ const ENET_PORT: u16 = 7777; // Dedicated ENet port for input
 pub(crate) static ENIGO_GUARD: Mutex<Option<Enigo>> = Mutex::new(None);
 static ENIGO_INIT: Once = Once::new();
 
+// Newest sequence injected per continuous command type and pointer. Batches of continuous commands
+// travel unsequenced, so an older one can overtake a newer one and must not move the cursor back.
+static CONTINUOUS_SEQUENCES: Mutex<Vec<((u8, u8), u32)>> = Mutex::new(Vec::new());
+
 static VIGEM_GUARD: Mutex<Option<Xbox360Wired<Client>>> = Mutex::new(None);
 static GAMEPAD_GUARD: Mutex<Option<XGamepad>> = Mutex::new(None);
 
@@ -102,7 +113,7 @@ fn start_enet_server() -> enet::Host<UdpSocket> {
         socket,
         enet::HostSettings {
             peer_limit: 1,
-            channel_limit: 2,
+            channel_limit: ENET_CHANNEL_COUNT,
             ..Default::default()
         },
     )
@@ -129,7 +140,7 @@ pub async fn run_enet_server() -> Result<(), IoError> {
                             peer.id().0,
                             peer.address().unwrap()
                         );
-                        init_vigem();
+                        on_input_connected();
                     }
                     enet::Event::Disconnect { peer, .. } => {
                         log::info!(
@@ -137,14 +148,19 @@ pub async fn run_enet_server() -> Result<(), IoError> {
                             peer.id().0,
                             peer.address().unwrap()
                         );
-                        deinit_vigem();
+                        on_input_disconnected();
                     }
                     enet::Event::Receive {
-                        peer: _,
-                        channel_id: _,
+                        peer,
+                        channel_id,
                         packet,
                     } => {
-                        handle_enet_packet(&packet);
+                        if let Some((reply_channel, reply)) =
+                            handle_channel_message(channel_id, packet.data())
+                        {
+                            let _ = peer
+                                .send(reply_channel, &enet::Packet::unreliable(reply.as_slice()));
+                        }
 
                         received_events = true;
                     }
@@ -164,13 +180,50 @@ pub async fn run_enet_server() -> Result<(), IoError> {
     Ok(())
 }
 
-#[repr(C, packed)] // Crucial for cross-language compatibility
+/// A client connected, over ENet or WebRTC data channels.
+pub fn on_input_connected() {
+    init_vigem();
+    CONTINUOUS_SEQUENCES.lock().unwrap().clear();
+}
+
+pub fn on_input_disconnected() {
+    deinit_vigem();
+}
+
+/// Handle a message from the client on one of the ENet channels, or the data channel standing in for it.
+///
+/// Returns the reply and the channel it goes on. Replies are sent unreliable: a retransmitted pong
+/// would be worthless, and the next batch brings a newer ack anyway.
+pub fn handle_channel_message(channel_id: u8, data: &[u8]) -> Option<(u8, Vec<u8>)> {
+    match channel_id {
+        clock_sync::ENET_CHANNEL_CLOCK => {
+            clock_sync::handle_ping(data).map(|pong| (channel_id, pong))
+        }
+        ENET_CHANNEL_CONTROL => {
+            handle_control_packet(data);
+            None
+        }
+        _ => {
+            let sequence = handle_input_packet(data)?;
+            input_ack(sequence).map(|ack| (ENET_CHANNEL_CONTROL, ack))
+        }
+    }
+}
+
 struct InputCommand {
     input_type: u8,
     data0: u32,
     data1: u32,
+    // Zero for commands from older clients.
+    pointer_id: u8,
+    sequence: u32,
+    // Our pipeline running time when the input happened on the client, 0 if unknown.
+    timestamp: i64,
 }
 
+// u8 type, u32 data0, u32 data1, as sent by older clients.
+const LEGACY_COMMAND_SIZE: usize = 9;
+
 // Helper function to handle the IO operations
 fn read_command_from_cursor(cursor: &mut Cursor<&[u8]>) -> Result<InputCommand, std::io::Error> {
     // 1. Read u8 (1 byte) - Endianness doesn't matter for single bytes
@@ -186,6 +239,30 @@ fn read_command_from_cursor(cursor: &mut Cursor<&[u8]>) -> Result<InputCommand,
         input_type,
         data0,
         data1,
+        pointer_id: 0,
+        sequence: 0,
+        timestamp: 0,
+    })
+}
+
+// u8 type, u8 pointer ID, u32 sequence, i64 timestamp, u32 data0, u32 data1.
+const COMMAND_SIZE: usize = 22;
+
+fn read_versioned_command(cursor: &mut Cursor<&[u8]>) -> Result<InputCommand, std::io::Error> {
+    let input_type = cursor.read_u8()?;
+    let pointer_id = cursor.read_u8()?;
+    let sequence = cursor.read_u32::<LittleEndian>()?;
+    let timestamp = cursor.read_i64::<LittleEndian>()?;
+    let data0 = cursor.read_u32::<LittleEndian>()?;
+    let data1 = cursor.read_u32::<LittleEndian>()?;
+
+    Ok(InputCommand {
+        input_type,
+        data0,
+        data1,
+        pointer_id,
+        sequence,
+        timestamp,
     })
 }
 
@@ -250,42 +327,170 @@ impl TryFrom<u8> for InputType {
     }
 }
 
-// --- ENet Input Handling Function ---
-fn handle_enet_packet(packet: &enet::Packet) {
-    // 1. Check if the packet size matches the struct size.
-    let packet_data = packet.data();
-    if packet_data.len() != size_of::<InputCommand>() {
+fn handle_control_packet(data: &[u8]) {
+    match data.first() {
+        Some(&CONTROL_KEYFRAME_REQUEST) => {
+            // Don't block the ENet loop on the pipeline lock.
+            task::spawn_blocking(crate::stream::request_keyframe);
+        }
+        _ => log::warn!("Unknown control message: {:?}", data),
+    }
+}
+
+// --- Input Handling Function ---
+/// Batches from older clients start with a u8 count, see client/src/stream/input_batch.h.
+const LEGACY_BATCH_HEADER_SIZE: usize = 1;
+
+/// Versioned batches start with the version and this flag, then a u8 count.
+const INPUT_BATCH_VERSION_FLAG: u8 = 0x80;
+const INPUT_BATCH_VERSION: u8 = 2;
+const INPUT_BATCH_HEADER_SIZE: usize = 2;
+
+/// Handle an input packet.
+///
+/// Returns the newest sequence number in a versioned batch, which the client wants acknowledged.
+fn handle_input_packet(packet_data: &[u8]) -> Option<u32> {
+    // A single bare command, as sent by older clients.
+    if packet_data.len() == LEGACY_COMMAND_SIZE {
+        let mut cursor = Cursor::new(packet_data);
+        match read_command_from_cursor(&mut cursor) {
+            Ok(command) => handle_input_command(command),
+            Err(e) => eprintln!("Failed to deserialize packet with byte order: {}", e),
+        }
+        return None;
+    }
+
+    let header = packet_data.first().copied().unwrap_or(0);
+    if header & INPUT_BATCH_VERSION_FLAG != 0 {
+        return handle_versioned_batch(packet_data);
+    }
+
+    let count = header as usize;
+    if count == 0 || packet_data.len() != LEGACY_BATCH_HEADER_SIZE + count * LEGACY_COMMAND_SIZE {
         eprintln!(
-            "Received packet size mismatch! Expected {} bytes, got {}",
-            size_of::<InputCommand>(),
+            "Received input batch size mismatch! Expected {} commands of {} bytes, got {} bytes",
+            count,
+            LEGACY_COMMAND_SIZE,
             packet_data.len()
         );
-        return;
+        return None;
     }
 
-    // println!("Received packet data: {:?}", packet_data);
+    // Commands are in the order they happened, the client already dropped stale continuous ones.
+    let mut cursor = Cursor::new(&packet_data[LEGACY_BATCH_HEADER_SIZE..]);
+    for _ in 0..count {
+        match read_command_from_cursor(&mut cursor) {
+            Ok(command) => handle_input_command(command),
+            Err(e) => {
+                eprintln!("Failed to deserialize packet with byte order: {}", e);
+                return None;
+            }
+        }
+    }
+    None
+}
 
-    // // 2. Perform the UNSAFE cast. This is only safe because we enforced
-    // //    #[repr(C, packed)] and checked the size.
-    // let command: InputCommand = unsafe {
-    //     // Create a raw pointer to the packet data
-    //     let ptr = packet_data.as_ptr() as *const InputCommand;
-    //     // Dereference the pointer to get the struct
-    //     ptr.read_unaligned()
-    // };
+fn handle_versioned_batch(packet_data: &[u8]) -> Option<u32> {
+    let version = packet_data[0] & !INPUT_BATCH_VERSION_FLAG;
+    if version != INPUT_BATCH_VERSION {
+        log::warn!("Unsupported input batch version {}", version);
+        return None;
+    }
 
-    // 1. Wrap the packet data in a Cursor for sequential reading
-    let mut cursor = Cursor::new(packet_data);
+    let count = packet_data.get(1).copied().unwrap_or(0) as usize;
+    if count == 0 || packet_data.len() != INPUT_BATCH_HEADER_SIZE + count * COMMAND_SIZE {
+        eprintln!(
+            "Received input batch size mismatch! Expected {} commands of {} bytes, got {} bytes",
+            count,
+            COMMAND_SIZE,
+            packet_data.len()
+        );
+        return None;
+    }
 
-    // 2. Read the fields manually, enforcing Little-Endian (LE) byte order
-    let command = match read_command_from_cursor(&mut cursor) {
-        Ok(c) => c,
-        Err(e) => {
-            eprintln!("Failed to deserialize packet with byte order: {}", e);
-            return;
+    let mut commands = Vec::with_capacity(count);
+    let mut cursor = Cursor::new(&packet_data[INPUT_BATCH_HEADER_SIZE..]);
+    for _ in 0..count {
+        match read_versioned_command(&mut cursor) {
+            Ok(command) => commands.push(command),
+            Err(e) => {
+                eprintln!("Failed to deserialize packet with byte order: {}", e);
+                return None;
+            }
         }
-    };
+    }
+
+    // The client sends in sequence order, but a batch that got reordered on the way is cheap to fix here.
+    commands.sort_by_key(|command| command.sequence);
+    let newest = commands.last().map(|command| command.sequence);
+
+    let now = crate::stream::pipeline_running_time();
+    for command in commands {
+        if is_continuous(command.input_type) && !advance_continuous_sequence(&command) {
+            log::trace!("Dropping stale input {}", command.sequence);
+            continue;
+        }
+        if let (Some(now), true) = (now, command.timestamp > 0) {
+            log::trace!(
+                "Input {} delay {:.1} ms",
+                command.sequence,
+                (now as i64 - command.timestamp) as f64 / 1e6
+            );
+        }
+        handle_input_command(command);
+    }
+    newest
+}
+
+/// Continuous commands only matter with their latest value, see client/src/stream/input_batch.c.
+fn is_continuous(input_type: u8) -> bool {
+    matches!(
+        InputType::try_from(input_type),
+        Ok(InputType::CursorMove
+            | InputType::CursorScroll
+            | InputType::GamepadLeftStick
+            | InputType::GamepadRightStick
+            | InputType::GamepadButtonL2
+            | InputType::GamepadButtonR2)
+    )
+}
+
+/// Returns false if a newer command of the same kind was already injected.
+///
+/// Scrolls are deltas rather than a position, a late one still counts and is never dropped.
+fn advance_continuous_sequence(command: &InputCommand) -> bool {
+    if matches!(
+        InputType::try_from(command.input_type),
+        Ok(InputType::CursorScroll)
+    ) {
+        return true;
+    }
+    let key = (command.input_type, command.pointer_id);
+    let mut sequences = CONTINUOUS_SEQUENCES.lock().unwrap();
+    match sequences.iter_mut().find(|(k, _)| *k == key) {
+        Some((_, last)) => {
+            if (command.sequence.wrapping_sub(*last) as i32) <= 0 {
+                return false;
+            }
+            *last = command.sequence;
+        }
+        None => sequences.push((key, command.sequence)),
+    }
+    true
+}
+
+/// Tell the client when its input got injected, so it can hide its local cursor once the video shows it.
+fn input_ack(sequence: u32) -> Option<Vec<u8>> {
+    let now = crate::stream::pipeline_running_time()?;
+
+    let mut ack = Vec::with_capacity(13);
+    ack.write_u8(CONTROL_INPUT_ACK).ok()?;
+    ack.write_u32::<LittleEndian>(sequence).ok()?;
+    ack.write_i64::<LittleEndian>(now as i64).ok()?;
+    Some(ack)
+}
 
+fn handle_input_command(command: InputCommand) {
     let native_resolution;
     let stream_resolution;
     {
@@ -4,10 +4,12 @@
 // Hide the console window.
 // #![windows_subsystem = "windows"]
 
+mod clock_sync;
 mod discovery;
 mod gui;
 mod input;
 mod stream;
+mod webrtc;
 
 use eframe::egui;
 use eframe::egui::{Style, Visuals};
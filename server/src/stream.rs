@@ -1,6 +1,8 @@
 use gst::prelude::*;
 use gstreamer as gst;
 
+use crate::webrtc;
+
 use async_std::net::{TcpListener, TcpStream};
 use async_std::task;
 use async_tungstenite::tungstenite::protocol::frame::coding::CloseCode;
@@ -19,8 +21,9 @@ use serde::{Deserialize, Serialize};
 use std::{
     collections::HashMap,
     io::Error as IoError,
-    net::SocketAddr,
+    net::{IpAddr, SocketAddr},
     sync::{Arc, Mutex, Once},
+    time::{Duration, Instant},
 };
 
 // --- FIXED: Use a thread-safe Mutex for the global pipeline ---
@@ -28,11 +31,13 @@ use std::{
 // `Option<gst::Pipeline>` allows the pipeline to be present or absent (Null state).
 static PIPELINE_GUARD: Mutex<Option<gst::Pipeline>> = Mutex::new(None);
 static PIPELINE_INIT: Once = Once::new();
+/// The client the running pipeline streams to, set and cleared with `PIPELINE_GUARD` held.
+static PIPELINE_CLIENT: Mutex<Option<SocketAddr>> = Mutex::new(None);
 
 // We'll keep the GstPipelineControl for single-start logic
 type GstPipelineControl = Arc<Once>;
 
-type Tx = UnboundedSender<Message>;
+pub(crate) type Tx = UnboundedSender<Message>;
 type PeerMap = Arc<Mutex<HashMap<SocketAddr, Tx>>>;
 
 pub struct Peer {
@@ -103,69 +108,382 @@ fn check_factory_exists(factory_name: &str) -> bool {
     gst::ElementFactory::find(factory_name).is_some()
 }
 
-fn start_gstreamer_pipeline(addr: SocketAddr, config: StreamConfigMessage) {
-    // Acquire the lock for the global pipeline state
-    let mut guard = PIPELINE_GUARD.lock().unwrap();
+/// Video codecs we can stream, named as in the client's `codecs` list.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum VideoCodec {
+    H264,
+    H265,
+    Av1,
+}
 
-    // Check if a pipeline is already running
-    if guard.is_some() {
-        warn!("Pipeline already running. Not restarting.");
-        return;
+impl VideoCodec {
+    fn from_name(name: &str) -> Option<VideoCodec> {
+        match name {
+            "h264" => Some(VideoCodec::H264),
+            "h265" => Some(VideoCodec::H265),
+            "av1" => Some(VideoCodec::Av1),
+            _ => None,
+        }
     }
 
-    let host = addr.ip().to_string();
+    fn name(self) -> &'static str {
+        match self {
+            VideoCodec::H264 => "h264",
+            VideoCodec::H265 => "h265",
+            VideoCodec::Av1 => "av1",
+        }
+    }
 
-    let found_amf = check_factory_exists("amfh264enc");
+    /// Encoders in order of preference, hardware first.
+    fn encoders(self) -> &'static [&'static str] {
+        match self {
+            VideoCodec::H264 => &["amfh264enc", "x264enc"],
+            VideoCodec::H265 => &["amfh265enc", "x265enc"],
+            // Software AV1 can't keep up with a desktop in real time.
+            VideoCodec::Av1 => &["amfav1enc"],
+        }
+    }
 
-    let encoder_str = if found_amf {
-        info!("amfh264enc is available.");
+    /// Encoder output caps, `ten_bit` picks the 10-bit profile, see `negotiate_ten_bit`.
+    fn encoded_caps(self, ten_bit: bool) -> &'static str {
+        match (self, ten_bit) {
+            (VideoCodec::H264, _) => "video/x-h264,profile=baseline",
+            (VideoCodec::H265, false) => "video/x-h265,profile=main",
+            (VideoCodec::H265, true) => "video/x-h265,profile=main-10",
+            (VideoCodec::Av1, _) => "video/x-av1",
+        }
+    }
+
+    /// Payloader and RTP encoding-name, sending as `ssrc`. `extra_caps` gets appended to the RTP caps.
+    fn payload_str(self, ssrc: u32, extra_caps: &str) -> String {
+        match self {
+            VideoCodec::H264 => format!(
+                "rtph264pay config-interval=-1 aggregate-mode=zero-latency timestamp-offset=0 ssrc={} ! \
+                application/x-rtp,encoding-name=H264,clock-rate=90000,media=video,payload=96{} ! ",
+                ssrc, extra_caps
+            ),
+            VideoCodec::H265 => format!(
+                "rtph265pay config-interval=-1 aggregate-mode=zero-latency timestamp-offset=0 ssrc={} ! \
+                application/x-rtp,encoding-name=H265,clock-rate=90000,media=video,payload=96{} ! ",
+                ssrc, extra_caps
+            ),
+            VideoCodec::Av1 => format!(
+                "rtpav1pay timestamp-offset=0 ssrc={} ! \
+                application/x-rtp,encoding-name=AV1,clock-rate=90000,media=video,payload=96{} ! ",
+                ssrc, extra_caps
+            ),
+        }
+    }
+
+    fn payloader(self) -> &'static str {
+        match self {
+            VideoCodec::H264 => "rtph264pay",
+            VideoCodec::H265 => "rtph265pay",
+            VideoCodec::Av1 => "rtpav1pay",
+        }
+    }
+}
+
+/// One entry of the client's `codecs` list, most preferred first.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct CodecSupport {
+    pub name: String,
+    /// Largest frame the client's decoder takes, 0 if it doesn't know.
+    #[serde(default)]
+    pub max_width: u32,
+    #[serde(default)]
+    pub max_height: u32,
+}
+
+/// Pick the first codec in the client's list that we can encode at the requested size.
+///
+/// Falls back to H264, which every client decodes and older clients don't list.
+fn negotiate_video_codec(config: &StreamConfigMessage) -> (VideoCodec, &'static str) {
+    for support in &config.codecs {
+        let Some(codec) = VideoCodec::from_name(&support.name) else {
+            continue;
+        };
+        if (support.max_width != 0 && support.max_width < config.video_width)
+            || (support.max_height != 0 && support.max_height < config.video_height)
+        {
+            continue;
+        }
+        if !check_factory_exists(codec.payloader()) {
+            continue;
+        }
+        if let Some(encoder) = codec
+            .encoders()
+            .iter()
+            .copied()
+            .find(|name| check_factory_exists(name))
+        {
+            return (codec, encoder);
+        }
+    }
+
+    let encoder = if check_factory_exists("amfh264enc") {
+        "amfh264enc"
+    } else {
+        "x264enc"
+    };
+    (VideoCodec::H264, encoder)
+}
+
+/// Whether to encode with 10 bits per channel, which the client asks for when it can present them.
+///
+/// H264 High 10 is not something hardware decoders do, so that stays 8 bit.
+fn negotiate_ten_bit(config: &StreamConfigMessage, codec: VideoCodec) -> bool {
+    config.ten_bit && codec != VideoCodec::H264
+}
+
+/// Periodic keyframes are only a fallback, loss is repaired with keyframes on request, see `request_keyframe`.
+const KEYFRAME_INTERVAL_SECONDS: u32 = 2;
+
+/// Most host monitors one session streams.
+const MAX_DISPLAYS: u32 = 4;
+
+/// Name of an element of the video branch of a display, the first display's keep the plain names.
+fn display_element_name(name: &str, display: u32) -> String {
+    if display == 0 {
+        name.to_owned()
+    } else {
+        format!("{}{}", name, display)
+    }
+}
+
+/// How many monitors to capture, what the client asked for as far as we have them.
+fn negotiate_display_count(config: &StreamConfigMessage) -> u32 {
+    let requested = config.display_count.clamp(1, MAX_DISPLAYS);
+    if requested == 1 {
+        return 1;
+    }
+
+    let monitor = gst::DeviceMonitor::new();
+    monitor.add_filter(Some("Source/Monitor"), None);
+    if monitor.start().is_err() {
+        warn!("Can't enumerate monitors, streaming only the first one.");
+        return 1;
+    }
+    let available = monitor.devices().into_iter().count() as u32;
+    monitor.stop();
+
+    requested.min(available.max(1))
+}
+
+/// Conversion, scaling and the encoder itself, for the encoders listed in `VideoCodec::encoders`.
+fn encoder_element_str(encoder: &str, config: &StreamConfigMessage, display: u32) -> String {
+    let enc_name = display_element_name("enc", display);
+    let scalecaps_name = display_element_name("scalecaps", display);
+    let bitrate = config.bitrate * 1024;
+    let gop = config.framerate.max(1) * KEYFRAME_INTERVAL_SECONDS;
+    // The desktop is captured in 8 bit sRGB either way, 10 bit just keeps gradients from banding after encoding.
+    // x265enc has no NV12 input, only planar I420.
+    let (amf_format, sw_format) = if config.ten_bit {
+        ("P010_10LE", "I420_10LE")
+    } else if encoder == "x265enc" {
+        ("NV12", "I420")
+    } else {
+        ("NV12", "NV12")
+    };
+
+    if encoder.starts_with("amf") {
+        // AV1 has no ultra-low-latency usage.
+        let usage = if encoder == "amfav1enc" {
+            "low-latency"
+        } else {
+            "ultra-low-latency"
+        };
 
         format!(
             "d3d11convert ! \
         videorate ! \
-        video/x-raw(memory:D3D11Memory),width={},height={},format=NV12,framerate={}/1 ! \
-        amfh264enc name=enc preset=speed usage=ultra-low-latency rate-control=cbr bitrate={} gop-size=30 ! ",
+        capsfilter name={} caps=\"video/x-raw(memory:D3D11Memory),width={},height={},format={},framerate={}/1\" ! \
+        {} name={} preset=speed usage={} rate-control=cbr bitrate={} gop-size={} ! ",
+            scalecaps_name,
             config.video_width,
             config.video_height,
+            amf_format,
             config.framerate,
-            config.bitrate * 1024
+            encoder,
+            enc_name,
+            usage,
+            bitrate,
+            gop
         )
     } else {
-        format!("videoconvert ! \
+        let encoder_params = if encoder == "x265enc" {
+            format!(
+                "x265enc name={} tune=zerolatency speed-preset=ultrafast bitrate={} key-int-max={}",
+                enc_name, bitrate, gop
+            )
+        } else {
+            format!(
+                "x264enc name={} tune=zerolatency sliced-threads=true speed-preset=ultrafast bframes=0 bitrate={} key-int-max={}",
+                enc_name, bitrate, gop
+            )
+        };
+
+        format!(
+            "videoconvert ! \
         videoscale ! \
         videorate ! \
-        video/x-raw,width={},height={},format=NV12,framerate={}/1 ! \
-        x264enc name=enc tune=zerolatency sliced-threads=true speed-preset=ultrafast bframes=0 bitrate={} key-int-max=30 ! ",
-                config.video_width,
-                config.video_height,
-                config.framerate,
-                config.bitrate * 1024
+        capsfilter name={} caps=\"video/x-raw,width={},height={},format={},framerate={}/1\" ! \
+        {} ! ",
+            scalecaps_name,
+            config.video_width,
+            config.video_height,
+            sw_format,
+            config.framerate,
+            encoder_params
         )
-    };
+    }
+}
+
+/// ULPFEC payload type, the client's FEC decoder expects this one.
+const VIDEO_FEC_PT: u32 = 122;
+
+/// Transport-wide sequence numbers, which webrtcbin's TWCC feedback is built on.
+const TWCC_EXTMAP: &str =
+    ",extmap-1=(string)\"http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\"";
+
+/// Extra RTP caps of both media, the payloaders add the header extensions listed there.
+fn rtp_extra_caps(config: &StreamConfigMessage) -> &'static str {
+    match config.transport {
+        Transport::Rtp => "",
+        Transport::WebRtc => TWCC_EXTMAP,
+    }
+}
+
+/// Inline ULPFEC encoder after the video payloader, empty when the client didn't ask for FEC.
+fn fec_element_str(config: &StreamConfigMessage) -> String {
+    if config.fec_percentage == 0 {
+        return String::new();
+    }
+    if !check_factory_exists("rtpulpfecenc") {
+        warn!("Client asked for FEC, but rtpulpfecenc is missing.");
+        return String::new();
+    }
+
+    // Keyframes are the expensive ones to lose, protect them twice as much.
+    let percentage = config.fec_percentage.min(100);
+    format!(
+        "rtpulpfecenc pt={} percentage={} percentage-important={} multipacket=true ! ",
+        VIDEO_FEC_PT,
+        percentage,
+        (percentage * 2).min(100)
+    )
+}
 
-    let pipeline_str = format!(
-        "rtpbin name=rtp \
-        d3d11screencapturesrc show-cursor=true ! \
+/// Capture, encoding and payloading of one monitor, up to the RTP packets of its SSRC.
+///
+/// `monitor_index` picks the monitor by index, the primary one if unset.
+fn video_branch_str(
+    config: &StreamConfigMessage,
+    codec: VideoCodec,
+    encoder: &str,
+    monitor_index: Option<u32>,
+    ssrc: u32,
+) -> String {
+    let display = monitor_index.unwrap_or(0);
+    format!(
+        "d3d11screencapturesrc monitor-index={} show-cursor=true ! \
+        {}\
+        {} ! \
         {}\
-        video/x-h264,profile=baseline ! \
-        rtph264pay config-interval=-1 aggregate-mode=zero-latency ! \
-        application/x-rtp,encoding-name=H264,clock-rate=90000,media=video,payload=96 ! \
-        rtp.send_rtp_sink_0 \
-        rtp.send_rtp_src_0 ! \
-        udpsink name=videoudpsrc host={} port=5601 sync=false \
-        wasapi2src loopback=true low-latency=true ! \
+        {}",
+        monitor_index.map_or(-1, |index| index as i32),
+        encoder_element_str(encoder, config, display),
+        codec.encoded_caps(config.ten_bit),
+        codec.payload_str(ssrc, rtp_extra_caps(config)),
+        fec_element_str(config)
+    )
+}
+
+/// Loopback capture and encoding of the system audio, up to its RTP packets.
+fn audio_branch_str(config: &StreamConfigMessage) -> String {
+    format!(
+        "wasapi2src loopback=true low-latency=true ! \
         queue ! \
         audioconvert ! \
         audioresample ! \
         audio/x-raw,rate=48000 ! \
         opusenc perfect-timestamp=true audio-type=restricted-lowdelay bitrate-type=cbr frame-size=10 ! \
         rtpopuspay ! \
-        application/x-rtp,encoding-name=OPUS,media=audio,payload=127 !
-        rtp.send_rtp_sink_1 \
-        rtp.send_rtp_src_1 ! \
-        udpsink host={} port=5602 sync=false",
-        encoder_str, host, host
-    );
+        application/x-rtp,encoding-name=OPUS,media=audio,payload=127{} ! ",
+        rtp_extra_caps(config)
+    )
+}
+
+fn start_gstreamer_pipeline(
+    addr: SocketAddr,
+    config: StreamConfigMessage,
+    codec: VideoCodec,
+    encoder: &str,
+    display_ssrcs: &[u32],
+    tx: Option<Tx>,
+) {
+    // Acquire the lock for the global pipeline state
+    let mut guard = PIPELINE_GUARD.lock().unwrap();
+
+    // Check if a pipeline is already running
+    if guard.is_some() {
+        warn!("Pipeline already running. Not restarting.");
+        return;
+    }
+
+    let host = addr.ip().to_string();
+
+    // All displays share the video session, the client tells their streams apart by SSRC.
+    let video_str = if config.transport == Transport::WebRtc {
+        // Only ever the one display.
+        format!(
+            "{}webrtc. ",
+            video_branch_str(&config, codec, encoder, None, display_ssrcs[0])
+        )
+    } else if display_ssrcs.len() == 1 {
+        format!(
+            "{}rtp.send_rtp_sink_0 ",
+            video_branch_str(&config, codec, encoder, None, display_ssrcs[0])
+        )
+    } else {
+        let mut branches = String::from("funnel name=videofunnel ! rtp.send_rtp_sink_0 ");
+        for (display, ssrc) in display_ssrcs.iter().enumerate() {
+            branches.push_str(&video_branch_str(
+                &config,
+                codec,
+                encoder,
+                Some(display as u32),
+                *ssrc,
+            ));
+            branches.push_str("videofunnel. ");
+        }
+        branches
+    };
+
+    let pipeline_str = match config.transport {
+        Transport::Rtp => format!(
+            "rtpbin name=rtp \
+            {}\
+            rtp.send_rtp_src_0 ! \
+            udpsink name=videoudpsrc host={} port=5601 sync=false \
+            {}\
+            rtp.send_rtp_sink_1 \
+            rtp.send_rtp_src_1 ! \
+            udpsink host={} port=5602 sync=false",
+            video_str,
+            host,
+            audio_branch_str(&config),
+            host
+        ),
+        Transport::WebRtc => format!(
+            "webrtcbin name=webrtc bundle-policy=max-bundle stun-server={} \
+            {}\
+            {}webrtc.",
+            webrtc::STUN_SERVER,
+            video_str,
+            audio_branch_str(&config)
+        ),
+    };
 
     info!("Attempting to parse pipeline: \n{}", pipeline_str);
 
@@ -253,8 +571,23 @@ fn start_gstreamer_pipeline(addr: SocketAddr, config: StreamConfigMessage) {
         ControlFlow::Continue
     });
 
+    if config.transport == Transport::WebRtc {
+        let Some(tx) = tx else {
+            warn!("Client {} left before its pipeline started.", addr);
+            let _ = pipeline.set_state(gst::State::Null);
+            return;
+        };
+        if let Err(e) = pipeline.set_state(gst::State::Ready) {
+            error!("Failed to set pipeline to Ready: {}", e);
+            let _ = pipeline.set_state(gst::State::Null);
+            return;
+        }
+        webrtc::setup(&pipeline, tx);
+    }
+
     // Store the running pipeline in the global Mutex
     *guard = Some(pipeline.clone());
+    *PIPELINE_CLIENT.lock().unwrap() = Some(addr);
 
     // Set pipeline to playing
     if let Err(e) = pipeline.set_state(gst::State::Playing) {
@@ -264,6 +597,265 @@ fn start_gstreamer_pipeline(addr: SocketAddr, config: StreamConfigMessage) {
     }
 }
 
+/// Ignore keyframe requests arriving sooner than this after the last forced keyframe.
+const KEYFRAME_REQUEST_MIN_INTERVAL: Duration = Duration::from_millis(100);
+
+static LAST_FORCED_KEYFRAME: Mutex<Option<Instant>> = Mutex::new(None);
+
+/// Make the encoder emit a keyframe, with the parameter sets, as soon as possible.
+///
+/// Sent by the client when it lost a packet that FEC couldn't repair.
+pub fn request_keyframe() {
+    {
+        let mut last = LAST_FORCED_KEYFRAME.lock().unwrap();
+        if last.is_some_and(|t| t.elapsed() < KEYFRAME_REQUEST_MIN_INTERVAL) {
+            return;
+        }
+        *last = Some(Instant::now());
+    }
+
+    let guard = PIPELINE_GUARD.lock().unwrap();
+    let Some(pipeline) = guard.as_ref() else {
+        return;
+    };
+
+    // Loss is reported for the session as a whole, every display's stream may have lost a packet.
+    for display in 0..MAX_DISPLAYS {
+        let Some(pad) = pipeline
+            .by_name(&display_element_name("enc", display))
+            .and_then(|enc| enc.static_pad("src"))
+        else {
+            break;
+        };
+
+        // The GstForceKeyUnit upstream event from gst-video, which all our encoders handle.
+        let structure = gst::Structure::builder("GstForceKeyUnit")
+            .field("all-headers", true)
+            .build();
+        if pad.send_event(gst::event::CustomUpstream::new(structure)) {
+            info!("Forced a keyframe on display {}.", display);
+        } else {
+            warn!(
+                "Encoder of display {} didn't take the keyframe request.",
+                display
+            );
+        }
+    }
+}
+
+/// Running time of the streaming pipeline in nanoseconds, the time base of the RTP timestamps.
+pub fn pipeline_running_time() -> Option<u64> {
+    let guard = PIPELINE_GUARD.lock().unwrap();
+    guard
+        .as_ref()
+        .and_then(|pipeline| pipeline.current_running_time())
+        .map(|time| time.nseconds())
+}
+
+/// Apply a new bitrate (kbit/s) and resolution to the running encoder without restarting the pipeline.
+fn update_encoder_config(config: &EncoderConfigMessage) {
+    let guard = PIPELINE_GUARD.lock().unwrap();
+    let Some(pipeline) = guard.as_ref() else {
+        warn!("No pipeline running, ignoring encoder config.");
+        return;
+    };
+
+    // Every display gets the same bitrate and resolution.
+    for display in 0..MAX_DISPLAYS {
+        let Some(enc) = pipeline.by_name(&display_element_name("enc", display)) else {
+            break;
+        };
+        // All encoders we pick take kbit/s and accept changes while playing.
+        enc.set_property("bitrate", config.bitrate_kbps);
+
+        let Some(capsfilter) = pipeline.by_name(&display_element_name("scalecaps", display)) else {
+            continue;
+        };
+        let mut caps = capsfilter.property::<gst::Caps>("caps").copy();
+        if let Some(s) = caps.make_mut().structure_mut(0) {
+            let width = s.get::<i32>("width").unwrap_or(0);
+            let height = s.get::<i32>("height").unwrap_or(0);
+            if width != config.video_width as i32 || height != config.video_height as i32 {
+                s.set("width", config.video_width as i32);
+                s.set("height", config.video_height as i32);
+                info!(
+                    "Encoder {} resolution {}x{} -> {}x{}",
+                    display, width, height, config.video_width, config.video_height
+                );
+                capsfilter.set_property("caps", &caps);
+            }
+        }
+    }
+}
+
+/// How long a pipeline outlives its client, so a client coming back from the background skips the capture and encoder
+/// setup. The pipeline is paused meanwhile.
+const SESSION_RESUME_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// The pipeline a client may take over again with its session token.
+struct ResumableSession {
+    token: String,
+    ip: IpAddr,
+    codec: VideoCodec,
+    encoder: &'static str,
+    /// Baked into the pipeline, unlike bitrate and resolution.
+    framerate: u32,
+    fec_percentage: u32,
+    ten_bit: bool,
+    /// One per captured monitor, the client set up its pipeline for these.
+    display_ssrcs: Vec<u32>,
+    /// Unset while a client is connected.
+    parked_at: Option<Instant>,
+}
+
+static RESUMABLE_SESSION: Mutex<Option<ResumableSession>> = Mutex::new(None);
+
+fn new_session_token() -> String {
+    format!("{:032x}", rand::random::<u128>())
+}
+
+/// Pause or resume the pipeline, without giving up the capture and encoder.
+fn set_pipeline_paused(paused: bool) {
+    let guard = PIPELINE_GUARD.lock().unwrap();
+    let Some(pipeline) = guard.as_ref() else {
+        return;
+    };
+    let state = if paused {
+        gst::State::Paused
+    } else {
+        gst::State::Playing
+    };
+    if let Err(e) = pipeline.set_state(state) {
+        error!("Failed to set pipeline to {:?}: {}", state, e);
+    }
+}
+
+fn resume_gstreamer_pipeline() {
+    set_pipeline_paused(false);
+    // The client's decoder starts from scratch.
+    *LAST_FORCED_KEYFRAME.lock().unwrap() = None;
+    request_keyframe();
+    info!("Pipeline resumed.");
+}
+
+/// Keep the pipeline of the client that just left around for a while, paused.
+fn park_session() {
+    let parked_at = Instant::now();
+    {
+        let mut session = RESUMABLE_SESSION.lock().unwrap();
+        let Some(session) = session.as_mut() else {
+            stop_gstreamer_pipeline();
+            return;
+        };
+        session.parked_at = Some(parked_at);
+    }
+    set_pipeline_paused(true);
+    info!(
+        "Session parked, resumable for {}s.",
+        SESSION_RESUME_TIMEOUT.as_secs()
+    );
+
+    task::spawn(async move {
+        task::sleep(SESSION_RESUME_TIMEOUT).await;
+        let mut session = RESUMABLE_SESSION.lock().unwrap();
+        // Resuming clears parked_at, parking again later sets a newer one.
+        if session.as_ref().and_then(|s| s.parked_at) == Some(parked_at) {
+            session.take();
+            drop(session);
+            task::spawn_blocking(stop_gstreamer_pipeline);
+            info!("Parked session expired.");
+        }
+    });
+}
+
+/// Whether `addr` is the client the running pipeline streams to.
+fn is_pipeline_client(addr: SocketAddr) -> bool {
+    *PIPELINE_CLIENT.lock().unwrap() == Some(addr)
+}
+
+/// Whether the running pipeline still streams to another client, which a new session mustn't take away.
+fn pipeline_busy_for(addr: SocketAddr, peer_map: &PeerMap) -> bool {
+    let Some(client) = *PIPELINE_CLIENT.lock().unwrap() else {
+        return false;
+    };
+    let parked = RESUMABLE_SESSION
+        .lock()
+        .unwrap()
+        .as_ref()
+        .is_some_and(|session| session.parked_at.is_some());
+    client != addr && !parked && peer_map.lock().unwrap().contains_key(&client)
+}
+
+/// Distinct SSRCs for the video streams of a new session.
+fn new_display_ssrcs(count: u32) -> Vec<u32> {
+    let mut ssrcs: Vec<u32> = Vec::with_capacity(count as usize);
+    while ssrcs.len() < count as usize {
+        let ssrc = rand::random::<u32>();
+        if !ssrcs.contains(&ssrc) {
+            ssrcs.push(ssrc);
+        }
+    }
+    ssrcs
+}
+
+/// Take the parked pipeline over if the token and address match, or start a new session.
+///
+/// Returns the token for the client, the SSRCs of the displays and whether the running pipeline was kept. None if
+/// the pipeline is busy, see `pipeline_busy_for`.
+fn begin_session(
+    addr: SocketAddr,
+    config: &StreamConfigMessage,
+    codec: VideoCodec,
+    encoder: &'static str,
+    display_count: u32,
+    pipeline_busy: bool,
+) -> Option<(String, Vec<u32>, bool)> {
+    let mut session = RESUMABLE_SESSION.lock().unwrap();
+    // The peer connection doesn't outlive the client, every WebRTC session negotiates from scratch.
+    let resumable = config.transport != Transport::WebRtc;
+    if let (Some(current), Some(token)) = (session.as_mut(), config.session_token.as_deref()) {
+        // Anything that can't be changed on the running encoder needs a new pipeline anyway.
+        if resumable
+            && current.token == token
+            && current.ip == addr.ip()
+            && current.codec == codec
+            && current.encoder == encoder
+            && current.framerate == config.framerate
+            && current.fec_percentage == config.fec_percentage
+            && current.ten_bit == config.ten_bit
+            && current.display_ssrcs.len() == display_count as usize
+            && PIPELINE_GUARD.lock().unwrap().is_some()
+        {
+            current.parked_at = None;
+            *PIPELINE_CLIENT.lock().unwrap() = Some(addr);
+            return Some((current.token.clone(), current.display_ssrcs.clone(), true));
+        }
+    }
+
+    if pipeline_busy {
+        return None;
+    }
+    if !resumable {
+        *session = None;
+        return Some((String::new(), new_display_ssrcs(display_count), false));
+    }
+
+    let token = new_session_token();
+    let display_ssrcs = new_display_ssrcs(display_count);
+    *session = Some(ResumableSession {
+        token: token.clone(),
+        ip: addr.ip(),
+        codec,
+        encoder,
+        framerate: config.framerate,
+        fec_percentage: config.fec_percentage,
+        ten_bit: config.ten_bit,
+        display_ssrcs: display_ssrcs.clone(),
+        parked_at: None,
+    });
+    Some((token, display_ssrcs, false))
+}
+
 pub fn stop_gstreamer_pipeline() {
     // Acquire the lock for the global pipeline state.
     let mut guard = PIPELINE_GUARD.lock().unwrap();
@@ -271,6 +863,7 @@ pub fn stop_gstreamer_pipeline() {
     // Use `Option::take()` to extract the pipeline and replace the value with None.
     // The extracted pipeline reference will then be dropped when it goes out of scope.
     if let Some(pipeline) = guard.take() {
+        *PIPELINE_CLIENT.lock().unwrap() = None;
         pipeline
             .set_state(gst::State::Null)
             .expect("Unable to set the pipeline to the `Null` state");
@@ -374,10 +967,10 @@ async fn handle_connection(
         }
     }
 
-    // Stop Pipeline if this was the last client
+    // Park the pipeline if this was the last client, it gets stopped unless the client comes back in time.
     if peer_map.lock().unwrap().is_empty() {
-        // Spawn a task to run the blocking pipeline stop function
-        task::spawn_blocking(stop_gstreamer_pipeline);
+        // Spawn a task to run the blocking pipeline functions
+        task::spawn_blocking(park_session);
     }
 }
 
@@ -425,6 +1018,92 @@ pub struct StreamConfigMessage {
     pub video_height: u32,
     pub framerate: u32,
     pub bitrate: u32,
+    /// Codecs the client can decode, most preferred first. Missing from older clients.
+    #[serde(default)]
+    pub codecs: Vec<CodecSupport>,
+    /// ULPFEC overhead in percent of the media packets, 0 or missing disables FEC.
+    #[serde(default)]
+    pub fec_percentage: u32,
+    /// Token from the last stream info, to take over the pipeline of a previous session.
+    #[serde(default)]
+    pub session_token: Option<String>,
+    /// Encode with 10 bits per channel if the codec allows, see `negotiate_ten_bit`.
+    #[serde(default)]
+    pub ten_bit: bool,
+    /// Host monitors to stream, each as a video stream of its own. 0 or missing streams one.
+    #[serde(default)]
+    pub display_count: u32,
+    /// Missing from older clients, which only know plain RTP.
+    #[serde(default)]
+    pub transport: Transport,
+}
+
+/// How media and input reach the client.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Default, Serialize, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum Transport {
+    /// RTP over UDP to fixed ports, input over ENet.
+    #[default]
+    Rtp,
+    /// One peer connection with SRTP media and input over data channels. A single display, without FEC, retransmitting
+    /// lost packets instead.
+    WebRtc,
+}
+
+/// Reply to the stream config, tells the client which depayloader and decoder to set up.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct StreamInfoMessage {
+    pub msg_type: String,
+    pub codec: String,
+    /// Lets the client resume this session after reconnecting.
+    pub session_token: String,
+    /// The pipeline of the previous session was kept, a keyframe is on its way.
+    pub resumed: bool,
+    /// Whether the stream is 10 bit, the client only gets it if it asked for it.
+    pub ten_bit: bool,
+    /// SSRC of each monitor's video stream, as many as we stream, in monitor order.
+    pub display_ssrcs: Vec<u32>,
+}
+
+/// Sent by the client's bitrate controller while streaming.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct EncoderConfigMessage {
+    pub bitrate_kbps: u32,
+    pub video_width: u32,
+    pub video_height: u32,
+}
+
+fn handle_encoder_config_message(text: &str) {
+    let config_msg = match serde_json::from_str::<EncoderConfigMessage>(text) {
+        Ok(config_msg) => config_msg,
+        Err(e) => {
+            error!(
+                "Failed to deserialize encoder config: {}\n\tPayload was: {}",
+                e, text
+            );
+            return;
+        }
+    };
+
+    {
+        let mut guard = STREAMING_STATE_GUARD.lock().unwrap();
+        let Some(config) = guard
+            .as_mut()
+            .and_then(|state| state.stream_config.as_mut())
+        else {
+            // Not authenticated yet.
+            warn!("Ignoring encoder config before stream config.");
+            return;
+        };
+
+        // The resolution stays: the client keeps sending input in pixels of the negotiated one, so input doesn't
+        // depend on which frames it was showing while the encoder switched.
+        config.bitrate = config_msg.bitrate_kbps / 1024;
+    }
+
+    task::spawn_blocking(move || {
+        update_encoder_config(&config_msg);
+    });
 }
 
 // Video control via WebSocket.
@@ -434,6 +1113,56 @@ fn handle_text_message(msg: Message, addr: SocketAddr, peer_map: PeerMap) {
         _ => return, // Handle other message types
     };
 
+    let msg_type = serde_json::from_str::<serde_json::Value>(&text)
+        .ok()
+        .and_then(|v| v.get("msg_type")?.as_str().map(str::to_owned));
+    match msg_type.as_deref() {
+        Some("encoder_config") => {
+            handle_encoder_config_message(&text);
+            return;
+        }
+        // Only up to the client the pipeline streams to.
+        Some(kind @ ("suspend" | "resume")) if !is_pipeline_client(addr) => {
+            warn!("Ignoring {} from {}, not its stream.", kind, addr);
+            return;
+        }
+        // The client lost its window but keeps the connection, no point in encoding meanwhile.
+        Some("suspend") => {
+            info!("Client {} suspended the stream.", addr);
+            task::spawn_blocking(|| set_pipeline_paused(true));
+            return;
+        }
+        Some("resume") => {
+            info!("Client {} resumed the stream.", addr);
+            task::spawn_blocking(resume_gstreamer_pipeline);
+            return;
+        }
+        Some("answer") | Some("candidate") => {
+            let Ok(msg) = serde_json::from_str::<serde_json::Value>(&text) else {
+                return;
+            };
+            task::spawn_blocking(move || {
+                let webrtcbin = {
+                    let guard = PIPELINE_GUARD.lock().unwrap();
+                    // Anyone else could take the media and the input channels over with an answer of their own.
+                    if !is_pipeline_client(addr) {
+                        warn!("Ignoring WebRTC signaling from {}, not its stream.", addr);
+                        return;
+                    }
+                    guard
+                        .as_ref()
+                        .and_then(|pipeline| pipeline.by_name("webrtc"))
+                };
+                match webrtcbin {
+                    Some(webrtcbin) => webrtc::handle_signaling_message(&webrtcbin, &msg),
+                    None => warn!("Ignoring WebRTC signaling without a WebRTC pipeline."),
+                }
+            });
+            return;
+        }
+        _ => {}
+    }
+
     match serde_json::from_str::<StreamConfigMessage>(&text) {
         Ok(config_msg) => {
             info!(
@@ -462,9 +1191,75 @@ fn handle_text_message(msg: Message, addr: SocketAddr, peer_map: PeerMap) {
             }
 
             if authenticated {
-                // Spawn a task to run the blocking pipeline start function
+                let (codec, encoder) = negotiate_video_codec(&config_msg);
+                let mut config_msg = config_msg;
+                config_msg.ten_bit = negotiate_ten_bit(&config_msg, codec);
+                if config_msg.transport == Transport::WebRtc {
+                    // Lost packets get retransmitted, and there is a single video transceiver.
+                    config_msg.fec_percentage = 0;
+                    config_msg.display_count = 1;
+                }
+                let display_count = negotiate_display_count(&config_msg);
+                let pipeline_busy = pipeline_busy_for(addr, &peer_map);
+                let Some((session_token, display_ssrcs, resumed)) = begin_session(
+                    addr,
+                    &config_msg,
+                    codec,
+                    encoder,
+                    display_count,
+                    pipeline_busy,
+                ) else {
+                    warn!("Pipeline already running for another client. Not restarting.");
+                    return;
+                };
+                info!(
+                    "Streaming {} display(s) of {}{} with {}{}",
+                    display_count,
+                    codec.name(),
+                    if config_msg.ten_bit { " 10 bit" } else { "" },
+                    encoder,
+                    if resumed { ", resumed" } else { "" }
+                );
+
+                let info_msg = StreamInfoMessage {
+                    msg_type: "stream_info".to_owned(),
+                    codec: codec.name().to_owned(),
+                    session_token,
+                    resumed,
+                    ten_bit: config_msg.ten_bit,
+                    display_ssrcs: display_ssrcs.clone(),
+                };
+                if let Some(tx) = peer_map.lock().unwrap().get(&addr) {
+                    let text = serde_json::to_string(&info_msg).unwrap();
+                    if let Err(e) = tx.unbounded_send(Message::Text(text.into())) {
+                        error!("Failed to send stream info to {}: {}", addr, e);
+                    }
+                }
+
+                let tx = peer_map.lock().unwrap().get(&addr).cloned();
+
+                // Spawn a task to run the blocking pipeline functions
                 task::spawn_blocking(move || {
-                    start_gstreamer_pipeline(addr, config_msg);
+                    if resumed {
+                        // The bitrate controller of the last session may have scaled the encoder down.
+                        update_encoder_config(&EncoderConfigMessage {
+                            bitrate_kbps: config_msg.bitrate * 1024,
+                            video_width: config_msg.video_width,
+                            video_height: config_msg.video_height,
+                        });
+                        resume_gstreamer_pipeline();
+                    } else {
+                        // A parked pipeline of another session is of no use now.
+                        stop_gstreamer_pipeline();
+                        start_gstreamer_pipeline(
+                            addr,
+                            config_msg,
+                            codec,
+                            encoder,
+                            &display_ssrcs,
+                            tx,
+                        );
+                    }
                 });
             } else {
                 warn!("Authentication failed for {}. Closing connection.", addr);
@@ -0,0 +1,302 @@
+use gst::glib;
+use gst::prelude::*;
+use gstreamer as gst;
+use gstreamer_sdp as gst_sdp;
+use gstreamer_webrtc as gst_webrtc;
+
+use crate::clock_sync;
+use crate::input;
+use crate::stream::Tx;
+use async_std::task;
+use async_tungstenite::tungstenite::protocol::Message;
+use log::{error, info, warn};
+use serde_json::json;
+use std::time::Duration;
+
+// WebRTC transport, see client/src/stream/connection.c. We offer, the client answers, over the
+// WebSocket. Input and the other ENet traffic go over data channels, a reliable and/or an
+// unreliable one per ENet channel.
+
+pub const STUN_SERVER: &str = "stun://stun.l.google.com:19302";
+
+/// How often the client gets our TWCC stats, about the pace of its bitrate controller.
+const TWCC_REPORT_INTERVAL: Duration = Duration::from_millis(500);
+
+struct DataChannelDesc {
+    label: &'static str,
+    enet_channel: u8,
+    /// Unordered without retransmissions otherwise, like an unreliable ENet packet.
+    reliable: bool,
+}
+
+/// The client looks them up by label.
+const DATA_CHANNELS: [DataChannelDesc; 5] = [
+    DataChannelDesc {
+        label: "input",
+        enet_channel: input::ENET_CHANNEL_INPUT,
+        reliable: true,
+    },
+    DataChannelDesc {
+        label: "input-unreliable",
+        enet_channel: input::ENET_CHANNEL_INPUT,
+        reliable: false,
+    },
+    DataChannelDesc {
+        label: "clock-sync",
+        enet_channel: clock_sync::ENET_CHANNEL_CLOCK,
+        reliable: false,
+    },
+    DataChannelDesc {
+        label: "control",
+        enet_channel: input::ENET_CHANNEL_CONTROL,
+        reliable: true,
+    },
+    // Only for our input acks, which shouldn't queue up behind retransmissions.
+    DataChannelDesc {
+        label: "control-unreliable",
+        enet_channel: input::ENET_CHANNEL_CONTROL,
+        reliable: false,
+    },
+];
+
+fn send_json(tx: &Tx, value: serde_json::Value) -> bool {
+    tx.unbounded_send(Message::Text(value.to_string().into()))
+        .is_ok()
+}
+
+/// Hook up a freshly parsed pipeline's webrtcbin to the client behind `tx`.
+///
+/// The pipeline has to be in READY, webrtcbin only creates data channels from then on, and they
+/// have to exist before the offer.
+pub fn setup(pipeline: &gst::Pipeline, tx: Tx) {
+    let Some(webrtcbin) = pipeline.by_name("webrtc") else {
+        error!("No webrtcbin in the pipeline.");
+        return;
+    };
+
+    // We only send media, and resend what the client's jitterbuffer asks for.
+    let mut index = 0u32;
+    while let Some(transceiver) = webrtcbin
+        .emit_by_name::<Option<gst_webrtc::WebRTCRTPTransceiver>>(
+            "get-transceiver",
+            &[&(index as i32)],
+        )
+    {
+        transceiver.set_property(
+            "direction",
+            gst_webrtc::WebRTCRTPTransceiverDirection::Sendonly,
+        );
+        transceiver.set_property("do-nack", true);
+        index += 1;
+    }
+
+    create_data_channels(&webrtcbin);
+
+    let offer_tx = tx.clone();
+    webrtcbin.connect("on-negotiation-needed", false, move |values| {
+        let webrtcbin = values[0].get::<gst::Element>().unwrap();
+        create_offer(&webrtcbin, offer_tx.clone());
+        None
+    });
+
+    let candidate_tx = tx.clone();
+    webrtcbin.connect("on-ice-candidate", false, move |values| {
+        let mline_index = values[1].get::<u32>().unwrap();
+        let candidate = values[2].get::<String>().unwrap();
+        send_json(
+            &candidate_tx,
+            json!({
+                "msg_type": "candidate",
+                "candidate": { "candidate": candidate, "sdpMLineIndex": mline_index },
+            }),
+        );
+        None
+    });
+
+    start_twcc_reports(&webrtcbin, tx);
+}
+
+fn create_data_channels(webrtcbin: &gst::Element) {
+    let mut channels = Vec::with_capacity(DATA_CHANNELS.len());
+    for desc in &DATA_CHANNELS {
+        let options = if desc.reliable {
+            gst::Structure::builder("config")
+                .field("ordered", true)
+                .build()
+        } else {
+            gst::Structure::builder("config")
+                .field("ordered", false)
+                .field("max-retransmits", 0i32)
+                .build()
+        };
+        let channel = webrtcbin.emit_by_name::<Option<gst_webrtc::WebRTCDataChannel>>(
+            "create-data-channel",
+            &[&desc.label, &Some(options)],
+        );
+        match channel {
+            Some(channel) => channels.push((desc.enet_channel, channel)),
+            None => {
+                error!("Failed to create data channel {}.", desc.label);
+                return;
+            }
+        }
+    }
+
+    // Replies go out unreliable like with ENet, on the unreliable channel standing in for their
+    // ENet channel: clock-sync for pongs, control-unreliable for acks.
+    let reply_channels: Vec<(u8, glib::WeakRef<gst_webrtc::WebRTCDataChannel>)> = DATA_CHANNELS
+        .iter()
+        .zip(&channels)
+        .filter(|(desc, _)| !desc.reliable)
+        .map(|(_, (enet_channel, channel))| (*enet_channel, channel.downgrade()))
+        .collect();
+
+    for (desc, (enet_channel, channel)) in DATA_CHANNELS.iter().zip(channels) {
+        let reply_channels = reply_channels.clone();
+        channel.connect("on-message-data", false, move |values| {
+            let data = values[1].get::<Option<glib::Bytes>>().ok().flatten()?;
+            let (reply_channel, reply) = input::handle_channel_message(enet_channel, &data)?;
+            let target = reply_channels
+                .iter()
+                .find(|(id, _)| *id == reply_channel)
+                .and_then(|(_, channel)| channel.upgrade())?;
+            target.emit_by_name::<()>("send-data", &[&glib::Bytes::from_owned(reply)]);
+            None
+        });
+
+        // The reliable input channel stands in for the ENet connection.
+        if desc.label == "input" {
+            channel.connect("on-open", false, |_| {
+                info!("WebRTC data channels open.");
+                input::on_input_connected();
+                None
+            });
+            channel.connect("on-close", false, |_| {
+                info!("WebRTC data channels closed.");
+                input::on_input_disconnected();
+                None
+            });
+        }
+    }
+}
+
+fn create_offer(webrtcbin: &gst::Element, tx: Tx) {
+    let webrtcbin_weak = webrtcbin.downgrade();
+    let promise = gst::Promise::with_change_func(move |reply| {
+        let Some(webrtcbin) = webrtcbin_weak.upgrade() else {
+            return;
+        };
+        let offer = match reply {
+            Ok(Some(reply)) => reply.get::<gst_webrtc::WebRTCSessionDescription>("offer"),
+            Ok(None) => {
+                error!("Creating the offer got no reply.");
+                return;
+            }
+            Err(e) => {
+                error!("Failed to create the offer: {:?}", e);
+                return;
+            }
+        };
+        let Ok(offer) = offer else {
+            error!("Offer reply without an offer.");
+            return;
+        };
+
+        webrtcbin.emit_by_name::<()>("set-local-description", &[&offer, &None::<gst::Promise>]);
+        match offer.sdp().as_text() {
+            Ok(sdp) => {
+                info!("Sending the WebRTC offer.");
+                send_json(&tx, json!({ "msg_type": "offer", "sdp": sdp }));
+            }
+            Err(e) => error!("Failed to serialize the offer: {}", e),
+        }
+    });
+
+    webrtcbin.emit_by_name::<()>("create-offer", &[&None::<gst::Structure>, &promise]);
+}
+
+/// Handle the client's answer or one of its ICE candidates.
+pub fn handle_signaling_message(webrtcbin: &gst::Element, msg: &serde_json::Value) {
+    match msg.get("msg_type").and_then(|v| v.as_str()) {
+        Some("answer") => {
+            let Some(text) = msg.get("sdp").and_then(|v| v.as_str()) else {
+                warn!("Answer without SDP.");
+                return;
+            };
+            let sdp = match gst_sdp::SDPMessage::parse_buffer(text.as_bytes()) {
+                Ok(sdp) => sdp,
+                Err(e) => {
+                    error!("Failed to parse the answer: {}", e);
+                    return;
+                }
+            };
+            let answer =
+                gst_webrtc::WebRTCSessionDescription::new(gst_webrtc::WebRTCSDPType::Answer, sdp);
+            webrtcbin
+                .emit_by_name::<()>("set-remote-description", &[&answer, &None::<gst::Promise>]);
+            info!("Got the WebRTC answer.");
+        }
+        Some("candidate") => {
+            let candidate = msg.get("candidate");
+            let text = candidate
+                .and_then(|c| c.get("candidate"))
+                .and_then(|v| v.as_str());
+            let mline_index = candidate
+                .and_then(|c| c.get("sdpMLineIndex"))
+                .and_then(|v| v.as_u64());
+            match (text, mline_index) {
+                // An empty candidate only marks the end of gathering.
+                (Some(""), _) => {}
+                (Some(text), Some(mline_index)) => {
+                    webrtcbin
+                        .emit_by_name::<()>("add-ice-candidate", &[&(mline_index as u32), &text]);
+                }
+                _ => warn!("Malformed ICE candidate: {}", msg),
+            }
+        }
+        _ => {}
+    }
+}
+
+/// The sender side of TWCC: what the client's feedback says about the packets we sent.
+fn twcc_stats(webrtcbin: &gst::Element) -> Option<serde_json::Value> {
+    let rtpbin = webrtcbin
+        .dynamic_cast_ref::<gst::Bin>()?
+        .by_name("rtpbin")?;
+    // Bundled, everything is in the first session.
+    let session = rtpbin.emit_by_name::<Option<gst::Element>>("get-session", &[&0u32])?;
+    let stats = session.property::<Option<gst::Structure>>("twcc-stats")?;
+
+    // Only there once feedback came in.
+    let sent = stats.get::<u32>("bitrate-sent").ok()?;
+    let received = stats.get::<u32>("bitrate-recv").ok()?;
+    let loss_percent = stats.get::<f64>("packet-loss-pct").unwrap_or(0.0);
+    let delay_gradient_ns = stats.get::<i64>("avg-delta-of-delta").unwrap_or(0);
+
+    Some(json!({
+        "msg_type": "twcc_stats",
+        "sent_kbps": sent / 1000,
+        "received_kbps": received / 1000,
+        "loss_percent": loss_percent,
+        "delay_gradient_ms": delay_gradient_ns as f64 / 1e6,
+    }))
+}
+
+/// Forward the TWCC stats to the client until it or the pipeline is gone.
+fn start_twcc_reports(webrtcbin: &gst::Element, tx: Tx) {
+    let webrtcbin = webrtcbin.downgrade();
+    task::spawn(async move {
+        loop {
+            task::sleep(TWCC_REPORT_INTERVAL).await;
+            let Some(webrtcbin) = webrtcbin.upgrade() else {
+                break;
+            };
+            let Some(stats) = twcc_stats(&webrtcbin) else {
+                continue;
+            };
+            if !send_json(&tx, stats) {
+                break;
+            }
+        }
+    });
+}